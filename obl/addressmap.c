@@ -17,9 +17,14 @@
 #include "allocator.h"
 #include "constants.h"
 #include "database.h"
+#include "growth.h"
 #include "session.h"
+#include "shared.h"
+#include "snapshot.h"
 #include "platform.h"
 
+#include <string.h>
+
 /* Prototypes for internal functions */
 
 /**
@@ -29,18 +34,49 @@
 static int _verify_addrtreepage(struct obl_database *d,
         obl_physical_address base);
 
-/** Traverses the address map tree to find the entry for +logical+. */
+/**
+ * Traverses the address map tree to find the entry for +logical+.  Stores the
+ * leaf page that holds it into +leaf+, if there is one.
+ */
 static obl_physical_address _lookup_in(struct obl_database *d,
-        obl_physical_address pagebase, obl_logical_address logical);
+        obl_physical_address pagebase, obl_logical_address logical,
+        obl_physical_address *leaf);
 
 /**
  * Traverse the address map and assign +value+ to +key+ in the appropriate
- * page.
+ * page.  If the page at +pagebase+ is copied, +pagebase+ is set to the copy.
+ * Returns 1 if a page could not be created or copied.
  */
-static void _assign_in(struct obl_session *s,
-        obl_physical_address pagebase,
+static int _assign_in(struct obl_session *s,
+        obl_physical_address *pagebase,
         obl_logical_address key, obl_physical_address value);
 
+/**
+ * Ensure that the commit in progress may change the page at +base+.  If a
+ * snapshot may still read it, copy it, retire the original, and set +base+ to
+ * the copy.  Returns 1 if no space could be allocated for the copy.
+ */
+static int _writable_treepage(struct obl_session *s,
+        obl_physical_address *base);
+
+/**
+ * Translate +logical+ with the address cache, if it holds the leaf page.
+ * Returns 1 and stores the translation into +physical+ on a hit.
+ */
+static inline int _cached_lookup(struct obl_database *d,
+        obl_logical_address logical, obl_physical_address *physical);
+
+/** Remember the leaf page that translates +logical+.  Returns the entry. */
+static inline uint64_t _cache_leaf(struct obl_database *d,
+        obl_logical_address logical, obl_physical_address leaf);
+
+/**
+ * Returns 1 if +base+ lies within the database and looks like an address map
+ * tree page, without reporting anything.
+ */
+static inline int _plausible_treepage(struct obl_database *d,
+        obl_physical_address base);
+
 /** Isolates the height-th PAGE_SHIFT bits out of address. */
 static inline obl_uint _treepage_index(obl_logical_address logical,
         obl_uint height);
@@ -60,12 +96,31 @@ static obl_physical_address _create_treepage(struct obl_session *s,
 #define CHUNK_MASK (CHUNK_SIZE - 1)
 #define PAGE_SHIFT (CHUNK_SIZE_LOG2 - 1)
 
+/** The cache slot responsible for the leaf page that holds +logical+. */
+#define CACHE_SLOT(cache, logical) \
+    (&(cache)->entries[((logical) >> PAGE_SHIFT) & (ADDRESS_CACHE_SIZE - 1)])
+
+/** The tallest possible address map, in levels above the leaves. */
+#define MAX_HEIGHT ((sizeof(obl_logical_address) * 8 - 1) / PAGE_SHIFT)
+
 obl_physical_address obl_address_lookup(struct obl_database *d,
         obl_logical_address logical)
+{
+    return _obl_address_lookup_at(d, d->root.address_map_addr, logical);
+}
+
+obl_physical_address _obl_address_lookup_at(struct obl_database *d,
+        obl_physical_address root, obl_logical_address logical)
 {
     obl_uint base, height, mask;
+    obl_physical_address result, leaf;
+    int current = root == d->root.address_map_addr;
 
-    base = d->root.address_map_addr;
+    if (current && _cached_lookup(d, logical, &result)) {
+        return result;
+    }
+
+    base = root;
     if (! _verify_addrtreepage(d, base)) {
         return OBL_PHYSICAL_UNASSIGNED;
     }
@@ -77,15 +132,171 @@ obl_physical_address obl_address_lookup(struct obl_database *d,
         return OBL_PHYSICAL_UNASSIGNED;
     }
 
-    return _lookup_in(d, base, logical);
+    leaf = OBL_PHYSICAL_UNASSIGNED;
+    result = _lookup_in(d, base, logical, &leaf);
+    if (current && leaf != OBL_PHYSICAL_UNASSIGNED) {
+        _cache_leaf(d, logical, leaf);
+    }
+
+    return result;
+}
+
+obl_physical_address obl_address_lookup_unlocked(struct obl_database *d,
+        obl_logical_address logical)
+{
+    obl_physical_address result, leaf;
+    unsigned long sequence;
+    int inconsistent;
+
+    if (! _obl_content_optimistic(d)) {
+        pthread_rwlock_rdlock(&d->content_lock);
+        if (_obl_shared_read_begin(d)) {
+            pthread_rwlock_unlock(&d->content_lock);
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+
+        result = obl_address_lookup(d, logical);
+
+        _obl_shared_read_end(d);
+        pthread_rwlock_unlock(&d->content_lock);
+        return result;
+    }
+
+    do {
+        sequence = _obl_content_read_begin(d);
+        result = _obl_address_peek(d, logical, &leaf, &inconsistent);
+    } while (_obl_content_read_retry(d, sequence));
+
+    if (inconsistent) {
+        obl_report_error(d, OBL_WRONG_STORAGE,
+                "The address map is corrupted.");
+        return OBL_PHYSICAL_UNASSIGNED;
+    }
+    /*
+     * Since the walk, a commit may have copied the leaf, cleared the cache,
+     * and retired the leaf, to be reused once no snapshot can read it.  Take
+     * the entry back unless no commit has begun since the walk: one that
+     * begins later clears the entry itself.
+     */
+    if (leaf != OBL_PHYSICAL_UNASSIGNED) {
+        uint64_t entry = _cache_leaf(d, logical, leaf);
+
+        if (_obl_content_read_retry(d, sequence)) {
+            __sync_bool_compare_and_swap(
+                    CACHE_SLOT(&d->address_cache, (obl_uint) logical),
+                    entry, (uint64_t) 0);
+        }
+    }
+
+    return result;
+}
+
+void obl_address_lookup_many(struct obl_database *d,
+        const obl_logical_address *logical, obl_physical_address *physical,
+        size_t count)
+{
+    _obl_address_lookup_many_at(d, d->root.address_map_addr, logical,
+            physical, count);
+}
+
+void _obl_address_lookup_many_at(struct obl_database *d,
+        obl_physical_address root, const obl_logical_address *logical,
+        obl_physical_address *physical, size_t count)
+{
+    obl_physical_address path[MAX_HEIGHT + 1], next;
+    obl_logical_address key, previous = 0;
+    obl_uint height, reached, h;
+    int current = root == d->root.address_map_addr;
+    size_t i;
+
+    if (count == 0) {
+        return ;
+    }
+
+    if (! _verify_addrtreepage(d, root)) {
+        for (i = 0; i < count; i++) {
+            physical[i] = OBL_PHYSICAL_UNASSIGNED;
+        }
+        return ;
+    }
+
+    height = readable_uint(d->content[root + 1]);
+    if (height > MAX_HEIGHT) {
+        height = MAX_HEIGHT;
+    }
+
+    /*
+     * path[h] holds the page at height h on the way to the previous key, for
+     * every h from reached up to height.
+     */
+    path[height] = root;
+    reached = height;
+
+    for (i = 0; i < count; i++) {
+        key = logical[i];
+
+        if (height < MAX_HEIGHT &&
+                ((obl_uint) key >> (PAGE_SHIFT * (height + 1))) != 0) {
+            physical[i] = OBL_PHYSICAL_UNASSIGNED;
+            continue;
+        }
+
+        if (current && _cached_lookup(d, key, &physical[i])) {
+            continue;
+        }
+
+        /* Resume from the lowest page that this key shares with the last. */
+        h = height;
+        while (h > reached && ((obl_uint) key >> (PAGE_SHIFT * h)) ==
+                ((obl_uint) previous >> (PAGE_SHIFT * h))) {
+            h--;
+        }
+
+        while (h > 0) {
+            next = readable_uint(
+                    d->content[path[h] + 2 + _treepage_index(key, h)]);
+            if (next == OBL_PHYSICAL_UNASSIGNED) {
+                break;
+            }
+
+            /* Fetch the entry below while the page header is verified. */
+            OBL_PREFETCH(&d->content[next + 2 + _treepage_index(key, h - 1)]);
+            if (! _verify_addrtreepage(d, next)) {
+                break;
+            }
+
+            h--;
+            path[h] = next;
+        }
+
+        reached = h;
+        previous = key;
+
+        if (h == 0) {
+            physical[i] = (obl_physical_address) readable_uint(
+                    d->content[path[0] + 2 + (key & CHUNK_MASK)]);
+            if (current) {
+                _cache_leaf(d, key, path[0]);
+            }
+
+            /* The next key is most likely within the same leaf. */
+            if (i + 1 < count) {
+                OBL_PREFETCH(&d->content[path[0] + 2 +
+                        (logical[i + 1] & CHUNK_MASK)]);
+            }
+        } else {
+            physical[i] = OBL_PHYSICAL_UNASSIGNED;
+        }
+    }
 }
 
-void obl_address_assign(struct obl_session *s,
+int obl_address_assign(struct obl_session *s,
         obl_logical_address logical, obl_physical_address physical)
 {
     struct obl_database *d = s->database;
-    obl_physical_address base;
+    obl_physical_address base, assigned;
     obl_uint height, copied_logical, required_height;
+    size_t mark;
 
     copied_logical = (obl_uint) logical;
     required_height = (obl_uint) 0;
@@ -95,7 +306,7 @@ void obl_address_assign(struct obl_session *s,
 
     base = d->root.address_map_addr;
     if (! _verify_addrtreepage(d, base)) {
-        return ;
+        return 1;
     }
 
     height = readable_uint(d->content[base + 1]);
@@ -108,9 +319,13 @@ void obl_address_assign(struct obl_session *s,
             obl_physical_address new_page;
 
             new_page = _create_treepage(s, h);
+            if (new_page == OBL_PHYSICAL_UNASSIGNED) {
+                return 1;
+            }
 
             /* At index 0x00, write the address of the lower page. */
             d->content[new_page + 2] = writable_uint((obl_uint) previous);
+            _obl_note_write(d, new_page + 2, (obl_uint) 1);
 
             previous = new_page;
         }
@@ -120,7 +335,103 @@ void obl_address_assign(struct obl_session *s,
         d->root.dirty = 1;
     }
 
-    _assign_in(s, base, logical, physical);
+    /* Assignments are rare next to lookups: conservatively forget the page. */
+    *CACHE_SLOT(&d->address_cache, (obl_uint) logical) = 0;
+
+    /*
+     * Parents only point to a copied page once it's complete, so a failed
+     * copy leaves the pages that it would have superseded in use.
+     */
+    mark = _obl_retire_mark(d);
+    assigned = base;
+    if (_assign_in(s, &assigned, logical, physical)) {
+        _obl_unretire(d, mark);
+        return 1;
+    }
+
+    if (assigned != base) {
+        /*
+         * The root was copied.  Reclaimed space may be reused for a later
+         * root, so don't rely on the cache noticing the change.
+         */
+        _obl_address_cache_clear(d);
+        d->root.address_map_addr = assigned;
+        d->root.dirty = 1;
+    }
+
+    return 0;
+}
+
+obl_physical_address _obl_address_peek(struct obl_database *d,
+        obl_logical_address logical, obl_physical_address *leaf,
+        int *inconsistent)
+{
+    const struct obl_address_cache *cache = &d->address_cache;
+    obl_physical_address page, next;
+    obl_uint height;
+    uint64_t entry;
+
+    *leaf = OBL_PHYSICAL_UNASSIGNED;
+    *inconsistent = 0;
+
+    page = d->root.address_map_addr;
+
+    /*
+     * A cached leaf is beneath the current root: commits clear the cache when
+     * they copy a leaf, and obl_address_lookup_unlocked() takes back entries
+     * that it may have made after such a commit began.
+     */
+    entry = *CACHE_SLOT(cache, (obl_uint) logical);
+    if (cache->root == page && entry != 0 &&
+            (obl_uint) (entry >> 32) == (obl_uint) logical >> PAGE_SHIFT) {
+        page = (obl_physical_address) entry;
+        height = 0;
+    } else {
+        if (! _plausible_treepage(d, page)) {
+            *inconsistent = 1;
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+
+        height = readable_uint(d->content[page + 1]);
+        if (height > MAX_HEIGHT) {
+            *inconsistent = 1;
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+        if (height < MAX_HEIGHT &&
+                ((obl_uint) logical >> (PAGE_SHIFT * (height + 1))) != 0) {
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+    }
+
+    while (height > 0) {
+        next = readable_uint(
+                d->content[page + 2 + _treepage_index(logical, height)]);
+        if (next == OBL_PHYSICAL_UNASSIGNED) {
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+        if (! _plausible_treepage(d, next) ||
+                readable_uint(d->content[next + 1]) != height - 1) {
+            *inconsistent = 1;
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+
+        page = next;
+        height--;
+    }
+
+    if (! _plausible_treepage(d, page)) {
+        *inconsistent = 1;
+        return OBL_PHYSICAL_UNASSIGNED;
+    }
+
+    *leaf = page;
+    return (obl_physical_address) readable_uint(
+            d->content[page + 2 + (logical & CHUNK_MASK)]);
+}
+
+void _obl_address_cache_clear(struct obl_database *d)
+{
+    memset(d->address_cache.entries, 0, sizeof(d->address_cache.entries));
 }
 
 /*
@@ -128,7 +439,8 @@ void obl_address_assign(struct obl_session *s,
  */
 
 static obl_physical_address _lookup_in(struct obl_database *d,
-        obl_physical_address pagebase, obl_logical_address logical)
+        obl_physical_address pagebase, obl_logical_address logical,
+        obl_physical_address *leaf)
 {
     obl_uint height, index;
     obl_physical_address value;
@@ -143,41 +455,121 @@ static obl_physical_address _lookup_in(struct obl_database *d,
     value = (obl_physical_address) readable_uint(
             d->content[pagebase + 2 + index]);
 
-    if (height == 0 || value == OBL_PHYSICAL_UNASSIGNED) {
+    if (height == 0) {
+        *leaf = pagebase;
+        return value;
+    } else if (value == OBL_PHYSICAL_UNASSIGNED) {
         return value;
     } else {
-        return _lookup_in(d, (obl_physical_address) value, logical);
+        return _lookup_in(d, (obl_physical_address) value, logical, leaf);
     }
 }
 
-static void _assign_in(struct obl_session *s,
-        obl_physical_address pagebase,
+static int _assign_in(struct obl_session *s,
+        obl_physical_address *page,
         obl_logical_address key, obl_physical_address value)
 {
     struct obl_database *d = s->database;
+    obl_physical_address pagebase;
     obl_uint height, index;
 
-    if (! _verify_addrtreepage(d, pagebase)) {
-        return ;
+    if (! _verify_addrtreepage(d, *page) || _writable_treepage(s, page)) {
+        return 1;
     }
+    pagebase = *page;
 
     height = readable_uint(d->content[pagebase + 1]);
     index = _treepage_index(key, height);
 
     if (height == 0) {
         d->content[pagebase + 2 + index] = writable_uint((obl_uint) value);
+        _obl_note_write(d, pagebase + 2 + index, (obl_uint) 1);
     } else {
-        obl_uint next_page;
+        obl_physical_address next_page, child;
 
         next_page = readable_uint(d->content[pagebase + 2 + index]);
         if (next_page == OBL_PHYSICAL_UNASSIGNED) {
             next_page = _create_treepage(s, height - 1);
-            d->content[pagebase + 2 + index] = writable_uint(
-                    (obl_uint) next_page);
+            if (next_page == OBL_PHYSICAL_UNASSIGNED) {
+                return 1;
+            }
         }
 
-        _assign_in(s, (obl_physical_address) next_page, key, value);
+        child = next_page;
+        if (_assign_in(s, &child, key, value)) {
+            return 1;
+        }
+        if (child != readable_uint(d->content[pagebase + 2 + index])) {
+            d->content[pagebase + 2 + index] = writable_uint((obl_uint) child);
+            _obl_note_write(d, pagebase + 2 + index, (obl_uint) 1);
+        }
     }
+
+    return 0;
+}
+
+static int _writable_treepage(struct obl_session *s,
+        obl_physical_address *base)
+{
+    struct obl_database *d = s->database;
+    obl_physical_address copy;
+
+    if (! _obl_snapshots_pinned(d) || _obl_is_copy(d, *base)) {
+        return 0;
+    }
+
+    copy = obl_allocate_physical(s, CHUNK_SIZE + 2);
+    if (copy == OBL_PHYSICAL_UNASSIGNED ||
+            _obl_ensure_capacity(d, copy + CHUNK_SIZE + 2)) {
+        return 1;
+    }
+
+    memcpy(d->content + copy, d->content + *base,
+            (CHUNK_SIZE + 2) * sizeof(obl_uint));
+    _obl_note_write(d, copy, (obl_uint) (CHUNK_SIZE + 2));
+
+    _obl_note_copy(d, copy);
+    _obl_retire(d, *base, CHUNK_SIZE + 2);
+    *base = copy;
+
+    return 0;
+}
+
+static inline int _cached_lookup(struct obl_database *d,
+        obl_logical_address logical, obl_physical_address *physical)
+{
+    struct obl_address_cache *cache = &d->address_cache;
+    obl_physical_address leaf;
+    uint64_t entry;
+
+    if (cache->root != d->root.address_map_addr) {
+        _obl_address_cache_clear(d);
+        cache->root = d->root.address_map_addr;
+    }
+
+    entry = *CACHE_SLOT(cache, (obl_uint) logical);
+    if (entry == 0 || (obl_uint) (entry >> 32) !=
+            (obl_uint) logical >> PAGE_SHIFT) {
+        cache->misses++;
+        return 0;
+    }
+
+    cache->hits++;
+    leaf = (obl_physical_address) entry;
+    *physical = (obl_physical_address) readable_uint(
+            d->content[leaf + 2 + (logical & CHUNK_MASK)]);
+
+    return 1;
+}
+
+static inline uint64_t _cache_leaf(struct obl_database *d,
+        obl_logical_address logical, obl_physical_address leaf)
+{
+    uint64_t entry = ((uint64_t) ((obl_uint) logical >> PAGE_SHIFT) << 32) |
+            (uint64_t) leaf;
+
+    *CACHE_SLOT(&d->address_cache, (obl_uint) logical) = entry;
+    return entry;
 }
 
 static int _verify_addrtreepage(struct obl_database *d,
@@ -195,6 +587,15 @@ static int _verify_addrtreepage(struct obl_database *d,
     }
 }
 
+static inline int _plausible_treepage(struct obl_database *d,
+        obl_physical_address base)
+{
+    return base != OBL_PHYSICAL_UNASSIGNED &&
+            (uint64_t) base + 2 + CHUNK_SIZE <= (uint64_t) d->content_size &&
+            readable_uint(d->content[base]) ==
+                (obl_uint) OBL_ADDRTREEPAGE_SHAPE_ADDR;
+}
+
 static inline obl_uint _treepage_index(obl_logical_address logical,
         obl_uint height)
 {
@@ -216,11 +617,21 @@ static obl_physical_address _create_treepage(struct obl_session *s,
         return base;
     }
 
+    if (_obl_ensure_capacity(d, base + CHUNK_SIZE + 2)) {
+        return OBL_PHYSICAL_UNASSIGNED;
+    }
+
     d->content[base] = writable_uint((obl_uint) OBL_ADDRTREEPAGE_SHAPE_ADDR);
     d->content[base + 1] = writable_uint((obl_uint) height);
     for (i = 0; i < CHUNK_SIZE; i++) {
         d->content[base + 2 + i] = writable_uint(OBL_PHYSICAL_UNASSIGNED);
     }
+    _obl_note_write(d, base, (obl_uint) (CHUNK_SIZE + 2));
+
+    /* No snapshot can see a new page, so it needn't be copied. */
+    if (_obl_snapshots_pinned(d)) {
+        _obl_note_copy(d, base);
+    }
 
     return base;
 }
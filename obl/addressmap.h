@@ -7,11 +7,16 @@
  *
  * These functions map logical addresses to physical addresses within an
  * ObjectLite database.
+ *
+ * While a snapshot is pinned (see snapshot.h), assignments copy each page on
+ * the way to the mapping that they change, once per commit, and publish a
+ * new root.  Otherwise, pages are changed in place.
  */
 
 #ifndef ADDRESSMAP_H
 #define ADDRESSMAP_H
 
+#include "constants.h"
 #include "platform.h"
 
 /* Defined in database.h */
@@ -23,9 +28,40 @@ struct obl_session;
 /* Defined in object.h */
 struct obl_object;
 
+/**
+ * A direct-mapped cache of address map leaf pages, so that translating an
+ * address near one translated recently costs a single probe instead of a walk
+ * from the root of the tree.  Leaf pages are only copied along with the root,
+ * so entries are discarded when the root is replaced, and again before
+ * retired pages are reclaimed for reuse.
+ */
+struct obl_address_cache
+{
+    /**
+     * Each entry packs the logical address prefix that selects a leaf page
+     * into its high 32 bits, and the physical address of that leaf into its
+     * low 32.  An entry of zero is empty.  Entries are single words, so
+     * threads racing to fill them never observe half of one.
+     */
+    uint64_t entries[ADDRESS_CACHE_SIZE];
+
+    /** The root page that the entries were found beneath. */
+    obl_physical_address root;
+
+    /**
+     * Translations that were answered by the cache.  Like misses, counted
+     * without synchronization, so approximate while several threads read.
+     */
+    unsigned long hits;
+
+    /** Translations that needed to walk the tree. */
+    unsigned long misses;
+};
+
 /**
  * Translate a logical address +logical+ into an assigned physical address, or
- * OBL_PHYSICAL_UNASSIGNED if none yet exists.
+ * OBL_PHYSICAL_UNASSIGNED if none yet exists.  The caller must hold the
+ * content lock.
  *
  * @param d The database in which the lookup shall be performed.
  * @param logical The logical address to translate.
@@ -35,6 +71,67 @@ struct obl_object;
 obl_physical_address obl_address_lookup(struct obl_database *d,
         obl_logical_address logical);
 
+/**
+ * Translate a logical address within the address map as of an earlier root,
+ * such as a snapshot's.  The address cache is only used for the current root.
+ * The caller must hold the content lock.  For internal use only.
+ *
+ * @param d The database in which the lookup shall be performed.
+ * @param root The root page of the address map.
+ * @param logical The logical address to translate.
+ * @return The physical address mapped to "logical" beneath root, or
+ *      OBL_PHYSICAL_UNASSIGNED if no such address exists.
+ */
+obl_physical_address _obl_address_lookup_at(struct obl_database *d,
+        obl_physical_address root, obl_logical_address logical);
+
+/**
+ * Translate a logical address without holding the content lock.  Where
+ * _obl_content_optimistic() allows, the address map is read without taking
+ * any lock at all, and the translation is repeated if a commit changed the
+ * contents meanwhile; otherwise, this takes the content lock for reading.
+ * Must not be called by a thread that holds the content lock.
+ *
+ * @param d The database in which the lookup shall be performed.
+ * @param logical The logical address to translate.
+ * @return The physical address mapped to "logical" as of the most recent
+ *      commit, or OBL_PHYSICAL_UNASSIGNED if no such address exists.
+ */
+obl_physical_address obl_address_lookup_unlocked(struct obl_database *d,
+        obl_logical_address logical);
+
+/**
+ * Translate many logical addresses at once.  Addresses that share a path
+ * through the address map only walk its shared pages once, and the entries
+ * of each level are prefetched as the walk descends.  Any order is
+ * translated correctly, but ascending order shares the most work.
+ *
+ * @param d The database in which the lookups shall be performed.
+ * @param logical The logical addresses to translate.
+ * @param physical [out] Receives the physical address mapped to each entry of
+ *      logical, or OBL_PHYSICAL_UNASSIGNED.
+ * @param count The length of both arrays.
+ */
+void obl_address_lookup_many(struct obl_database *d,
+        const obl_logical_address *logical, obl_physical_address *physical,
+        size_t count);
+
+/**
+ * Translate many logical addresses at once beneath an earlier root, as
+ * obl_address_lookup_many() does beneath the current one.  For internal use
+ * only.
+ *
+ * @param d The database in which the lookups shall be performed.
+ * @param root The root page of the address map.
+ * @param logical The logical addresses to translate.
+ * @param physical [out] Receives the physical address mapped to each entry of
+ *      logical, or OBL_PHYSICAL_UNASSIGNED.
+ * @param count The length of both arrays.
+ */
+void _obl_address_lookup_many_at(struct obl_database *d,
+        obl_physical_address root, const obl_logical_address *logical,
+        obl_physical_address *physical, size_t count);
+
 /**
  * Store a mapping between the addresses "logical" and "physical", creating
  * address map tree pages as necessary.  This function modifies the address map
@@ -45,8 +142,39 @@ obl_physical_address obl_address_lookup(struct obl_database *d,
  *      should be preparing to commit.
  * @param logical The logical address to map.
  * @param physical The physical address to map it to.
+ * @return 0 on success, or 1 if a page could not be created or copied.  The
+ *      mapping is then left as it was, although pages created along the way
+ *      may remain.
  */
-void obl_address_assign(struct obl_session *s,
+int obl_address_assign(struct obl_session *s,
         obl_logical_address logical, obl_physical_address physical);
 
+/**
+ * Translate a logical address on behalf of an optimistic reader, which will
+ * discard the result if _obl_content_read_retry() says that it raced with a
+ * writer.  Every page is checked against the bounds of the database before
+ * it's read, nothing is reported, and the address cache is consulted but not
+ * filled.  For internal use only.
+ *
+ * @param d
+ * @param logical The logical address to translate.
+ * @param leaf [out] The leaf page that holds the translation, or
+ *      OBL_PHYSICAL_UNASSIGNED.  Worth caching once the read is validated.
+ * @param inconsistent [out] Set to 1 if the address map didn't make sense,
+ *      which is a corruption unless the read is retried; otherwise 0.
+ * @return The translation, or OBL_PHYSICAL_UNASSIGNED.
+ */
+obl_physical_address _obl_address_peek(struct obl_database *d,
+        obl_logical_address logical, obl_physical_address *leaf,
+        int *inconsistent);
+
+/**
+ * Discard every entry within a database's address translation cache.  Used
+ * when the address map may have been changed from elsewhere.  For internal
+ * use only.
+ *
+ * @param d
+ */
+void _obl_address_cache_clear(struct obl_database *d);
+
 #endif /* ADDRESSMAP_H */
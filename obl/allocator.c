@@ -5,59 +5,150 @@
  *
  * The simplest possible allocator implementation.  It uses a one-up counter
  * for logical addresses, and increments physical addresses by object size.
+ * Sessions lease runs of each from the persistent counters; see allocator.h.
  */
 
 #include "allocator.h"
 
 #include "storage/object.h"
+#include "addressmap.h"
 #include "database.h"
 #include "session.h"
+#include "snapshot.h"
 
 /* Internal function prototypes. */
 
 static struct obl_object *_get_allocator(struct obl_session *s);
 
+/**
+ * Advance the allocator counter in slot +slot+ by +amount+ and grant the
+ * addresses that it skips over to +lease+.
+ */
+static int _renew(struct obl_session *s, obl_uint slot,
+        struct obl_allocation_lease *lease, obl_uint amount);
+
+/** Return the unused portion of +lease+, if its counter still ends there. */
+static int _release(struct obl_database *d, struct obl_allocation_lease *lease);
+
+/* Slot indices of the allocator's counters. */
+#define NEXT_LOGICAL_SLOT 0
+#define NEXT_PHYSICAL_SLOT 1
+
 /* External function definitions. */
 
 obl_logical_address obl_allocate_logical(struct obl_session *s)
 {
-    struct obl_object *allocator, *next_logical;
-    obl_logical_address result;
+    struct obl_allocation_lease *lease = &s->logical_lease;
 
-    allocator = _get_allocator(s);
-    if (allocator == NULL)
+    if (lease->next >= lease->limit &&
+            _renew(s, NEXT_LOGICAL_SLOT, lease,
+                    s->database->configuration.lease_addresses)) {
         return OBL_LOGICAL_UNASSIGNED;
+    }
 
-    next_logical = obl_slotted_at(allocator, (obl_uint) 0);
-    result = obl_integer_value(next_logical);
-    obl_integer_set(next_logical, result + 1);
-
-    return result;
+    return (obl_logical_address) lease->next++;
 }
 
 obl_physical_address obl_allocate_physical(struct obl_session *s,
         obl_uint size)
 {
-    struct obl_object *allocator, *next_physical;
+    struct obl_allocation_lease *lease = &s->physical_lease;
     obl_physical_address result;
 
-    allocator = _get_allocator(s);
-    if (allocator == NULL)
-        return OBL_PHYSICAL_UNASSIGNED;
+    /* Space that snapshots have let go of comes first. */
+    result = _obl_reuse_physical(s->database, size);
+    if (result != OBL_PHYSICAL_UNASSIGNED) {
+        return result;
+    }
+
+    if (lease->limit - lease->next < size) {
+        obl_uint amount;
+
+        /* Objects larger than a lease are given an extent of their own. */
+        amount = s->database->configuration.lease_size / sizeof(obl_uint);
+        if (amount < size) {
+            amount = size;
+        }
 
-    next_physical = obl_slotted_at(allocator, (obl_uint) 1);
-    result = obl_integer_value(next_physical);
-    obl_integer_set(next_physical, result + size);
+        if (_renew(s, NEXT_PHYSICAL_SLOT, lease, amount)) {
+            return OBL_PHYSICAL_UNASSIGNED;
+        }
+    }
+
+    result = (obl_physical_address) lease->next;
+    lease->next += size;
 
     return result;
 }
 
+void obl_lease_init(struct obl_allocation_lease *lease)
+{
+    lease->next = lease->limit = 0;
+    lease->counter = OBL_PHYSICAL_UNASSIGNED;
+}
+
+void _obl_release_leases(struct obl_session *s)
+{
+    struct obl_database *d = s->database;
+    int changed;
+
+    if (s->logical_lease.counter == OBL_PHYSICAL_UNASSIGNED &&
+            s->physical_lease.counter == OBL_PHYSICAL_UNASSIGNED) {
+        return ;
+    }
+
+    _obl_content_write_begin(d);
+    if (_obl_shared_write_begin(d)) {
+        _obl_content_write_end(d);
+        return ;
+    }
+
+    changed = _release(d, &s->logical_lease);
+    changed |= _release(d, &s->physical_lease);
+
+    _obl_shared_write_end(d, changed);
+    _obl_content_write_end(d);
+}
+
+int _obl_lease_logical(struct obl_session *s, obl_uint count)
+{
+    struct obl_database *d = s->database;
+    obl_uint amount = d->configuration.lease_addresses;
+    int result;
+
+    if (amount < count) {
+        amount = count;
+    }
+
+    _obl_content_write_begin(d);
+    if (_obl_shared_write_begin(d)) {
+        _obl_content_write_end(d);
+        return 1;
+    }
+    pthread_mutex_lock(&s->session_mutex);
+
+    result = _renew(s, NEXT_LOGICAL_SLOT, &s->logical_lease, amount);
+
+    pthread_mutex_unlock(&s->session_mutex);
+    _obl_shared_write_end(d, result == 0);
+    _obl_content_write_end(d);
+
+    return result;
+}
+
+/* Internal function definitions. */
+
 static struct obl_object *_get_allocator(struct obl_session *s)
 {
     struct obl_database *d = s->database;
     struct obl_object *allocator;
 
-    allocator = obl_at_address(s, d->root.allocator_addr);
+    /*
+     * Leases are renewed while committing, with the session lock already
+     * held.
+     */
+    allocator = _obl_at_address_depth(s, d->root.allocator_addr,
+            d->configuration.default_stub_depth, 0);
 
     if (allocator->shape != _obl_at_fixed_address(OBL_ALLOCATOR_SHAPE_ADDR)) {
         obl_report_error(d, OBL_MISSING_SYSTEM_OBJECT,
@@ -67,3 +158,76 @@ static struct obl_object *_get_allocator(struct obl_session *s)
 
     return allocator;
 }
+
+static int _renew(struct obl_session *s, obl_uint slot,
+        struct obl_allocation_lease *lease, obl_uint amount)
+{
+    struct obl_database *d = s->database;
+    struct obl_object *allocator, *counter;
+    obl_physical_address at;
+    obl_int start;
+
+    allocator = _get_allocator(s);
+    if (allocator == NULL) {
+        return 1;
+    }
+
+    /*
+     * The persisted counter is authoritative: other sessions may have
+     * advanced it since this session read its copy.  Stubs are translated
+     * directly, because resolving them would take the session lock again.
+     */
+    counter = allocator->storage.slotted_storage->slots[slot];
+    if (_obl_is_stub(counter)) {
+        at = obl_address_lookup(d, counter->storage.stub_storage->value);
+        counter = NULL;
+    } else {
+        at = counter->physical_address;
+    }
+
+    if (at != OBL_PHYSICAL_UNASSIGNED) {
+        start = readable_int(d->content[at + 1]);
+    } else if (counter != NULL) {
+        start = obl_integer_value(counter);
+    } else {
+        obl_report_error(d, OBL_MISSING_SYSTEM_OBJECT,
+                "Allocator counter is missing.");
+        return 1;
+    }
+
+    if (amount == 0 || start < 0 || (obl_uint) (OBL_INT_MAX - start) < amount) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY,
+                "The allocator has run out of addresses.");
+        return 1;
+    }
+
+    if (at != OBL_PHYSICAL_UNASSIGNED) {
+        d->content[at + 1] = writable_int(start + (obl_int) amount);
+        _obl_note_write(d, at + 1, (obl_uint) 1);
+    }
+    if (counter != NULL) {
+        counter->storage.integer_storage->value = start + (obl_int) amount;
+    }
+
+    lease->next = (obl_uint) start;
+    lease->limit = (obl_uint) start + amount;
+    lease->counter = at;
+
+    return 0;
+}
+
+static int _release(struct obl_database *d, struct obl_allocation_lease *lease)
+{
+    obl_physical_address at = lease->counter;
+
+    if (at == OBL_PHYSICAL_UNASSIGNED || lease->next >= lease->limit ||
+            (obl_uint) readable_int(d->content[at + 1]) != lease->limit) {
+        return 0;
+    }
+
+    d->content[at + 1] = writable_int((obl_int) lease->next);
+    _obl_note_write(d, at + 1, (obl_uint) 1);
+    lease->limit = lease->next;
+
+    return 1;
+}
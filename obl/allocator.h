@@ -7,6 +7,15 @@
  *
  * The allocator is responsible for assigning unused logical and physical
  * addresses to newly created objects.
+ *
+ * Rather than updating the persistent allocator object once per new object,
+ * each session leases a block of logical addresses and an extent of physical
+ * space with a single update, then hands them out from the lease with a plain
+ * counter.  Leases are renewed with the content lock held: while publishing a
+ * commit or, for logical addresses, just before a commit serializes its new
+ * objects.
+ * The unused tail of a lease is returned when its session is destroyed, if no
+ * other session has leased addresses beyond it in the meantime.
  */
 
 #ifndef ALLOCATOR_H
@@ -20,6 +29,25 @@ struct obl_database;
 /* defined in session.h */
 struct obl_session;
 
+/**
+ * A range of addresses leased from the allocator for the exclusive use of one
+ * session.
+ */
+struct obl_allocation_lease
+{
+    /** The next address to hand out. */
+    obl_uint next;
+
+    /** One past the last address within the lease. */
+    obl_uint limit;
+
+    /**
+     * The physical address of the persisted allocator counter that the lease
+     * was taken from, or OBL_PHYSICAL_UNASSIGNED if it isn't persisted.
+     */
+    obl_physical_address counter;
+};
+
 /**
  * Allocate an unused logical address.
  *
@@ -31,7 +59,8 @@ obl_logical_address obl_allocate_logical(struct obl_session *s);
 
 /**
  * Allocate an unused physical address.  Reserve size space after the
- * allocated address.
+ * allocated address.  Space reclaimed from old snapshots is reused before the
+ * session's lease, so the caller must have exclusive access to the database.
  *
  * @param s The session in which allocation should occur.
  * @param size The number of obl_uint-sized blocks to reserve for this object.
@@ -41,4 +70,30 @@ obl_logical_address obl_allocate_logical(struct obl_session *s);
 obl_physical_address obl_allocate_physical(struct obl_session *s,
         obl_uint size);
 
+/**
+ * Initialize an empty lease, which will be renewed on first use.
+ *
+ * @param lease
+ */
+void obl_lease_init(struct obl_allocation_lease *lease);
+
+/**
+ * Return the unused tails of a session's leases to the allocator.  Called when
+ * the session is destroyed.  For internal use only.
+ *
+ * @param s
+ */
+void _obl_release_leases(struct obl_session *s);
+
+/**
+ * Replace a session's logical address lease with one of at least +count+
+ * addresses, taking exclusive access to the database to do so.  The caller
+ * must not hold the content lock or the session lock.  For internal use only.
+ *
+ * @param s
+ * @param count The number of addresses that the caller is about to allocate.
+ * @return 0 on success, or 1 if the lease could not be renewed.
+ */
+int _obl_lease_logical(struct obl_session *s, obl_uint count);
+
 #endif /* ALLOCATOR_H */
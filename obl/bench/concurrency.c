@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Measure how reads scale with the number of threads.  Each thread opens its
+ * own session on a shared in-memory database and, in turn, faults objects in
+ * random order, refreshes the objects that it has faulted, and translates
+ * logical addresses.  Faults and refreshes both share the database's content
+ * lock; the database reserves its address space, so translations take no lock
+ * at all.  Throughput should grow with the thread count until the cores run
+ * out.
+ *
+ * Usage: concurrency [object count] [operations per thread]
+ *      (defaults: 100,000 objects, 200,000 operations)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "storage/object.h"
+#include "addressmap.h"
+#include "database.h"
+#include "platform.h"
+#include "session.h"
+#include "transaction.h"
+
+#define MAX_THREADS 64
+
+/* The number of integers committed by each populating transaction. */
+#define BATCH 1000
+
+/* The number of objects each thread refreshes, repeatedly. */
+#define REFRESHED 256
+
+struct worker
+{
+    pthread_t thread;
+
+    struct obl_database *database;
+    obl_logical_address *addresses;
+    size_t count, operations;
+
+    uint64_t seed;
+    size_t checksum;
+};
+
+/* A small, fast generator, so that choosing addresses doesn't dominate. */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Commit +count+ integers in batches, recording their addresses. */
+static int populate(struct obl_database *d, obl_logical_address *addresses,
+        size_t count)
+{
+    struct obl_session *s = obl_create_session(d);
+    size_t done = 0, i;
+
+    while (done < count) {
+        size_t batch = count - done < BATCH ? count - done : BATCH;
+        struct obl_transaction *t;
+        struct obl_object *fixed;
+
+        t = obl_begin_transaction(s);
+        fixed = obl_create_fixed((obl_uint) batch);
+        for (i = 0; i < batch; i++) {
+            obl_fixed_at_put(fixed, (obl_uint) i,
+                    obl_create_integer((obl_int) (done + i)));
+        }
+        fixed->session = s;
+        obl_mark_dirty(fixed);
+        if (obl_commit_transaction(t)) {
+            return 1;
+        }
+
+        for (i = 0; i < batch; i++) {
+            addresses[done + i] = obl_fixed_at(fixed, (obl_uint) i)->logical_address;
+        }
+        done += batch;
+    }
+
+    obl_destroy_session(s);
+    return 0;
+}
+
+static void *fault(void *argument)
+{
+    struct worker *w = argument;
+    struct obl_session *s = obl_create_session(w->database);
+    size_t i;
+
+    for (i = 0; i < w->operations; i++) {
+        struct obl_object *o;
+
+        o = obl_at_address(s, w->addresses[next_random(&w->seed) % w->count]);
+        w->checksum += (size_t) obl_integer_value(o);
+    }
+
+    obl_destroy_session(s);
+    return NULL;
+}
+
+static void *refresh(void *argument)
+{
+    struct worker *w = argument;
+    struct obl_session *s = obl_create_session(w->database);
+    struct obl_object *objects[REFRESHED];
+    size_t i;
+
+    for (i = 0; i < REFRESHED; i++) {
+        objects[i] = obl_at_address(s,
+                w->addresses[next_random(&w->seed) % w->count]);
+    }
+
+    for (i = 0; i < w->operations; i++) {
+        struct obl_object *o = objects[i % REFRESHED];
+
+        obl_refresh_object(o);
+        w->checksum += (size_t) obl_integer_value(o);
+    }
+
+    obl_destroy_session(s);
+    return NULL;
+}
+
+static void *lookup(void *argument)
+{
+    struct worker *w = argument;
+    size_t i;
+
+    for (i = 0; i < w->operations; i++) {
+        w->checksum += (size_t) obl_address_lookup_unlocked(w->database,
+                w->addresses[next_random(&w->seed) % w->count]);
+    }
+
+    return NULL;
+}
+
+/* Run +body+ on +threads+ threads at once and report the throughput. */
+static void run(const char *phase, void *(*body)(void *), int threads,
+        struct worker *workers)
+{
+    uint64_t started, elapsed;
+    size_t operations = 0;
+    int i;
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < threads; i++) {
+        pthread_create(&workers[i].thread, NULL, body, &workers[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        operations += workers[i].operations;
+    }
+    elapsed = obl_monotonic_usec() - started;
+
+    printf("%-8s %3d threads %10lu ops %10.3f ms %8.3f Mops/s\n", phase,
+            threads, (unsigned long) operations, elapsed / 1000.0,
+            elapsed == 0 ? 0.0 : (double) operations / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct worker workers[MAX_THREADS];
+    obl_logical_address *addresses;
+    size_t count = 100000, operations = 200000;
+    int threads, i;
+
+    if (argc > 1) {
+        count = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        operations = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (count == 0) {
+        count = 1;
+    }
+
+    obl_startup();
+
+    config.reserve_size = (uint64_t) 1 << 30;
+    addresses = malloc(count * sizeof(obl_logical_address));
+    d = obl_open_database(&config);
+    if (addresses == NULL || d == NULL || populate(d, addresses, count)) {
+        fprintf(stderr, "Unable to populate %lu objects.\n",
+                (unsigned long) count);
+        return 1;
+    }
+
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        for (i = 0; i < threads; i++) {
+            workers[i].database = d;
+            workers[i].addresses = addresses;
+            workers[i].count = count;
+            workers[i].operations = operations;
+            workers[i].seed = 0x2545F4914F6CDD1DULL + (uint64_t) i;
+            workers[i].checksum = 0;
+        }
+
+        run("fault", &fault, threads, workers);
+        run("refresh", &refresh, threads, workers);
+        run("lookup", &lookup, threads, workers);
+    }
+
+    obl_close_database(d);
+    free(addresses);
+
+    obl_shutdown();
+    return 0;
+}
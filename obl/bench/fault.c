@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Measure what decoding costs per slot.  Persist a number of fixed
+ * collections of integers into an in-memory database, then time a fresh
+ * session faulting each collection in, which decodes every slot straight into
+ * its storage.  For comparison, time filling the same slots through
+ * obl_fixed_at_put() within one transaction, the path that a decoder must
+ * never take: it marks each word dirty and logs its former value.
+ *
+ * Usage: fault [collection count] [slots per collection]
+ *      (defaults: 20,000 collections, 64 slots)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "storage/object.h"
+#include "database.h"
+#include "platform.h"
+#include "session.h"
+#include "transaction.h"
+
+/* Report one timed phase. */
+static void report(const char *phase, size_t slots, uint64_t usec)
+{
+    printf("%-8s %10lu slots %10.3f ms %8.1f ns/slot\n", phase,
+            (unsigned long) slots, usec / 1000.0,
+            slots == 0 ? 0.0 : usec * 1000.0 / slots);
+}
+
+/* Commit +count+ collections of +width+ integers, recording their addresses. */
+static int populate(struct obl_database *d, obl_logical_address *addresses,
+        size_t count, obl_uint width)
+{
+    struct obl_session *s = obl_create_session(d);
+    size_t i;
+    obl_uint j;
+
+    for (i = 0; i < count; i++) {
+        struct obl_transaction *t;
+        struct obl_object *fixed;
+
+        t = obl_begin_transaction(s);
+        fixed = obl_create_fixed(width);
+        for (j = 0; j < width; j++) {
+            obl_fixed_at_put(fixed, j,
+                    obl_create_integer((obl_int) (i * width + j)));
+        }
+        fixed->session = s;
+        obl_mark_dirty(fixed);
+        if (obl_commit_transaction(t)) {
+            return 1;
+        }
+
+        addresses[i] = fixed->logical_address;
+    }
+
+    obl_destroy_session(s);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_transaction *t;
+    struct obl_object **collections;
+    obl_logical_address *addresses;
+    size_t count = 20000, slots, i;
+    obl_uint width = 64, j;
+    uint64_t started;
+
+    if (argc > 1) {
+        count = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        width = (obl_uint) strtoul(argv[2], NULL, 10);
+    }
+    slots = count * width;
+
+    obl_startup();
+
+    collections = malloc(count * sizeof(struct obl_object *));
+    addresses = malloc(count * sizeof(obl_logical_address));
+    if (collections == NULL || addresses == NULL) {
+        fprintf(stderr, "Unable to allocate %lu collections.\n",
+                (unsigned long) count);
+        return 1;
+    }
+
+    /* Children beyond the collections themselves remain stubs. */
+    config.default_stub_depth = 1;
+    d = obl_open_database(&config);
+    if (populate(d, addresses, count, width)) {
+        fprintf(stderr, "Unable to populate the database.\n");
+        return 1;
+    }
+
+    s = obl_create_session(d);
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        collections[i] = obl_at_address(s, addresses[i]);
+    }
+    report("fault", slots, obl_monotonic_usec() - started);
+
+    t = obl_begin_transaction(s);
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < width; j++) {
+            obl_fixed_at_put(collections[i], j, obl_nil());
+        }
+    }
+    report("put", slots, obl_monotonic_usec() - started);
+    obl_abort_transaction(t);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+
+    free(collections);
+    free(addresses);
+    return 0;
+}
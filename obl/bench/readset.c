@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Compare the red-black obl_set with the open-addressing obl_table as a
+ * session read set: populate each with objects at consecutive logical
+ * addresses, then time lookups in random order, lookups that miss, and
+ * removal.
+ *
+ * Usage: readset [object count]    (default: 1,000,000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "storage/object.h"
+#include "database.h"
+#include "platform.h"
+#include "set.h"
+#include "table.h"
+
+/* Report one timed phase. */
+static void report(const char *structure, const char *phase, size_t count,
+        uint64_t usec)
+{
+    printf("%-10s %-8s %10lu ops %10.3f ms %8.1f ns/op\n", structure, phase,
+            (unsigned long) count, usec / 1000.0,
+            count == 0 ? 0.0 : usec * 1000.0 / count);
+}
+
+/* A small, fast generator, so that shuffling doesn't dominate the run. */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = 1000000, i;
+    struct obl_object **objects;
+    obl_logical_address *order;
+    struct obl_set *set;
+    struct obl_table *table;
+    uint64_t seed = 0x2545F4914F6CDD1DULL, started;
+    size_t found;
+
+    if (argc > 1) {
+        count = (size_t) strtoul(argv[1], NULL, 10);
+    }
+
+    obl_startup();
+
+    objects = malloc(count * sizeof(struct obl_object *));
+    order = malloc(count * sizeof(obl_logical_address));
+    if (objects == NULL || order == NULL) {
+        fprintf(stderr, "Unable to allocate %lu objects.\n",
+                (unsigned long) count);
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        objects[i] = obl_create_integer((obl_int) i);
+        objects[i]->logical_address = (obl_logical_address) (i + 1);
+        order[i] = (obl_logical_address) (i + 1);
+    }
+    for (i = count; i > 1; i--) {
+        size_t j = (size_t) (next_random(&seed) % i);
+        obl_logical_address swap = order[i - 1];
+
+        order[i - 1] = order[j];
+        order[j] = swap;
+    }
+
+    /* obl_set */
+
+    set = obl_create_set(&logical_address_keyfunction);
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        obl_set_insert(set, objects[i]);
+    }
+    report("obl_set", "insert", count, obl_monotonic_usec() - started);
+
+    found = 0;
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        found += obl_set_lookup(set, (obl_set_key) order[i]) != NULL;
+    }
+    report("obl_set", "hit", count, obl_monotonic_usec() - started);
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        found += obl_set_lookup(set, (obl_set_key) (order[i] + count)) != NULL;
+    }
+    report("obl_set", "miss", count, obl_monotonic_usec() - started);
+    if (found != count) {
+        fprintf(stderr, "obl_set found %lu of %lu objects.\n",
+                (unsigned long) found, (unsigned long) count);
+    }
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        obl_set_remove(set, objects[order[i] - 1]);
+    }
+    report("obl_set", "remove", count, obl_monotonic_usec() - started);
+
+    obl_destroy_set(set, NULL);
+
+    /* obl_table */
+
+    table = obl_create_table();
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        obl_table_insert(table, objects[i]);
+    }
+    report("obl_table", "insert", count, obl_monotonic_usec() - started);
+
+    found = 0;
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        found += obl_table_lookup(table, order[i]) != NULL;
+    }
+    report("obl_table", "hit", count, obl_monotonic_usec() - started);
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        found += obl_table_lookup(table,
+                (obl_logical_address) (order[i] + count)) != NULL;
+    }
+    report("obl_table", "miss", count, obl_monotonic_usec() - started);
+    if (found != count) {
+        fprintf(stderr, "obl_table found %lu of %lu objects.\n",
+                (unsigned long) found, (unsigned long) count);
+    }
+
+    started = obl_monotonic_usec();
+    for (i = 0; i < count; i++) {
+        obl_table_remove(table, objects[order[i] - 1]);
+    }
+    report("obl_table", "remove", count, obl_monotonic_usec() - started);
+
+    obl_destroy_table(table, NULL);
+
+    for (i = 0; i < count; i++) {
+        _obl_deallocate_object(objects[i]);
+    }
+    free(objects);
+    free(order);
+
+    obl_shutdown();
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file cache.c
+ */
+
+#include "cache.h"
+
+#include <stdlib.h>
+
+#include "storage/object.h"
+#include "database.h"
+#include "session.h"
+#include "set.h"
+#include "table.h"
+#include "transaction.h"
+
+/* Internal function prototypes. */
+
+/** Return true if +o+ may be turned into a stub. */
+static int _evictable(struct obl_session *s, struct obl_object *o,
+        struct obl_object *keep);
+
+/** Turn +o+ into a stub in place.  Returns 1 if memory ran out. */
+static int _evict(struct obl_session *s, struct obl_object *o);
+
+/* External function definitions. */
+
+void obl_cache_init(struct obl_cache *cache, uint64_t budget)
+{
+    cache->budget = budget;
+    cache->used = 0;
+    cache->hand = 0;
+    cache->hits = cache->misses = cache->evictions = 0;
+}
+
+void obl_pin_object(struct obl_object *o)
+{
+    o->cache.pins++;
+}
+
+void obl_unpin_object(struct obl_object *o)
+{
+    if (o->cache.pins > 0) {
+        o->cache.pins--;
+    }
+}
+
+void _obl_cache_admit(struct obl_session *s, struct obl_object *o)
+{
+    uint32_t charge;
+
+    if (o->cache.charge != 0) {
+        return ;
+    }
+
+    charge = (uint32_t) (sizeof(struct obl_object) +
+            obl_object_wordsize(o) * sizeof(obl_uint));
+
+    o->cache.charge = charge;
+    o->cache.referenced = 1;
+    s->cache.used += charge;
+}
+
+void _obl_cache_forget(struct obl_session *s, struct obl_object *o)
+{
+    s->cache.used -= o->cache.charge;
+    o->cache.charge = 0;
+}
+
+void _obl_cache_trim(struct obl_session *s, struct obl_object *keep)
+{
+    struct obl_cache *cache = &s->cache;
+    struct obl_table *table = s->read_set;
+    size_t examined = 0, limit;
+    int locking = ! s->database->configuration.read_only;
+
+    if (cache->budget == 0 || cache->used <= cache->budget) {
+        return ;
+    }
+
+    if (locking) pthread_mutex_lock(&s->session_mutex);
+
+    /* Two laps: one to clear reference bits, one to evict. */
+    limit = 2 * table->capacity;
+    while (cache->used > cache->budget && examined < limit) {
+        struct obl_object *o;
+        size_t start;
+
+        if (cache->hand >= table->capacity) {
+            cache->hand = 0;
+        }
+        start = cache->hand;
+        o = obl_table_next(table, &cache->hand);
+        examined += cache->hand - start;
+
+        if (o == NULL || ! _evictable(s, o, keep)) {
+            continue;
+        }
+        if (o->cache.referenced) {
+            o->cache.referenced = 0;
+            continue;
+        }
+        if (_evict(s, o)) {
+            break;
+        }
+    }
+
+    if (locking) pthread_mutex_unlock(&s->session_mutex);
+}
+
+/* Internal function definitions. */
+
+static int _evictable(struct obl_session *s, struct obl_object *o,
+        struct obl_object *keep)
+{
+    struct obl_transaction *t = s->current_transaction;
+
+    if (o == keep || o->cache.pins > 0 || o->cache.committing > 0 ||
+            o->cache.charge == 0) {
+        return 0;
+    }
+    if (o->physical_address == OBL_PHYSICAL_UNASSIGNED ||
+            _obl_is_stub(o) || obl_storage_of(o) == OBL_SHAPE) {
+        return 0;
+    }
+    if (t != NULL && obl_set_lookup(t->write_set,
+            (obl_set_key) o->logical_address) != NULL) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int _evict(struct obl_session *s, struct obl_object *o)
+{
+    struct obl_stub_storage *stub;
+
+    stub = malloc(sizeof(struct obl_stub_storage));
+    if (stub == NULL) {
+        obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+        return 1;
+    }
+    stub->value = o->logical_address;
+
+    _obl_cache_forget(s, o);
+    _obl_deallocate_storage(o);
+
+    o->shape = _obl_at_fixed_address(OBL_STUB_SHAPE_ADDR);
+    o->storage.stub_storage = stub;
+    o->physical_address = OBL_PHYSICAL_UNASSIGNED;
+
+    s->cache.evictions++;
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file cache.h
+ *
+ * Bounds the memory used by the objects resident within a session.  Each
+ * object faulted in from the database is charged against its session's
+ * cache_size budget.  Whenever the session exceeds its budget after a call to
+ * obl_at_address(), a CLOCK hand sweeps the read set: objects that have been
+ * used since the hand last passed are given a second chance, and the rest are
+ * evicted by turning them into stubs in place.  An evicted object is faulted
+ * back in, into the same obl_object, the next time it's reached through a
+ * reference.
+ *
+ * Objects that are shapes, are unpersisted, or belong to the current
+ * transaction's write set or to an asynchronous commit that has yet to be
+ * published are never evicted, nor are pinned objects.  Client
+ * code that holds an obl_object across calls to obl_at_address() in a session
+ * with a cache budget must pin it with obl_pin_object().
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defined in storage/object.h */
+struct obl_object;
+
+/* Defined in session.h */
+struct obl_session;
+
+/**
+ * Per-object cache state, embedded within each obl_object.
+ */
+struct obl_cache_entry
+{
+    /** The number of bytes charged against the session for this object. */
+    uint32_t charge;
+
+    /** While nonzero, this object will not be evicted. */
+    uint16_t pins;
+
+    /**
+     * The number of detached asynchronous commits that will write this
+     * object.  While nonzero, it will not be evicted.  Guarded by the session
+     * lock.
+     */
+    uint16_t committing;
+
+    /** Set when the object is used; cleared as the clock hand passes it. */
+    uint8_t referenced;
+};
+
+/**
+ * Per-session cache state.
+ */
+struct obl_cache
+{
+    /** The number of bytes of objects to keep resident, or 0 for no limit. */
+    uint64_t budget;
+
+    /** The number of bytes currently charged. */
+    uint64_t used;
+
+    /** The read set slot at which the next sweep will begin. */
+    size_t hand;
+
+    /** Lookups that found an object already resident. */
+    unsigned long hits;
+
+    /** Lookups that had to read an object from the database. */
+    unsigned long misses;
+
+    /** Objects that have been turned into stubs to stay within budget. */
+    unsigned long evictions;
+};
+
+/**
+ * Initialize an empty cache.
+ *
+ * @param cache
+ * @param budget The number of bytes to keep resident, or 0 for no limit.
+ */
+void obl_cache_init(struct obl_cache *cache, uint64_t budget);
+
+/**
+ * Prevent an object from being evicted until a matching call to
+ * obl_unpin_object().  Pins nest.
+ *
+ * @param o
+ */
+void obl_pin_object(struct obl_object *o);
+
+/**
+ * Release a pin acquired by obl_pin_object().
+ *
+ * @param o
+ */
+void obl_unpin_object(struct obl_object *o);
+
+/**
+ * Charge a newly resident object against its session's budget.  The caller
+ * must hold the session lock.  For internal use only.
+ *
+ * @param s
+ * @param o An object that has just been added to s's read set.
+ */
+void _obl_cache_admit(struct obl_session *s, struct obl_object *o);
+
+/**
+ * Refund an object's charge as it leaves its session's read set.  The caller
+ * must hold the session lock.  For internal use only.
+ *
+ * @param s
+ * @param o
+ */
+void _obl_cache_forget(struct obl_session *s, struct obl_object *o);
+
+/**
+ * Evict objects until the session is within its budget, or until nothing
+ * else can be evicted.  Takes the session lock.  For internal use only.
+ *
+ * @param s
+ * @param keep An object that must not be evicted, or NULL.
+ */
+void _obl_cache_trim(struct obl_session *s, struct obl_object *keep);
+
+#endif /* CACHE_H */
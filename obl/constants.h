@@ -23,20 +23,78 @@
 #define CHUNK_SIZE_LOG2 9
 
 /**
- * Default number of buckets in the cache.  This should be set to a prime number
- * relatively close to DEFAULT_CACHE_SIZE.
+ * Number of buckets in each database's cache of shared payloads.  This should
+ * be set to a prime number.
  */
 #define DEFAULT_CACHE_BUCKETS 1021
 
+/**
+ * The number of entries in each database's address translation cache.  Each
+ * entry covers one leaf page of the address map, or CHUNK_SIZE logical
+ * addresses.  Must be a power of two.
+ */
+#define ADDRESS_CACHE_SIZE 256
+
 /**
  * Default depth to automatically follow stubs.
  */
 #define DEFAULT_STUB_DEPTH 4
 
 /**
- * Extend the database file by this many bytes each time an
+ * Extend the database file by at least this many bytes each time an
  * allocation is attempted after the end.
  */
 #define DEFAULT_GROWTH_SIZE 4096
 
+/**
+ * Each growth operation extends the database by this percentage of its
+ * current size, so a value of 100 doubles the database every time.
+ */
+#define DEFAULT_GROWTH_FACTOR 100
+
+/**
+ * Never extend the database by more than this many bytes in a single growth
+ * operation.
+ */
+#define DEFAULT_GROWTH_MAX (64 * 1024 * 1024)
+
+/**
+ * Number of logical addresses that a session leases from the allocator at once.
+ */
+#define DEFAULT_LEASE_ADDRESSES 4096
+
+/**
+ * Number of bytes of physical space that a session leases from the allocator
+ * at once.
+ */
+#define DEFAULT_LEASE_SIZE (1024 * 1024)
+
+/**
+ * A session keeps the array that collects the objects adopted by a commit
+ * unless it has grown past this many entries.
+ */
+#define ADOPTED_RETAINED 65536
+
+/**
+ * Bytes of decoded object contents that a database shares among its sessions.
+ */
+#define DEFAULT_SHARED_CACHE_SIZE (8 * 1024 * 1024)
+
+/**
+ * Microseconds that a committing session will wait for concurrent commits to
+ * join its write-ahead log fsync().
+ */
+#define DEFAULT_GROUP_COMMIT_DELAY 100
+
+/**
+ * The number of asynchronous commits that may wait for a database's writer
+ * thread at once.
+ */
+#define DEFAULT_COMMIT_QUEUE_LENGTH 64
+
+/**
+ * Checkpoint the write-ahead log once it grows past this many bytes.
+ */
+#define DEFAULT_CHECKPOINT_SIZE (4 * 1024 * 1024)
+
 #endif
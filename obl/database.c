@@ -13,10 +13,13 @@
 #include "addressmap.h"
 #include "allocator.h"
 #include "constants.h"
+#include "growth.h"
 #include "log.h"
 #include "platform.h"
 #include "session.h"
 #include "set.h"
+#include "shared.h"
+#include "table.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -40,13 +43,18 @@ static int _obl_map_database(struct obl_database *d);
 
 static int _obl_unmap_database(struct obl_database *d);
 
-static void _grow_database(struct obl_database *d);
-
-static void _bootstrap_database(struct obl_database *d);
+/**
+ * Bootstrap a new database if the mapped file is empty.  In a read-only
+ * database, verify that there is nothing to bootstrap instead.
+ */
+static int _prepare_content(struct obl_database *d);
 
-static void _read_root(struct obl_database *d);
+/**
+ * Write the root, the allocator and the first address map page into an empty
+ * database.  Return 0 on success, or 1 if they couldn't all be placed.
+ */
+static int _bootstrap_database(struct obl_database *d);
 
-static void _write_root(struct obl_database *d);
 
 /** Error codes: one for each obl_error_code in log.h. */
 static char *error_messages[] = {
@@ -61,7 +69,11 @@ static char *error_messages[] = {
         "Database must be open",
         "Invalid index",
         "Invalid address",
-        "An attempt was made to begin a transaction while one was already in progress"
+        "An attempt was made to begin a transaction while one was already in progress",
+        "Unable to write file",
+        "The database is read-only",
+        "A commit conflicted with a concurrent one",
+        "The database's configuration doesn't support this operation"
 };
 
 /** Storage for fixed space, shared by all active databases. */
@@ -121,9 +133,31 @@ struct obl_database *obl_open_database(struct obl_database_config *config)
         conf->default_stub_depth = DEFAULT_STUB_DEPTH;
     if (conf->growth_size == 0)
         conf->growth_size = DEFAULT_GROWTH_SIZE;
+    if (conf->growth_factor == 0)
+        conf->growth_factor = DEFAULT_GROWTH_FACTOR;
+    if (conf->growth_max == 0)
+        conf->growth_max = DEFAULT_GROWTH_MAX;
+    if (conf->lease_addresses <= 0)
+        conf->lease_addresses = DEFAULT_LEASE_ADDRESSES;
+    if (conf->lease_size < (int) sizeof(obl_uint))
+        conf->lease_size = DEFAULT_LEASE_SIZE;
+    if (conf->shared_cache_size == 0)
+        conf->shared_cache_size = DEFAULT_SHARED_CACHE_SIZE;
+    if (conf->group_commit_delay == 0)
+        conf->group_commit_delay = DEFAULT_GROUP_COMMIT_DELAY;
+    if (conf->checkpoint_size == 0)
+        conf->checkpoint_size = DEFAULT_CHECKPOINT_SIZE;
+    if (conf->commit_queue_length <= 0)
+        conf->commit_queue_length = DEFAULT_COMMIT_QUEUE_LENGTH;
     if (conf->log_level == L_DEFAULT)
         conf->log_level = L_NOTICE;
 
+    if (conf->multi_process && conf->write_ahead_log) {
+        OBL_NOTICE(d, "The write-ahead log is unavailable to multi-process "
+                "databases.");
+        conf->write_ahead_log = 0;
+    }
+
     /*
      * Set the ambient logging level of the ObjectLite library to match this,
      * the most recently created database.
@@ -140,34 +174,54 @@ struct obl_database *obl_open_database(struct obl_database_config *config)
     d->root.name_map_addr = OBL_PHYSICAL_UNASSIGNED;
     d->root.shape_map_addr = OBL_PHYSICAL_UNASSIGNED;
     d->root.dirty = 0;
+    memset(&d->address_cache, 0, sizeof(struct obl_address_cache));
+    _obl_payload_cache_init(&d->payload_cache);
 
     /* Prepare the content pointer to be appropriately empty. */
     d->content = NULL;
     d->content_size = (obl_uint) 0;
+    d->fd = -1;
+    d->reserved_size = 0;
+    d->wal = NULL;
+    d->shared = NULL;
+    obl_page_set_init(&d->dirty_pages);
+    memset(&d->commit_statistics, 0, sizeof(struct obl_commit_statistics));
+    memset(&d->growth_statistics, 0, sizeof(struct obl_growth_statistics));
+    _obl_writer_init(&d->writer, (size_t) conf->commit_queue_length);
+    d->commit_version = 0;
+    _obl_versions_init(&d->versions);
+    _obl_snapshots_init(&d->snapshots);
 
     /* Initialize the content lock. */
-    sem_init(&d->content_mutex, 0, 1);
+    pthread_rwlock_init(&d->content_lock, NULL);
+    d->content_sequence = 0;
 
     /* Initialize the session list. */
     d->session_list = NULL;
-    sem_init(&d->session_list_mutex, 0, 1);
+    pthread_rwlock_init(&d->session_list_lock, NULL);
 
     if (_obl_map_database(d)) {
-        sem_destroy(&d->content_mutex);
+        pthread_rwlock_destroy(&d->content_lock);
+        pthread_rwlock_destroy(&d->session_list_lock);
+        _obl_payload_cache_destroy(&d->payload_cache);
+        _obl_writer_destroy(&d->writer);
+        _obl_snapshots_destroy(&d->snapshots);
         free(d);
         return NULL;
     }
 
-    if (d->content_size == 0) {
-        _grow_database(d);
-    }
-
-    if (readable_uint(d->content[0]) != magic) {
-        OBL_INFO(d, "Bootstrapping the database.");
-        _bootstrap_database(d);
+    if (_prepare_content(d)) {
+        _obl_unmap_database(d);
+        pthread_rwlock_destroy(&d->content_lock);
+        pthread_rwlock_destroy(&d->session_list_lock);
+        _obl_payload_cache_destroy(&d->payload_cache);
+        _obl_writer_destroy(&d->writer);
+        _obl_snapshots_destroy(&d->snapshots);
+        free(d);
+        return NULL;
     }
 
-    _read_root(d);
+    _obl_read_root(d);
 
     return d;
 }
@@ -199,13 +253,8 @@ void obl_close_database(struct obl_database *d)
 {
     struct obl_session_list *current;
 
-    _obl_unmap_database(d);
-
-    if (d->error_message != NULL ) {
-        free(d->error_message);
-    }
-
-    sem_destroy(&d->content_mutex);
+    /* Apply any asynchronous commits before their sessions go away. */
+    _obl_writer_destroy(&d->writer);
 
     current = d->session_list;
 
@@ -221,6 +270,20 @@ void obl_close_database(struct obl_database *d)
         current = next;
     }
 
+    /* Sessions return their leases to the contents, so unmap them last. */
+    _obl_unmap_database(d);
+    obl_page_set_destroy(&d->dirty_pages);
+
+    if (d->error_message != NULL ) {
+        free(d->error_message);
+    }
+
+    pthread_rwlock_destroy(&d->content_lock);
+    pthread_rwlock_destroy(&d->session_list_lock);
+
+    _obl_payload_cache_destroy(&d->payload_cache);
+    _obl_versions_destroy(&d->versions);
+    _obl_snapshots_destroy(&d->snapshots);
     free(d);
 }
 
@@ -317,21 +380,28 @@ int _obl_assign_addresses(struct obl_object *o)
 
     if (o->logical_address == OBL_LOGICAL_UNASSIGNED) {
         o->logical_address = obl_allocate_logical(s);
+        if (o->logical_address == OBL_LOGICAL_UNASSIGNED) {
+            return -1;
+        }
         assigned = 1;
     }
 
     if (o->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+        obl_physical_address physical;
         obl_uint size, extent;
 
         size = obl_object_wordsize(o);
-        o->physical_address = obl_allocate_physical(s, size);
-
-        extent = (obl_uint) (o->physical_address) + size;
-        if (extent >= d->content_size) {
-            _grow_database(d);
+        physical = obl_allocate_physical(s, size);
+        if (physical == OBL_PHYSICAL_UNASSIGNED) {
+            return -1;
         }
 
-        obl_address_assign(s, o->logical_address, o->physical_address);
+        extent = (obl_uint) physical + size;
+        if (_obl_ensure_capacity(d, extent) ||
+                obl_address_assign(s, o->logical_address, physical)) {
+            return -1;
+        }
+        o->physical_address = physical;
     }
 
     return assigned;
@@ -355,6 +425,80 @@ void _obl_write(struct obl_object *o)
     }
 
     obl_write_object(o, d->content);
+    _obl_note_write(d, o->physical_address, obl_object_wordsize(o));
+}
+
+void _obl_note_write(struct obl_database *d, obl_physical_address base,
+        obl_uint count)
+{
+    if (d->wal != NULL) {
+        _obl_wal_note(d, base, count);
+    } else if (d->configuration.sync_commits && d->fd >= 0) {
+        if (obl_page_set_add(&d->dirty_pages, base, count)) {
+            obl_report_error(d, OBL_OUT_OF_MEMORY,
+                    "Unable to record a modified page.");
+        }
+    }
+}
+
+void _obl_write_root(struct obl_database *d)
+{
+    d->content[ADDRMAP_ADDR] = writable_physical(d->root.address_map_addr);
+    d->content[ALLOCATOR_ADDR] = writable_logical(d->root.allocator_addr);
+    d->content[NAMEMAP_ADDR] = writable_logical(d->root.name_map_addr);
+    d->content[SHAPEMAP_ADDR] = writable_logical(d->root.shape_map_addr);
+    _obl_note_write(d, (obl_physical_address) ADDRMAP_ADDR, (obl_uint) 4);
+
+    d->root.dirty = 0;
+}
+
+void _obl_content_write_begin(struct obl_database *d)
+{
+    pthread_rwlock_wrlock(&d->content_lock);
+    d->content_sequence++;
+    OBL_MEMORY_BARRIER();
+}
+
+void _obl_content_write_end(struct obl_database *d)
+{
+    OBL_MEMORY_BARRIER();
+    d->content_sequence++;
+    pthread_rwlock_unlock(&d->content_lock);
+}
+
+int _obl_content_optimistic(const struct obl_database *d)
+{
+    return d->shared == NULL &&
+            (d->reserved_size != 0 || d->configuration.read_only);
+}
+
+unsigned long _obl_content_read_begin(const struct obl_database *d)
+{
+    unsigned long sequence;
+
+    while ( (sequence = d->content_sequence) & 1 ) {
+        obl_sleep_usec(0);
+    }
+    OBL_MEMORY_BARRIER();
+
+    return sequence;
+}
+
+int _obl_content_read_retry(const struct obl_database *d,
+        unsigned long sequence)
+{
+    OBL_MEMORY_BARRIER();
+    return d->content_sequence != sequence;
+}
+
+void _obl_read_root(struct obl_database *d)
+{
+    d->root.address_map_addr = readable_physical(d->content[ADDRMAP_ADDR]);
+    d->root.allocator_addr = readable_logical(d->content[ALLOCATOR_ADDR]);
+    d->root.name_map_addr = readable_logical(d->content[NAMEMAP_ADDR]);
+    d->root.shape_map_addr = readable_logical(d->content[SHAPEMAP_ADDR]);
+
+    d->root.dirty = 0;
 }
 
 void _obl_database_release(struct obl_object *o)
@@ -493,26 +637,26 @@ static int _obl_map_database(struct obl_database *d)
     struct stat buffer;
 
     if (d->configuration.filename == NULL) {
-        /* Prepare an in-memory database on the heap. */
-
-        d->content_size = (obl_uint) d->configuration.growth_size;
-        d->content = malloc(sizeof(obl_uint) * d->content_size);
-        memset(d->content, 0, sizeof(obl_uint) * d->content_size);
-
-        if (d->content == NULL) {
-            d->content_size = (obl_uint) 0;
-            obl_report_error(d, OBL_OUT_OF_MEMORY,
-                    "Unable to allocate enough space for an in-memory "
-                    "database.");
+        if (d->configuration.read_only) {
+            obl_report_error(d, OBL_UNABLE_TO_OPEN_FILE,
+                    "An in-memory database can't be opened read-only.");
             return 1;
         }
 
-        return 0;
+        /*
+         * In-memory databases begin empty; their storage is allocated by the
+         * first growth operation.
+         */
+        return _obl_map_content(d, (obl_uint) 0);
     }
 
-    flags = O_RDWR;
-    if (! d->configuration.prohibit_creation) {
-        flags |= O_CREAT;
+    if (d->configuration.read_only) {
+        flags = O_RDONLY;
+    } else {
+        flags = O_RDWR;
+        if (! d->configuration.prohibit_creation) {
+            flags |= O_CREAT;
+        }
     }
 
     fd = open(d->configuration.filename, flags, S_IRUSR | S_IWUSR);
@@ -525,9 +669,28 @@ static int _obl_map_database(struct obl_database *d)
         return 1;
     }
 
+    d->fd = fd;
+
+    /* Recover any commits that didn't reach the file before a crash. */
+    if (_obl_wal_open(d)) {
+        close(fd);
+        d->fd = -1;
+        return 1;
+    }
+
+    if (_obl_shared_open(d)) {
+        _obl_wal_close(d);
+        close(fd);
+        d->fd = -1;
+        return 1;
+    }
+
     if (fstat(fd, &buffer)) {
         /* Unable to stat database file. */
+        _obl_shared_close(d);
+        _obl_wal_close(d);
         close(fd);
+        d->fd = -1;
         obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
                 "Unable to stat file <%s>: %s",
                 d->configuration.filename,
@@ -535,80 +698,90 @@ static int _obl_map_database(struct obl_database *d)
         return 1;
     }
 
-    d->content_size = (obl_uint) (buffer.st_size / sizeof(obl_uint));
-    d->content = (obl_uint*) mmap(NULL, d->content_size,
-            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    close(fd);
+    if (_obl_map_content(d, (obl_uint) (buffer.st_size / sizeof(obl_uint)))) {
+        _obl_shared_close(d);
+        _obl_wal_close(d);
+        _obl_unmap_content(d);
+        close(fd);
+        d->fd = -1;
+        return 1;
+    }
 
     return 0;
 }
 
 static int _obl_unmap_database(struct obl_database *d)
 {
-    if (d->configuration.filename == NULL) {
-        /* Free heap space. */
+    _obl_wal_close(d);
+    _obl_shared_close(d);
+    _obl_unmap_content(d);
 
-        free(d->content);
-        d->content = NULL;
-        d->content_size = (obl_uint) 0;
-
-        return 0;
+    if (d->fd >= 0) {
+        close(d->fd);
+        d->fd = -1;
     }
 
-    munmap(d->content, d->content_size * sizeof(obl_uint));
-
-    d->content = NULL;
-    d->content_size = (obl_uint) 0;
-
     return 0;
 }
 
-static void _grow_database(struct obl_database *d)
+static int _prepare_content(struct obl_database *d)
 {
-    FILE *fd;
+    int bootstrapped = 0;
 
-    sem_wait(&d->content_mutex);
+    if (d->configuration.read_only) {
+        int valid = 0;
 
-    if (d->configuration.filename == NULL) {
-        /* Allocate additional space on the heap. */
+        /* A read-only database can't be bootstrapped. */
+        if (! _obl_shared_read_begin(d)) {
+            valid = d->content_size > 0 &&
+                    readable_uint(d->content[0]) == magic;
+            _obl_shared_read_end(d);
+        }
+        if (! valid) {
+            obl_report_errorf(d, OBL_UNABLE_TO_READ_FILE,
+                    "File <%s> is not an ObjectLite database.",
+                    d->configuration.filename);
+            return 1;
+        }
 
-        d->content_size = d->content_size + d->configuration.growth_size;
-        d->content = realloc(d->content, d->content_size);
+        return 0;
+    }
 
-        if (d->content == NULL) {
-            obl_report_errorf(d, OBL_OUT_OF_MEMORY,
-                    "Unable to grow an in-memory database to <%lu> bytes.",
-                    d->content_size);
-            d->content_size = (obl_uint) 0;
-        }
+    /* Another process may be bootstrapping the same file. */
+    if (_obl_shared_write_begin(d)) {
+        return 1;
+    }
 
-        sem_post(&d->content_mutex);
-        return ;
+    if (d->content_size == 0 && _obl_ensure_capacity(d, (obl_uint) 1)) {
+        _obl_shared_write_end(d, 0);
+        return 1;
     }
 
-    if (d->content != NULL) {
-        _obl_unmap_database(d);
+    if (readable_uint(d->content[0]) != magic) {
+        OBL_INFO(d, "Bootstrapping the database.");
+        if (_bootstrap_database(d)) {
+            _obl_shared_write_end(d, 0);
+            return 1;
+        }
+        bootstrapped = 1;
     }
 
-    fd = fopen(d->configuration.filename, "rb+");
-    fseek(fd, d->configuration.growth_size - 1, SEEK_END);
-    fputc('\0', fd);
-    fclose(fd);
+    _obl_shared_write_end(d, bootstrapped);
 
-    _obl_map_database(d);
-    sem_post(&d->content_mutex);
+    return 0;
 }
 
-static void _bootstrap_database(struct obl_database *d)
+static int _bootstrap_database(struct obl_database *d)
 {
     struct obl_session *s;
     struct obl_object *treepage, *allocator;
     struct obl_object *next_physical, *next_logical;
     obl_logical_address current_logical;
     obl_physical_address current_physical;
+    int failed;
 
     s = obl_create_session(d);
-    if (s == NULL) return ;
+    if (s == NULL) return 1;
 
     /* Logical 0 is OBL_LOGICAL_UNASSIGNED, so start at Logical 1. */
     current_logical = (obl_logical_address) 1;
@@ -658,50 +831,45 @@ static void _bootstrap_database(struct obl_database *d)
     obl_integer_set(next_logical, (int) current_logical);
 
     /* Write everything so far. */
-    _write_root(d);
+    _obl_write_root(d);
     obl_write_object(allocator, d->content);
     obl_write_object(next_physical, d->content);
     obl_write_object(next_logical, d->content);
     obl_write_object(treepage, d->content);
 
     /* Write the address assignments into the address map. */
-    obl_address_assign(s, allocator->logical_address,
-            allocator->physical_address);
-    obl_address_assign(s, next_physical->logical_address,
-            next_physical->physical_address);
-    obl_address_assign(s, next_logical->logical_address,
+    failed = obl_address_assign(s, allocator->logical_address,
+            allocator->physical_address) ||
+            obl_address_assign(s, next_physical->logical_address,
+            next_physical->physical_address) ||
+            obl_address_assign(s, next_logical->logical_address,
             next_logical->physical_address);
 
     /* Store temporary objects in the read set. */
-    obl_set_insert(s->read_set, allocator);
-    obl_set_insert(s->read_set, next_physical);
-    obl_set_insert(s->read_set, next_logical);
+    obl_table_insert(s->read_set, allocator);
+    obl_table_insert(s->read_set, next_physical);
+    obl_table_insert(s->read_set, next_logical);
 
     obl_destroy_session(s);
 
+    /* Without the magic word, the next open bootstraps the file again. */
+    if (failed) {
+        return 1;
+    }
+
     /*
      * Write the "magic word" at address 0 to indicate a successful
      * bootstrapping.
      */
     d->content[0] = writable_uint(magic);
-}
-
-static void _read_root(struct obl_database *d)
-{
-    d->root.address_map_addr = readable_physical(d->content[ADDRMAP_ADDR]);
-    d->root.allocator_addr = readable_logical(d->content[ALLOCATOR_ADDR]);
-    d->root.name_map_addr = readable_logical(d->content[NAMEMAP_ADDR]);
-    d->root.shape_map_addr = readable_logical(d->content[SHAPEMAP_ADDR]);
-
-    d->root.dirty = 0;
-}
 
-static void _write_root(struct obl_database *d)
-{
-    d->content[ADDRMAP_ADDR] = writable_physical(d->root.address_map_addr);
-    d->content[ALLOCATOR_ADDR] = writable_logical(d->root.allocator_addr);
-    d->content[NAMEMAP_ADDR] = writable_logical(d->root.shape_map_addr);
-    d->content[SHAPEMAP_ADDR] = writable_logical(d->root.name_map_addr);
+    /* Make the new database durable before anything else is committed. */
+    _obl_note_write(d, (obl_physical_address) 0, d->content_size);
+    if (d->wal != NULL) {
+        obl_checkpoint_database(d);
+    } else if (d->configuration.sync_commits) {
+        _obl_flush_pages(d);
+    }
 
-    d->root.dirty = 0;
+    return 0;
 }
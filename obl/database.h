@@ -12,8 +12,18 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "addressmap.h"
+#include "dirty.h"
+#include "growth.h"
 #include "log.h"
+#include "payload.h"
 #include "platform.h"
+#include "shared.h"
+#include "snapshot.h"
+#include "transaction.h"
+#include "versions.h"
+#include "wal.h"
+#include "writer.h"
 
 /* Defined in cache.h */
 struct obl_cache;
@@ -93,15 +103,160 @@ struct obl_database_config
     int prohibit_creation;
 
     /**
-     * The number of bytes to grow the database file each time it allocates all
-     * available space.  Smaller values will create more compact storage, but
-     * larger values will reduce the number of growth operations that need to
-     * be performed (which are very expensive).
+     * If nonzero, open an existing database file for reading only.  Its
+     * contents are mapped without write access and are never bootstrapped,
+     * grown, logged or flushed, so any number of processes may open the same
+     * file this way at once.  Transactions can't be started.  Because nothing
+     * can change underneath them, object reads take no locks; each session
+     * must then be used by a single thread at a time.  Opening fails if the
+     * file isn't a complete database or still has a write-ahead log to
+     * replay.  Implies prohibit_creation, and the reserve_size,
+     * write_ahead_log and sync_commits settings are ignored.
      *
-     * Default: 1024.
+     * Default: 0, which opens the database for reading and writing.
+     */
+    int read_only;
+
+    /**
+     * If nonzero, coordinate with other processes that open the same file
+     * with this setting, through a "-shm" sidecar file (see shared.h).  Any
+     * number of processes may read at once, commits are serialized across
+     * processes, and each process notices other processes' commits by their
+     * sequence number.  A process should open a given database this way only
+     * once.  Has no effect on in-memory databases.  The write_ahead_log
+     * setting is ignored.
+     *
+     * Default: 0, which assumes that no other process is using the file.
+     */
+    int multi_process;
+
+    /**
+     * The minimum number of bytes to grow the database file each time it
+     * allocates all available space, and the initial size of a new database.
+     * Smaller values will create more compact storage, but larger values will
+     * reduce the number of growth operations that need to be performed (which
+     * are very expensive).
+     *
+     * Default: 4096.
      */
     int growth_size;
 
+    /**
+     * Each growth operation extends the database by this percentage of its
+     * current size (but by no less than growth_size bytes and no more than
+     * growth_max bytes).  Geometric growth keeps the number of growth
+     * operations logarithmic in the final size of the database.
+     *
+     * Default: 100, which doubles the database each time it fills.
+     */
+    int growth_factor;
+
+    /**
+     * The largest number of bytes to add to the database in a single growth
+     * operation.
+     *
+     * Default: 64 MB.
+     */
+    int growth_max;
+
+    /**
+     * If nonzero, reserve this many bytes of virtual address space when the
+     * database is opened and map its contents into the start of that range.
+     * Growth then extends the mapping in place, so d->content never moves
+     * and pointers into it remain valid for as long as the database is open.
+     * The reservation consumes address space but no memory or swap.  Growth
+     * beyond the reservation fails.
+     *
+     * Default: 0, which maps only the current contents and may move them
+     * when the database grows.
+     */
+    uint64_t reserve_size;
+
+    /**
+     * The number of logical addresses that each session leases from the
+     * allocator at a time (see allocator.h).  Larger leases update the
+     * allocator less often, but leave larger gaps in the address space when
+     * sessions close out of order.
+     *
+     * Default: 4096.
+     */
+    int lease_addresses;
+
+    /**
+     * The number of bytes of physical space that each session leases from the
+     * allocator at a time.
+     *
+     * Default: 1 MB.
+     */
+    int lease_size;
+
+    /**
+     * If nonzero, each session tries to keep no more than this many bytes of
+     * objects resident, evicting the least recently used clean objects as it
+     * faults in others (see cache.h).  Objects that client code holds across
+     * calls to obl_at_address() must then be pinned with obl_pin_object().
+     *
+     * Default: 0, which keeps every object that a session reads until the
+     * session is destroyed.
+     */
+    uint64_t cache_size;
+
+    /**
+     * The number of bytes of decoded object contents, such as the text of
+     * strings, that the database keeps for its sessions to share (see
+     * payload.h).  Negative values disable sharing.
+     *
+     * Default: 8 MB.
+     */
+    int shared_cache_size;
+
+    /**
+     * If nonzero, make commits durable with a write-ahead log (see wal.h).
+     * Has no effect on in-memory databases.
+     *
+     * Default: 0, which writes commits directly into the database file with
+     * no durability guarantee.
+     */
+    int write_ahead_log;
+
+    /**
+     * When one session synchronizes the write-ahead log while other commits
+     * are in progress, it waits this many microseconds for them to append
+     * their records so that a single fsync() makes them all durable.  Larger
+     * values trade commit latency for commit throughput.  Negative values
+     * disable the wait.
+     *
+     * Default: 100.
+     */
+    int group_commit_delay;
+
+    /**
+     * The write-ahead log is checkpointed into the database file once it
+     * grows past this many bytes.
+     *
+     * Default: 4 MB.
+     */
+    int checkpoint_size;
+
+    /**
+     * The number of commits made with obl_commit_transaction_async() that may
+     * wait for the database's writer thread at once.  Further asynchronous
+     * commits block until one of them has been applied.
+     *
+     * Default: 64.
+     */
+    int commit_queue_length;
+
+    /**
+     * If nonzero, each commit to a file-backed database without a
+     * write-ahead log flushes the pages that it modified to disk with
+     * msync() before returning.  Only touched pages are flushed, so the cost
+     * of a commit is proportional to its size, not to the database's.
+     *
+     * Default: 0, which leaves writing modified pages to the operating system.
+     */
+    int sync_commits;
+
     /**
      * If specified, ObjectLite will log messages to the specified file.
      *
@@ -191,6 +346,12 @@ struct obl_database
     /** Root storage.  Initialized during open. */
     struct obl_root root;
 
+    /** Recently used address map leaf pages.  See addressmap.h. */
+    struct obl_address_cache address_cache;
+
+    /** Decoded contents shared among sessions.  See payload.h. */
+    struct obl_payload_cache payload_cache;
+
     /** The memory-mapped contents of the database file. */
     obl_uint *content;
 
@@ -200,14 +361,86 @@ struct obl_database
      */
     obl_uint content_size;
 
-    /** A semaphore to make database content operations atomic. */
-    sem_t content_mutex;
+    /**
+     * The open descriptor of the database file, or -1 for an in-memory
+     * database.  It remains open for the lifetime of the database so that
+     * growth doesn't need to reopen the file.
+     */
+    int fd;
+
+    /**
+     * The length of the address space range reserved at content, in bytes,
+     * or 0 if content may move when the database grows.
+     */
+    size_t reserved_size;
+
+    /** Counts and timings of the growth operations performed so far. */
+    struct obl_growth_statistics growth_statistics;
+
+    /**
+     * The write-ahead log, or NULL if the database doesn't use one.  See
+     * wal.h.
+     */
+    struct obl_wal *wal;
+
+    /**
+     * State shared with other processes, or NULL if multi_process is unset.
+     * See shared.h.
+     */
+    struct obl_shared *shared;
+
+    /**
+     * Pages modified since the last commit was flushed.  Only maintained
+     * when sync_commits is set and there is no write-ahead log.
+     */
+    struct obl_page_set dirty_pages;
+
+    /** Counts of the commits performed so far, and the pages they flushed. */
+    struct obl_commit_statistics commit_statistics;
+
+    /**
+     * Publishes the commits made with obl_commit_transaction_async().  See
+     * writer.h.
+     */
+    struct obl_writer writer;
+
+    /**
+     * The number of the last commit published, and the last commit to write
+     * each object, for optimistic concurrency control.  Both are guarded by
+     * the content lock.  See versions.h.
+     */
+    uint64_t commit_version;
+    struct obl_versions versions;
+
+    /**
+     * The snapshots pinned by sessions, and the space kept for them.  See
+     * snapshot.h.
+     */
+    struct obl_snapshots snapshots;
+
+    /**
+     * Held for reading while objects are read from the database contents,
+     * and for writing while a commit, checkpoint or allocator lease changes
+     * them.
+     */
+    pthread_rwlock_t content_lock;
+
+    /**
+     * Advanced by _obl_content_write_begin() and again by
+     * _obl_content_write_end(), so that it is odd exactly while the contents
+     * are being changed.  Optimistic readers that take no lock use it to
+     * detect that they raced with a writer.
+     */
+    volatile unsigned long content_sequence;
 
     /** A singly-linked list of currently active sessions. */
     struct obl_session_list *session_list;
 
-    /** A semaphore to protect access to the session list. */
-    sem_t session_list_mutex;
+    /**
+     * Held for reading to traverse the session list, and for writing to
+     * change it.
+     */
+    pthread_rwlock_t session_list_lock;
 };
 
 /**
@@ -314,7 +547,9 @@ struct obl_object *_obl_at_fixed_address(obl_logical_address address);
  * internal use only.
  *
  * @param o The object that is (possibly) missing an address.
- * @return 1 if a new logical address was assigned, 0 otherwise.
+ * @return 1 if a new logical address was assigned, 0 otherwise, or -1 if an
+ *      address couldn't be allocated or mapped.  The object is then left
+ *      without a physical address.
  */
 int _obl_assign_addresses(struct obl_object *o);
 
@@ -331,6 +566,81 @@ int _obl_assign_addresses(struct obl_object *o);
  */
 void _obl_write(struct obl_object *o);
 
+/**
+ * Record that +count+ words starting at physical address +base+ have been
+ * modified, so that they are logged or flushed when the current commit
+ * completes.  Every write into d->content must be followed by a call to this
+ * function.  For internal use only: the caller must hold the content lock.
+ *
+ * @param d
+ * @param base The first modified word.
+ * @param count The number of modified words.
+ */
+void _obl_note_write(struct obl_database *d, obl_physical_address base,
+        obl_uint count);
+
+/**
+ * Write the contents of d->root into the database and clear its dirty flag.
+ * For internal use only: the caller must hold the content lock.
+ *
+ * @param d
+ */
+void _obl_write_root(struct obl_database *d);
+
+/**
+ * Reload d->root from the database contents.  For internal use only.
+ *
+ * @param d
+ */
+void _obl_read_root(struct obl_database *d);
+
+/**
+ * Acquire the content lock for writing and announce to optimistic readers
+ * that the contents are changing.  For internal use only.
+ *
+ * @param d
+ */
+void _obl_content_write_begin(struct obl_database *d);
+
+/**
+ * Release the access acquired by _obl_content_write_begin().  For internal use
+ * only.
+ *
+ * @param d
+ */
+void _obl_content_write_end(struct obl_database *d);
+
+/**
+ * Return nonzero if the contents may be read without the content lock,
+ * validating each read with _obl_content_read_retry().  That's only safe while
+ * d->content can't move and no other process can change it: in a database
+ * that reserved its address space or is read-only, and isn't multi_process.
+ * For internal use only.
+ *
+ * @param d
+ */
+int _obl_content_optimistic(const struct obl_database *d);
+
+/**
+ * Begin an optimistic read of the database contents, waiting out any writer
+ * that is already active.  For internal use only.
+ *
+ * @param d
+ * @return The sequence to pass to _obl_content_read_retry().
+ */
+unsigned long _obl_content_read_begin(const struct obl_database *d);
+
+/**
+ * Finish an optimistic read.  For internal use only.
+ *
+ * @param d
+ * @param sequence As returned by _obl_content_read_begin().
+ * @return Nonzero if a writer changed the contents during the read, which
+ *      must then be discarded and repeated.
+ */
+int _obl_content_read_retry(const struct obl_database *d,
+        unsigned long sequence);
+
 /**
  * Atomically removes an object from any internal data structures.
  *
@@ -0,0 +1,225 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file dirty.c
+ */
+
+#include "dirty.h"
+
+#include "database.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Internal function prototypes. */
+
+/** Grow a set's bitmap so that it can hold page +page+. */
+static int _ensure_page(struct obl_page_set *set, size_t page);
+
+/** Number of pages represented by each word of the bitmap. */
+#define PAGES_PER_WORD 64
+
+/* External function definitions. */
+
+void obl_page_set_init(struct obl_page_set *set)
+{
+    long page_bytes;
+
+#ifdef WIN32
+    page_bytes = 4096;
+#else
+    page_bytes = sysconf(_SC_PAGESIZE);
+#endif
+    if (page_bytes < (long) sizeof(obl_uint)) {
+        page_bytes = 4096;
+    }
+
+    set->bits = NULL;
+    set->capacity = 0;
+    set->page_words = (obl_uint) (page_bytes / sizeof(obl_uint));
+    set->count = 0;
+    set->first = set->last = 0;
+}
+
+int obl_page_set_add(struct obl_page_set *set, obl_physical_address base,
+        obl_uint count)
+{
+    size_t first, last, page;
+    int was_empty = set->count == 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    first = (size_t) base / set->page_words;
+    last = ((size_t) base + count - 1) / set->page_words;
+
+    if (_ensure_page(set, last)) {
+        return 1;
+    }
+
+    for (page = first; page <= last; page++) {
+        uint64_t mask = (uint64_t) 1 << (page % PAGES_PER_WORD);
+        uint64_t *word = &set->bits[page / PAGES_PER_WORD];
+
+        if (! (*word & mask)) {
+            *word |= mask;
+            set->count++;
+        }
+    }
+
+    if (was_empty || first < set->first) {
+        set->first = first;
+    }
+    if (was_empty || last > set->last) {
+        set->last = last;
+    }
+
+    return 0;
+}
+
+int obl_page_set_next_run(const struct obl_page_set *set, size_t *cursor,
+        size_t *first, size_t *length)
+{
+    size_t page, start;
+
+    if (set->count == 0) {
+        return 0;
+    }
+
+    page = *cursor < set->first ? set->first : *cursor;
+
+    /* Skip to the next set bit, a whole word at a time where possible. */
+    while (page <= set->last) {
+        uint64_t word = set->bits[page / PAGES_PER_WORD] >>
+                (page % PAGES_PER_WORD);
+
+        if (word == 0) {
+            page = (page / PAGES_PER_WORD + 1) * PAGES_PER_WORD;
+        } else if (word & 1) {
+            break;
+        } else {
+            page++;
+        }
+    }
+    if (page > set->last) {
+        *cursor = page;
+        return 0;
+    }
+
+    start = page;
+    while (page <= set->last &&
+            (set->bits[page / PAGES_PER_WORD] &
+                    ((uint64_t) 1 << (page % PAGES_PER_WORD)))) {
+        page++;
+    }
+
+    *first = start;
+    *length = page - start;
+    *cursor = page;
+
+    return 1;
+}
+
+void obl_page_set_clear(struct obl_page_set *set)
+{
+    if (set->count > 0) {
+        memset(set->bits + set->first / PAGES_PER_WORD, 0,
+                (set->last / PAGES_PER_WORD - set->first / PAGES_PER_WORD + 1)
+                * sizeof(uint64_t));
+    }
+
+    set->count = 0;
+    set->first = set->last = 0;
+}
+
+void obl_page_set_destroy(struct obl_page_set *set)
+{
+    free(set->bits);
+    set->bits = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+int _obl_flush_pages(struct obl_database *d)
+{
+    struct obl_page_set *set = &d->dirty_pages;
+    struct obl_commit_statistics *stats = &d->commit_statistics;
+    size_t cursor = 0, first, length, limit;
+    uint64_t started;
+
+    if (set->count == 0) {
+        return 0;
+    }
+
+    started = obl_monotonic_usec();
+    limit = ((size_t) d->content_size + set->page_words - 1) / set->page_words;
+
+    while (obl_page_set_next_run(set, &cursor, &first, &length)) {
+        size_t bytes;
+
+        if (first >= limit) {
+            break;
+        }
+        if (first + length > limit) {
+            length = limit - first;
+        }
+
+        /* The final page of the mapping may be partial. */
+        bytes = length * set->page_words * sizeof(obl_uint);
+        if ((first + length) * set->page_words > d->content_size) {
+            bytes = ((size_t) d->content_size - first * set->page_words) *
+                    sizeof(obl_uint);
+        }
+
+        if (msync(d->content + first * set->page_words, bytes, MS_SYNC) != 0) {
+            obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                    "Unable to flush file <%s>: %s",
+                    d->configuration.filename, strerror(errno));
+            return 1;
+        }
+
+        stats->pages_flushed += length;
+        stats->flush_runs++;
+    }
+
+    stats->flush_usec += obl_monotonic_usec() - started;
+    obl_page_set_clear(set);
+
+    return 0;
+}
+
+/* Internal function definitions. */
+
+static int _ensure_page(struct obl_page_set *set, size_t page)
+{
+    size_t needed, grown;
+    uint64_t *larger;
+
+    needed = page / PAGES_PER_WORD + 1;
+    if (needed <= set->capacity) {
+        return 0;
+    }
+
+    grown = set->capacity == 0 ? 16 : set->capacity;
+    while (grown < needed) {
+        grown *= 2;
+    }
+
+    larger = realloc(set->bits, grown * sizeof(uint64_t));
+    if (larger == NULL) {
+        return 1;
+    }
+    memset(larger + set->capacity, 0,
+            (grown - set->capacity) * sizeof(uint64_t));
+
+    set->bits = larger;
+    set->capacity = grown;
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file dirty.h
+ *
+ * Tracks which pages of the database contents have been modified, one bit
+ * per page, so that flushing a commit (or a checkpoint) costs time in
+ * proportion to the number of pages it touched rather than to the size of
+ * the database.  Pages are the size of the platform's virtual memory pages so
+ * that runs of them can be handed directly to msync() and madvise().
+ */
+
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include "platform.h"
+
+#include <stddef.h>
+
+/* Defined in database.h */
+struct obl_database;
+
+/**
+ * A growable bitmap of database pages.
+ */
+struct obl_page_set
+{
+    /** One bit per page, 64 pages to a word. */
+    uint64_t *bits;
+
+    /** The number of words allocated within bits. */
+    size_t capacity;
+
+    /** The number of database words per page. */
+    obl_uint page_words;
+
+    /** The number of pages currently within the set. */
+    size_t count;
+
+    /** The lowest and highest pages within the set, if count is nonzero. */
+    size_t first;
+    size_t last;
+};
+
+/**
+ * Prepare an empty page set.
+ *
+ * @param set Uninitialized storage for the set.
+ */
+void obl_page_set_init(struct obl_page_set *set);
+
+/**
+ * Add every page that overlaps a range of database words to a set.
+ *
+ * @param set An initialized page set.
+ * @param base The first word of the range.
+ * @param count The number of words within the range.
+ * @return 0 on success, or 1 if the bitmap couldn't be extended.
+ */
+int obl_page_set_add(struct obl_page_set *set, obl_physical_address base,
+        obl_uint count);
+
+/**
+ * Find the next run of consecutive pages within a set.  Iterate over the
+ * runs of a set by zeroing +cursor+ and calling this until it returns 0.
+ *
+ * @param set An initialized page set.
+ * @param cursor [in, out] The page at which to resume the search.
+ * @param first [out] The first page of the run.
+ * @param length [out] The number of pages within the run.
+ * @return 1 if a run was found, or 0 if there are no more.
+ */
+int obl_page_set_next_run(const struct obl_page_set *set, size_t *cursor,
+        size_t *first, size_t *length);
+
+/**
+ * Remove every page from a set, retaining its storage.
+ */
+void obl_page_set_clear(struct obl_page_set *set);
+
+/**
+ * Release the storage held by a page set.
+ */
+void obl_page_set_destroy(struct obl_page_set *set);
+
+/**
+ * Write the pages that have been modified since the last flush back to the
+ * database file with msync(), one call per run of consecutive pages, and
+ * record the work in d->commit_statistics.  The caller must hold the content
+ * lock.  For internal use only.
+ *
+ * @param d A file-backed database opened with sync_commits.
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_flush_pages(struct obl_database *d);
+
+#endif /* DIRTY_H */
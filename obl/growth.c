@@ -0,0 +1,400 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file growth.c
+ *
+ * Geometric database growth.  File-backed databases are extended with a
+ * single posix_fallocate() (or ftruncate()) call on the already-open file
+ * descriptor and remapped in place where the platform allows it; in-memory
+ * databases are simply reallocated.
+ *
+ * If the database was configured with a reserve_size, an inaccessible range of
+ * virtual address space is reserved up front and the contents are mapped into
+ * its head with MAP_FIXED.  Growth then only maps the new tail, so the base of
+ * d->content never moves.
+ */
+
+/* Required for mremap() on Linux. */
+#define _GNU_SOURCE
+
+#include "growth.h"
+
+#include "database.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Internal function prototypes. */
+
+/** Reallocate the heap storage of an in-memory database. */
+static int _grow_memory(struct obl_database *d, obl_uint size);
+
+/** Extend and remap the file behind a file-backed database. */
+static int _grow_file(struct obl_database *d, obl_uint size);
+
+/** Make a longer prefix of a reserved address range accessible. */
+static int _grow_reserved(struct obl_database *d, obl_uint size);
+
+/** Reserve virtual address space for the database contents. */
+static int _reserve_address_space(struct obl_database *d);
+
+/** Reserve file space between two byte offsets with a single system call. */
+static int _reserve_file(int fd, off_t from, off_t to);
+
+/** Read-only databases are mapped without write access. */
+static inline int _protection(struct obl_database *d);
+
+/**
+ * Databases with a write-ahead log are mapped privately, so that changes only
+ * reach the file once they've been logged.
+ */
+static inline int _sharing(struct obl_database *d);
+
+/**
+ * Database sizes are rounded up to a multiple of this many words (4 KB) so
+ * that the end of the file always falls on a page boundary.
+ */
+#define GROWTH_ALIGNMENT 1024
+
+/* External function definitions. */
+
+int _obl_map_content(struct obl_database *d, obl_uint size)
+{
+    if (d->configuration.reserve_size != 0 && d->content == NULL &&
+            ! d->configuration.read_only) {
+        if (_reserve_address_space(d)) {
+            return 1;
+        }
+    }
+
+    if (size <= d->content_size) {
+        return 0;
+    }
+
+    if (d->reserved_size != 0) {
+        return _grow_reserved(d, size);
+    } else if (d->configuration.filename == NULL) {
+        return _grow_memory(d, size);
+    } else {
+        return _grow_file(d, size);
+    }
+}
+
+void _obl_unmap_content(struct obl_database *d)
+{
+    if (d->reserved_size != 0) {
+        munmap(d->content, d->reserved_size);
+        d->reserved_size = 0;
+    } else if (d->configuration.filename == NULL) {
+        free(d->content);
+    } else if (d->content != NULL) {
+        munmap(d->content, (size_t) d->content_size * sizeof(obl_uint));
+    }
+
+    d->content = NULL;
+    d->content_size = (obl_uint) 0;
+}
+
+obl_uint obl_growth_target(const struct obl_database_config *config,
+        obl_uint current, obl_uint required)
+{
+    uint64_t minimum, maximum, step, target;
+
+    minimum = (uint64_t) config->growth_size / sizeof(obl_uint);
+    if (minimum == 0) {
+        minimum = 1;
+    }
+    maximum = (uint64_t) config->growth_max / sizeof(obl_uint);
+
+    step = (uint64_t) current * (uint64_t) config->growth_factor / 100;
+    if (step < minimum) {
+        step = minimum;
+    }
+    if (maximum != 0 && step > maximum) {
+        step = maximum > minimum ? maximum : minimum;
+    }
+
+    target = (uint64_t) current + step;
+    if (target < (uint64_t) required) {
+        target = (uint64_t) required + minimum;
+    }
+
+    target = (target + GROWTH_ALIGNMENT - 1) & ~((uint64_t) GROWTH_ALIGNMENT - 1);
+    if (target > (uint64_t) OBL_ADDRESS_MAX) {
+        target = (uint64_t) OBL_ADDRESS_MAX;
+    }
+
+    return (obl_uint) target;
+}
+
+int _obl_ensure_capacity(struct obl_database *d, obl_uint required)
+{
+    struct obl_growth_statistics *stats = &d->growth_statistics;
+    obl_uint previous, size;
+    uint64_t started, elapsed;
+    int result;
+
+    if (required <= d->content_size) {
+        return 0;
+    }
+
+    if (d->configuration.read_only) {
+        obl_report_error(d, OBL_READ_ONLY, NULL);
+        return 1;
+    }
+
+    previous = d->content_size;
+    size = obl_growth_target(&d->configuration, previous, required);
+    if (size < required) {
+        obl_report_errorf(d, OBL_OUT_OF_MEMORY,
+                "Unable to grow the database to <%lu> words: the address "
+                "space is exhausted.", (unsigned long) required);
+        return 1;
+    }
+
+    if (d->reserved_size != 0 &&
+            (uint64_t) size * sizeof(obl_uint) > (uint64_t) d->reserved_size) {
+        /*
+         * Moving the mapping would break the promise that d->content is
+         * stable, so growth stops at the end of the reservation.
+         */
+        size = (obl_uint) (d->reserved_size / sizeof(obl_uint));
+        if (size < required) {
+            obl_report_errorf(d, OBL_OUT_OF_MEMORY,
+                    "Unable to grow the database to <%lu> words: only <%lu> "
+                    "bytes of address space were reserved.",
+                    (unsigned long) required,
+                    (unsigned long) d->reserved_size);
+            return 1;
+        }
+    }
+
+    started = obl_monotonic_usec();
+    if (d->configuration.filename != NULL) {
+        result = _reserve_file(d->fd,
+                (off_t) previous * sizeof(obl_uint),
+                (off_t) size * sizeof(obl_uint));
+        if (result) {
+            obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                    "Unable to extend file <%s> to <%lu> words: %s",
+                    d->configuration.filename, (unsigned long) size,
+                    strerror(result));
+            return 1;
+        }
+    }
+    if (_obl_map_content(d, size)) {
+        return 1;
+    }
+    elapsed = obl_monotonic_usec() - started;
+
+    stats->growth_count++;
+    stats->bytes_added += (uint64_t) (size - previous) * sizeof(obl_uint);
+    stats->total_usec += elapsed;
+    if (elapsed > stats->max_usec) {
+        stats->max_usec = elapsed;
+    }
+
+    OBL_DEBUGF(d, "Grew the database from <%lu> to <%lu> words in %lu usec.",
+            (unsigned long) previous, (unsigned long) size,
+            (unsigned long) elapsed);
+
+    return 0;
+}
+
+/* Internal function definitions. */
+
+static int _grow_memory(struct obl_database *d, obl_uint size)
+{
+    obl_uint *grown;
+
+    grown = realloc(d->content, (size_t) size * sizeof(obl_uint));
+    if (grown == NULL) {
+        obl_report_errorf(d, OBL_OUT_OF_MEMORY,
+                "Unable to grow an in-memory database to <%lu> words.",
+                (unsigned long) size);
+        return 1;
+    }
+
+    memset(grown + d->content_size, 0,
+            (size_t) (size - d->content_size) * sizeof(obl_uint));
+
+    d->content = grown;
+    d->content_size = size;
+
+    return 0;
+}
+
+static int _grow_file(struct obl_database *d, obl_uint size)
+{
+    size_t old_bytes, new_bytes;
+    void *mapped;
+
+    old_bytes = (size_t) d->content_size * sizeof(obl_uint);
+    new_bytes = (size_t) size * sizeof(obl_uint);
+
+    if (d->content == NULL) {
+        mapped = mmap(NULL, new_bytes, _protection(d), _sharing(d), d->fd, 0);
+    } else {
+#ifdef MREMAP_MAYMOVE
+        mapped = mremap(d->content, old_bytes, new_bytes, MREMAP_MAYMOVE);
+#else
+        mapped = mmap(NULL, new_bytes, PROT_READ | PROT_WRITE,
+                _sharing(d), d->fd, 0);
+        if (mapped != MAP_FAILED) {
+            if (_sharing(d) == MAP_PRIVATE) {
+                /* Unlogged changes only exist within the old mapping. */
+                memcpy(mapped, d->content, old_bytes);
+            }
+            munmap(d->content, old_bytes);
+        }
+#endif
+    }
+
+    if (mapped == MAP_FAILED) {
+        obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
+                "Unable to map <%lu> bytes of file <%s>: %s",
+                (unsigned long) new_bytes, d->configuration.filename,
+                strerror(errno));
+        return 1;
+    }
+
+    d->content = (obl_uint *) mapped;
+    d->content_size = size;
+
+    return 0;
+}
+
+static int _grow_reserved(struct obl_database *d, obl_uint size)
+{
+    size_t page, old_bytes, new_bytes, offset;
+    void *mapped;
+
+    new_bytes = (size_t) size * sizeof(obl_uint);
+    if (new_bytes > d->reserved_size) {
+        obl_report_errorf(d, OBL_OUT_OF_MEMORY,
+                "Unable to map <%lu> words into <%lu> bytes of reserved "
+                "address space.",
+                (unsigned long) size, (unsigned long) d->reserved_size);
+        return 1;
+    }
+
+    page = (size_t) sysconf(_SC_PAGESIZE);
+    old_bytes = (size_t) d->content_size * sizeof(obl_uint);
+    offset = old_bytes & ~(page - 1);
+
+    if (d->configuration.filename == NULL) {
+        /* Anonymous reserved pages are already zero-filled. */
+        if (mprotect((char *) d->content + offset, new_bytes - offset,
+                PROT_READ | PROT_WRITE) != 0) {
+            obl_report_errorf(d, OBL_OUT_OF_MEMORY,
+                    "Unable to grow an in-memory database to <%lu> words: %s",
+                    (unsigned long) size, strerror(errno));
+            return 1;
+        }
+    } else {
+        /*
+         * Map only the tail of the file, starting from the page that holds the
+         * old end of the mapping.  MAP_FIXED atomically replaces the reserved
+         * pages, and the pages before the tail are left untouched, so readers
+         * of existing content are never disturbed.
+         */
+        char boundary[old_bytes - offset + 1];
+
+        /* A private boundary page may hold changes that aren't in the file. */
+        memcpy(boundary, (char *) d->content + offset, old_bytes - offset);
+
+        mapped = mmap((char *) d->content + offset, new_bytes - offset,
+                PROT_READ | PROT_WRITE, _sharing(d) | MAP_FIXED,
+                d->fd, (off_t) offset);
+        if (mapped == MAP_FAILED) {
+            obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
+                    "Unable to map <%lu> bytes of file <%s>: %s",
+                    (unsigned long) new_bytes, d->configuration.filename,
+                    strerror(errno));
+            return 1;
+        }
+
+        if (_sharing(d) == MAP_PRIVATE) {
+            memcpy(mapped, boundary, old_bytes - offset);
+        }
+    }
+
+    d->content_size = size;
+
+    return 0;
+}
+
+static int _reserve_address_space(struct obl_database *d)
+{
+#ifdef MAP_NORESERVE
+    uint64_t requested, maximum;
+    size_t page, length;
+    void *base;
+
+    page = (size_t) sysconf(_SC_PAGESIZE);
+    maximum = (uint64_t) OBL_ADDRESS_MAX * sizeof(obl_uint);
+    requested = d->configuration.reserve_size;
+    if (requested > maximum) {
+        requested = maximum;
+    }
+    if (requested > (uint64_t) SIZE_MAX - page) {
+        requested = (uint64_t) SIZE_MAX - page;
+    }
+    length = ((size_t) requested + page - 1) & ~(page - 1);
+
+    base = mmap(NULL, length, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        /* Not fatal: fall back to a mapping whose base may move. */
+        OBL_WARN(d, "Unable to reserve address space for the database.");
+        return 0;
+    }
+
+    d->content = (obl_uint *) base;
+    d->reserved_size = length;
+#else
+    OBL_NOTICE(d, "Address space reservation is not supported here.");
+#endif
+
+    return 0;
+}
+
+static inline int _protection(struct obl_database *d)
+{
+    return d->configuration.read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+}
+
+static inline int _sharing(struct obl_database *d)
+{
+    return d->wal != NULL ? MAP_PRIVATE : MAP_SHARED;
+}
+
+static int _reserve_file(int fd, off_t from, off_t to)
+{
+#ifndef WIN32
+    int error;
+
+    /*
+     * posix_fallocate() both extends the file and reserves its blocks, so
+     * later stores into the mapping can't fail with SIGBUS on a full disk.
+     * Fall back to ftruncate() on filesystems that don't support it.
+     */
+    error = posix_fallocate(fd, from, to - from);
+    if (error != EINVAL && error != EOPNOTSUPP) {
+        return error;
+    }
+#endif
+
+    if (ftruncate(fd, to) != 0) {
+        return errno;
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file growth.h
+ *
+ * Extends the storage behind an obl_database when the allocator runs off of
+ * the end of it.  Growth is geometric: each growth operation extends the
+ * database by a fraction of its current size, within the bounds set by the
+ * growth_size and growth_max configuration settings, so that filling a
+ * database requires a logarithmic number of (very expensive) remaps.
+ */
+
+#ifndef GROWTH_H
+#define GROWTH_H
+
+#include "platform.h"
+
+/* Defined in database.h */
+struct obl_database;
+
+/* Defined in database.h */
+struct obl_database_config;
+
+/**
+ * Running totals that describe the growth operations performed on a single
+ * obl_database since it was opened.  Use these to size database files ahead
+ * of time.
+ */
+struct obl_growth_statistics
+{
+    /** The number of times that the database has been extended. */
+    unsigned long growth_count;
+
+    /** The total number of bytes added by all growth operations. */
+    uint64_t bytes_added;
+
+    /** Wall-clock time spent within growth operations, in microseconds. */
+    uint64_t total_usec;
+
+    /** The duration of the single slowest growth operation, in microseconds. */
+    uint64_t max_usec;
+};
+
+/**
+ * Compute the size that a database should be extended to in order to hold at
+ * least +required+ words, according to the growth policy in a database
+ * configuration.
+ *
+ * @param config A database configuration with its defaults already applied.
+ * @param current The current database size, in sizeof(obl_uint) units.
+ * @param required The minimum acceptable size, in sizeof(obl_uint) units.
+ * @return The new database size, in sizeof(obl_uint) units.  This will be at
+ *      least +required+ unless +required+ exceeds the addressable range.
+ */
+obl_uint obl_growth_target(const struct obl_database_config *config,
+        obl_uint current, obl_uint required);
+
+/**
+ * Map the first +size+ words of a database's storage into d->content, or
+ * extend an existing mapping to +size+ words.  File-backed storage must
+ * already be at least +size+ words long.  If the database configuration
+ * requests a reserve_size, the first call reserves that much address space
+ * and every later call extends the mapping without moving its base.
+ *
+ * For internal use only.
+ *
+ * @param d The database whose contents should be mapped.
+ * @param size The new extent of d->content, in sizeof(obl_uint) units.
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_map_content(struct obl_database *d, obl_uint size);
+
+/**
+ * Release the mapping (or heap storage) and any address space reservation
+ * behind d->content.  For internal use only.
+ *
+ * @param d The database whose contents should be unmapped.
+ */
+void _obl_unmap_content(struct obl_database *d);
+
+/**
+ * Ensure that the database contents are at least +required+ words long,
+ * growing the database if they are not.  Unless the database has reserved
+ * address space (d->reserved_size is nonzero), growth may remap the database
+ * contents, so any pointers into d->content are invalid after this call.
+ *
+ * The caller must hold the database's content lock (or otherwise guarantee
+ * that no other thread is accessing d->content).  For internal use only.
+ *
+ * @param d The database to grow.
+ * @param required The minimum database size, in sizeof(obl_uint) units.
+ * @return 0 on success.  Reports an error and returns 1 if the database
+ *      could not be grown.
+ */
+int _obl_ensure_capacity(struct obl_database *d, obl_uint required);
+
+#endif /* GROWTH_H */
@@ -43,7 +43,7 @@ void obl_log(struct obl_database_config *config, enum obl_log_level level,
     } else {
         if (config->log_level > level)
             return ;
-        filename = config->filename;
+        filename = config->log_filename;
     }
 
     if (filename != NULL) {
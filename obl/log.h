@@ -35,6 +35,10 @@ enum obl_error_code
     OBL_INVALID_INDEX,          //!< OBL_INVALID_INDEX
     OBL_INVALID_ADDRESS,        //!< OBL_INVALID_ADDRESS
     OBL_ALREADY_IN_TRANSACTION, //!< OBL_ALREADY_IN_TRANSACTION
+    OBL_UNABLE_TO_WRITE_FILE,   //!< OBL_UNABLE_TO_WRITE_FILE
+    OBL_READ_ONLY,              //!< OBL_READ_ONLY
+    OBL_CONFLICT,               //!< OBL_CONFLICT
+    OBL_UNSUPPORTED,            //!< OBL_UNSUPPORTED
 };
 
 /**
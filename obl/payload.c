@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file payload.c
+ */
+
+#include "payload.h"
+
+#include <stdlib.h>
+
+#include "constants.h"
+#include "database.h"
+
+#ifdef WIN32
+#define ATOMIC_ADD(target, amount) \
+    (InterlockedExchangeAdd((target), (amount)) + (amount))
+#else
+#define ATOMIC_ADD(target, amount) __sync_add_and_fetch((target), (amount))
+#endif
+
+/** Select the bucket for a physical address. */
+#define BUCKET(address) ((size_t) (address) % DEFAULT_CACHE_BUCKETS)
+
+/**
+ * One cached payload.
+ */
+struct obl_payload_entry
+{
+    obl_physical_address address;
+
+    struct obl_payload *payload;
+
+    /** The next entry within the same bucket. */
+    struct obl_payload_entry *next;
+
+    /** Neighbours in order of publication. */
+    struct obl_payload_entry *older, *newer;
+};
+
+/* Internal function prototypes. */
+
+/** Unlink +entry+ from +cache+, release its payload and free it. */
+static void _discard(struct obl_payload_cache *cache,
+        struct obl_payload_entry *entry);
+
+/** Return the entry for +address+, or NULL. */
+static struct obl_payload_entry *_find(struct obl_payload_cache *cache,
+        obl_physical_address address);
+
+/* External function definitions. */
+
+struct obl_payload *obl_payload_create(size_t size)
+{
+    struct obl_payload *p;
+
+    p = malloc(offsetof(struct obl_payload, data) +
+            (size > sizeof(p->data) ? size : sizeof(p->data)));
+    if (p == NULL) {
+        return NULL;
+    }
+
+    p->references = 1;
+    p->size = size;
+
+    return p;
+}
+
+void obl_payload_retain(struct obl_payload *p)
+{
+    ATOMIC_ADD(&p->references, 1);
+}
+
+void obl_payload_release(struct obl_payload *p)
+{
+    if (ATOMIC_ADD(&p->references, -1) == 0) {
+        free(p);
+    }
+}
+
+void _obl_payload_cache_init(struct obl_payload_cache *cache)
+{
+    cache->buckets = NULL;
+    cache->oldest = cache->newest = NULL;
+    cache->version = 0;
+    cache->used = 0;
+    cache->hits = cache->misses = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+void _obl_payload_cache_destroy(struct obl_payload_cache *cache)
+{
+    while (cache->oldest != NULL) {
+        _discard(cache, cache->oldest);
+    }
+
+    free(cache->buckets);
+    cache->buckets = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+struct obl_payload *_obl_payload_lookup(struct obl_database *d,
+        obl_physical_address address, uint64_t *version)
+{
+    struct obl_payload_cache *cache = &d->payload_cache;
+    struct obl_payload_entry *entry;
+    struct obl_payload *p = NULL;
+
+    if (d->configuration.shared_cache_size < 0) {
+        *version = 0;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = _find(cache, address);
+    if (entry != NULL) {
+        p = entry->payload;
+        obl_payload_retain(p);
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    *version = cache->version;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return p;
+}
+
+void _obl_payload_publish(struct obl_database *d,
+        obl_physical_address address, uint64_t version, struct obl_payload *p)
+{
+    struct obl_payload_cache *cache = &d->payload_cache;
+    struct obl_payload_entry *entry;
+    uint64_t budget;
+
+    if (d->configuration.shared_cache_size < 0) {
+        return ;
+    }
+    budget = (uint64_t) d->configuration.shared_cache_size;
+    if (p->size > budget) {
+        return ;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->version != version || _find(cache, address) != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        return ;
+    }
+
+    if (cache->buckets == NULL) {
+        cache->buckets = calloc(DEFAULT_CACHE_BUCKETS,
+                sizeof(struct obl_payload_entry *));
+    }
+    entry = malloc(sizeof(struct obl_payload_entry));
+    if (cache->buckets == NULL || entry == NULL) {
+        free(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return ;
+    }
+
+    /* Make room by evicting the oldest payloads. */
+    while (cache->oldest != NULL && cache->used + p->size > budget) {
+        _discard(cache, cache->oldest);
+    }
+
+    obl_payload_retain(p);
+    entry->address = address;
+    entry->payload = p;
+
+    entry->next = cache->buckets[BUCKET(address)];
+    cache->buckets[BUCKET(address)] = entry;
+
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+
+    cache->used += p->size;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void _obl_payload_invalidate(struct obl_database *d,
+        obl_physical_address address)
+{
+    struct obl_payload_cache *cache = &d->payload_cache;
+    struct obl_payload_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache->version++;
+    entry = _find(cache, address);
+    if (entry != NULL) {
+        _discard(cache, entry);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void _obl_payload_clear(struct obl_database *d)
+{
+    struct obl_payload_cache *cache = &d->payload_cache;
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache->version++;
+    while (cache->oldest != NULL) {
+        _discard(cache, cache->oldest);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Internal function definitions. */
+
+static void _discard(struct obl_payload_cache *cache,
+        struct obl_payload_entry *entry)
+{
+    struct obl_payload_entry **link;
+
+    link = &cache->buckets[BUCKET(entry->address)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+
+    cache->used -= entry->payload->size;
+    obl_payload_release(entry->payload);
+    free(entry);
+}
+
+static struct obl_payload_entry *_find(struct obl_payload_cache *cache,
+        obl_physical_address address)
+{
+    struct obl_payload_entry *entry;
+
+    if (cache->buckets == NULL) {
+        return NULL;
+    }
+
+    for (entry = cache->buckets[BUCKET(address)]; entry != NULL;
+            entry = entry->next) {
+        if (entry->address == address) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,164 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file payload.h
+ *
+ * Shares decoded object contents among the sessions of a database.  Every
+ * session decodes its own obl_object for each persisted object that it reads,
+ * but the bulk of an immutable object -- the code points of a string, for
+ * example -- can be decoded once into a reference-counted obl_payload and
+ * shared by each session's copy.
+ *
+ * Each database keeps a cache of payloads keyed by the physical address they
+ * were decoded from.  Committing an object invalidates the entry at its
+ * physical address, and advances a version number that keeps a payload
+ * decoded concurrently with a commit from being published.  Payloads are
+ * never modified once published, so an object must make a private copy of
+ * its payload before changing it.
+ */
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform.h"
+
+/* Defined in database.h */
+struct obl_database;
+
+/* Defined in payload.c */
+struct obl_payload_entry;
+
+/**
+ * A reference-counted block of decoded object contents.
+ */
+struct obl_payload
+{
+    /** The number of references to this payload.  Modified atomically. */
+    volatile long references;
+
+    /** The size of data, in bytes. */
+    size_t size;
+
+    /** The decoded contents themselves. */
+    union
+    {
+        UChar uchars[1];
+        obl_uint words[1];
+        double alignment;
+    } data;
+};
+
+/**
+ * A database's cache of payloads.
+ */
+struct obl_payload_cache
+{
+    /** Hash buckets of entries, keyed by physical address.  Allocated lazily. */
+    struct obl_payload_entry **buckets;
+
+    /** Entries in order of publication, for eviction. */
+    struct obl_payload_entry *oldest, *newest;
+
+    /** Advanced by each invalidation. */
+    uint64_t version;
+
+    /** The total size of the cached payloads, in bytes. */
+    uint64_t used;
+
+    /** Lookups that found a payload. */
+    unsigned long hits;
+
+    /** Lookups that did not. */
+    unsigned long misses;
+
+    /** Guards every field above. */
+    pthread_mutex_t lock;
+};
+
+/**
+ * Allocate a payload of +size+ bytes with a single reference.
+ *
+ * @param size
+ * @return The new payload, or NULL if memory is exhausted.
+ */
+struct obl_payload *obl_payload_create(size_t size);
+
+/**
+ * Acquire an additional reference to a payload.
+ *
+ * @param p
+ */
+void obl_payload_retain(struct obl_payload *p);
+
+/**
+ * Release a reference to a payload, freeing it when the last is released.
+ *
+ * @param p
+ */
+void obl_payload_release(struct obl_payload *p);
+
+/**
+ * Prepare an empty payload cache.  For internal use only.
+ *
+ * @param cache
+ */
+void _obl_payload_cache_init(struct obl_payload_cache *cache);
+
+/**
+ * Release every payload held by a cache and free its storage.  For internal
+ * use only.
+ *
+ * @param cache
+ */
+void _obl_payload_cache_destroy(struct obl_payload_cache *cache);
+
+/**
+ * Look up the payload decoded from a physical address.
+ *
+ * @param d
+ * @param address The physical address of the object.
+ * @param version [out] On a miss, receives the version to pass to
+ *      _obl_payload_publish() once the object has been decoded.
+ * @return A new reference to the cached payload, or NULL on a miss.
+ */
+struct obl_payload *_obl_payload_lookup(struct obl_database *d,
+        obl_physical_address address, uint64_t *version);
+
+/**
+ * Offer a freshly decoded payload to the cache.  It is cached only if nothing
+ * has been invalidated since _obl_payload_lookup() returned +version+.  The
+ * caller keeps its own reference.  For internal use only.
+ *
+ * @param d
+ * @param address The physical address the payload was decoded from.
+ * @param version As returned by _obl_payload_lookup().
+ * @param p
+ */
+void _obl_payload_publish(struct obl_database *d,
+        obl_physical_address address, uint64_t version, struct obl_payload *p);
+
+/**
+ * Discard any payload decoded from a physical address that is about to be
+ * overwritten.  The caller must hold the content lock.  For internal use
+ * only.
+ *
+ * @param d
+ * @param address
+ */
+void _obl_payload_invalidate(struct obl_database *d,
+        obl_physical_address address);
+
+/**
+ * Discard every cached payload, as when another process has committed.  For
+ * internal use only.
+ *
+ * @param d
+ */
+void _obl_payload_clear(struct obl_database *d);
+
+#endif /* PAYLOAD_H */
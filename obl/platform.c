@@ -10,6 +10,11 @@
 
 #include "platform.h"
 
+#ifndef WIN32
+#include <errno.h>
+#include <time.h>
+#endif
+
 #ifdef WIN32
 
 #define WIN32_LEAN_AND_MEAN
@@ -17,6 +22,7 @@
 #include <io.h>
 
 #include <errno.h>
+#include <stdlib.h>
 
 /**
  * Emulate the POSIX mmap() function.
@@ -26,7 +32,7 @@
  * @param prot Bitmask indicating the protections applied to this mapping.  May
  *      be one of PROT_READ, PROT_WRITE, or PROT_READ | PROT_WRITE.
  * @param flags Bitmask indicating the type of mapping to create and its
- *      visibility.  Must be MAP_SHARED.
+ *      visibility.  Must be MAP_SHARED or MAP_PRIVATE.
  * @param fd File descriptor of the underlying file.
  * @param offset The address within the file at which the mapping should begin.
  */
@@ -54,11 +60,16 @@ void *mmap(void *start, size_t length, int prot, int flags,
         break;
     }
 
-    if (start != NULL || !(flags & MAP_SHARED)) {
+    if (start != NULL || !(flags & (MAP_SHARED | MAP_PRIVATE))) {
         /* Invalid use of this very limited mmap(). */
         return MAP_FAILED;
     }
 
+    if (flags & MAP_PRIVATE) {
+        /* Copy-on-write: changes are never written back to the file. */
+        map_access = FILE_MAP_COPY;
+    }
+
     handle = CreateFileMapping( (HANDLE) _get_osfhandle(fd),
             NULL, handle_protect, 0, 0, NULL);
 
@@ -86,6 +97,20 @@ int munmap(void *start, size_t length)
     return UnmapViewOfFile(start);
 }
 
+/**
+ * Emulates the POSIX msync() function.  Writes modified pages within a range
+ * of a mapping back to the underlying file.
+ *
+ * @param start The first byte to flush.
+ * @param length The number of bytes to flush.
+ * @param flags Ignored: the flush is always synchronous.
+ * @return 0 if successful.
+ */
+int msync(void *start, size_t length, int flags)
+{
+    return FlushViewOfFile(start, length) ? 0 : -1;
+}
+
 /**
  * Emulates the POSIX sem_init function.  Initializes a new semaphore object.
  *
@@ -164,4 +189,243 @@ int sem_destroy(sem_t *sem)
     return 0;
 }
 
+/**
+ * A thread's start routine and its argument, handed to _thread_start().
+ */
+struct thread_start
+{
+    void *(*start)(void *);
+
+    void *argument;
+};
+
+/** Adapts a POSIX start routine to the signature CreateThread() expects. */
+static DWORD WINAPI _thread_start(LPVOID parameter)
+{
+    struct thread_start ts = *(struct thread_start *) parameter;
+
+    free(parameter);
+    (*ts.start)(ts.argument);
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_create function.
+ *
+ * @param thread [out] Storage for the created thread.
+ * @param attr Ignored.
+ * @param start The routine to run on the new thread.
+ * @param argument Passed to start.
+ * @return 0 on success, or EAGAIN if the thread could not be created.
+ */
+int pthread_create(pthread_t *thread, const void *attr,
+        void *(*start)(void *), void *argument)
+{
+    struct thread_start *ts = malloc(sizeof(struct thread_start));
+
+    if (ts == NULL) {
+        return EAGAIN;
+    }
+    ts->start = start;
+    ts->argument = argument;
+
+    *thread = CreateThread(NULL, 0, &_thread_start, ts, 0, NULL);
+    if (*thread == NULL) {
+        free(ts);
+        return EAGAIN;
+    }
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_join function.  The start routine's result is
+ * not kept, so +result+ must be NULL.
+ */
+int pthread_join(pthread_t thread, void **result)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_mutex_init function.
+ *
+ * @param mutex [out] Storage for the created mutex.
+ * @param attr Ignored.
+ * @return 0.
+ */
+int pthread_mutex_init(pthread_mutex_t *mutex, const void *attr)
+{
+    InitializeCriticalSection(mutex);
+    return 0;
+}
+
+/** Emulates the POSIX pthread_mutex_lock function. */
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    EnterCriticalSection(mutex);
+    return 0;
+}
+
+/** Emulates the POSIX pthread_mutex_unlock function. */
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+    LeaveCriticalSection(mutex);
+    return 0;
+}
+
+/** Emulates the POSIX pthread_mutex_destroy function. */
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+    DeleteCriticalSection(mutex);
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_rwlock_init function.
+ *
+ * @param rwlock [out] Storage for the created lock.
+ * @param attr Ignored.
+ * @return 0.
+ */
+int pthread_rwlock_init(pthread_rwlock_t *rwlock, const void *attr)
+{
+    InitializeSRWLock(&rwlock->lock);
+    rwlock->exclusive = 0;
+    return 0;
+}
+
+/** Emulates the POSIX pthread_rwlock_rdlock function. */
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+    AcquireSRWLockShared(&rwlock->lock);
+    return 0;
+}
+
+/** Emulates the POSIX pthread_rwlock_wrlock function. */
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+    AcquireSRWLockExclusive(&rwlock->lock);
+    rwlock->exclusive = 1;
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_rwlock_unlock function.  Only the writer can see
+ * exclusive set, because no reader holds the lock at the same time.
+ */
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+    if (rwlock->exclusive) {
+        rwlock->exclusive = 0;
+        ReleaseSRWLockExclusive(&rwlock->lock);
+    } else {
+        ReleaseSRWLockShared(&rwlock->lock);
+    }
+    return 0;
+}
+
+/** Slim reader-writer locks hold no resources on WIN32. */
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_cond_init function.
+ *
+ * @param cond [out] Storage for the created condition variable.
+ * @param attr Ignored.
+ * @return 0.
+ */
+int pthread_cond_init(pthread_cond_t *cond, const void *attr)
+{
+    InitializeConditionVariable(cond);
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pthread_cond_wait function.  Atomically releases +mutex+
+ * and blocks until +cond+ is signalled, then reacquires +mutex+.
+ */
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    return SleepConditionVariableCS(cond, mutex, INFINITE) ? 0 : EINVAL;
+}
+
+/** Emulates the POSIX pthread_cond_broadcast function. */
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+    WakeAllConditionVariable(cond);
+    return 0;
+}
+
+/** Condition variables hold no resources on WIN32. */
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+    return 0;
+}
+
+/**
+ * Emulates the POSIX pread function.  Unlike the POSIX function, this moves
+ * the file position of +fd+.
+ */
+ssize_t pread(int fd, void *buffer, size_t count, off_t offset)
+{
+    if (_lseek(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _read(fd, buffer, (unsigned int) count);
+}
+
+/**
+ * Emulates the POSIX pwrite function.  Unlike the POSIX function, this moves
+ * the file position of +fd+.
+ */
+ssize_t pwrite(int fd, const void *buffer, size_t count, off_t offset)
+{
+    if (_lseek(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _write(fd, buffer, (unsigned int) count);
+}
+
+/** Emulates the POSIX fsync function. */
+int fsync(int fd)
+{
+    return _commit(fd);
+}
+
+#endif
+
+uint64_t obl_monotonic_usec(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER frequency, counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) (counter.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
 #endif
+}
+
+void obl_sleep_usec(uint64_t usec)
+{
+#ifdef WIN32
+    Sleep((DWORD) ((usec + 999) / 1000));
+#else
+    struct timespec interval;
+
+    interval.tv_sec = (time_t) (usec / 1000000);
+    interval.tv_nsec = (long) (usec % 1000000) * 1000;
+    while (nanosleep(&interval, &interval) != 0 && errno == EINTR) {
+        /* Resume sleeping for the remainder. */
+    }
+#endif
+}
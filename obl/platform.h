@@ -126,11 +126,15 @@ void *mmap(void *start, size_t length, int prot, int flags, int fd,
 
 int munmap(void *start, size_t length);
 
+int msync(void *start, size_t length, int flags);
+
 /* +prot+ and +flags+ constants. */
 #ifndef PROT_READ
 #define PROT_READ 1
 #define PROT_WRITE 2
 #define MAP_SHARED 1
+#define MAP_PRIVATE 2
+#define MS_SYNC 4
 #define MAP_FAILED ((void*) -1)
 #endif
 
@@ -164,4 +168,104 @@ int sem_destroy(sem_t *sem);
 
 #endif
 
+/*
+ * Threads, mutexes, reader-writer locks and condition variables: native on
+ * POSIX systems, emulated on WIN32 with threads, critical sections, slim
+ * reader-writer locks and condition variables.  Only the default attributes
+ * are supported.
+ */
+#ifdef WIN32
+
+typedef HANDLE pthread_t;
+
+int pthread_create(pthread_t *thread, const void *attr,
+        void *(*start)(void *), void *argument);
+
+int pthread_join(pthread_t thread, void **result);
+
+typedef CRITICAL_SECTION pthread_mutex_t;
+
+typedef CONDITION_VARIABLE pthread_cond_t;
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const void *attr);
+
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+
+typedef struct
+{
+    SRWLOCK lock;
+
+    /** Nonzero while held for writing, so that unlock knows how to release. */
+    int exclusive;
+} pthread_rwlock_t;
+
+int pthread_rwlock_init(pthread_rwlock_t *rwlock, const void *attr);
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock);
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock);
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock);
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock);
+
+int pthread_cond_init(pthread_cond_t *cond, const void *attr);
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+
+int pthread_cond_broadcast(pthread_cond_t *cond);
+
+int pthread_cond_destroy(pthread_cond_t *cond);
+
+/*
+ * Positioned I/O and file synchronization: native on POSIX systems, emulated
+ * on WIN32.
+ */
+
+ssize_t pread(int fd, void *buffer, size_t count, off_t offset);
+
+ssize_t pwrite(int fd, const void *buffer, size_t count, off_t offset);
+
+int fsync(int fd);
+
+#else
+
+#include <pthread.h>
+
+#endif
+
+/**
+ * Order every memory access before the barrier ahead of every access after
+ * it, for the compiler and the processor alike.
+ */
+#ifdef WIN32
+#define OBL_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define OBL_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+/**
+ * Hint that the memory at +address+ will be read soon.
+ */
+#ifdef __GNUC__
+#define OBL_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define OBL_PREFETCH(address) ((void) 0)
+#endif
+
+/**
+ * Suspend the calling thread for at least +usec+ microseconds.
+ */
+void obl_sleep_usec(uint64_t usec);
+
+/**
+ * Read a monotonic clock with microsecond resolution.  Only differences
+ * between two timestamps are meaningful.
+ */
+uint64_t obl_monotonic_usec(void);
+
 #endif
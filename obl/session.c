@@ -12,10 +12,56 @@
 
 #include "storage/object.h"
 #include "addressmap.h"
+#include "cache.h"
 #include "set.h"
+#include "shared.h"
+#include "table.h"
 #include "transaction.h"
 #include "database.h"
 
+/* Internal function prototypes. */
+
+/**
+ * Fault in an object on behalf of a top-level call to _obl_at_address_depth(),
+ * with read access to the database and the session lock held.
+ */
+static struct obl_object *_locked_at_address(struct obl_session *s,
+        obl_logical_address address, int depth);
+
+/**
+ * Read the object with logical address +address+ from physical address
+ * +physical+ and add it to the read set.  If +stub+ is non-NULL, it is the
+ * stub already in the read set for +address+, and it becomes the object in
+ * place so that references to it remain valid.  Returns nil if +physical+ is
+ * unassigned.
+ */
+static struct obl_object *_fault(struct obl_session *s,
+        obl_logical_address address, obl_physical_address physical,
+        int depth, struct obl_object *stub);
+
+/**
+ * Deallocate every object within a read set.  Shapes go last, because
+ * deallocating an object consults its shape.
+ */
+static void _destroy_read_set(struct obl_table *read_set);
+
+/** qsort() comparison function that orders children by logical address. */
+static int _compare_children(const void *left, const void *right);
+
+/**
+ * Re-read every object within a session's read set that a commit has moved
+ * since its snapshot was begun.  The caller must hold the session lock and
+ * read access to the database contents.
+ */
+static void _leave_snapshot(struct obl_session *s);
+
+/** A child address awaiting translation by _obl_read_children(). */
+struct child
+{
+    obl_logical_address logical;
+    obl_uint index;
+};
+
 struct obl_session *obl_create_session(struct obl_database *database)
 {
     if (database == NULL) {
@@ -33,14 +79,29 @@ struct obl_session *obl_create_session(struct obl_database *database)
 
     session->database = database;
 
-    session->read_set = obl_create_set(&logical_address_keyfunction);
+    session->read_set = obl_create_table();
     session->current_transaction = NULL;
-
-    sem_init(&session->session_mutex, 0, 1);
-
-    sem_wait(&database->session_list_mutex);
+    session->generation = 0;
+    obl_cache_init(&session->cache, database->configuration.cache_size);
+    obl_lease_init(&session->logical_lease);
+    obl_lease_init(&session->physical_lease);
+    session->adopted = NULL;
+    session->adopted_count = session->adopted_capacity = 0;
+    session->batch_mutations = 0;
+    session->batch_usec = 0;
+    session->commits_pending = 0;
+    session->detached_oldest = UINT64_MAX;
+    session->snapshot.pinned = 0;
+    session->snapshot.address_map = OBL_PHYSICAL_UNASSIGNED;
+    session->snapshot.version = 0;
+    session->snapshot.older = session->snapshot.newer = NULL;
+
+    pthread_mutex_init(&session->session_mutex, NULL);
+    pthread_cond_init(&session->commits_applied, NULL);
+
+    pthread_rwlock_wrlock(&database->session_list_lock);
     obl_session_list_append(&database->session_list, session);
-    sem_post(&database->session_list_mutex);
+    pthread_rwlock_unlock(&database->session_list_lock);
 
     return session;
 }
@@ -62,46 +123,164 @@ struct obl_object *obl_at_address(struct obl_session *session,
 struct obl_object *obl_at_address_depth(struct obl_session *session,
         obl_logical_address address, int depth)
 {
-    return _obl_at_address_depth(session, address, depth, 1);
+    struct obl_object *o;
+
+    o = _obl_at_address_depth(session, address, depth, 1);
+
+    if (! IS_FIXED_ADDR(address)) {
+        _obl_cache_trim(session, o);
+    }
+
+    return o;
 }
 
 void obl_refresh_object(struct obl_object *o)
 {
     struct obl_session *s = o->session;
     struct obl_database *d = s->database;
-    struct obl_object *n;
+    int locking = ! d->configuration.read_only;
 
-    sem_wait(&d->content_mutex);
-    sem_wait(&s->session_mutex);
-    n = obl_read_object(s, d->content, o->physical_address,
-            d->configuration.default_stub_depth);
+    if (locking) {
+        pthread_rwlock_rdlock(&d->content_lock);
+    }
+    if (_obl_shared_read_begin(d)) {
+        if (locking) pthread_rwlock_unlock(&d->content_lock);
+        return ;
+    }
+    if (locking) {
+        pthread_mutex_lock(&s->session_mutex);
+    }
 
-    o->shape = n->shape;
-    o->storage.any_storage = n->storage.any_storage;
-    sem_post(&s->session_mutex);
-    sem_post(&d->content_mutex);
+    _obl_reread_object(s, o);
 
-    /*
-     * Free n directly; its storage is now referenced by o.
-     */
-    free(n);
+    if (locking) {
+        pthread_mutex_unlock(&s->session_mutex);
+    }
+    _obl_shared_read_end(d);
+    if (locking) {
+        pthread_rwlock_unlock(&d->content_lock);
+    }
+}
+
+void obl_session_batch(struct obl_session *session, unsigned long mutations,
+        uint64_t usec)
+{
+    obl_session_flush(session);
+
+    session->batch_mutations = mutations;
+    session->batch_usec = usec;
+}
+
+int obl_session_flush(struct obl_session *session)
+{
+    struct obl_transaction *t = session->current_transaction;
+
+    if (t == NULL || ! t->implicit) {
+        return 0;
+    }
+
+    return obl_commit_transaction(t);
+}
+
+int obl_begin_snapshot(struct obl_session *session)
+{
+    struct obl_database *d = session->database;
+    int locking = ! d->configuration.read_only;
+
+    /* Other processes write in place, whatever this one has pinned. */
+    if (d->shared != NULL) {
+        obl_report_error(d, OBL_UNSUPPORTED,
+                "Snapshots aren't supported by shared databases.");
+        return 1;
+    }
+
+    if (session->snapshot.pinned) {
+        obl_report_error(d, OBL_ALREADY_IN_TRANSACTION,
+                "The session is already reading a snapshot.");
+        return 1;
+    }
+
+    obl_session_flush(session);
+
+    /* The snapshot should include this session's own commits. */
+    pthread_mutex_lock(&session->session_mutex);
+    while (session->commits_pending > 0) {
+        pthread_cond_wait(&session->commits_applied, &session->session_mutex);
+    }
+    pthread_mutex_unlock(&session->session_mutex);
+
+    if (session->current_transaction != NULL) {
+        obl_report_error(d, OBL_ALREADY_IN_TRANSACTION, NULL);
+        return 1;
+    }
+
+    if (locking) {
+        pthread_rwlock_rdlock(&d->content_lock);
+        pthread_mutex_lock(&session->session_mutex);
+    }
+
+    _obl_snapshot_pin(d, &session->snapshot);
+
+    if (locking) {
+        pthread_mutex_unlock(&session->session_mutex);
+        pthread_rwlock_unlock(&d->content_lock);
+    }
+
+    return 0;
+}
+
+void obl_end_snapshot(struct obl_session *session)
+{
+    struct obl_database *d = session->database;
+    int locking = ! d->configuration.read_only;
+
+    if (! session->snapshot.pinned) {
+        return ;
+    }
+
+    if (locking) {
+        pthread_rwlock_rdlock(&d->content_lock);
+        pthread_mutex_lock(&session->session_mutex);
+    }
+
+    _obl_snapshot_unpin(d, &session->snapshot);
+    _leave_snapshot(session);
+
+    if (locking) {
+        pthread_mutex_unlock(&session->session_mutex);
+        pthread_rwlock_unlock(&d->content_lock);
+    }
 }
 
 void obl_destroy_session(struct obl_session *session)
 {
     struct obl_database *d = session->database;
 
+    /* Batched mutations are kept, not discarded. */
+    obl_session_flush(session);
+
+    /* The writer thread may still be publishing this session's commits. */
+    _obl_await_commits(session);
+
     if (session->current_transaction != NULL) {
         obl_abort_transaction(session->current_transaction);
     }
 
-    obl_destroy_set(session->read_set, &_obl_deallocate_object);
+    if (session->snapshot.pinned) {
+        _obl_snapshot_unpin(d, &session->snapshot);
+    }
+
+    _obl_release_leases(session);
+
+    _destroy_read_set(session->read_set);
+    free(session->adopted);
 
-    sem_destroy(&session->session_mutex);
+    pthread_cond_destroy(&session->commits_applied);
+    pthread_mutex_destroy(&session->session_mutex);
 
-    sem_wait(&d->session_list_mutex);
+    pthread_rwlock_wrlock(&d->session_list_lock);
     obl_session_list_remove(&d->session_list, session);
-    sem_post(&d->session_list_mutex);
+    pthread_rwlock_unlock(&d->session_list_lock);
 
     free(session);
 }
@@ -144,18 +323,21 @@ void _obl_session_release(struct obl_object *o)
 {
     struct obl_session *s = o->session;
     struct obl_transaction *t;
+    int locking;
 
     if (s == NULL) return;
-    sem_wait(&s->session_mutex);
+    locking = ! s->database->configuration.read_only;
+    if (locking) pthread_mutex_lock(&s->session_mutex);
 
-    obl_set_remove(s->read_set, o);
+    obl_table_remove(s->read_set, o);
+    _obl_cache_forget(s, o);
 
     t = s->current_transaction;
     if (t != NULL) {
         obl_set_remove(t->write_set, o);
     }
 
-    sem_post(&s->session_mutex);
+    if (locking) pthread_mutex_unlock(&s->session_mutex);
 }
 
 struct obl_object *_obl_at_address_depth(struct obl_session *s,
@@ -170,51 +352,384 @@ struct obl_object *_obl_at_address_depth(struct obl_session *s,
         return _obl_at_fixed_address(address);
     }
 
+    if (top) {
+        return _locked_at_address(s, address, depth);
+    }
+
     /* If this object already exists within the read set, return it as-is. */
-    if (top) sem_wait(&s->session_mutex);
-    o = obl_set_lookup(s->read_set, (obl_set_key) address);
+    o = obl_table_lookup(s->read_set, address);
     if (o != NULL && ! _obl_is_stub(o)) {
-        if (top) sem_post(&s->session_mutex);
+        o->cache.referenced = 1;
+        s->cache.hits++;
         return o;
     }
 
     if (depth > 0) {
         /* Look up the physical address. */
-        physical = obl_address_lookup(d, address);
+        physical = _obl_address_lookup_at(d, _obl_session_address_map(s),
+                address);
+        return _fault(s, address, physical, depth, o);
+    }
+
+    /* Others may already refer to the existing stub. */
+    if (o != NULL) {
+        return o;
+    }
+
+    /* Create and return a stub that will resolve to this object. */
+    o = _obl_create_stub(s, address);
+    obl_table_insert(s->read_set, o);
+
+    return o;
+}
+
+void _obl_read_children(struct obl_session *s, const obl_uint *source,
+        obl_uint count, int depth, struct obl_object **children)
+{
+    struct obl_database *d = s->database;
+    struct child *pending;
+    obl_logical_address *logical;
+    obl_physical_address *physical;
+    struct obl_object *o;
+    obl_uint i, waiting = 0;
+
+    pending = NULL;
+    logical = NULL;
+    if (depth > 0 && count > 1) {
+        pending = malloc(count * sizeof(struct child));
+        logical = malloc(2 * count * sizeof(obl_uint));
+    }
+
+    /*
+     * Stubs don't need translating, and neither do fixed objects or those
+     * already in the read set.  Without room to batch, fall back to one at a
+     * time.
+     */
+    if (pending == NULL || logical == NULL) {
+        free(pending);
+        free(logical);
+        for (i = 0; i < count; i++) {
+            children[i] = _obl_at_address_depth(s,
+                    readable_logical(source[i]), depth, 0);
+        }
+        return ;
+    }
+
+    for (i = 0; i < count; i++) {
+        obl_logical_address address = readable_logical(source[i]);
+
+        children[i] = NULL;
+        if (IS_FIXED_ADDR(address)) {
+            children[i] = _obl_at_fixed_address(address);
+            continue;
+        }
+
+        o = obl_table_lookup(s->read_set, address);
+        if (o != NULL && ! _obl_is_stub(o)) {
+            o->cache.referenced = 1;
+            s->cache.hits++;
+            children[i] = o;
+            continue;
+        }
+
+        pending[waiting].logical = address;
+        pending[waiting].index = i;
+        waiting++;
+    }
+
+    /* Translate in address order, so that neighbours share their walks. */
+    qsort(pending, waiting, sizeof(struct child), &_compare_children);
+    physical = (obl_physical_address *) logical + waiting;
+    for (i = 0; i < waiting; i++) {
+        logical[i] = pending[i].logical;
+    }
+    _obl_address_lookup_many_at(d, _obl_session_address_map(s), logical,
+            physical, waiting);
+
+    for (i = 0; i < waiting; i++) {
+        /* An earlier child may have faulted in the same object. */
+        o = obl_table_lookup(s->read_set, logical[i]);
+        if (o == NULL || _obl_is_stub(o)) {
+            o = _fault(s, logical[i], physical[i], depth, o);
+        }
+        children[pending[i].index] = o;
+    }
+
+    free(pending);
+    free(logical);
+}
+
+void _obl_session_catch_up(struct obl_session *s)
+{
+    struct obl_database *d = s->database;
+    struct obl_transaction *t = s->current_transaction;
+    struct obl_object *current;
+    struct obl_object_list *stale = NULL;
+    unsigned long generation;
+    size_t cursor = 0;
+
+    generation = _obl_shared_generation(d);
+    if (s->generation == generation) {
+        return ;
+    }
+    s->generation = generation;
+
+    /*
+     * Collect the stale objects first: re-reading them may fault new objects
+     * into the read set.
+     */
+    while ( (current = obl_table_next(s->read_set, &cursor)) != NULL ) {
+        if (_obl_is_stub(current) ||
+                current->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+            continue;
+        }
+        if (t != NULL && obl_set_lookup(t->write_set,
+                (obl_set_key) current->logical_address) != NULL) {
+            continue;
+        }
+        obl_object_list_append(&stale, current);
+    }
+
+    while (stale != NULL) {
+        struct obl_object_list *former = stale;
+
+        _obl_reread_object(s, stale->entry);
+        stale = stale->next;
+        free(former);
+    }
+}
+
+void _obl_update_objects(struct obl_session *s, struct obl_set *change_set,
+        uint64_t version)
+{
+    struct obl_database *d = s->database;
+    struct obl_transaction *t;
+    struct obl_set_iterator *it;
+    struct obl_object *current, *mine;
+
+    pthread_rwlock_rdlock(&d->content_lock);
+    if (_obl_shared_read_begin(d)) {
+        pthread_rwlock_unlock(&d->content_lock);
+        return ;
+    }
+    pthread_mutex_lock(&s->session_mutex);
+    t = s->current_transaction;
+
+    /*
+     * obl_end_snapshot() catches up with later commits instead.  Earlier ones
+     * are within the snapshot, and the session may not have seen them yet.
+     */
+    if (s->snapshot.pinned && version > s->snapshot.version) {
+        pthread_mutex_unlock(&s->session_mutex);
+        _obl_shared_read_end(d);
+        pthread_rwlock_unlock(&d->content_lock);
+        return ;
+    }
+
+    it = obl_set_inorder_iter(change_set);
+    while ( (current = obl_set_iternext(it)) != NULL ) {
+        mine = obl_table_lookup(s->read_set, current->logical_address);
+        if (mine == NULL || _obl_is_stub(mine)) {
+            continue;
+        }
+
+        if (t != NULL && obl_set_lookup(t->write_set,
+                (obl_set_key) mine->logical_address) != NULL) {
+            /*
+             * Keep the uncommitted changes, and the version they were made
+             * against, so that the commit detects the conflict.  The undo log
+             * would restore what's now stale, so an abort must read it again.
+             */
+            free(mine->dirty_words);
+            mine->dirty_words = NULL;
+        } else {
+            _obl_reread_object(s, mine);
+        }
+    }
+    obl_set_destroyiter(it);
+
+    pthread_mutex_unlock(&s->session_mutex);
+    _obl_shared_read_end(d);
+    pthread_rwlock_unlock(&d->content_lock);
+}
+
+obl_physical_address _obl_session_address_map(struct obl_session *s)
+{
+    if (s->snapshot.pinned) {
+        return s->snapshot.address_map;
+    }
+    return s->database->root.address_map_addr;
+}
+
+void _obl_reread_object(struct obl_session *s, struct obl_object *o)
+{
+    struct obl_database *d = s->database;
+    struct obl_object *n;
+    obl_physical_address physical;
+
+    if (o->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+        return ;
+    }
+
+    /* Commits made while a snapshot was pinned may have moved it. */
+    physical = o->physical_address;
+    if (o->logical_address != OBL_LOGICAL_UNASSIGNED &&
+            ! IS_FIXED_ADDR(o->logical_address)) {
+        physical = _obl_address_lookup_at(d, _obl_session_address_map(s),
+                o->logical_address);
         if (physical == OBL_PHYSICAL_UNASSIGNED) {
-            if (top) sem_post(&s->session_mutex);
-            return obl_nil();
+            physical = o->physical_address;
         }
+    }
+
+    if (physical >= d->content_size) {
+        return ;
+    }
+
+    n = obl_read_object(s, d->content, physical,
+            d->configuration.default_stub_depth);
+    if (n == obl_nil()) {
+        return ;
+    }
 
-        o = obl_read_object(s, d->content, physical, depth);
+    _obl_deallocate_storage(o);
+    o->shape = n->shape;
+    o->storage.any_storage = n->storage.any_storage;
+    o->physical_address = physical;
+    o->read_version = s->snapshot.pinned ?
+            s->snapshot.version : n->read_version;
+
+    /*
+     * Free n directly; its storage is now referenced by o.
+     */
+    free(n);
+}
+
+/* Internal function definitions. */
+
+static struct obl_object *_locked_at_address(struct obl_session *s,
+        obl_logical_address address, int depth)
+{
+    struct obl_database *d = s->database;
+    struct obl_object *o;
+    int locking;
+
+    /*
+     * No other session can commit into a read-only database, so nothing but
+     * the calling thread ever touches this session's read set.
+     */
+    locking = ! d->configuration.read_only;
+
+    if (locking) pthread_rwlock_rdlock(&d->content_lock);
+    if (_obl_shared_read_begin(d)) {
+        if (locking) pthread_rwlock_unlock(&d->content_lock);
+        return obl_nil();
+    }
+    if (locking) pthread_mutex_lock(&s->session_mutex);
+
+    _obl_session_catch_up(s);
+    o = _obl_at_address_depth(s, address, depth, 0);
+
+    if (locking) pthread_mutex_unlock(&s->session_mutex);
+    _obl_shared_read_end(d);
+    if (locking) pthread_rwlock_unlock(&d->content_lock);
+
+    return o;
+}
+
+static struct obl_object *_fault(struct obl_session *s,
+        obl_logical_address address, obl_physical_address physical,
+        int depth, struct obl_object *stub)
+{
+    struct obl_database *d = s->database;
+    struct obl_object *o;
+
+    if (physical == OBL_PHYSICAL_UNASSIGNED) {
+        return obl_nil();
+    }
+
+    o = obl_read_object(s, d->content, physical, depth);
+    if (o == obl_nil()) {
+        return o;
+    }
+    s->cache.misses++;
+
+    if (stub != NULL) {
+        _obl_deallocate_storage(stub);
+        stub->shape = o->shape;
+        stub->storage.any_storage = o->storage.any_storage;
+        stub->physical_address = o->physical_address;
+        stub->read_version = s->snapshot.pinned ?
+                s->snapshot.version : o->read_version;
+
+        /* Free o directly; its storage is now referenced by the stub. */
+        free(o);
+        o = stub;
+    } else {
         o->logical_address = address;
         o->session = s;
-    } else {
-        /* Create and return a stub that will resolve to this object. */
-        o = _obl_create_stub(s, address);
+        if (s->snapshot.pinned) {
+            o->read_version = s->snapshot.version;
+        }
+        obl_table_insert(s->read_set, o);
     }
 
-    obl_set_insert(s->read_set, o);
-    if (top) sem_post(&s->session_mutex);
+    _obl_cache_admit(s, o);
 
     return o;
+}
+
+static void _destroy_read_set(struct obl_table *read_set)
+{
+    struct obl_object *o;
+    size_t cursor = 0;
+
+    while ( (o = obl_table_next(read_set, &cursor)) != NULL ) {
+        if (obl_storage_of(o) != OBL_SHAPE) {
+            obl_table_remove(read_set, o);
+            _obl_deallocate_object(o);
+        }
+    }
 
+    obl_destroy_table(read_set, &_obl_deallocate_object);
 }
 
-void _obl_update_objects(struct obl_session *s, struct obl_set *change_set)
+static int _compare_children(const void *left, const void *right)
 {
-    struct obl_set_iterator *it;
-    struct obl_object *current, *mine;
+    obl_logical_address a = ((const struct child *) left)->logical;
+    obl_logical_address b = ((const struct child *) right)->logical;
 
-    it = obl_set_inorder_iter(change_set);
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
 
-    sem_wait(&s->session_mutex);
-    while ( (current = obl_set_iternext(it)) != NULL ) {
-        mine = obl_set_lookup(s->read_set,
-                (obl_set_key) current->logical_address);
-        if (mine != NULL) {
-            obl_refresh_object(mine);
+static void _leave_snapshot(struct obl_session *s)
+{
+    struct obl_object *current;
+    struct obl_object_list *moved = NULL;
+    size_t cursor = 0;
+
+    /*
+     * Every commit made during the snapshot copied on write, so an object
+     * that one changed is no longer where the session read it.  Collect them
+     * first: re-reading them may fault new objects into the read set.
+     */
+    while ( (current = obl_table_next(s->read_set, &cursor)) != NULL ) {
+        if (_obl_is_stub(current) ||
+                current->physical_address == OBL_PHYSICAL_UNASSIGNED ||
+                IS_FIXED_ADDR(current->logical_address)) {
+            continue;
+        }
+        if (obl_address_lookup(s->database, current->logical_address) !=
+                current->physical_address) {
+            obl_object_list_append(&moved, current);
         }
     }
-    sem_post(&s->session_mutex);
+
+    while (moved != NULL) {
+        struct obl_object_list *former = moved;
+
+        _obl_reread_object(s, moved->entry);
+        moved = moved->next;
+        free(former);
+    }
 }
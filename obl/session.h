@@ -12,6 +12,9 @@
 #ifndef SESSION_H
 #define SESSION_H
 
+#include "allocator.h"
+#include "cache.h"
+#include "snapshot.h"
 #include "platform.h"
 
 /* Defined in database.h */
@@ -23,6 +26,9 @@ struct obl_transaction;
 /* Defined in set.h */
 struct obl_set;
 
+/* Defined in table.h */
+struct obl_table;
+
 /**
  * An obl_session represents one thread or process' view of the data contained
  * within the obl_database.  Sessions cache object reads and manage writes with
@@ -41,15 +47,82 @@ struct obl_session
     struct obl_transaction *current_transaction;
 
     /**
-     * A red-black tree of all objects resident within the session, keyed by
+     * A hash table of all objects resident within the session, keyed by
      * logical address.
      */
-    struct obl_set *read_set;
+    struct obl_table *read_set;
+
+    /**
+     * Limits the memory used by the objects within the read set.
+     */
+    struct obl_cache cache;
+
+    /**
+     * The value of _obl_shared_generation() when the read set was last brought
+     * up to date with commits made by other processes.  See shared.h.
+     */
+    unsigned long generation;
+
+    /**
+     * Logical addresses leased from the allocator for new objects.
+     */
+    struct obl_allocation_lease logical_lease;
+
+    /**
+     * Physical space leased from the allocator for new objects.
+     */
+    struct obl_allocation_lease physical_lease;
+
+    /**
+     * Objects adopted by the commit in progress, in the order in which they
+     * were discovered.  The array is kept from one commit to the next, so that
+     * most commits don't allocate it at all.
+     */
+    struct obl_object **adopted;
+
+    /** The number of entries in use and allocated within adopted. */
+    size_t adopted_count, adopted_capacity;
+
+    /**
+     * If nonzero, mutations made outside of any transaction are batched, and
+     * committed together once there are this many.  See obl_session_batch().
+     */
+    unsigned long batch_mutations;
+
+    /**
+     * If nonzero, batched mutations are also committed once the batch has
+     * been open for this many microseconds.
+     */
+    uint64_t batch_usec;
+
+    /**
+     * The number of commits made with obl_commit_transaction_async() that the
+     * writer thread has yet to apply.  Guarded by session_mutex.
+     */
+    unsigned long commits_pending;
+
+    /** Signalled as commits_pending falls. */
+    pthread_cond_t commits_applied;
 
     /**
-     * Semaphore to protect access to any of this session's resources.
+     * The oldest version that an object written by a pending asynchronous
+     * commit was read at, or UINT64_MAX once none are pending.  Guarded by
+     * session_mutex.
      */
-    sem_t session_mutex;
+    uint64_t detached_oldest;
+
+    /**
+     * The state of the database that the session reads between
+     * obl_begin_snapshot() and obl_end_snapshot().
+     */
+    struct obl_snapshot snapshot;
+
+    /**
+     * Protects access to any of this session's resources.  Reads within a
+     * read-only database don't use it.  Always acquire the database's
+     * content_lock first, if both are needed.
+     */
+    pthread_mutex_t session_mutex;
 };
 
 /**
@@ -110,6 +183,62 @@ struct obl_object *obl_at_address_depth(struct obl_session *session,
  */
 void obl_refresh_object(struct obl_object *o);
 
+/**
+ * Batch the changes that the storage mutators make outside of any transaction.
+ * Ordinarily, each such change is committed by a transaction of its own.  In
+ * batching mode, they're collected into one implicit transaction instead,
+ * which is committed once it holds a number of mutations or has been open for
+ * a time, when obl_session_flush() is called, when an explicit transaction is
+ * begun, or when the session is destroyed.  Until then, other sessions can't
+ * see the batched changes.
+ *
+ * The age of a batch is only checked as mutations are made, so a session that
+ * stops making changes should call obl_session_flush().
+ *
+ * @param session
+ * @param mutations The most mutations to batch together, or 0 to commit each
+ *      mutation separately again.  Any pending batch is committed first.
+ * @param usec The longest to keep a batch open, in microseconds, or 0 for no
+ *      limit.
+ */
+void obl_session_batch(struct obl_session *session, unsigned long mutations,
+        uint64_t usec);
+
+/**
+ * Commit any mutations that have been batched by obl_session_batch().
+ *
+ * @param session
+ * @return 0 on success or if nothing was batched, as obl_commit_transaction()
+ *      otherwise.
+ */
+int obl_session_flush(struct obl_session *session);
+
+/**
+ * Begin reading the database as it stands now, while other sessions continue
+ * to commit.  Until obl_end_snapshot() is called, the objects that the
+ * session faults in or already holds reflect no commit made after this one,
+ * and the session may not begin a transaction.  Any batched mutations are
+ * committed first.
+ *
+ * Commits copy on write while a snapshot is pinned, so long snapshots keep
+ * superseded objects from being reused.  Snapshots aren't supported by
+ * databases shared between processes.
+ *
+ * @param session
+ * @return 0 on success, or 1 if the session is within a transaction or
+ *      snapshot already, or the database doesn't support snapshots.
+ */
+int obl_begin_snapshot(struct obl_session *session);
+
+/**
+ * Release a session's snapshot, and bring the objects within its read set up
+ * to date with the commits made since it was begun.  Does nothing if no
+ * snapshot was begun.
+ *
+ * @param session
+ */
+void obl_end_snapshot(struct obl_session *session);
+
 /**
  * Deallocate a session and remove it from its owning database.
  *
@@ -164,13 +293,65 @@ struct obl_object *_obl_at_address_depth(struct obl_session *session,
         obl_logical_address address, int depth, int top);
 
 /**
- * Use obl_refresh_object() to acquire a new version of each object contained
- * within a change set.  For internal use only.
+ * Fault in the objects referenced by a run of logical addresses within the
+ * database contents, as though by calling _obl_at_address_depth() without
+ * locking on each of them, but translating all of their addresses with a
+ * single obl_address_lookup_many().  Used by storage types to read their
+ * children.  For internal use only.
+ *
+ * @param session
+ * @param source The first of +count+ consecutive words that hold logical
+ *      addresses, in database byte order.
+ * @param count The number of addresses to read.
+ * @param depth Object fault depth for each child.
+ * @param children [out] Receives the object referenced by each address.
+ */
+void _obl_read_children(struct obl_session *session, const obl_uint *source,
+        obl_uint count, int depth, struct obl_object **children);
+
+/**
+ * If other processes have committed since this session last looked, re-read
+ * every object within its read set, except those that the current
+ * transaction has changed.  The caller must hold the session lock and read
+ * or write access to the database contents.  For internal use only.
+ *
+ * @param s
+ */
+void _obl_session_catch_up(struct obl_session *s);
+
+/**
+ * Return the root of the address map that a session reads: its snapshot's,
+ * or the current one.  For internal use only.
+ *
+ * @param s
+ */
+obl_physical_address _obl_session_address_map(struct obl_session *s);
+
+/**
+ * Replace the state of an object with a fresh copy read from the database, at
+ * the physical address that the session's address map now gives it.  Objects
+ * that have never been persisted, or whose physical addresses lie beyond the
+ * end of the database, are left alone.  The caller must hold the session lock
+ * and read or write access to the database contents.  For internal use only.
+ *
+ * @param s
+ * @param o
+ */
+void _obl_reread_object(struct obl_session *s, struct obl_object *o);
+
+/**
+ * Acquire a new version of each object within a change set that this session
+ * has already read, except for those that its current transaction has
+ * changed: their commit will conflict instead.  A session reading a snapshot
+ * older than the commit is left alone until the snapshot ends.  Must be
+ * called without the session lock or access to the database contents.  For
+ * internal use only.
  *
  * @param s
  * @param change_set
+ * @param version The version of the commit that made the changes.
  */
 void _obl_update_objects(struct obl_session *s,
-        struct obl_set *change_set);
+        struct obl_set *change_set, uint64_t version);
 
 #endif /* SESSION_H */
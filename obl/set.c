@@ -653,9 +653,6 @@ static struct obl_object *destroying_iternext(
 
     result = current_node->o;
 
-    /* Destroy the current node. */
-    free(current_node);
-
     /* Allocate a new context frame for the right child. */
     if (current_node->children[RIGHT] != NULL) {
         struct iterator_context *right;
@@ -682,6 +679,9 @@ static struct obl_object *destroying_iternext(
         new_context = left;
     }
 
+    /* Destroy the current node, now that its children have been recorded. */
+    free(current_node);
+
     /* Destroy the former current context.  Replace it with its child nodes,
      * if any were created.
      */
@@ -0,0 +1,508 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file shared.c
+ *
+ * Multi-process coordination through a shared sidecar file.  The sidecar is
+ * locked a byte at a time:
+ *
+ *   byte 0: held exclusively by the process that is committing.
+ *   byte 1: held shared by reading processes, and exclusively by the
+ *           process that is committing.
+ *   byte 2: held exclusively while a process initializes the header.
+ *   byte 3: held shared by every process that has the database open, so that
+ *           a process that can lock it exclusively knows that it is alone.
+ *
+ * Because closing any descriptor for a file releases every fcntl() lock the
+ * process holds on it, each process should open a multi-process database
+ * only once.
+ */
+
+#include "shared.h"
+
+#include "addressmap.h"
+#include "database.h"
+#include "growth.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Identifies an initialized header.  The string "oblS" in hex. */
+#define SHARED_MAGIC 0x6F626C53
+
+/** The suffix appended to a database filename to name its sidecar. */
+#define SHARED_SUFFIX "-shm"
+
+/* Offsets of the locked bytes within the sidecar. */
+
+#define WRITE_BYTE 0
+#define READ_BYTE 1
+#define INIT_BYTE 2
+#define ATTACH_BYTE 3
+
+#ifndef WIN32
+
+/**
+ * The per-process state of a database shared among processes.
+ */
+struct obl_shared
+{
+    /** The open sidecar file. */
+    int fd;
+
+    /** The name of the sidecar file, heap-allocated. */
+    char *filename;
+
+    /** The mapped header of the sidecar. */
+    volatile struct obl_shared_header *header;
+
+    /** The commit sequence number as of this process' last catch-up. */
+    uint64_t sequence;
+
+    /** Incremented by each catch-up.  See _obl_shared_generation(). */
+    unsigned long generation;
+
+    /**
+     * Held for reading by each thread with read access, and for writing by a
+     * thread that is committing or catching up.
+     */
+    pthread_rwlock_t access;
+
+    /** Guards readers and this process' lock on the read byte. */
+    pthread_mutex_t mutex;
+
+    /** The number of threads that share this process' lock on the read byte. */
+    unsigned long readers;
+
+    /** The thread that is committing, if writing is nonzero. */
+    pthread_t writer;
+    int writing;
+};
+
+/* Internal function prototypes. */
+
+/**
+ * Apply an fcntl() lock of +type+ to +length+ bytes of the sidecar, starting
+ * at +offset+.  Waits for conflicting locks if +wait+ is nonzero.  Returns 0
+ * on success or an errno value.
+ */
+static int _lock(int fd, short type, off_t offset, off_t length, int wait);
+
+/**
+ * Join this process' shared lock on the read byte, acquiring it if no other
+ * thread holds it.
+ */
+static int _share(struct obl_database *d);
+
+/** Leave this process' shared lock, releasing it if no other thread holds it. */
+static void _unshare(struct obl_database *d);
+
+/**
+ * Map any growth performed by other processes and reread the root.  The
+ * caller must have exclusive access within this process and hold the read
+ * byte.
+ */
+static int _catch_up(struct obl_database *d);
+
+/** Return nonzero if the calling thread holds write access. */
+static inline int _is_writer(struct obl_shared *shared);
+
+#endif /* WIN32 */
+
+/* External function definitions. */
+
+#ifndef WIN32
+
+uint64_t obl_commit_sequence(struct obl_database *d)
+{
+    if (d->shared == NULL) {
+        return 0;
+    }
+
+    return d->shared->header->commit_sequence;
+}
+
+int _obl_shared_open(struct obl_database *d)
+{
+    struct obl_shared *shared;
+    struct stat info;
+    char *filename;
+    void *mapped;
+    int fd, error;
+
+    if (! d->configuration.multi_process || d->configuration.filename == NULL) {
+        return 0;
+    }
+
+    filename = malloc(strlen(d->configuration.filename) +
+            sizeof(SHARED_SUFFIX));
+    shared = malloc(sizeof(struct obl_shared));
+    if (filename == NULL || shared == NULL) {
+        free(filename);
+        free(shared);
+        obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+        return 1;
+    }
+    strcpy(filename, d->configuration.filename);
+    strcat(filename, SHARED_SUFFIX);
+
+    fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
+                "Unable to open shared file <%s>: %s",
+                filename, strerror(errno));
+        free(filename);
+        free(shared);
+        return 1;
+    }
+
+    /* Only one process at a time may size and initialize the header. */
+    error = _lock(fd, F_WRLCK, INIT_BYTE, 1, 1);
+    if (! error && fstat(fd, &info) != 0) {
+        error = errno;
+    }
+    if (! error && info.st_size < (off_t) sizeof(struct obl_shared_header) &&
+            ftruncate(fd, (off_t) sizeof(struct obl_shared_header)) != 0) {
+        error = errno;
+    }
+
+    mapped = MAP_FAILED;
+    if (! error) {
+        mapped = mmap(NULL, sizeof(struct obl_shared_header),
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            error = errno;
+        }
+    }
+
+    if (error) {
+        obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
+                "Unable to map shared file <%s>: %s",
+                filename, strerror(error));
+        close(fd);
+        free(filename);
+        free(shared);
+        return 1;
+    }
+
+    shared->fd = fd;
+    shared->filename = filename;
+    shared->header = (struct obl_shared_header *) mapped;
+
+    /*
+     * If no other process is attached, any counts in the header were left by
+     * processes that died without detaching.
+     */
+    if (_lock(fd, F_WRLCK, ATTACH_BYTE, 1, 0) == 0 ||
+            shared->header->magic != SHARED_MAGIC) {
+        if (shared->header->magic != SHARED_MAGIC) {
+            shared->header->commit_sequence = 0;
+            shared->header->content_size = 0;
+        }
+        shared->header->readers = 0;
+        shared->header->writers = 0;
+        shared->header->attached = 0;
+        shared->header->magic = SHARED_MAGIC;
+    }
+    _lock(fd, F_RDLCK, ATTACH_BYTE, 1, 1);
+    __sync_fetch_and_add(&shared->header->attached, 1);
+    _lock(fd, F_UNLCK, INIT_BYTE, 1, 0);
+
+    shared->sequence = shared->header->commit_sequence;
+    shared->generation = 0;
+    pthread_rwlock_init(&shared->access, NULL);
+    pthread_mutex_init(&shared->mutex, NULL);
+    shared->readers = 0;
+    shared->writing = 0;
+
+    d->shared = shared;
+
+    return 0;
+}
+
+void _obl_shared_close(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+
+    if (shared == NULL) {
+        return ;
+    }
+
+    __sync_fetch_and_sub(&shared->header->attached, 1);
+
+    munmap((void *) shared->header, sizeof(struct obl_shared_header));
+    close(shared->fd);
+
+    pthread_rwlock_destroy(&shared->access);
+    pthread_mutex_destroy(&shared->mutex);
+    free(shared->filename);
+    free(shared);
+
+    d->shared = NULL;
+}
+
+int _obl_shared_read_begin(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+    int result;
+
+    if (shared == NULL || _is_writer(shared)) {
+        return 0;
+    }
+
+    for (;;) {
+        pthread_rwlock_rdlock(&shared->access);
+        if (_share(d)) {
+            pthread_rwlock_unlock(&shared->access);
+            return 1;
+        }
+
+        /* No commit can be in progress while the read byte is held. */
+        if (shared->header->commit_sequence == shared->sequence) {
+            return 0;
+        }
+
+        /* Catching up changes d->content, so other threads must be excluded. */
+        _unshare(d);
+        pthread_rwlock_unlock(&shared->access);
+
+        pthread_rwlock_wrlock(&shared->access);
+        result = _share(d);
+        if (! result) {
+            result = _catch_up(d);
+            _unshare(d);
+        }
+        pthread_rwlock_unlock(&shared->access);
+
+        if (result) {
+            return 1;
+        }
+    }
+}
+
+void _obl_shared_read_end(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+
+    if (shared == NULL || _is_writer(shared)) {
+        return ;
+    }
+
+    _unshare(d);
+    pthread_rwlock_unlock(&shared->access);
+}
+
+int _obl_shared_write_begin(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+    int error;
+
+    if (shared == NULL) {
+        return 0;
+    }
+
+    /*
+     * Once this thread has exclusive access within the process, no thread
+     * here holds the read byte, so locking both bytes waits only for other
+     * processes.
+     */
+    pthread_rwlock_wrlock(&shared->access);
+    error = _lock(shared->fd, F_WRLCK, WRITE_BYTE, 2, 1);
+    if (error) {
+        pthread_rwlock_unlock(&shared->access);
+        obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                "Unable to lock shared file <%s>: %s",
+                shared->filename, strerror(error));
+        return 1;
+    }
+
+    __sync_fetch_and_add(&shared->header->writers, 1);
+    shared->writer = pthread_self();
+    shared->writing = 1;
+
+    if (shared->header->commit_sequence != shared->sequence &&
+            _catch_up(d)) {
+        _obl_shared_write_end(d, 0);
+        return 1;
+    }
+
+    return 0;
+}
+
+void _obl_shared_write_end(struct obl_database *d, int committed)
+{
+    struct obl_shared *shared = d->shared;
+
+    if (shared == NULL) {
+        return ;
+    }
+
+    if (committed) {
+        shared->header->content_size = d->content_size;
+        __sync_synchronize();
+        shared->header->commit_sequence++;
+        shared->sequence = shared->header->commit_sequence;
+    }
+
+    __sync_fetch_and_sub(&shared->header->writers, 1);
+    shared->writing = 0;
+
+    _lock(shared->fd, F_UNLCK, WRITE_BYTE, 2, 0);
+    pthread_rwlock_unlock(&shared->access);
+}
+
+unsigned long _obl_shared_generation(struct obl_database *d)
+{
+    if (d->shared == NULL) {
+        return 0;
+    }
+
+    return d->shared->generation;
+}
+
+#else /* WIN32 */
+
+uint64_t obl_commit_sequence(struct obl_database *d)
+{
+    return 0;
+}
+
+int _obl_shared_open(struct obl_database *d)
+{
+    if (d->configuration.multi_process) {
+        OBL_NOTICE(d, "Multi-process access is not supported here.");
+    }
+    return 0;
+}
+
+void _obl_shared_close(struct obl_database *d)
+{
+}
+
+int _obl_shared_read_begin(struct obl_database *d)
+{
+    return 0;
+}
+
+void _obl_shared_read_end(struct obl_database *d)
+{
+}
+
+int _obl_shared_write_begin(struct obl_database *d)
+{
+    return 0;
+}
+
+void _obl_shared_write_end(struct obl_database *d, int committed)
+{
+}
+
+unsigned long _obl_shared_generation(struct obl_database *d)
+{
+    return 0;
+}
+
+#endif /* WIN32 */
+
+/* Internal function definitions. */
+
+#ifndef WIN32
+
+static int _lock(int fd, short type, off_t offset, off_t length, int wait)
+{
+    struct flock region;
+
+    region.l_type = type;
+    region.l_whence = SEEK_SET;
+    region.l_start = offset;
+    region.l_len = length;
+
+    while (fcntl(fd, wait ? F_SETLKW : F_SETLK, &region) != 0) {
+        if (errno != EINTR) {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+static int _share(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+    int error = 0;
+
+    pthread_mutex_lock(&shared->mutex);
+    if (shared->readers == 0) {
+        error = _lock(shared->fd, F_RDLCK, READ_BYTE, 1, 1);
+        if (! error) {
+            __sync_fetch_and_add(&shared->header->readers, 1);
+        }
+    }
+    if (! error) {
+        shared->readers++;
+    }
+    pthread_mutex_unlock(&shared->mutex);
+
+    if (error) {
+        obl_report_errorf(d, OBL_UNABLE_TO_READ_FILE,
+                "Unable to lock shared file <%s>: %s",
+                shared->filename, strerror(error));
+        return 1;
+    }
+
+    return 0;
+}
+
+static void _unshare(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+
+    pthread_mutex_lock(&shared->mutex);
+    shared->readers--;
+    if (shared->readers == 0) {
+        __sync_fetch_and_sub(&shared->header->readers, 1);
+        _lock(shared->fd, F_UNLCK, READ_BYTE, 1, 0);
+    }
+    pthread_mutex_unlock(&shared->mutex);
+}
+
+static int _catch_up(struct obl_database *d)
+{
+    struct obl_shared *shared = d->shared;
+    uint64_t size;
+
+    size = shared->header->content_size;
+    if (size > (uint64_t) d->content_size &&
+            _obl_map_content(d, (obl_uint) size)) {
+        return 1;
+    }
+
+    if (d->content_size > 0) {
+        _obl_read_root(d);
+    }
+    _obl_address_cache_clear(d);
+    _obl_payload_clear(d);
+
+    shared->sequence = shared->header->commit_sequence;
+    shared->generation++;
+
+    OBL_DEBUGF(d, "Caught up with commit <%lu> from another process.",
+            (unsigned long) shared->sequence);
+
+    return 0;
+}
+
+static inline int _is_writer(struct obl_shared *shared)
+{
+    return shared->writing && pthread_equal(shared->writer, pthread_self());
+}
+
+#endif /* WIN32 */
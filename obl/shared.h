@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file shared.h
+ *
+ * Coordinates several processes that have the same database file open.  Each
+ * file-backed database opened with multi_process set maps a small sidecar
+ * file, named by appending "-shm" to the database filename, that holds a
+ * struct obl_shared_header.  Byte-range fcntl() locks on the sidecar decide
+ * who may touch the database:
+ *
+ *  - Readers hold a shared lock on the read byte while they fault objects in,
+ *    so any number of processes may read at once.
+ *  - A committing process holds exclusive locks on both the write byte and
+ *    the read byte, so commits are serialized and never observed half-done.
+ *
+ * Every commit increments the header's commit sequence number.  A process
+ * compares it with the last sequence number it saw whenever it takes a lock;
+ * only when they differ does it remap any growth and have its sessions
+ * re-read the objects they hold.
+ *
+ * fcntl() locks belong to a process rather than to a thread, so the threads
+ * of one process share a single lock on the read byte, counted and guarded by
+ * an in-process readers-writer lock.
+ */
+
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "platform.h"
+
+/* Defined in database.h */
+struct obl_database;
+
+/* Defined in session.h */
+struct obl_session;
+
+/* Defined in shared.c */
+struct obl_shared;
+
+/**
+ * The contents of the shared sidecar file.  Every field is in host byte
+ * order: the sidecar only describes processes on this machine.
+ */
+struct obl_shared_header
+{
+    /** Identifies an initialized header.  The string "oblS" in hex. */
+    uint32_t magic;
+
+    /** The number of processes that currently hold the read lock. */
+    uint32_t readers;
+
+    /** The number of processes currently committing: 0 or 1. */
+    uint32_t writers;
+
+    /** The number of processes that have the database open. */
+    uint32_t attached;
+
+    /** Incremented by every commit, in any process. */
+    uint64_t commit_sequence;
+
+    /** The size of the database contents in words, as of the last commit. */
+    uint64_t content_size;
+};
+
+/**
+ * Return the number of commits made to a multi-process database by all
+ * processes since the first of them opened it.
+ *
+ * @param d An open database.
+ * @return The shared commit sequence number, or 0 if multi_process is unset.
+ */
+uint64_t obl_commit_sequence(struct obl_database *d);
+
+/**
+ * Open and map the shared sidecar of a file-backed database opened with
+ * multi_process, initializing it if no other process has it open, and attach
+ * it to the database as d->shared.  Must be called after d->fd has been
+ * opened.  For internal use only.
+ *
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_shared_open(struct obl_database *d);
+
+/**
+ * Detach and unmap the shared sidecar.  For internal use only.
+ */
+void _obl_shared_close(struct obl_database *d);
+
+/**
+ * Acquire the right to read the database contents, and catch up with any
+ * commits made by other processes since the last call.  Does nothing for
+ * databases without multi_process, or when called by the thread that is
+ * committing.  Pair each successful call with _obl_shared_read_end().  For
+ * internal use only.
+ *
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_shared_read_begin(struct obl_database *d);
+
+/**
+ * Release the right acquired by _obl_shared_read_begin().  For internal use
+ * only.
+ */
+void _obl_shared_read_end(struct obl_database *d);
+
+/**
+ * Acquire exclusive access to the database contents on behalf of a commit
+ * and catch up with any commits made by other processes.  The caller must
+ * hold the content lock.  Pair each successful call with
+ * _obl_shared_write_end().  For internal use only.
+ *
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_shared_write_begin(struct obl_database *d);
+
+/**
+ * Publish a commit to other processes by advancing the commit sequence, then
+ * release the access acquired by _obl_shared_write_begin().  For internal
+ * use only.
+ *
+ * @param d
+ * @param committed Nonzero if the database contents were changed.
+ */
+void _obl_shared_write_end(struct obl_database *d, int committed);
+
+/**
+ * Return a counter that advances each time this process catches up with
+ * commits made by other processes.  Sessions compare it with the value they
+ * last saw to decide whether the objects they hold are stale.  The caller
+ * must hold read or write access.  For internal use only.
+ */
+unsigned long _obl_shared_generation(struct obl_database *d);
+
+#endif /* SHARED_H */
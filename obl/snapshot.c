@@ -0,0 +1,269 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file snapshot.c
+ */
+
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "addressmap.h"
+#include "constants.h"
+#include "database.h"
+
+/* Internal function prototypes. */
+
+/** Append an extent to a list.  Returns 1 if memory is exhausted. */
+static int _append(struct obl_extent_list *list, obl_physical_address address,
+        obl_uint size, uint64_t version);
+
+/** Return reclaimed space to the bin or list for its size. */
+static void _free_extent(struct obl_snapshots *snapshots,
+        obl_physical_address address, obl_uint size);
+
+/** Free a list's storage. */
+static void _clear(struct obl_extent_list *list);
+
+/* External function definitions. */
+
+void _obl_snapshots_init(struct obl_snapshots *snapshots)
+{
+    memset(snapshots, 0, sizeof(struct obl_snapshots));
+    pthread_mutex_init(&snapshots->lock, NULL);
+}
+
+void _obl_snapshots_destroy(struct obl_snapshots *snapshots)
+{
+    size_t i;
+
+    _clear(&snapshots->retired);
+    for (i = 0; i < OBL_FREE_BINS; i++) {
+        _clear(&snapshots->bins[i]);
+    }
+    _clear(&snapshots->large);
+    _clear(&snapshots->copies);
+
+    pthread_mutex_destroy(&snapshots->lock);
+}
+
+void _obl_snapshot_pin(struct obl_database *d, struct obl_snapshot *snapshot)
+{
+    struct obl_snapshots *snapshots = &d->snapshots;
+
+    snapshot->address_map = d->root.address_map_addr;
+    snapshot->version = d->commit_version;
+
+    pthread_mutex_lock(&snapshots->lock);
+    snapshot->older = snapshots->newest;
+    snapshot->newer = NULL;
+    if (snapshots->newest != NULL) {
+        snapshots->newest->newer = snapshot;
+    } else {
+        snapshots->oldest = snapshot;
+    }
+    snapshots->newest = snapshot;
+    snapshot->pinned = 1;
+    pthread_mutex_unlock(&snapshots->lock);
+}
+
+void _obl_snapshot_unpin(struct obl_database *d,
+        struct obl_snapshot *snapshot)
+{
+    struct obl_snapshots *snapshots = &d->snapshots;
+
+    pthread_mutex_lock(&snapshots->lock);
+    if (snapshot->older != NULL) {
+        snapshot->older->newer = snapshot->newer;
+    } else {
+        snapshots->oldest = snapshot->newer;
+    }
+    if (snapshot->newer != NULL) {
+        snapshot->newer->older = snapshot->older;
+    } else {
+        snapshots->newest = snapshot->older;
+    }
+    snapshot->older = snapshot->newer = NULL;
+    snapshot->pinned = 0;
+    pthread_mutex_unlock(&snapshots->lock);
+}
+
+int _obl_snapshots_pinned(struct obl_database *d)
+{
+    int pinned;
+
+    pthread_mutex_lock(&d->snapshots.lock);
+    pinned = d->snapshots.oldest != NULL;
+    pthread_mutex_unlock(&d->snapshots.lock);
+
+    return pinned;
+}
+
+void _obl_retire(struct obl_database *d, obl_physical_address address,
+        obl_uint size)
+{
+    /* The commit in progress is stamped with the next version. */
+    _append(&d->snapshots.retired, address, size, d->commit_version + 1);
+}
+
+size_t _obl_retire_mark(struct obl_database *d)
+{
+    return d->snapshots.retired.count;
+}
+
+void _obl_unretire(struct obl_database *d, size_t mark)
+{
+    if (mark < d->snapshots.retired.count) {
+        d->snapshots.retired.count = mark;
+    }
+}
+
+void _obl_reclaim(struct obl_database *d)
+{
+    struct obl_snapshots *snapshots = &d->snapshots;
+    struct obl_extent_list *retired = &snapshots->retired;
+    uint64_t oldest;
+    int reclaimed = 0;
+
+    /*
+     * Snapshots are pinned in version order, so the oldest one sees the
+     * least.  Space superseded by a commit that it has seen is unreachable.
+     */
+    pthread_mutex_lock(&snapshots->lock);
+    oldest = snapshots->oldest != NULL ?
+            snapshots->oldest->version : UINT64_MAX;
+    pthread_mutex_unlock(&snapshots->lock);
+
+    while (snapshots->retired_first < retired->count &&
+            retired->extents[snapshots->retired_first].version <= oldest) {
+        struct obl_extent *e = &retired->extents[snapshots->retired_first++];
+
+        _free_extent(snapshots, e->address, e->size);
+        reclaimed = 1;
+    }
+
+    /* No cached translation may lead into space that's about to be reused. */
+    if (reclaimed) {
+        _obl_address_cache_clear(d);
+    }
+
+    if (snapshots->retired_first == retired->count) {
+        retired->count = snapshots->retired_first = 0;
+    } else if (snapshots->retired_first > retired->count / 2) {
+        retired->count -= snapshots->retired_first;
+        memmove(retired->extents, retired->extents + snapshots->retired_first,
+                retired->count * sizeof(struct obl_extent));
+        snapshots->retired_first = 0;
+    }
+}
+
+obl_physical_address _obl_reuse_physical(struct obl_database *d,
+        obl_uint size)
+{
+    struct obl_snapshots *snapshots = &d->snapshots;
+    struct obl_extent_list *large = &snapshots->large;
+    obl_physical_address result;
+    size_t i;
+
+    if (size < OBL_FREE_BINS && snapshots->bins[size].count > 0) {
+        struct obl_extent_list *bin = &snapshots->bins[size];
+
+        return bin->extents[--bin->count].address;
+    }
+
+    for (i = 0; i < large->count; i++) {
+        struct obl_extent *e = &large->extents[i];
+
+        if (e->size < size) {
+            continue;
+        }
+
+        result = e->address;
+        e->address += size;
+        e->size -= size;
+        if (e->size < OBL_FREE_BINS) {
+            struct obl_extent rest = *e;
+
+            *e = large->extents[--large->count];
+            if (rest.size > 0) {
+                _free_extent(snapshots, rest.address, rest.size);
+            }
+        }
+        return result;
+    }
+
+    return OBL_PHYSICAL_UNASSIGNED;
+}
+
+void _obl_note_copy(struct obl_database *d, obl_physical_address page)
+{
+    /* Without room to remember it, the page is merely copied again. */
+    _append(&d->snapshots.copies, page, CHUNK_SIZE + 2, 0);
+}
+
+int _obl_is_copy(struct obl_database *d, obl_physical_address page)
+{
+    struct obl_extent_list *copies = &d->snapshots.copies;
+    size_t i;
+
+    /* Assignments tend to follow one another down the same path. */
+    for (i = copies->count; i > 0; i--) {
+        if (copies->extents[i - 1].address == page) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void _obl_forget_copies(struct obl_database *d)
+{
+    d->snapshots.copies.count = 0;
+}
+
+/* Internal function definitions. */
+
+static int _append(struct obl_extent_list *list, obl_physical_address address,
+        obl_uint size, uint64_t version)
+{
+    struct obl_extent *e;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 64 : 2 * list->capacity;
+        struct obl_extent *grown;
+
+        grown = realloc(list->extents, capacity * sizeof(struct obl_extent));
+        if (grown == NULL) {
+            return 1;
+        }
+        list->extents = grown;
+        list->capacity = capacity;
+    }
+
+    e = &list->extents[list->count++];
+    e->address = address;
+    e->size = size;
+    e->version = version;
+
+    return 0;
+}
+
+static void _free_extent(struct obl_snapshots *snapshots,
+        obl_physical_address address, obl_uint size)
+{
+    if (size < OBL_FREE_BINS) {
+        _append(&snapshots->bins[size], address, size, 0);
+    } else {
+        _append(&snapshots->large, address, size, 0);
+    }
+}
+
+static void _clear(struct obl_extent_list *list)
+{
+    free(list->extents);
+    list->extents = NULL;
+    list->count = list->capacity = 0;
+}
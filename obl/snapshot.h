@@ -0,0 +1,230 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file snapshot.h
+ *
+ * Snapshots let a session read a database as of one commit while other
+ * sessions keep committing.  See obl_begin_snapshot().
+ *
+ * A snapshot pins the root of the address map as it stood when the snapshot
+ * was begun.  While any snapshot is pinned, commits copy on write: changed
+ * objects are written to fresh physical space rather than over their former
+ * versions, and the address map pages on the way to each changed mapping are
+ * copied rather than changed, so that every commit publishes a new root and
+ * leaves the pages and objects reachable from older roots as they were.
+ * While no snapshot is pinned, commits write in place as usual.
+ *
+ * The space that a commit supersedes is retired, tagged with that commit's
+ * version.  Once no pinned snapshot is older than that version, it's
+ * reclaimed, and the allocator hands it out again before leasing new space.
+ * Reclaimed space is only remembered while the database is open.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform.h"
+
+/* Defined in database.h */
+struct obl_database;
+
+/** Freed extents of each size below this many words are kept apart. */
+#define OBL_FREE_BINS 64
+
+/**
+ * The state of the database that one session is reading.
+ */
+struct obl_snapshot
+{
+    /** Set while the snapshot is pinned. */
+    int pinned;
+
+    /** The root of the address map when the snapshot was begun. */
+    obl_physical_address address_map;
+
+    /** The version of the last commit that the snapshot sees. */
+    uint64_t version;
+
+    /** Neighbouring pinned snapshots, in the order that they were begun. */
+    struct obl_snapshot *older, *newer;
+};
+
+/**
+ * A run of physical space.
+ */
+struct obl_extent
+{
+    obl_physical_address address;
+
+    obl_uint size;
+
+    /** For retired space, the version of the commit that superseded it. */
+    uint64_t version;
+};
+
+/**
+ * A growable array of extents.
+ */
+struct obl_extent_list
+{
+    struct obl_extent *extents;
+
+    size_t count, capacity;
+};
+
+/**
+ * A database's pinned snapshots, and the space that commits have left behind
+ * for them.
+ */
+struct obl_snapshots
+{
+    /** The oldest and newest pinned snapshots, or NULL. */
+    struct obl_snapshot *oldest, *newest;
+
+    /** Guards oldest, newest and the links between pinned snapshots. */
+    pthread_mutex_t lock;
+
+    /**
+     * Space superseded by commits made while snapshots were pinned, in commit
+     * order.  Entries before retired_first have been reclaimed.
+     */
+    struct obl_extent_list retired;
+    size_t retired_first;
+
+    /** Reclaimed extents of each size below OBL_FREE_BINS. */
+    struct obl_extent_list bins[OBL_FREE_BINS];
+
+    /** Reclaimed extents of larger sizes. */
+    struct obl_extent_list large;
+
+    /** The address map pages copied by the commit in progress. */
+    struct obl_extent_list copies;
+};
+
+/**
+ * Prepare a database's snapshot state.  For internal use only.
+ *
+ * @param snapshots
+ */
+void _obl_snapshots_init(struct obl_snapshots *snapshots);
+
+/**
+ * Release a database's snapshot state.  No snapshot may be pinned.  For
+ * internal use only.
+ *
+ * @param snapshots
+ */
+void _obl_snapshots_destroy(struct obl_snapshots *snapshots);
+
+/**
+ * Pin a snapshot of the database as it stands.  The caller must hold read or
+ * write access to the database contents.  For internal use only.
+ *
+ * @param d
+ * @param snapshot
+ */
+void _obl_snapshot_pin(struct obl_database *d, struct obl_snapshot *snapshot);
+
+/**
+ * Unpin a snapshot.  The space that it kept from being reclaimed is reclaimed
+ * by the next commit.  For internal use only.
+ *
+ * @param d
+ * @param snapshot
+ */
+void _obl_snapshot_unpin(struct obl_database *d,
+        struct obl_snapshot *snapshot);
+
+/**
+ * Return nonzero if any snapshot is pinned, in which case commits must copy on
+ * write.  The caller must have exclusive access to the database, so that no
+ * snapshot can be pinned until it's done.  For internal use only.
+ *
+ * @param d
+ */
+int _obl_snapshots_pinned(struct obl_database *d);
+
+/**
+ * Retire space that the commit in progress has superseded.  If memory is
+ * exhausted, the space is never reclaimed.  Requires exclusive access to the
+ * database.  For internal use only.
+ *
+ * @param d
+ * @param address
+ * @param size In words.
+ */
+void _obl_retire(struct obl_database *d, obl_physical_address address,
+        obl_uint size);
+
+/**
+ * Return a mark to which later retirements can be undone with
+ * _obl_unretire().  Requires exclusive access to the database.  For internal
+ * use only.
+ *
+ * @param d
+ */
+size_t _obl_retire_mark(struct obl_database *d);
+
+/**
+ * Undo the retirements made since _obl_retire_mark() returned +mark+, when
+ * the changes that superseded the space are abandoned.  Requires exclusive
+ * access to the database.  For internal use only.
+ *
+ * @param d
+ * @param mark
+ */
+void _obl_unretire(struct obl_database *d, size_t mark);
+
+/**
+ * Reclaim the retired space that no pinned snapshot can see.  Requires
+ * exclusive access to the database.  For internal use only.
+ *
+ * @param d
+ */
+void _obl_reclaim(struct obl_database *d);
+
+/**
+ * Take +size+ words of reclaimed space.  Requires exclusive access to the
+ * database.  For internal use only.
+ *
+ * @param d
+ * @param size
+ * @return The address of the space, or OBL_PHYSICAL_UNASSIGNED if there's no
+ *      reclaimed extent large enough.
+ */
+obl_physical_address _obl_reuse_physical(struct obl_database *d,
+        obl_uint size);
+
+/**
+ * Record that the commit in progress copied or created an address map page,
+ * which it may then change in place.  Requires exclusive access to the
+ * database.  For internal use only.
+ *
+ * @param d
+ * @param page
+ */
+void _obl_note_copy(struct obl_database *d, obl_physical_address page);
+
+/**
+ * Return nonzero if the commit in progress copied or created an address map
+ * page.  Requires exclusive access to the database.  For internal use only.
+ *
+ * @param d
+ * @param page
+ */
+int _obl_is_copy(struct obl_database *d, obl_physical_address page);
+
+/**
+ * Forget the address map pages copied by a commit, once it's done with the
+ * address map.  For internal use only.
+ *
+ * @param d
+ */
+void _obl_forget_copies(struct obl_database *d);
+
+#endif /* SNAPSHOT_H */
@@ -18,9 +18,26 @@
 struct obl_object *obl_create_addrtreepage(obl_uint depth)
 {
     struct obl_object *result;
-    struct obl_addrtreepage_storage *storage;
     obl_uint i;
 
+    result = _obl_allocate_addrtreepage(depth);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < CHUNK_SIZE; i++) {
+        result->storage.addrtreepage_storage->contents[i] =
+                OBL_PHYSICAL_UNASSIGNED;
+    }
+
+    return result;
+}
+
+struct obl_object *_obl_allocate_addrtreepage(obl_uint depth)
+{
+    struct obl_object *result;
+    struct obl_addrtreepage_storage *storage;
+
     result = _obl_allocate_object();
     if (result == NULL) {
         return NULL;
@@ -34,9 +51,6 @@ struct obl_object *obl_create_addrtreepage(obl_uint depth)
         return NULL;
     }
     storage->height = depth;
-    for (i = 0; i < CHUNK_SIZE; i++) {
-        storage->contents[i] = OBL_PHYSICAL_UNASSIGNED;
-    }
     result->storage.addrtreepage_storage = storage;
 
     return result;
@@ -52,7 +66,10 @@ struct obl_object *obl_addrtreepage_read(struct obl_session *session,
     int i;
 
     height = readable_uint(source[base + 1]);
-    result = obl_create_addrtreepage(height);
+    result = _obl_allocate_addrtreepage(height);
+    if (result == NULL) {
+        return obl_nil();
+    }
 
     for (i = 0; i < CHUNK_SIZE; i++) {
         addr = (obl_physical_address) readable_uint(source[base + 2 + i]);
@@ -62,19 +79,18 @@ struct obl_object *obl_addrtreepage_read(struct obl_session *session,
     return result;
 }
 
-void obl_addrtreepage_write(struct obl_object *treepage, obl_uint *dest)
+void obl_addrtreepage_write(struct obl_object *treepage, obl_uint *dest,
+        obl_physical_address offset)
 {
     int i;
-    obl_physical_address base;
     obl_physical_address *contents;
 
-    base = treepage->physical_address;
-    dest[base + 1] =
+    dest[offset + 1] =
             writable_uint(treepage->storage.addrtreepage_storage->height);
 
     contents = treepage->storage.addrtreepage_storage->contents;
     for (i = 0; i < CHUNK_SIZE; i++) {
-        dest[base + 2 + i] = writable_uint((obl_uint) contents[i]);
+        dest[offset + 2 + i] = writable_uint((obl_uint) contents[i]);
     }
 }
 
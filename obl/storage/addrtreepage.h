@@ -52,6 +52,16 @@ struct obl_addrtreepage_storage {
  */
 struct obl_object *obl_create_addrtreepage(obl_uint depth);
 
+/**
+ * Allocate an address tree page without initializing its contents, for a
+ * decoder that fills all of them itself.  For internal use only.
+ *
+ * @param depth
+ * @return A newly allocated address tree page, or NULL if memory is
+ *      exhausted.
+ */
+struct obl_object *_obl_allocate_addrtreepage(obl_uint depth);
+
 /**
  * Read an address tree page.  Address tree pages reference each other by
  * physical address (so that they can used during the address lookup process)
@@ -64,7 +74,8 @@ struct obl_object *obl_addrtreepage_read(struct obl_session *session,
 /**
  * Write an address map tree page.
  */
-void obl_addrtreepage_write(struct obl_object *treepage, obl_uint *dest);
+void obl_addrtreepage_write(struct obl_object *treepage, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Output the contents of an address tree page.  This will usually be an
@@ -19,9 +19,25 @@
 struct obl_object *obl_create_fixed(obl_uint length)
 {
     struct obl_object *result;
-    struct obl_fixed_storage *storage;
     obl_uint i;
 
+    result = _obl_allocate_fixed(length);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < length; i++) {
+        result->storage.fixed_storage->contents[i] = obl_nil();
+    }
+
+    return result;
+}
+
+struct obl_object *_obl_allocate_fixed(obl_uint length)
+{
+    struct obl_object *result;
+    struct obl_fixed_storage *storage;
+
     result = _obl_allocate_object();
     if (result == NULL) {
         return NULL;
@@ -46,10 +62,6 @@ struct obl_object *obl_create_fixed(obl_uint length)
         return NULL;
     }
 
-    for (i = 0; i < length; i++) {
-        storage->contents[i] = obl_nil();
-    }
-
     return result;
 }
 
@@ -88,7 +100,7 @@ void obl_fixed_at_put(struct obl_object *fixed, const obl_uint index,
 {
     struct obl_session *s = fixed->session;
     struct obl_transaction *t;
-    int created = 0;
+    int implicit;
 
     if (obl_storage_of(fixed) != OBL_FIXED) {
         obl_report_error(obl_database_of(fixed), OBL_WRONG_STORAGE,
@@ -104,12 +116,14 @@ void obl_fixed_at_put(struct obl_object *fixed, const obl_uint index,
         return ;
     }
 
-    t = obl_ensure_transaction(s, &created);
+    t = _obl_begin_mutation(s, &implicit);
 
-    obl_mark_dirty(fixed);
+    _obl_mark_dirty_word(fixed, 2 + index);
+    _obl_log_reference(fixed, 2 + index,
+            fixed->storage.fixed_storage->contents[index]);
     fixed->storage.fixed_storage->contents[index] = value;
 
-    if (created) obl_commit_transaction(t);
+    _obl_end_mutation(t, implicit);
 }
 
 struct obl_object *obl_fixed_read(struct obl_session *session,
@@ -117,37 +131,36 @@ struct obl_object *obl_fixed_read(struct obl_session *session,
         obl_physical_address base, int depth)
 {
     obl_uint length;
-    obl_uint i;
     struct obl_object *o;
-    obl_logical_address addr;
-    struct obl_object *linked;
 
     length = readable_uint(source[base + 1]);
-    o = obl_create_fixed(length);
-
-    for (i = 0; i < length; i++) {
-        addr = readable_logical(source[base + 2 + i]);
-        linked = _obl_at_address_depth(session, addr, depth - 1, 0);
-        obl_fixed_at_put(o, i, linked);
+    o = _obl_allocate_fixed(length);
+    if (o == NULL) {
+        return obl_nil();
     }
 
+    /* Children are stored directly into the new collection. */
+    _obl_read_children(session, &source[base + 2], length, depth - 1,
+            o->storage.fixed_storage->contents);
+
     return o;
 }
 
-void obl_fixed_write(struct obl_object *fixed, obl_uint *dest)
+void obl_fixed_write(struct obl_object *fixed, obl_uint *dest,
+        obl_physical_address offset)
 {
     obl_uint length;
     obl_uint i;
     struct obl_object *linked;
 
     length = obl_fixed_size(fixed);
-    dest[fixed->physical_address + 1] = writable_uint(length);
+    dest[offset + 1] = writable_uint(length);
 
     for (i = 0; i < length; i++) {
         /* Avoid unnecessarily resolving any stubs. */
         linked = fixed->storage.fixed_storage->contents[i];
 
-        dest[fixed->physical_address + 2 + i] = writable_uint(
+        dest[offset + 2 + i] = writable_uint(
                 (obl_uint) linked->logical_address);
     }
 }
@@ -186,6 +199,21 @@ struct obl_object_list *_obl_fixed_children(struct obl_object *fixed)
     return results;
 }
 
+int _obl_fixed_each_child(struct obl_object *fixed,
+        obl_child_callback callback, void *data)
+{
+    struct obl_fixed_storage *storage = fixed->storage.fixed_storage;
+    obl_uint i;
+    int result;
+
+    result = (*callback)(fixed->shape, data);
+    for (i = 0; result == 0 && i < storage->length; i++) {
+        result = (*callback)(storage->contents[i], data);
+    }
+
+    return result;
+}
+
 void _obl_fixed_deallocate(struct obl_object *fixed)
 {
     free(fixed->storage.fixed_storage->contents);
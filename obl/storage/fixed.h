@@ -11,6 +11,7 @@
 #ifndef FIXED_H
 #define FIXED_H
 
+#include "storage/storagetypes.h"
 #include "platform.h"
 
 /* defined in object.h */
@@ -49,6 +50,16 @@ struct obl_fixed_storage {
  */
 struct obl_object *obl_create_fixed(obl_uint length);
 
+/**
+ * Allocate a fixed-size collection without initializing its elements, for a
+ * decoder that fills every one of them itself.  For internal use only.
+ *
+ * @param length
+ * @return A newly allocated obl_object with obl_fixed_storage, or NULL if
+ *      memory is exhausted.
+ */
+struct obl_object *_obl_allocate_fixed(obl_uint length);
+
 /**
  * Access the number of elements present in a fixed-size collection.
  *
@@ -92,7 +103,8 @@ struct obl_object *obl_fixed_read(struct obl_session *session,
 /**
  * Write a fixed-length collection.
  */
-void obl_fixed_write(struct obl_object *fixed, obl_uint *dest);
+void obl_fixed_write(struct obl_object *fixed, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Output the contents of a fixed collection to stdout.
@@ -112,6 +124,18 @@ void obl_fixed_print(struct obl_object *fixed, int depth, int indent);
  */
 struct obl_object_list *_obl_fixed_children(struct obl_object *fixed);
 
+/**
+ * Invoke a callback with each obl_object referenced by this one, as
+ * _obl_fixed_children() would list them.  For internal use only.
+ *
+ * @param fixed The root object.
+ * @param callback
+ * @param data Passed through to +callback+.
+ * @return 0, or the first nonzero value returned by +callback+.
+ */
+int _obl_fixed_each_child(struct obl_object *fixed,
+        obl_child_callback callback, void *data);
+
 /**
  * Deallocate a fixed object, its internal storage, and any obl_stub_storage
  * objects linked from it.  For internal use only.
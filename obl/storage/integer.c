@@ -54,7 +54,7 @@ void obl_integer_set(struct obl_object *integer, obl_int value)
 {
     struct obl_session *s = integer->session;
     struct obl_transaction *t;
-    int created = 0;
+    int implicit;
 
     if (obl_storage_of(integer) != OBL_INTEGER) {
         obl_report_error(obl_database_of(integer), OBL_WRONG_STORAGE,
@@ -62,12 +62,13 @@ void obl_integer_set(struct obl_object *integer, obl_int value)
         return ;
     }
 
-    t = obl_ensure_transaction(s, &created);
+    t = _obl_begin_mutation(s, &implicit);
 
-    obl_mark_dirty(integer);
+    _obl_mark_dirty_word(integer, 1);
+    _obl_log_integer(integer, integer->storage.integer_storage->value);
     integer->storage.integer_storage->value = value;
 
-    if (created) obl_commit_transaction(t);
+    _obl_end_mutation(t, implicit);
 }
 
 /* Integers are stored in 32 bits, network byte order. */
@@ -78,12 +79,13 @@ struct obl_object *obl_integer_read(struct obl_session *session,
     return obl_create_integer(readable_int(source[base + 1]));
 }
 
-void obl_integer_write(struct obl_object *integer, obl_uint *dest)
+void obl_integer_write(struct obl_object *integer, obl_uint *dest,
+        obl_physical_address offset)
 {
     obl_int value;
 
     value = obl_integer_value(integer);
-    dest[integer->physical_address + 1] = writable_int(value);
+    dest[offset + 1] = writable_int(value);
 }
 
 void obl_integer_print(struct obl_object *integer, int depth, int indent)
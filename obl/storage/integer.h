@@ -65,7 +65,8 @@ struct obl_object *obl_integer_read(struct obl_session *session,
 /**
  * Write an integer object.
  */
-void obl_integer_write(struct obl_object *integer, obl_uint *dest);
+void obl_integer_write(struct obl_object *integer, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Output an integer to stdout.
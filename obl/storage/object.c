@@ -24,13 +24,17 @@ static struct obl_object *invalid_read(struct obl_session *session,
         struct obl_object *shape, obl_uint *source,
         obl_physical_address offset, int depth);
 
-static void invalid_write(struct obl_object *o, obl_uint *dest);
+static void invalid_write(struct obl_object *o, obl_uint *dest,
+        obl_physical_address offset);
 
 static void invalid_print(struct obl_object *o,
         int depth, int indent);
 
 static struct obl_object_list *no_children(struct obl_object *root);
 
+static int no_each_child(struct obl_object *root,
+        obl_child_callback callback, void *data);
+
 static void simple_deallocate(struct obl_object *o);
 
 /* Function types. */
@@ -46,11 +50,12 @@ typedef struct obl_object *(*read_function)(struct obl_session *session,
         obl_physical_address offset, int depth);
 
 /**
- * Signature of a function that writes an obl_object into a memory-mapped file,
- * not including its shape header word.  The object will be written at a
- * location specified by its assigned physical address.
+ * Signature of a function that writes an obl_object into a memory-mapped file
+ * or buffer, not including its shape header word.  The object will be written
+ * at +offset+ words from +dest+.
  */
-typedef void (*write_function)(struct obl_object *object, obl_uint *source);
+typedef void (*write_function)(struct obl_object *object, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Signature of a function that recursively prints an object to stdout.
@@ -64,6 +69,13 @@ typedef void (*print_function)(struct obl_object *o, int depth, int indent);
 typedef struct obl_object_list *(*children_function)(
         struct obl_object *root);
 
+/**
+ * Signature of a function that hands each of an obl_object's references to
+ * a callback.
+ */
+typedef int (*each_child_function)(struct obl_object *root,
+        obl_child_callback callback, void *data);
+
 /**
  * Signature of a function that deallocates an object and its internal
  * structure.
@@ -80,7 +92,7 @@ typedef void (*deallocate_function)(struct obl_object *o);
 static read_function read_functions[OBL_STORAGE_TYPE_MAX + 1] = {
         &obl_shape_read,        /* OBL_SHAPE */
         &obl_slotted_read,      /* OBL_SLOTTED */
-        &invalid_read,          /* OBL_FIXED */
+        &obl_fixed_read,        /* OBL_FIXED */
         &invalid_read,          /* OBL_CHUNK */
         &obl_addrtreepage_read, /* OBL_ADDRTREEPAGE */
         &obl_integer_read,      /* OBL_INTEGER */
@@ -146,6 +158,22 @@ static children_function children_functions[OBL_STORAGE_TYPE_MAX + 1] = {
         &no_children            /* OBL_STUB */
 };
 
+static each_child_function each_child_functions[OBL_STORAGE_TYPE_MAX + 1] = {
+        &_obl_shape_each_child,   /* OBL_SHAPE */
+        &_obl_slotted_each_child, /* OBL_SLOTTED */
+        &_obl_fixed_each_child,   /* OBL_FIXED */
+        &no_each_child,           /* OBL_CHUNK */
+        &no_each_child,           /* OBL_ADDRTREEPAGE */
+        &no_each_child,           /* OBL_INTEGER */
+        &no_each_child,           /* OBL_FLOAT */
+        &no_each_child,           /* OBL_DOUBLE */
+        &no_each_child,           /* OBL_CHAR */
+        &no_each_child,           /* OBL_STRING */
+        &no_each_child,           /* OBL_BOOLEAN */
+        &no_each_child,           /* OBL_NIL */
+        &no_each_child            /* OBL_STUB */
+};
+
 static deallocate_function deallocate_functions[OBL_STORAGE_TYPE_MAX + 1] = {
         &simple_deallocate,       /* OBL_SHAPE */
         &_obl_slotted_deallocate, /* OBL_SLOTTED */
@@ -173,7 +201,7 @@ obl_uint obl_object_wordsize(struct obl_object *o)
     case OBL_SLOTTED:
         return 1 + obl_shape_slotcount(o->shape);
     case OBL_FIXED:
-        return 1 + obl_fixed_size(o);
+        return 2 + obl_fixed_size(o);
     case OBL_CHUNK:
         return 2 + CHUNK_SIZE;
     case OBL_ADDRTREEPAGE:
@@ -261,17 +289,27 @@ struct obl_object *obl_read_object(struct obl_session *s, obl_uint *source,
     }
 
     result = (read_functions[function_index])(s, shape, source, base, depth);
+    if (result == obl_nil()) {
+        return result;
+    }
     result->shape = shape;
     result->physical_address = base;
+    result->read_version = d->commit_version;
 
     return result;
 }
 
+void obl_write_object(struct obl_object *o, obl_uint *dest)
+{
+    obl_write_object_at(o, dest, o->physical_address);
+}
+
 /*
  * Writes the shape address and delegates to the appropriate write function
  * for this object's storage type.
  */
-void obl_write_object(struct obl_object *o, obl_uint *dest)
+void obl_write_object_at(struct obl_object *o, obl_uint *dest,
+        obl_physical_address offset)
 {
     struct obl_object *shape;
     int function_index;
@@ -290,9 +328,9 @@ void obl_write_object(struct obl_object *o, obl_uint *dest)
         function_index = (int) OBL_SHAPE;
     }
 
-    dest[o->physical_address] = writable_logical(shape->logical_address);
+    dest[offset] = writable_logical(shape->logical_address);
 
-    (*write_functions[function_index])(o, dest);
+    (*write_functions[function_index])(o, dest, offset);
 }
 
 void obl_object_list_append(struct obl_object_list **list,
@@ -323,6 +361,12 @@ struct obl_object_list *_obl_children(struct obl_object *root)
     return (*children_functions[obl_storage_of(root)])(root);
 }
 
+int _obl_each_child(struct obl_object *root, obl_child_callback callback,
+        void *data)
+{
+    return (*each_child_functions[obl_storage_of(root)])(root, callback, data);
+}
+
 struct obl_object *_obl_allocate_object()
 {
     struct obl_object *result = malloc(sizeof(struct obl_object));
@@ -335,6 +379,12 @@ struct obl_object *_obl_allocate_object()
     result->session = NULL;
     result->logical_address = OBL_LOGICAL_UNASSIGNED;
     result->physical_address = OBL_PHYSICAL_UNASSIGNED;
+    result->cache.charge = 0;
+    result->cache.pins = 0;
+    result->cache.committing = 0;
+    result->cache.referenced = 0;
+    result->dirty_words = NULL;
+    result->read_version = 0;
     return result;
 }
 
@@ -344,10 +394,17 @@ struct obl_object *_obl_allocate_object()
  */
 void _obl_deallocate_object(struct obl_object *o)
 {
-    (*deallocate_functions[obl_storage_of(o)])(o);
+    _obl_deallocate_storage(o);
+    free(o->dirty_words);
     free(o);
 }
 
+void _obl_deallocate_storage(struct obl_object *o)
+{
+    (*deallocate_functions[obl_storage_of(o)])(o);
+    o->storage.any_storage = NULL;
+}
+
 /* Static function implementations. */
 
 /**
@@ -368,7 +425,8 @@ static struct obl_object *invalid_read(struct obl_session *session,
  * Invoked for any storage type that is either not defined yet, or isn't
  * supposed to actually be written to the database.
  */
-static void invalid_write(struct obl_object *o, obl_uint *dest)
+static void invalid_write(struct obl_object *o, obl_uint *dest,
+        obl_physical_address offset)
 {
     obl_report_errorf(obl_database_of(o), OBL_WRONG_STORAGE,
             "Attempt to write an object with an invalid storage type (%lu).",
@@ -401,6 +459,20 @@ static struct obl_object_list *no_children(struct obl_object *root)
     return NULL;
 }
 
+/**
+ * The each_child_function counterpart of no_children().
+ *
+ * @param root Any object of a storage type without direct children.
+ * @param callback Never invoked.
+ * @param data Ignored.
+ * @return 0.
+ */
+static int no_each_child(struct obl_object *root,
+        obl_child_callback callback, void *data)
+{
+    return 0;
+}
+
 /**
  * An deallocate_function to be invoked for any object without
  * special storage requirements.  This is sufficient for any obl_object storage
@@ -15,6 +15,7 @@
 #define OBJECT_H
 
 #include "storage/storagetypes.h"
+#include "cache.h"
 #include "platform.h"
 
 /* Include the headers for every storage type. */
@@ -92,6 +93,23 @@ struct obl_object
 
         void *any_storage;
     } storage;
+
+    /** Bookkeeping for the owning session's object cache.  See cache.h. */
+    struct obl_cache_entry cache;
+
+    /**
+     * While this object is in its session's write set, one bit for each word
+     * of it that has changed, or NULL if the whole object needs to be written.
+     * See _obl_mark_dirty_word().
+     */
+    uint64_t *dirty_words;
+
+    /**
+     * The commit version that this object's contents were read at, or that
+     * its session last committed it at.  A commit that writes it conflicts
+     * with any later commit that has written it since.  See versions.h.
+     */
+    uint64_t read_version;
 };
 
 /**
@@ -182,6 +200,18 @@ struct obl_object *obl_read_object(struct obl_session *s, obl_uint *source,
  */
 void obl_write_object(struct obl_object *o, obl_uint *dest);
 
+/**
+ * Serialize an object at an arbitrary offset within a buffer, rather than at
+ * its physical address.  The object's children must already have logical
+ * addresses, but the object itself needn't have a physical one.
+ *
+ * @param o The object to write.
+ * @param dest The start of the buffer.
+ * @param offset Where, in words from dest, to write the object's shape word.
+ */
+void obl_write_object_at(struct obl_object *o, obl_uint *dest,
+        obl_physical_address offset);
+
 /**
  * Append an entry to an existing obl_object_list or create a new
  * obl_object_list.
@@ -209,6 +239,19 @@ void obl_destroy_object_list(struct obl_object_list *list);
  */
 struct obl_object_list *_obl_children(struct obl_object *root);
 
+/**
+ * Invoke a callback with each obl_object directly referenced by root, without
+ * allocating anything.  For internal use only; as with _obl_children(), stubs
+ * are not resolved.
+ *
+ * @param root
+ * @param callback Invoked with each child and +data+.
+ * @param data Passed through to +callback+.
+ * @return 0, or the first nonzero value returned by +callback+.
+ */
+int _obl_each_child(struct obl_object *root, obl_child_callback callback,
+        void *data);
+
 /**
  * Allocate a new obl_object from the heap, without specified storage.  For
  * internal use only.
@@ -227,4 +270,12 @@ struct obl_object *_obl_allocate_object();
  */
 void _obl_deallocate_object(struct obl_object *o);
 
+/**
+ * Free an obl_object's internal storage, but not the obl_object itself.  For
+ * internal use only.
+ *
+ * @param o The object whose storage should be released.
+ */
+void _obl_deallocate_storage(struct obl_object *o);
+
 #endif
@@ -213,18 +213,14 @@ struct obl_object *obl_shape_read(struct obl_session *session,
         int depth)
 {
     struct obl_object *result;
-    obl_logical_address addr;
-    struct obl_object *name, *slot_names, *current_shape;
+    struct obl_object *children[3], *name, *slot_names, *current_shape;
     obl_uint storage_format;
 
-    addr = readable_logical(source[base + 1]);
-    name = _obl_at_address_depth(session, addr, depth - 1, 0);
-
-    addr = readable_logical(source[base + 2]);
-    slot_names = _obl_at_address_depth(session, addr, depth - 1, 0);
-
-    addr = readable_logical(source[base + 3]);
-    current_shape = _obl_at_address_depth(session, addr, depth - 1, 0);
+    /* The name, slot names and current shape are stored consecutively. */
+    _obl_read_children(session, &source[base + 1], 3, depth - 1, children);
+    name = children[0];
+    slot_names = children[1];
+    current_shape = children[2];
 
     storage_format = readable_uint(source[base + 4]);
     if (storage_format > OBL_STORAGE_TYPE_MAX) {
@@ -238,7 +234,8 @@ struct obl_object *obl_shape_read(struct obl_session *session,
     return result;
 }
 
-void obl_shape_write(struct obl_object *shape, obl_uint *dest)
+void obl_shape_write(struct obl_object *shape, obl_uint *dest,
+        obl_physical_address offset)
 {
     struct obl_object *name, *slot_names, *current_shape;
 
@@ -246,14 +243,14 @@ void obl_shape_write(struct obl_object *shape, obl_uint *dest)
     slot_names = shape->storage.shape_storage->slot_names;
     current_shape = shape->storage.shape_storage->current_shape;
 
-    dest[shape->physical_address + 1] = writable_uint(
+    dest[offset + 1] = writable_uint(
             (obl_uint) name->logical_address);
-    dest[shape->physical_address + 2] = writable_uint(
+    dest[offset + 2] = writable_uint(
             (obl_uint) slot_names->logical_address);
-    dest[shape->physical_address + 3] = writable_uint(
+    dest[offset + 3] = writable_uint(
             (obl_uint) current_shape->logical_address);
 
-    dest[shape->physical_address + 4] = writable_uint(
+    dest[offset + 4] = writable_uint(
             (obl_uint) obl_shape_storagetype(shape));
 }
 
@@ -301,3 +298,23 @@ struct obl_object_list *_obl_shape_children(struct obl_object *shape)
 
     return results;
 }
+
+int _obl_shape_each_child(struct obl_object *shape,
+        obl_child_callback callback, void *data)
+{
+    struct obl_shape_storage *storage = shape->storage.shape_storage;
+    int result;
+
+    result = (*callback)(shape->shape, data);
+    if (result == 0) {
+        result = (*callback)(storage->name, data);
+    }
+    if (result == 0) {
+        result = (*callback)(storage->slot_names, data);
+    }
+    if (result == 0) {
+        result = (*callback)(storage->current_shape, data);
+    }
+
+    return result;
+}
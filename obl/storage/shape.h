@@ -148,7 +148,8 @@ struct obl_object *obl_shape_read(struct obl_session *session,
 /**
  * Write a shape object.
  */
-void obl_shape_write(struct obl_object *string, obl_uint *dest);
+void obl_shape_write(struct obl_object *string, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Output a shape nicely to stdout.
@@ -167,4 +168,16 @@ void obl_shape_print(struct obl_object *shape, int depth, int indent);
  */
 struct obl_object_list *_obl_shape_children(struct obl_object *shape);
 
+/**
+ * Invoke a callback with each object referenced by a shape, without
+ * allocating.  For internal use only.
+ *
+ * @param shape
+ * @param callback
+ * @param data Passed through to +callback+.
+ * @return 0, or the first nonzero value returned by +callback+.
+ */
+int _obl_shape_each_child(struct obl_object *shape,
+        obl_child_callback callback, void *data);
+
 #endif /* SHAPE_H */
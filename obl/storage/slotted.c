@@ -19,9 +19,7 @@
 struct obl_object *obl_create_slotted(struct obl_object *shape)
 {
     struct obl_object *result;
-    struct obl_slotted_storage *storage;
     obl_uint slot_count;
-    struct obl_object **slots;
     obl_uint i;
 
     if (obl_storage_of(shape) != OBL_SHAPE) {
@@ -30,6 +28,25 @@ struct obl_object *obl_create_slotted(struct obl_object *shape)
         return NULL;
     }
 
+    result = _obl_allocate_slotted(shape);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    slot_count = obl_shape_slotcount(shape);
+    for (i = 0; i < slot_count; i++) {
+        result->storage.slotted_storage->slots[i] = obl_nil();
+    }
+
+    return result;
+}
+
+struct obl_object *_obl_allocate_slotted(struct obl_object *shape)
+{
+    struct obl_object *result;
+    struct obl_slotted_storage *storage;
+    struct obl_object **slots;
+
     result = _obl_allocate_object();
     if (result == NULL) {
         return NULL;
@@ -44,8 +61,7 @@ struct obl_object *obl_create_slotted(struct obl_object *shape)
     result->storage.slotted_storage = storage;
     result->shape = shape;
 
-    slot_count = obl_shape_slotcount(shape);
-    slots = malloc(sizeof(struct obl_object*) * slot_count);
+    slots = malloc(sizeof(struct obl_object*) * obl_shape_slotcount(shape));
     if (slots == NULL) {
         obl_report_error(obl_database_of(shape), OBL_OUT_OF_MEMORY, NULL);
         free(result);
@@ -54,10 +70,6 @@ struct obl_object *obl_create_slotted(struct obl_object *shape)
     }
     storage->slots = slots;
 
-    for (i = 0; i < slot_count; i++) {
-        slots[i] = obl_nil();
-    }
-
     return result;
 }
 
@@ -101,7 +113,7 @@ void obl_slotted_at_put(struct obl_object *slotted,
 {
     struct obl_session *s = slotted->session;
     struct obl_transaction *t;
-    int created = 0;
+    int implicit;
     obl_uint maximum;
 
     if (obl_storage_of(slotted) != OBL_SLOTTED) {
@@ -119,12 +131,14 @@ void obl_slotted_at_put(struct obl_object *slotted,
         return ;
     }
 
-    t = obl_ensure_transaction(s, &created);
+    t = _obl_begin_mutation(s, &implicit);
 
-    obl_mark_dirty(slotted);
+    _obl_mark_dirty_word(slotted, 1 + index);
+    _obl_log_reference(slotted, 1 + index,
+            slotted->storage.slotted_storage->slots[index]);
     slotted->storage.slotted_storage->slots[index] = value;
 
-    if (created) obl_commit_transaction(t);
+    _obl_end_mutation(t, implicit);
 }
 
 void obl_slotted_atnamed_put(struct obl_object *slotted,
@@ -145,23 +159,22 @@ struct obl_object *obl_slotted_read(struct obl_session *session,
 {
     struct obl_object *result;
     obl_uint slot_count;
-    obl_uint i;
-    obl_logical_address addr;
-    struct obl_object *linked;
 
-    result = obl_create_slotted(shape);
+    result = _obl_allocate_slotted(shape);
+    if (result == NULL) {
+        return obl_nil();
+    }
 
+    /* Children are stored directly into the new object's slots. */
     slot_count = obl_shape_slotcount(shape);
-    for (i = 0; i < slot_count; i++) {
-        addr = readable_logical(source[base + 1 + i]);
-        linked = _obl_at_address_depth(session, addr, depth - 1, 0);
-        obl_slotted_at_put(result, i, linked);
-    }
+    _obl_read_children(session, &source[base + 1], slot_count, depth - 1,
+            result->storage.slotted_storage->slots);
 
     return result;
 }
 
-void obl_slotted_write(struct obl_object *slotted, obl_uint *dest)
+void obl_slotted_write(struct obl_object *slotted, obl_uint *dest,
+        obl_physical_address offset)
 {
     obl_uint slot_count;
     obl_uint i;
@@ -172,7 +185,7 @@ void obl_slotted_write(struct obl_object *slotted, obl_uint *dest)
         /* Avoid unnecessary stub resolution. */
         linked = slotted->storage.slotted_storage->slots[i];
 
-        dest[slotted->physical_address + 1 + i] = writable_uint(
+        dest[offset + 1 + i] = writable_uint(
                 (obl_uint) linked->logical_address);
     }
 }
@@ -229,6 +242,21 @@ struct obl_object_list *_obl_slotted_children(struct obl_object *slotted)
     return list;
 }
 
+int _obl_slotted_each_child(struct obl_object *slotted,
+        obl_child_callback callback, void *data)
+{
+    struct obl_slotted_storage *storage = slotted->storage.slotted_storage;
+    int count, result;
+
+    result = (*callback)(slotted->shape, data);
+    for (count = 0; result == 0 &&
+            count < obl_shape_slotcount(slotted->shape); count++) {
+        result = (*callback)(storage->slots[count], data);
+    }
+
+    return result;
+}
+
 void _obl_slotted_deallocate(struct obl_object *slotted)
 {
     free(slotted->storage.slotted_storage->slots);
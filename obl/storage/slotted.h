@@ -10,6 +10,7 @@
 #ifndef SLOTTED_H
 #define SLOTTED_H
 
+#include "storage/storagetypes.h"
 #include "platform.h"
 
 /* defined in object.h */
@@ -46,6 +47,15 @@ struct obl_slotted_storage {
  */
 struct obl_object *obl_create_slotted(struct obl_object *shape);
 
+/**
+ * Allocate a slotted object without initializing its slots, for a decoder
+ * that fills every one of them itself.  For internal use only.
+ *
+ * \param shape The shape to use for this object, which must be a valid shape.
+ * \return A newly allocated slotted object, or NULL if memory is exhausted.
+ */
+struct obl_object *_obl_allocate_slotted(struct obl_object *shape);
+
 /**
  * Return the object at a slot by index.
  *
@@ -112,7 +122,8 @@ struct obl_object *obl_slotted_read(struct obl_session *session,
 /**
  * Write a slotted object.
  */
-void obl_slotted_write(struct obl_object *slotted, obl_uint *dest);
+void obl_slotted_write(struct obl_object *slotted, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Output a slotted object nicely to stdout.
@@ -132,6 +143,18 @@ void obl_slotted_print(struct obl_object *slotted, int depth, int indent);
  */
 struct obl_object_list *_obl_slotted_children(struct obl_object *slotted);
 
+/**
+ * Invoke a callback with each of a slotted object's referenced children,
+ * without allocating.  For internal use only.
+ *
+ * @param slotted
+ * @param callback
+ * @param data Passed through to +callback+.
+ * @return 0, or the first nonzero value returned by +callback+.
+ */
+int _obl_slotted_each_child(struct obl_object *slotted,
+        obl_child_callback callback, void *data);
+
 /**
  * Deallocate a slotted-storage object.  For internal use only.
  *
@@ -31,5 +31,13 @@ enum obl_storage_type {
     OBL_STORAGE_TYPE_MAX = OBL_STUB
 };
 
+/* Defined in storage/object.h */
+struct obl_object;
+
+/**
+ * Signature of a function that accepts each child of an object in turn from
+ * _obl_each_child().  Returning nonzero ends the iteration early.
+ */
+typedef int (*obl_child_callback)(struct obl_object *child, void *data);
 
 #endif /* STORAGETYPES_H */
@@ -10,6 +10,7 @@
 
 #include "storage/object.h"
 #include "database.h"
+#include "payload.h"
 #include "session.h"
 
 #include "unicode/ucnv.h"
@@ -182,39 +183,60 @@ size_t obl_string_value(struct obl_object *string,
     return count;
 }
 
-/* Strings are stored as UTF-16BE with a one-word length prefix. */
+/*
+ * Strings are stored as UTF-16BE with a one-word length prefix.  The decoded
+ * code points are shared with every other session that reads the same
+ * string; see payload.h.  The shared cache is keyed by address within the
+ * database's content, so strings decoded from any other buffer bypass it.
+ */
 struct obl_object *obl_string_read(struct obl_session *session,
         struct obl_object *shape, obl_uint *source,
         obl_physical_address base, int depth)
 {
+    struct obl_database *d = session->database;
     obl_uint length;
     obl_uint i;
     UChar *casted_source;
     int casted_offset;
-    UChar *contents;
+    struct obl_payload *payload;
     struct obl_object *o;
-
-    length = readable_uint(source[base + 1]);
-    contents = malloc(length * sizeof(UChar));
-    if (contents == NULL) {
-        obl_report_error(obl_database_of(shape), OBL_OUT_OF_MEMORY, NULL);
-        return obl_nil();
+    uint64_t version = 0;
+    int shared = (source == d->content);
+
+    payload = shared ? _obl_payload_lookup(d, base, &version) : NULL;
+    if (payload == NULL) {
+        length = readable_uint(source[base + 1]);
+        payload = obl_payload_create(length * sizeof(UChar));
+        if (payload == NULL) {
+            obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+            return obl_nil();
+        }
+
+        casted_source = (UChar *) source;
+        casted_offset = (base + 2) * (sizeof(obl_uint) / sizeof(UChar));
+        for (i = 0; i < length; i++) {
+            payload->data.uchars[i] = readable_UChar(
+                    casted_source[casted_offset + i]);
+        }
+
+        if (shared) {
+            _obl_payload_publish(d, base, version, payload);
+        }
     }
 
-    casted_source = (UChar *) source;
-    casted_offset = (base + 2) * (sizeof(obl_uint) / sizeof(UChar));
-    for (i = 0; i < length; i++) {
-        contents[i] = readable_UChar(
-                casted_source[casted_offset + i]);
+    o = _allocate_string(payload->data.uchars,
+            (obl_uint) (payload->size / sizeof(UChar)));
+    if (o == NULL) {
+        obl_payload_release(payload);
+        return obl_nil();
     }
+    o->storage.string_storage->payload = payload;
 
-    o = obl_create_string(contents, length);
-
-    free(contents);
     return o;
 }
 
-void obl_string_write(struct obl_object *string, obl_uint *dest)
+void obl_string_write(struct obl_object *string, obl_uint *dest,
+        obl_physical_address offset)
 {
     obl_uint length;
     obl_uint i;
@@ -223,10 +245,10 @@ void obl_string_write(struct obl_object *string, obl_uint *dest)
     UChar ch;
 
     length = obl_string_size(string);
-    dest[string->physical_address + 1] = writable_uint(length);
+    dest[offset + 1] = writable_uint(length);
 
     casted_dest = (UChar *) dest;
-    casted_offset = (string->physical_address + 2) *
+    casted_offset = (offset + 2) *
             (sizeof(obl_uint) / sizeof(UChar));
 
     for (i = 0; i < length; i++) {
@@ -251,8 +273,14 @@ void obl_string_print(struct obl_object *string, int depth, int indent)
 
 void _obl_string_deallocate(struct obl_object *string)
 {
-    free(string->storage.string_storage->contents);
-    free(string->storage.string_storage);
+    struct obl_string_storage *storage = string->storage.string_storage;
+
+    if (storage->payload != NULL) {
+        obl_payload_release(storage->payload);
+    } else {
+        free(storage->contents);
+    }
+    free(storage);
 }
 
 struct obl_object *_allocate_string(UChar *uc, obl_uint length)
@@ -276,6 +304,7 @@ struct obl_object *_allocate_string(UChar *uc, obl_uint length)
 
     storage->length = length;
     storage->contents = uc;
+    storage->payload = NULL;
 
     return result;
 }
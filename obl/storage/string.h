@@ -21,6 +21,9 @@ struct obl_database;
 /* defined in session.h */
 struct obl_session;
 
+/* defined in payload.h */
+struct obl_payload;
+
 /**
  * A length-prefixed UTF-16 string.
  */
@@ -32,6 +35,12 @@ struct obl_string_storage {
     /** Array of code points. */
     UChar *contents;
 
+    /**
+     * If non-NULL, contents belongs to this payload, which other sessions'
+     * copies of the same string may share, and must not be modified.
+     */
+    struct obl_payload *payload;
+
 };
 
 /**
@@ -107,7 +116,8 @@ struct obl_object *obl_string_read(struct obl_session *session,
 /*
  * Write a string object.
  */
-void obl_string_write(struct obl_object *string, obl_uint *dest);
+void obl_string_write(struct obl_object *string, obl_uint *dest,
+        obl_physical_address offset);
 
 /**
  * Output a string to stdout.
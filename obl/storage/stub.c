@@ -50,6 +50,7 @@ struct obl_object *_obl_resolve_stub(struct obl_object *stub)
                 stub->storage.stub_storage->value,
                 obl_database_of(stub)->configuration.default_stub_depth, 1);
     } else {
+        stub->cache.referenced = 1;
         return stub;
     }
 }
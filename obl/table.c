@@ -0,0 +1,338 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file table.c
+ */
+
+#include "table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "storage/object.h"
+#include "database.h"
+
+/* Control byte values.  Occupied slots hold a seven-bit hash instead. */
+#define EMPTY ((uint8_t) 0x80)
+#define DELETED ((uint8_t) 0xFE)
+
+/* Never let more than 7/8ths of the slots be occupied or deleted. */
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+/* Internal function prototypes. */
+
+/** Spread the bits of a logical address across a 64-bit hash. */
+static uint64_t _hash(obl_logical_address key);
+
+/** Return a bitmask of the slots within +group+ whose control byte is +byte+. */
+static unsigned _match(const uint8_t *group, uint8_t byte);
+
+/** Return a bitmask of the slots within +group+ that are empty or deleted. */
+static unsigned _match_free(const uint8_t *group);
+
+/** Return the index of the lowest set bit of a nonzero mask. */
+static unsigned _lowest_bit(unsigned mask);
+
+/** Return the slot holding +key+, or table->capacity if it isn't present. */
+static size_t _find(struct obl_table *table, obl_logical_address key,
+        uint64_t hash);
+
+/** Return the first empty or deleted slot along +hash+'s probe sequence. */
+static size_t _find_free(struct obl_table *table, uint64_t hash);
+
+/** Move every entry into freshly allocated arrays of +capacity+ slots. */
+static int _resize(struct obl_table *table, size_t capacity);
+
+/* External function definitions. */
+
+struct obl_table *obl_create_table(void)
+{
+    struct obl_table *table = malloc(sizeof(struct obl_table));
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->control = NULL;
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->tombstones = 0;
+
+    return table;
+}
+
+void obl_table_insert(struct obl_table *table, struct obl_object *o)
+{
+    obl_logical_address key = o->logical_address;
+    uint64_t hash = _hash(key);
+    size_t slot;
+
+    slot = _find(table, key, hash);
+    if (slot < table->capacity) {
+        if (table->entries[slot].object != o) {
+            _obl_deallocate_object(table->entries[slot].object);
+        }
+        table->entries[slot].object = o;
+        return ;
+    }
+
+    if (table->count + table->tombstones + 1 > MAX_LOAD(table->capacity)) {
+        size_t capacity = table->capacity == 0 ? OBL_TABLE_GROUP :
+                table->capacity;
+
+        /* Reclaim tombstones in place unless the table is genuinely full. */
+        if (table->count + 1 > capacity / 2) {
+            capacity *= 2;
+        }
+        if (_resize(table, capacity)) {
+            obl_report_error(NULL, OBL_OUT_OF_MEMORY,
+                    "Unable to grow an object table.");
+            return ;
+        }
+    }
+
+    slot = _find_free(table, hash);
+    if (table->control[slot] == DELETED) {
+        table->tombstones--;
+    }
+    table->control[slot] = (uint8_t) (hash >> 57);
+    table->entries[slot].key = key;
+    table->entries[slot].object = o;
+    table->count++;
+}
+
+struct obl_object *obl_table_lookup(struct obl_table *table,
+        obl_logical_address key)
+{
+    size_t slot = _find(table, key, _hash(key));
+
+    return slot < table->capacity ? table->entries[slot].object : NULL;
+}
+
+int obl_table_includes(struct obl_table *table, struct obl_object *o)
+{
+    return obl_table_lookup(table, o->logical_address) == o;
+}
+
+void obl_table_remove(struct obl_table *table, struct obl_object *o)
+{
+    size_t slot;
+    const uint8_t *group;
+
+    slot = _find(table, o->logical_address, _hash(o->logical_address));
+    if (slot == table->capacity) {
+        return ;
+    }
+
+    /*
+     * A probe only moves past a group that has no empty slots, so if this
+     * group still has one, no probe sequence can depend on this slot.
+     */
+    group = table->control + (slot & ~(size_t) (OBL_TABLE_GROUP - 1));
+    if (_match(group, EMPTY)) {
+        table->control[slot] = EMPTY;
+    } else {
+        table->control[slot] = DELETED;
+        table->tombstones++;
+    }
+    table->entries[slot].object = NULL;
+    table->count--;
+}
+
+struct obl_object *obl_table_next(struct obl_table *table, size_t *cursor)
+{
+    while (*cursor < table->capacity) {
+        size_t slot = (*cursor)++;
+
+        if (! (table->control[slot] & 0x80)) {
+            return table->entries[slot].object;
+        }
+    }
+
+    return NULL;
+}
+
+void obl_destroy_table(struct obl_table *table, obl_table_callback callback)
+{
+    size_t slot;
+
+    if (callback != NULL) {
+        for (slot = 0; slot < table->capacity; slot++) {
+            if (! (table->control[slot] & 0x80)) {
+                (*callback)(table->entries[slot].object);
+            }
+        }
+    }
+
+    free(table->control);
+    free(table->entries);
+    free(table);
+}
+
+/* Internal function definitions. */
+
+static uint64_t _hash(obl_logical_address key)
+{
+    uint64_t h = (uint64_t) key * UINT64_C(0x9E3779B97F4A7C15);
+
+    return h ^ (h >> 29);
+}
+
+#ifdef __SSE2__
+
+static unsigned _match(const uint8_t *group, uint8_t byte)
+{
+    __m128i control = _mm_loadu_si128((const __m128i *) group);
+
+    return (unsigned) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(control, _mm_set1_epi8((char) byte)));
+}
+
+static unsigned _match_free(const uint8_t *group)
+{
+    /* Empty and deleted control bytes are exactly those with the top bit set. */
+    return (unsigned) _mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i *) group));
+}
+
+#else
+
+static unsigned _match(const uint8_t *group, uint8_t byte)
+{
+    unsigned mask = 0, i;
+
+    for (i = 0; i < OBL_TABLE_GROUP; i++) {
+        if (group[i] == byte) {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+}
+
+static unsigned _match_free(const uint8_t *group)
+{
+    unsigned mask = 0, i;
+
+    for (i = 0; i < OBL_TABLE_GROUP; i++) {
+        if (group[i] & 0x80) {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+}
+
+#endif /* __SSE2__ */
+
+static unsigned _lowest_bit(unsigned mask)
+{
+#ifdef __GNUC__
+    return (unsigned) __builtin_ctz(mask);
+#else
+    unsigned bit = 0;
+
+    while (! (mask & 1)) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/*
+ * Groups are probed in triangular order, which visits every group exactly
+ * once when the number of groups is a power of two.
+ */
+
+static size_t _find(struct obl_table *table, obl_logical_address key,
+        uint64_t hash)
+{
+    size_t groups, group, probe;
+    uint8_t tag = (uint8_t) (hash >> 57);
+
+    groups = table->capacity / OBL_TABLE_GROUP;
+    group = (size_t) hash & (groups - 1);
+
+    for (probe = 1; probe <= groups; probe++) {
+        const uint8_t *control = table->control + group * OBL_TABLE_GROUP;
+        unsigned mask = _match(control, tag);
+
+        while (mask != 0) {
+            size_t slot = group * OBL_TABLE_GROUP + _lowest_bit(mask);
+
+            if (table->entries[slot].key == key) {
+                return slot;
+            }
+            mask &= mask - 1;
+        }
+
+        if (_match(control, EMPTY)) {
+            break;
+        }
+        group = (group + probe) & (groups - 1);
+    }
+
+    return table->capacity;
+}
+
+static size_t _find_free(struct obl_table *table, uint64_t hash)
+{
+    size_t groups, group, probe;
+
+    groups = table->capacity / OBL_TABLE_GROUP;
+    group = (size_t) hash & (groups - 1);
+
+    /* The load limit guarantees that some group has a free slot. */
+    for (probe = 1; ; probe++) {
+        unsigned mask = _match_free(table->control + group * OBL_TABLE_GROUP);
+
+        if (mask != 0) {
+            return group * OBL_TABLE_GROUP + _lowest_bit(mask);
+        }
+        group = (group + probe) & (groups - 1);
+    }
+}
+
+static int _resize(struct obl_table *table, size_t capacity)
+{
+    uint8_t *old_control = table->control;
+    struct obl_table_entry *old_entries = table->entries;
+    size_t old_capacity = table->capacity, slot;
+
+    table->control = malloc(capacity);
+    table->entries = malloc(capacity * sizeof(struct obl_table_entry));
+    if (table->control == NULL || table->entries == NULL) {
+        free(table->control);
+        free(table->entries);
+        table->control = old_control;
+        table->entries = old_entries;
+        return 1;
+    }
+
+    memset(table->control, EMPTY, capacity);
+    table->capacity = capacity;
+    table->tombstones = 0;
+
+    for (slot = 0; slot < old_capacity; slot++) {
+        if (! (old_control[slot] & 0x80)) {
+            uint64_t hash = _hash(old_entries[slot].key);
+            size_t moved = _find_free(table, hash);
+
+            table->control[moved] = old_control[slot];
+            table->entries[moved] = old_entries[slot];
+        }
+    }
+
+    free(old_control);
+    free(old_entries);
+
+    return 0;
+}
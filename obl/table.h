@@ -0,0 +1,140 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file table.h
+ *
+ * An open-addressing hash table of obl_objects keyed by logical address.
+ * Session read sets are probed on every object fault and stub resolution but
+ * never need to be traversed in order, so they use this instead of an obl_set.
+ *
+ * Slots are arranged in groups of OBL_TABLE_GROUP.  Each slot has a control
+ * byte that is either empty, deleted, or holds seven bits of its key's hash,
+ * so that a lookup compares a whole group of control bytes at once (with SSE2
+ * where it's available) and only examines the slots whose hash bits match.
+ * Keys are stored beside their objects, so a miss never touches the objects
+ * themselves.
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform.h"
+
+/* Defined in storage/object.h */
+struct obl_object;
+
+/**
+ * The number of slots whose control bytes are compared at once.
+ */
+#define OBL_TABLE_GROUP 16
+
+/**
+ * One slot of an obl_table.
+ */
+struct obl_table_entry
+{
+    obl_logical_address key;
+
+    struct obl_object *object;
+};
+
+/**
+ * Allocate them with obl_create_table().
+ */
+struct obl_table
+{
+    /** One control byte per slot.  NULL until the first insertion. */
+    uint8_t *control;
+
+    /** The slots themselves, parallel to control. */
+    struct obl_table_entry *entries;
+
+    /** The number of slots: a power of two, and a multiple of OBL_TABLE_GROUP. */
+    size_t capacity;
+
+    /** The number of objects within the table. */
+    size_t count;
+
+    /** The number of slots marked deleted, which still lengthen probes. */
+    size_t tombstones;
+};
+
+/**
+ * Some obl_table functions accept a callback to invoke on each object.
+ */
+typedef void (*obl_table_callback)(struct obl_object *);
+
+/**
+ * Create an empty obl_table.  No slots are allocated until the first
+ * insertion.
+ *
+ * @return A newly allocated obl_table, or NULL if the allocation failed.
+ */
+struct obl_table *obl_create_table(void);
+
+/**
+ * Add an obl_object to the table under its logical address.  If a different
+ * object with the same logical address is already present, it will be
+ * deallocated and this object will be inserted in its place, just as with
+ * obl_set_insert().
+ *
+ * @param table The table to add to.
+ * @param o The object to add.
+ */
+void obl_table_insert(struct obl_table *table, struct obl_object *o);
+
+/**
+ * Return the obl_object that is currently mapped to a logical address.
+ *
+ * @param table The table possibly containing the object.
+ * @param key The logical address to query.
+ * @return The obl_object with the specified address, if one is present, or
+ *      NULL otherwise.
+ */
+struct obl_object *obl_table_lookup(struct obl_table *table,
+        obl_logical_address key);
+
+/**
+ * Return true if a table contains a provided object.
+ *
+ * @param table The table possibly containing the object.
+ * @param o The object to test.
+ * @return 1 if table contains the exact object "o", 0 if it does not.
+ */
+int obl_table_includes(struct obl_table *table, struct obl_object *o);
+
+/**
+ * Remove an obl_object from the table.
+ *
+ * @param table The table to remove from.
+ * @param o The object to remove.  As with obl_set_remove(), any object mapped
+ *      to the same logical address as o will be removed.
+ */
+void obl_table_remove(struct obl_table *table, struct obl_object *o);
+
+/**
+ * Step through the objects within a table, in no particular order.  The object
+ * most recently returned may be removed, but nothing may be inserted while a
+ * traversal is in progress.
+ *
+ * @param table The table to traverse.
+ * @param cursor [in,out] Traversal state.  Initialize it to 0.
+ * @return The next object, or NULL when the traversal is complete.
+ */
+struct obl_object *obl_table_next(struct obl_table *table, size_t *cursor);
+
+/**
+ * Deallocate a table.
+ *
+ * @param table The table to deallocate.  This storage will be freed.
+ * @param callback If non-NULL, this callback function will be invoked with
+ *      each obl_object in the table.
+ */
+void obl_destroy_table(struct obl_table *table, obl_table_callback callback);
+
+#endif /* TABLE_H */
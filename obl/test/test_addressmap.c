@@ -12,10 +12,66 @@
 
 #include "storage/object.h"
 #include "database.h"
-#include "set.h"
+#include "table.h"
 #include "session.h"
+#include "transaction.h"
 #include "unitutilities.h"
 
+/* Objects committed by each transaction in the lock-free lookup tests. */
+#define BATCH 500
+
+/* Enough batches to add many address map pages while readers run. */
+#define BATCHES 12
+
+/* Address space reserved by databases that permit lock-free lookups. */
+#define RESERVE (64 * 1024 * 1024)
+
+/*
+ * Commit BATCH integers within a single fixed collection, recording their
+ * logical addresses.
+ */
+static void commit_batch(struct obl_session *s, obl_logical_address *addresses)
+{
+    struct obl_transaction *t;
+    struct obl_object *fixed;
+    obl_uint i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(BATCH);
+    for (i = 0; i < BATCH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    obl_commit_transaction(t);
+
+    for (i = 0; i < BATCH; i++) {
+        addresses[i] = obl_fixed_at(fixed, i)->logical_address;
+    }
+}
+
+struct committer
+{
+    struct obl_database *database;
+    obl_logical_address addresses[BATCHES * BATCH];
+    volatile int finished;
+};
+
+static void *commit_batches(void *argument)
+{
+    struct committer *c = argument;
+    struct obl_session *s = obl_create_session(c->database);
+    int i;
+
+    for (i = 0; i < BATCHES; i++) {
+        commit_batch(s, &c->addresses[i * BATCH]);
+    }
+
+    obl_destroy_session(s);
+    c->finished = 1;
+    return NULL;
+}
+
 void test_map_leaf(void)
 {
     struct obl_database *d;
@@ -164,7 +220,7 @@ void test_create_leaf(void)
     obl_slotted_atcnamed_put(allocator, "next_physical", next_physical);
     allocator->logical_address = (obl_logical_address) 1;
     d->root.allocator_addr = allocator->logical_address;
-    obl_set_insert(s->read_set, allocator);
+    obl_table_insert(s->read_set, allocator);
 
     obl_address_assign(s,
             (obl_logical_address) 0x00000403,
@@ -215,7 +271,7 @@ void test_create_branch(void)
     obl_slotted_atcnamed_put(allocator, "next_physical", next_physical);
     allocator->logical_address = (obl_logical_address) 1;
     d->root.allocator_addr = allocator->logical_address;
-    obl_set_insert(s->read_set, allocator);
+    obl_table_insert(s->read_set, allocator);
 
     obl_address_assign(s,
             (obl_logical_address) 0x0000010F,
@@ -230,6 +286,190 @@ void test_create_branch(void)
     obl_close_database(d);
 }
 
+void test_lookup_cache(void)
+{
+    struct obl_database *d;
+    struct obl_session *s;
+    unsigned long hits, misses;
+
+    d = obl_open_defdatabase(NULL);
+    wipe(d);
+
+    SET_UINT(d->content, 1, OBL_ADDRTREEPAGE_SHAPE_ADDR);
+    SET_CHAR(d->content, 2, 0x00, 0x00, 0x00, 0x00); /* page height */
+    SET_CHAR(d->content, 4, 0x00, 0xAA, 0xBB, 0xCC); /* 0x01 = addr */
+
+    SET_UINT(d->content, 260, OBL_ADDRTREEPAGE_SHAPE_ADDR);
+    SET_CHAR(d->content, 261, 0x00, 0x00, 0x00, 0x01); /* height = 1 */
+    SET_CHAR(d->content, 264, 0x00, 0x00, 0x00, 0x01); /* 0x02 = physical 1 */
+
+    d->root.address_map_addr = (obl_physical_address) 260;
+    hits = d->address_cache.hits;
+    misses = d->address_cache.misses;
+
+    /* The first lookup walks the tree; its neighbours hit the cache. */
+    CU_ASSERT(obl_address_lookup(d, 0x201) == 0xAABBCC);
+    CU_ASSERT(d->address_cache.misses == misses + 1);
+    CU_ASSERT(obl_address_lookup(d, 0x201) == 0xAABBCC);
+    CU_ASSERT(obl_address_lookup(d, 0x2FF) == OBL_PHYSICAL_UNASSIGNED);
+    CU_ASSERT(d->address_cache.hits == hits + 2);
+
+    /* Addresses without a leaf page are never cached. */
+    CU_ASSERT(obl_address_lookup(d, 0x301) == OBL_PHYSICAL_UNASSIGNED);
+    CU_ASSERT(obl_address_lookup(d, 0x301) == OBL_PHYSICAL_UNASSIGNED);
+    CU_ASSERT(d->address_cache.misses == misses + 3);
+
+    /* Assignment invalidates the page, and the next lookup sees it. */
+    s = obl_create_session(d);
+    obl_address_assign(s, 0x202, 0x1234);
+    CU_ASSERT(obl_address_lookup(d, 0x202) == 0x1234);
+    CU_ASSERT(d->address_cache.misses == misses + 4);
+    CU_ASSERT(obl_address_lookup(d, 0x201) == 0xAABBCC);
+    CU_ASSERT(d->address_cache.hits == hits + 3);
+
+    /* Replacing the root discards everything. */
+    d->root.address_map_addr = (obl_physical_address) 1;
+    CU_ASSERT(obl_address_lookup(d, 0x01) == 0xAABBCC);
+    CU_ASSERT(d->address_cache.misses == misses + 5);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_lookup_many(void)
+{
+    struct obl_database *d;
+    obl_logical_address logical[7] = {
+            0x001, 0x201, 0x201, 0x2FF, 0x301, 0x402, 0x10001
+    };
+    obl_physical_address physical[7];
+    int i;
+
+    d = obl_open_defdatabase(NULL);
+    wipe(d);
+
+    /* Leaves at 1 (for 0x2xx) and 600 (for 0x4xx), beneath a root at 260. */
+    SET_UINT(d->content, 1, OBL_ADDRTREEPAGE_SHAPE_ADDR);
+    SET_CHAR(d->content, 4, 0x00, 0xAA, 0xBB, 0xCC); /* 0x01 = addr */
+
+    SET_UINT(d->content, 600, OBL_ADDRTREEPAGE_SHAPE_ADDR);
+    SET_UINT(d->content, 604, 0x00112233); /* 0x02 = addr */
+
+    SET_UINT(d->content, 260, OBL_ADDRTREEPAGE_SHAPE_ADDR);
+    SET_UINT(d->content, 261, 1); /* height = 1 */
+    SET_UINT(d->content, 264, 1); /* 0x02 = physical 1 */
+    SET_UINT(d->content, 266, 600); /* 0x04 = physical 600 */
+
+    d->root.address_map_addr = (obl_physical_address) 260;
+
+    obl_address_lookup_many(d, logical, physical, 7);
+    CU_ASSERT(physical[0] == OBL_PHYSICAL_UNASSIGNED);
+    CU_ASSERT(physical[1] == 0xAABBCC);
+    CU_ASSERT(physical[2] == 0xAABBCC);
+    CU_ASSERT(physical[3] == OBL_PHYSICAL_UNASSIGNED);
+    CU_ASSERT(physical[4] == OBL_PHYSICAL_UNASSIGNED);
+    CU_ASSERT(physical[5] == 0x00112233);
+    CU_ASSERT(physical[6] == OBL_PHYSICAL_UNASSIGNED);
+
+    /* Unsorted input is translated just the same, cached or not. */
+    logical[0] = 0x402;
+    logical[5] = 0x001;
+    _obl_address_cache_clear(d);
+    obl_address_lookup_many(d, logical, physical, 7);
+    for (i = 0; i < 7; i++) {
+        CU_ASSERT(physical[i] == obl_address_lookup(d, logical[i]));
+    }
+
+    obl_close_database(d);
+}
+
+void test_lookup_unlocked(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s;
+    obl_logical_address addresses[BATCH];
+    int i, reserved, agreed;
+
+    /* With and without a reservation, so both paths are exercised. */
+    for (reserved = 0; reserved < 2; reserved++) {
+        config.reserve_size = reserved ? RESERVE : 0;
+        d = obl_open_database(&config);
+        CU_ASSERT(_obl_content_optimistic(d) == reserved);
+
+        s = obl_create_session(d);
+        commit_batch(s, addresses);
+
+        agreed = 1;
+        for (i = 0; i < BATCH; i++) {
+            obl_physical_address physical;
+
+            physical = obl_address_lookup_unlocked(d, addresses[i]);
+            if (physical == OBL_PHYSICAL_UNASSIGNED ||
+                    physical != obl_address_lookup(d, addresses[i])) {
+                agreed = 0;
+            }
+        }
+        CU_ASSERT(agreed);
+        CU_ASSERT(obl_address_lookup_unlocked(d,
+                addresses[BATCH - 1] + 1000) == OBL_PHYSICAL_UNASSIGNED);
+
+        obl_destroy_session(s);
+        obl_close_database(d);
+    }
+}
+
+void test_lookup_concurrent(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s;
+    struct committer *c;
+    obl_logical_address addresses[BATCH];
+    obl_physical_address expected[BATCH];
+    pthread_t thread;
+    unsigned long rounds = 0;
+    int i, stable = 1, complete = 1;
+
+    config.reserve_size = RESERVE;
+    d = obl_open_database(&config);
+    s = obl_create_session(d);
+    commit_batch(s, addresses);
+    for (i = 0; i < BATCH; i++) {
+        expected[i] = obl_address_lookup_unlocked(d, addresses[i]);
+    }
+
+    c = malloc(sizeof(struct committer));
+    c->database = d;
+    c->finished = 0;
+    CU_ASSERT_FATAL(pthread_create(&thread, NULL, &commit_batches, c) == 0);
+
+    /* Existing translations hold steady while the map grows beneath them. */
+    while (! c->finished || rounds == 0) {
+        for (i = 0; i < BATCH; i++) {
+            if (obl_address_lookup_unlocked(d, addresses[i]) != expected[i]) {
+                stable = 0;
+            }
+        }
+        rounds++;
+    }
+    pthread_join(thread, NULL);
+    CU_ASSERT(stable);
+
+    for (i = 0; i < BATCHES * BATCH; i++) {
+        if (obl_address_lookup_unlocked(d, c->addresses[i]) ==
+                OBL_PHYSICAL_UNASSIGNED) {
+            complete = 0;
+        }
+    }
+    CU_ASSERT(complete);
+    CU_ASSERT(obl_database_ok(d));
+
+    free(c);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
 /*
  * Collect the unit tests defined here into a CUnit test suite.  Return the
  * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
@@ -249,6 +489,10 @@ CU_pSuite initialize_addressmap_suite(void)
     ADD_TEST(test_assign_branch);
     ADD_TEST(test_create_leaf);
     ADD_TEST(test_create_branch);
+    ADD_TEST(test_lookup_cache);
+    ADD_TEST(test_lookup_many);
+    ADD_TEST(test_lookup_unlocked);
+    ADD_TEST(test_lookup_concurrent);
 
     return pSuite;
 }
@@ -12,8 +12,9 @@
 
 #include "storage/object.h"
 #include "database.h"
-#include "set.h"
+#include "table.h"
 #include "session.h"
+#include "transaction.h"
 #include "platform.h"
 #include "unitutilities.h"
 
@@ -29,15 +30,15 @@ static struct obl_session *setup_session()
     allocator = obl_create_slotted(
             _obl_at_fixed_address(OBL_ALLOCATOR_SHAPE_ADDR));
     allocator->logical_address = (obl_logical_address) 1;
-    allocator->session = s;
     logical = obl_create_integer((obl_int) 2);
     physical = obl_create_integer((obl_int) 1);
 
     obl_slotted_at_put(allocator, (obl_uint) 0, logical);
     obl_slotted_at_put(allocator, (obl_uint) 1, physical);
+    allocator->session = s;
 
     d->root.allocator_addr = allocator->logical_address;
-    obl_set_insert(s->read_set, allocator);
+    obl_table_insert(s->read_set, allocator);
 
     return s;
 }
@@ -93,6 +94,123 @@ void test_allocate_physical(void)
     teardown_session(s);
 }
 
+/* Read the persisted value of one of the allocator's counters. */
+static obl_int persisted_counter(struct obl_database *d, obl_uint slot)
+{
+    struct obl_session *s;
+    struct obl_object *allocator, *counter;
+    obl_int result;
+
+    s = obl_create_session(d);
+    allocator = obl_at_address(s, d->root.allocator_addr);
+    counter = obl_slotted_at(allocator, slot);
+    result = readable_int(d->content[counter->physical_address + 1]);
+    obl_destroy_session(s);
+
+    return result;
+}
+
+void test_allocation_leases(void)
+{
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_transaction *t;
+    struct obl_object *o[3];
+    obl_int logical, physical;
+    int i;
+
+    d = obl_open_defdatabase(NULL);
+    s = obl_create_session(d);
+
+    logical = persisted_counter(d, 0);
+    physical = persisted_counter(d, 1);
+
+    for (i = 0; i < 3; i++) {
+        t = obl_begin_transaction(s);
+        o[i] = obl_create_integer((obl_int) i);
+        o[i]->session = s;
+        obl_mark_dirty(o[i]);
+        CU_ASSERT(obl_commit_transaction(t) == 0);
+    }
+
+    for (i = 0; i < 3; i++) {
+        CU_ASSERT(o[i]->logical_address != OBL_LOGICAL_UNASSIGNED);
+        CU_ASSERT(o[i]->logical_address >= (obl_logical_address) logical);
+        CU_ASSERT(o[i]->logical_address < (obl_logical_address) logical + 3);
+    }
+
+    /* A single lease covered every allocation. */
+    CU_ASSERT(persisted_counter(d, 0) == logical + DEFAULT_LEASE_ADDRESSES);
+    CU_ASSERT(persisted_counter(d, 1) ==
+            physical + DEFAULT_LEASE_SIZE / (obl_int) sizeof(obl_uint));
+
+    /* Closing the session returns the unused tails. */
+    obl_destroy_session(s);
+    CU_ASSERT(persisted_counter(d, 0) == logical + 3);
+    CU_ASSERT(persisted_counter(d, 1) > physical);
+    CU_ASSERT(persisted_counter(d, 1) <
+            physical + DEFAULT_LEASE_SIZE / (obl_int) sizeof(obl_uint));
+
+    obl_close_database(d);
+}
+
+/*
+ * Commit more new objects than a logical address lease holds, so that the
+ * lease must be renewed while the commit is being prepared.
+ */
+void test_lease_renewal_in_commit(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s, *other;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *o;
+    obl_logical_address addresses[10];
+    obl_int logical;
+    int i, j, distinct = 1, correct = 1;
+
+    config.lease_addresses = 4;
+    d = obl_open_database(&config);
+    s = obl_create_session(d);
+    logical = persisted_counter(d, 0);
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed((obl_uint) 10);
+    for (i = 0; i < 10; i++) {
+        obl_fixed_at_put(fixed, (obl_uint) i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    for (i = 0; i < 10; i++) {
+        addresses[i] = obl_fixed_at(fixed, (obl_uint) i)->logical_address;
+        if (addresses[i] == OBL_LOGICAL_UNASSIGNED ||
+                addresses[i] == fixed->logical_address) {
+            distinct = 0;
+        }
+        for (j = 0; j < i; j++) {
+            if (addresses[j] == addresses[i]) {
+                distinct = 0;
+            }
+        }
+    }
+    CU_ASSERT(distinct);
+    CU_ASSERT(persisted_counter(d, 0) >= logical + 11);
+
+    other = obl_create_session(d);
+    for (i = 0; i < 10; i++) {
+        o = obl_at_address(other, addresses[i]);
+        if (obl_integer_value(o) != (obl_int) i) {
+            correct = 0;
+        }
+    }
+    CU_ASSERT(correct);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
 
 /*
  * Collect the unit tests defined here into a CUnit test suite.  Return the
@@ -109,6 +227,8 @@ CU_pSuite initialize_allocator_suite(void)
 
     ADD_TEST(test_allocate_logical);
     ADD_TEST(test_allocate_physical);
+    ADD_TEST(test_allocation_leases);
+    ADD_TEST(test_lease_renewal_in_commit);
 
     return pSuite;
 }
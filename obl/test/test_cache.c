@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for the bounded per-session object cache.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "cache.h"
+
+#include "storage/object.h"
+#include "database.h"
+#include "session.h"
+#include "transaction.h"
+#include "unitutilities.h"
+
+#define OBJECT_COUNT 200
+
+/* Roughly the charge for a resident integer. */
+#define INTEGER_CHARGE (sizeof(struct obl_object) + 2 * sizeof(obl_uint))
+
+/* Create OBJECT_COUNT integers, counting up from 0. */
+static void _create_integers(struct obl_object **objects)
+{
+    int i;
+
+    for (i = 0; i < OBJECT_COUNT; i++) {
+        objects[i] = obl_create_integer((obl_int) i);
+    }
+}
+
+void test_cache_eviction(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address addresses[OBJECT_COUNT];
+    struct obl_object *objects[OBJECT_COUNT];
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_object *first, *o;
+    int i, correct = 1;
+
+    config.cache_size = 20 * INTEGER_CHARGE;
+    _create_integers(objects);
+    d = populate(&config, objects, OBJECT_COUNT, addresses, NULL);
+    s = obl_create_session(d);
+
+    first = obl_at_address(s, addresses[0]);
+    CU_ASSERT(obl_integer_value(first) == 0);
+
+    for (i = 1; i < OBJECT_COUNT; i++) {
+        o = obl_at_address(s, addresses[i]);
+        if (obl_integer_value(o) != i) {
+            correct = 0;
+        }
+    }
+    CU_ASSERT(correct);
+
+    CU_ASSERT(s->cache.misses == OBJECT_COUNT);
+    CU_ASSERT(s->cache.evictions > 0);
+    CU_ASSERT(s->cache.used <= s->cache.budget);
+
+    /* An evicted object is faulted back into the same obl_object. */
+    CU_ASSERT(_obl_is_stub(first));
+    o = obl_at_address(s, addresses[0]);
+    CU_ASSERT(o == first);
+    CU_ASSERT(obl_integer_value(o) == 0);
+    CU_ASSERT(s->cache.misses == OBJECT_COUNT + 1);
+
+    /* Resident objects are hits. */
+    o = obl_at_address(s, addresses[OBJECT_COUNT - 1]);
+    CU_ASSERT(obl_integer_value(o) == OBJECT_COUNT - 1);
+    CU_ASSERT(s->cache.hits > 0);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_cache_pinning(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address addresses[OBJECT_COUNT];
+    struct obl_object *objects[OBJECT_COUNT];
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_object *pinned;
+    int i;
+
+    config.cache_size = 10 * INTEGER_CHARGE;
+    _create_integers(objects);
+    d = populate(&config, objects, OBJECT_COUNT, addresses, NULL);
+    s = obl_create_session(d);
+
+    pinned = obl_at_address(s, addresses[0]);
+    obl_pin_object(pinned);
+
+    for (i = 1; i < OBJECT_COUNT; i++) {
+        obl_at_address(s, addresses[i]);
+    }
+
+    CU_ASSERT(s->cache.evictions > 0);
+    CU_ASSERT(obl_storage_of(pinned) == OBL_INTEGER);
+    CU_ASSERT(obl_integer_value(pinned) == 0);
+
+    obl_unpin_object(pinned);
+    CU_ASSERT(pinned->cache.pins == 0);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_cache_unbounded(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address addresses[OBJECT_COUNT];
+    struct obl_object *objects[OBJECT_COUNT];
+    struct obl_database *d;
+    struct obl_session *s;
+    int i;
+
+    config.cache_size = 0;
+    _create_integers(objects);
+    d = populate(&config, objects, OBJECT_COUNT, addresses, NULL);
+    s = obl_create_session(d);
+
+    for (i = 0; i < OBJECT_COUNT; i++) {
+        obl_at_address(s, addresses[i]);
+    }
+
+    CU_ASSERT(s->cache.evictions == 0);
+    CU_ASSERT(s->cache.used >= OBJECT_COUNT * INTEGER_CHARGE);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_cache_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("cache", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_cache_eviction);
+    ADD_TEST(test_cache_pinning);
+    ADD_TEST(test_cache_unbounded);
+
+    return pSuite;
+}
@@ -9,14 +9,19 @@
 
 #include "CUnit/Basic.h"
 
+#include "storage/integer.h"
 #include "storage/object.h"
 #include "allocator.h"
 #include "constants.h"
 #include "database.h"
+#include "dirty.h"
+#include "growth.h"
 #include "session.h"
 #include "set.h"
+#include "transaction.h"
 #include "unitutilities.h"
 
+#include <sys/stat.h>
 #include <stdio.h>
 
 static const char *filename = "database.obl";
@@ -37,6 +42,8 @@ void test_initialize_database(void)
     CU_ASSERT(database->configuration.log_level == L_NOTICE);
     CU_ASSERT(database->configuration.default_stub_depth == DEFAULT_STUB_DEPTH);
     CU_ASSERT(database->configuration.growth_size == DEFAULT_GROWTH_SIZE)
+    CU_ASSERT(database->configuration.growth_factor == DEFAULT_GROWTH_FACTOR);
+    CU_ASSERT(database->configuration.growth_max == DEFAULT_GROWTH_MAX);
 
     CU_ASSERT(obl_database_ok(database));
 
@@ -118,7 +125,7 @@ void test_database_roundtrip(void)
     o = obl_create_integer((obl_int) 42);
     o->session = s;
 
-    _obl_assign_addresses(o);
+    CU_ASSERT(_obl_assign_addresses(o) == 1);
     _obl_write(o);
     addr = o->logical_address;
 
@@ -137,6 +144,244 @@ void test_database_roundtrip(void)
     obl_close_database(d);
 }
 
+void test_growth_target(void)
+{
+    struct obl_database_config conf = { 0 };
+
+    conf.growth_size = 4096;
+    conf.growth_factor = 100;
+    conf.growth_max = 1024 * 1024;
+
+    /* Small databases grow by the minimum growth size. */
+    CU_ASSERT(obl_growth_target(&conf, 0, 1) == 1024);
+    CU_ASSERT(obl_growth_target(&conf, 512, 513) == 2048);
+
+    /* Larger databases double. */
+    CU_ASSERT(obl_growth_target(&conf, 4096, 4097) == 8192);
+    CU_ASSERT(obl_growth_target(&conf, 65536, 65537) == 131072);
+
+    /* No single step may exceed growth_max. */
+    CU_ASSERT(obl_growth_target(&conf, 1048576, 1048577) == 1310720);
+
+    /* A single huge allocation is honored regardless of the policy. */
+    CU_ASSERT(obl_growth_target(&conf, 4096, 100000) >= 100000);
+}
+
+void test_database_growth(void)
+{
+    struct obl_database *d;
+    struct stat info;
+    obl_uint initial;
+    unsigned long growths;
+
+    remove(filename);
+    d = obl_open_defdatabase(filename);
+    CU_ASSERT_FATAL(d != NULL);
+
+    initial = d->content_size;
+    growths = d->growth_statistics.growth_count;
+    CU_ASSERT(initial > 0);
+    CU_ASSERT(growths >= 1);
+
+    /* Capacity that is already present doesn't cause growth. */
+    CU_ASSERT(_obl_ensure_capacity(d, initial) == 0);
+    CU_ASSERT(d->growth_statistics.growth_count == growths);
+
+    /* Filling a megabyte, a word at a time, grows logarithmically. */
+    while (d->content_size < 256 * 1024) {
+        CU_ASSERT_FATAL(_obl_ensure_capacity(d, d->content_size + 1) == 0);
+    }
+    CU_ASSERT(d->growth_statistics.growth_count - growths < 12);
+    CU_ASSERT(d->growth_statistics.bytes_added ==
+            (uint64_t) d->content_size * sizeof(obl_uint));
+
+    /* The file and the mapping agree, and existing contents survive. */
+    CU_ASSERT(fstat(d->fd, &info) == 0);
+    CU_ASSERT((obl_uint) (info.st_size / sizeof(obl_uint)) == d->content_size);
+    d->content[d->content_size - 1] = writable_uint(0xCAFE);
+    CU_ASSERT(readable_uint(d->content[0]) == 0x6F626C00);
+
+    obl_close_database(d);
+}
+
+void test_stable_base(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct stat info;
+    obl_uint *base, size;
+
+    remove(filename);
+    config.filename = filename;
+    config.reserve_size = 16 * 1024 * 1024;
+    d = obl_open_database(&config);
+    CU_ASSERT_FATAL(d != NULL);
+    CU_ASSERT(d->reserved_size >= 16 * 1024 * 1024);
+
+    /* Growth within the reservation never moves the mapping. */
+    base = d->content;
+    d->content[d->content_size - 1] = writable_uint(0xCAFE);
+    while (d->content_size < 1024 * 1024) {
+        CU_ASSERT_FATAL(_obl_ensure_capacity(d, d->content_size + 1) == 0);
+        CU_ASSERT_FATAL(d->content == base);
+    }
+    CU_ASSERT(readable_uint(d->content[0]) == 0x6F626C00);
+    CU_ASSERT(fstat(d->fd, &info) == 0);
+    CU_ASSERT((obl_uint) (info.st_size / sizeof(obl_uint)) == d->content_size);
+
+    /* Growth past the reservation fails rather than moving the mapping. */
+    CU_ASSERT(_obl_ensure_capacity(d, 8 * 1024 * 1024) == 1);
+    CU_ASSERT(d->content == base);
+    obl_clear_error(d);
+    size = d->content_size;
+    obl_close_database(d);
+
+    /* Reopened files are mapped into a fresh reservation. */
+    d = obl_open_database(&config);
+    CU_ASSERT_FATAL(d != NULL);
+    CU_ASSERT(d->content_size == size);
+    CU_ASSERT(readable_uint(d->content[0]) == 0x6F626C00);
+    obl_close_database(d);
+
+    /* In-memory databases can reserve address space, too. */
+    config.filename = NULL;
+    d = obl_open_database(&config);
+    CU_ASSERT_FATAL(d != NULL);
+    base = d->content;
+    CU_ASSERT_FATAL(_obl_ensure_capacity(d, 1024 * 1024) == 0);
+    CU_ASSERT(d->content == base);
+    CU_ASSERT(d->content[1024 * 1024 - 1] == 0);
+    CU_ASSERT(readable_uint(d->content[0]) == 0x6F626C00);
+    obl_close_database(d);
+}
+
+void test_page_set(void)
+{
+    struct obl_page_set set;
+    size_t cursor, first, length;
+    obl_uint page;
+
+    obl_page_set_init(&set);
+    page = set.page_words;
+    CU_ASSERT(page > 0);
+
+    /* Overlapping and adjacent ranges collapse into a single run. */
+    CU_ASSERT(obl_page_set_add(&set, 3 * page + 1, 2) == 0);
+    CU_ASSERT(obl_page_set_add(&set, 3 * page + 2, page) == 0);
+    CU_ASSERT(obl_page_set_add(&set, 200 * page - 1, 1) == 0);
+    CU_ASSERT(set.count == 3);
+
+    cursor = 0;
+    CU_ASSERT(obl_page_set_next_run(&set, &cursor, &first, &length));
+    CU_ASSERT(first == 3);
+    CU_ASSERT(length == 2);
+    CU_ASSERT(obl_page_set_next_run(&set, &cursor, &first, &length));
+    CU_ASSERT(first == 199);
+    CU_ASSERT(length == 1);
+    CU_ASSERT(! obl_page_set_next_run(&set, &cursor, &first, &length));
+
+    obl_page_set_clear(&set);
+    CU_ASSERT(set.count == 0);
+    cursor = 0;
+    CU_ASSERT(! obl_page_set_next_run(&set, &cursor, &first, &length));
+
+    CU_ASSERT(obl_page_set_add(&set, 7, 1) == 0);
+    cursor = 0;
+    CU_ASSERT(obl_page_set_next_run(&set, &cursor, &first, &length));
+    CU_ASSERT(first == 0);
+    CU_ASSERT(length == 1);
+
+    obl_page_set_destroy(&set);
+}
+
+void test_sync_commit_pages(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *database;
+    struct obl_session *session;
+    struct obl_transaction *t;
+    struct obl_object *o;
+    unsigned long flushed;
+
+    remove(filename);
+    config.filename = filename;
+    config.sync_commits = 1;
+    database = obl_open_database(&config);
+    CU_ASSERT_FATAL(database != NULL);
+    session = obl_create_session(database);
+
+    flushed = database->commit_statistics.pages_flushed;
+
+    t = obl_begin_transaction(session);
+    o = obl_create_integer(4242);
+    o->session = session;
+    o->logical_address = (obl_logical_address) 1600;
+    o->physical_address = (obl_physical_address) 600;
+    obl_mark_dirty(o);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    obl_destroy_object(o);
+
+    /* Only the page holding the integer needed to reach the disk. */
+    CU_ASSERT(database->commit_statistics.pages_flushed - flushed == 1);
+    CU_ASSERT(database->dirty_pages.count == 0);
+
+    obl_destroy_session(session);
+    obl_close_database(database);
+
+    database = obl_open_defdatabase(filename);
+    CU_ASSERT_FATAL(database != NULL);
+    CU_ASSERT(readable_int(database->content[601]) == 4242);
+    obl_close_database(database);
+}
+
+void test_read_only(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *database;
+    struct obl_session *session;
+    struct obl_object *allocator;
+    int created = 1;
+
+    /* Publish a freshly bootstrapped database. */
+    remove(filename);
+    database = obl_open_defdatabase(filename);
+    CU_ASSERT_FATAL(database != NULL);
+    obl_close_database(database);
+
+    config.filename = filename;
+    config.read_only = 1;
+    database = obl_open_database(&config);
+    CU_ASSERT_FATAL(database != NULL);
+    CU_ASSERT(database->wal == NULL);
+
+    session = obl_create_session(database);
+    allocator = obl_at_address(session, database->root.allocator_addr);
+    CU_ASSERT(allocator->shape ==
+            _obl_at_fixed_address(OBL_ALLOCATOR_SHAPE_ADDR));
+    CU_ASSERT(obl_at_address(session, database->root.allocator_addr) ==
+            allocator);
+
+    /* Writes are refused before anything is locked or allocated. */
+    CU_ASSERT(obl_begin_transaction(session) == NULL);
+    CU_ASSERT(database->error_code == OBL_READ_ONLY);
+    obl_clear_error(database);
+    CU_ASSERT(obl_ensure_transaction(session, &created) == NULL);
+    CU_ASSERT(created == 0);
+    obl_clear_error(database);
+    CU_ASSERT(_obl_ensure_capacity(database, database->content_size + 1) != 0);
+    CU_ASSERT(database->error_code == OBL_READ_ONLY);
+
+    obl_destroy_session(session);
+    obl_close_database(database);
+
+    /* Read-only opens neither create nor bootstrap files. */
+    remove(filename);
+    CU_ASSERT(obl_open_database(&config) == NULL);
+    fclose(fopen(filename, "w"));
+    CU_ASSERT(obl_open_database(&config) == NULL);
+    remove(filename);
+}
+
 /*
  * Collect the unit tests defined here into a CUnit test suite.  Return the
  * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
@@ -154,6 +399,12 @@ CU_pSuite initialize_database_suite(void)
     ADD_TEST(test_report_error);
     ADD_TEST(test_allocate_fixed_space);
     ADD_TEST(test_database_roundtrip);
+    ADD_TEST(test_growth_target);
+    ADD_TEST(test_database_growth);
+    ADD_TEST(test_stable_base);
+    ADD_TEST(test_page_set);
+    ADD_TEST(test_sync_commit_pages);
+    ADD_TEST(test_read_only);
 
     return pSuite;
 }
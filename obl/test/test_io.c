@@ -19,7 +19,7 @@
 #include "database.h"
 #include "platform.h"
 #include "session.h"
-#include "set.h"
+#include "table.h"
 #include "unitutilities.h"
 
 static const char *filename = "testing.obl";
@@ -114,10 +114,10 @@ void test_read_fixed(void)
     three->logical_address = (obl_logical_address) 0x0C0D;
     four->logical_address = (obl_logical_address) 0x0D0E;
 
-    obl_set_insert(s->read_set, one);
-    obl_set_insert(s->read_set, two);
-    obl_set_insert(s->read_set, three);
-    obl_set_insert(s->read_set, four);
+    obl_table_insert(s->read_set, one);
+    obl_table_insert(s->read_set, two);
+    obl_table_insert(s->read_set, three);
+    obl_table_insert(s->read_set, four);
 
     o = obl_fixed_read(s, shape, d->content,
             (obl_physical_address) 0, 1);
@@ -159,8 +159,8 @@ void test_read_shape(void)
     obl_fixed_at_put(slot_names, 1, slot_two_name);
     slot_names->logical_address = (obl_logical_address) 2;
 
-    obl_set_insert(s->read_set, name);
-    obl_set_insert(s->read_set, slot_names);
+    obl_table_insert(s->read_set, name);
+    obl_table_insert(s->read_set, slot_names);
 
     out = obl_shape_read(s, obl_nil(), d->content,
             (obl_physical_address) 0, 2);
@@ -198,8 +198,8 @@ void test_read_slotted(void)
     two = obl_create_cstring("value", 5);
     two->logical_address = (obl_logical_address) 0xBB;
 
-    obl_set_insert(s->read_set, one);
-    obl_set_insert(s->read_set, two);
+    obl_table_insert(s->read_set, one);
+    obl_table_insert(s->read_set, two);
 
     o = obl_slotted_read(s, shape, d->content,
             (obl_physical_address) 0, 1);
@@ -281,7 +281,7 @@ void test_write_integer(void)
 
     o = obl_create_integer((obl_int) 0x12345678);
     o->physical_address = (obl_physical_address) 0;
-    obl_integer_write(o, d->content);
+    obl_integer_write(o, d->content, o->physical_address);
 
     CU_ASSERT(memcmp(d->content, expected, 8) == 0);
 
@@ -305,7 +305,7 @@ void test_write_string(void)
 
     o = obl_create_cstring("hello", 5);
     o->physical_address = (obl_physical_address) 0;
-    obl_string_write(o, d->content);
+    obl_string_write(o, d->content, o->physical_address);
 
     CU_ASSERT(memcmp(d->content, expected, 20) == 0);
 
@@ -341,7 +341,7 @@ void test_write_fixed(void)
     obl_fixed_at_put(o, 1, two);
     obl_fixed_at_put(o, 2, three);
 
-    obl_fixed_write(o, d->content);
+    obl_fixed_write(o, d->content, o->physical_address);
 
     CU_ASSERT(memcmp(d->content, expected, 20) == 0);
 
@@ -375,7 +375,7 @@ void test_write_shape(void)
     shape->storage.shape_storage->slot_names->logical_address =
             (obl_logical_address) 0xCCDD;
 
-    obl_shape_write(shape, d->content);
+    obl_shape_write(shape, d->content, shape->physical_address);
     CU_ASSERT(memcmp(d->content, expected, 20) == 0);
 
     obl_destroy_cshape(shape);
@@ -413,7 +413,7 @@ void test_write_slotted(void)
     obl_slotted_at_put(slotted, 1, bbb);
     obl_slotted_at_put(slotted, 2, ccc);
 
-    obl_slotted_write(slotted, d->content);
+    obl_slotted_write(slotted, d->content, slotted->physical_address);
     CU_ASSERT(memcmp(d->content, expected, 16) == 0);
 
     obl_destroy_object(aaa);
@@ -440,7 +440,7 @@ void test_write_addrtreepage(void)
     treepage->storage.addrtreepage_storage->contents[1] =
             (obl_physical_address) 0x00AA00BB;
 
-    obl_addrtreepage_write(treepage, d->content);
+    obl_addrtreepage_write(treepage, d->content, treepage->physical_address);
     CU_ASSERT(memcmp(d->content, expected, 4 + CHUNK_SIZE * 4) == 0);
 
     obl_destroy_object(treepage);
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for payloads shared among sessions.
+ */
+
+#include <stdlib.h>
+
+#include "CUnit/Basic.h"
+
+#include "payload.h"
+
+#include "storage/object.h"
+#include "database.h"
+#include "session.h"
+#include "transaction.h"
+#include "unitutilities.h"
+
+void test_payload_sharing(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address address;
+    struct obl_database *d;
+    struct obl_object *string;
+    struct obl_session *a, *b;
+    struct obl_object *from_a, *from_b;
+
+    string = obl_create_cstring("shared contents", 15);
+    d = populate(&config, &string, 1, &address, NULL);
+    a = obl_create_session(d);
+    b = obl_create_session(d);
+
+    from_a = obl_at_address(a, address);
+    CU_ASSERT(obl_string_ccmp(from_a, "shared contents") == 0);
+    CU_ASSERT(d->payload_cache.misses == 1);
+
+    from_b = obl_at_address(b, address);
+    CU_ASSERT(obl_string_ccmp(from_b, "shared contents") == 0);
+    CU_ASSERT(d->payload_cache.hits == 1);
+
+    CU_ASSERT(from_a != from_b);
+    CU_ASSERT(from_a->storage.string_storage->contents ==
+            from_b->storage.string_storage->contents);
+
+    /* The payload outlives the session that decoded it. */
+    obl_destroy_session(a);
+    CU_ASSERT(obl_string_ccmp(from_b, "shared contents") == 0);
+
+    obl_destroy_session(b);
+    obl_close_database(d);
+}
+
+void test_payload_invalidation(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address address;
+    struct obl_database *d;
+    struct obl_object *string;
+    struct obl_session *a, *b;
+    struct obl_transaction *t;
+    struct obl_object *o;
+    uint64_t version;
+
+    string = obl_create_cstring("shared contents", 15);
+    d = populate(&config, &string, 1, &address, NULL);
+    a = obl_create_session(d);
+
+    o = obl_at_address(a, address);
+    CU_ASSERT(d->payload_cache.used > 0);
+    version = d->payload_cache.version;
+
+    t = obl_begin_transaction(a);
+    obl_mark_dirty(o);
+    obl_commit_transaction(t);
+
+    CU_ASSERT(d->payload_cache.version > version);
+    CU_ASSERT(d->payload_cache.used == 0);
+
+    /* The rewritten string is decoded afresh. */
+    b = obl_create_session(d);
+    o = obl_at_address(b, address);
+    CU_ASSERT(obl_string_ccmp(o, "shared contents") == 0);
+    CU_ASSERT(d->payload_cache.hits == 0);
+    CU_ASSERT(d->payload_cache.misses == 2);
+
+    obl_destroy_session(b);
+    obl_destroy_session(a);
+    obl_close_database(d);
+}
+
+void test_payload_disabled(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address address;
+    struct obl_database *d;
+    struct obl_object *string;
+    struct obl_session *a, *b;
+    struct obl_object *from_a, *from_b;
+
+    config.shared_cache_size = -1;
+    string = obl_create_cstring("shared contents", 15);
+    d = populate(&config, &string, 1, &address, NULL);
+    a = obl_create_session(d);
+    b = obl_create_session(d);
+
+    from_a = obl_at_address(a, address);
+    from_b = obl_at_address(b, address);
+    CU_ASSERT(obl_string_cmp(from_a, from_b) == 0);
+    CU_ASSERT(from_a->storage.string_storage->contents !=
+            from_b->storage.string_storage->contents);
+    CU_ASSERT(d->payload_cache.used == 0);
+
+    obl_destroy_session(b);
+    obl_destroy_session(a);
+    obl_close_database(d);
+}
+
+void test_payload_foreign_source(void)
+{
+    struct obl_database_config config = { 0 };
+    obl_logical_address address;
+    obl_physical_address base;
+    struct obl_database *d;
+    struct obl_object *string;
+    struct obl_session *a, *b;
+    struct obl_object *cached, *foreign, *shape, *o;
+    obl_uint *buffer;
+    unsigned long hits, misses;
+
+    string = obl_create_cstring("shared contents", 15);
+    d = populate(&config, &string, 1, &address, NULL);
+    a = obl_create_session(d);
+
+    cached = obl_at_address(a, address);
+    base = cached->physical_address;
+    CU_ASSERT(d->payload_cache.used > 0);
+    hits = d->payload_cache.hits;
+    misses = d->payload_cache.misses;
+
+    /* A string at the same address in another buffer isn't the cached one. */
+    foreign = obl_create_cstring("foreign", 7);
+    buffer = calloc(base + 8, sizeof(obl_uint));
+    obl_string_write(foreign, buffer, base);
+
+    shape = obl_at_address(a, OBL_STRING_SHAPE_ADDR);
+    o = obl_string_read(a, shape, buffer, base, 0);
+    CU_ASSERT(obl_string_ccmp(o, "foreign") == 0);
+    CU_ASSERT(d->payload_cache.hits == hits);
+    CU_ASSERT(d->payload_cache.misses == misses);
+
+    /* Nor does it replace the cached payload. */
+    b = obl_create_session(d);
+    CU_ASSERT(obl_string_ccmp(obl_at_address(b, address),
+            "shared contents") == 0);
+    CU_ASSERT(d->payload_cache.hits == hits + 1);
+
+    obl_destroy_object(o);
+    obl_destroy_object(foreign);
+    free(buffer);
+    obl_destroy_session(b);
+    obl_destroy_session(a);
+    obl_close_database(d);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_payload_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("payload", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_payload_sharing);
+    ADD_TEST(test_payload_invalidation);
+    ADD_TEST(test_payload_disabled);
+    ADD_TEST(test_payload_foreign_source);
+
+    return pSuite;
+}
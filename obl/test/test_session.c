@@ -9,13 +9,24 @@
 #include "session.h"
 #include "transaction.h"
 
+#include "storage/fixed.h"
 #include "storage/integer.h"
 #include "database.h"
 #include "set.h"
+#include "table.h"
 #include "unitutilities.h"
 
 #include "CUnit/Basic.h"
 
+/* Links in the chain committed by test_deep_discovery. */
+#define CHAIN_LENGTH 200000
+
+/* New objects committed at once by test_coalesced_write_out. */
+#define RUN_LENGTH 50
+
+/* Commits of fresh objects made by test_version_pruning. */
+#define PRUNE_COMMITS 1000
+
 void test_ensure_transaction(void)
 {
     int created = 0;
@@ -69,7 +80,7 @@ void test_mark_dirty(void)
     obl_mark_dirty(o);
 
     CU_ASSERT(obl_set_includes(t->write_set, o));
-    CU_ASSERT(!obl_set_includes(s->read_set, o));
+    CU_ASSERT(!obl_table_includes(s->read_set, o));
 
     obl_abort_transaction(t);
 
@@ -163,16 +174,164 @@ void test_object_discovery(void)
     CU_ASSERT(one_shape->logical_address != OBL_LOGICAL_UNASSIGNED);
     CU_ASSERT(one_shape->session == s);
 
-    CU_ASSERT(obl_set_includes(s->read_set, one));
-    CU_ASSERT(obl_set_includes(s->read_set, two));
-    CU_ASSERT(obl_set_includes(s->read_set, a));
-    CU_ASSERT(obl_set_includes(s->read_set, b));
-    CU_ASSERT(obl_set_includes(s->read_set, root_shape));
-    CU_ASSERT(obl_set_includes(s->read_set, one_shape));
+    CU_ASSERT(obl_table_includes(s->read_set, one));
+    CU_ASSERT(obl_table_includes(s->read_set, two));
+    CU_ASSERT(obl_table_includes(s->read_set, a));
+    CU_ASSERT(obl_table_includes(s->read_set, b));
+    CU_ASSERT(obl_table_includes(s->read_set, root_shape));
+    CU_ASSERT(obl_table_includes(s->read_set, one_shape));
 
     CU_ASSERT(obl_nil()->session == NULL);
-    CU_ASSERT(! obl_set_includes(s->read_set, obl_nil()));
+    CU_ASSERT(! obl_table_includes(s->read_set, obl_nil()));
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+/*
+ * Discover a chain long enough to exhaust the stack of a recursive traversal,
+ * whose last link refers back to its first.
+ */
+void test_deep_discovery(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d);
+    struct obl_transaction *t;
+    struct obl_object *head, *link;
+    size_t i, resident;
+    int assigned = 1;
+
+    t = obl_begin_transaction(s);
+
+    head = link = obl_create_fixed(1);
+    for (i = 1; i < CHAIN_LENGTH; i++) {
+        struct obl_object *next = obl_create_fixed(1);
+
+        obl_fixed_at_put(link, 0, next);
+        link = next;
+    }
+    obl_fixed_at_put(link, 0, head);
+
+    head->session = s;
+    obl_mark_dirty(head);
+    resident = s->read_set->count;
+
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    link = head;
+    for (i = 0; i < CHAIN_LENGTH; i++) {
+        if (link->session != s ||
+                link->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+            assigned = 0;
+        }
+        link = obl_fixed_at(link, 0);
+    }
+    CU_ASSERT(assigned);
+    CU_ASSERT(link == head);
+    CU_ASSERT(s->read_set->count >= resident + CHAIN_LENGTH);
+    CU_ASSERT(s->adopted_count == 0);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_coalesced_write_out(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d);
+    struct obl_commit_statistics *stats = &d->commit_statistics;
+    struct obl_transaction *t;
+    struct obl_object *fixed;
+    unsigned long written, runs;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+
+    written = stats->objects_written;
+    runs = stats->write_runs;
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    /* New objects are laid out, and written, back to back. */
+    CU_ASSERT(stats->objects_written - written == RUN_LENGTH + 1);
+    CU_ASSERT(stats->write_runs - runs == 1);
+
+    /* Neighbours share a run; distant objects don't. */
+    t = obl_begin_transaction(s);
+    obl_mark_dirty(obl_fixed_at(fixed, 0));
+    obl_mark_dirty(obl_fixed_at(fixed, 1));
+    obl_mark_dirty(obl_fixed_at(fixed, RUN_LENGTH - 1));
+
+    written = stats->objects_written;
+    runs = stats->write_runs;
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    CU_ASSERT(stats->objects_written - written == 3);
+    CU_ASSERT(stats->write_runs - runs == 2);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
 
+void test_partial_write(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *other;
+    struct obl_commit_statistics *stats = &d->commit_statistics;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *seven, *o;
+    uint64_t words;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    /* Replacing one element writes only the word that refers to it. */
+    seven = obl_fixed_at(fixed, 7);
+    t = obl_begin_transaction(s);
+    obl_fixed_at_put(fixed, 7, obl_fixed_at(fixed, 3));
+    obl_fixed_at_put(fixed, 3, seven);
+    CU_ASSERT(fixed->dirty_words != NULL);
+
+    words = stats->words_written;
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    CU_ASSERT(stats->words_written - words == 2);
+    CU_ASSERT(fixed->dirty_words == NULL);
+
+    /* So does changing an integer. */
+    words = stats->words_written;
+    obl_integer_set(seven, 77);
+    CU_ASSERT(stats->words_written - words == 1);
+
+    /* Marking the whole object dirty supersedes the bitmap. */
+    t = obl_begin_transaction(s);
+    obl_fixed_at_put(fixed, 0, seven);
+    obl_mark_dirty(fixed);
+    CU_ASSERT(fixed->dirty_words == NULL);
+
+    words = stats->words_written;
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    CU_ASSERT(stats->words_written - words == obl_object_wordsize(fixed));
+
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 0)) == 77);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 3)) == 77);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 7)) == 3);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 8)) == 8);
+
+    obl_destroy_session(other);
     obl_destroy_session(s);
     obl_close_database(d);
 }
@@ -292,6 +451,299 @@ void test_simple_abort(void)
     obl_close_database(d);
 }
 
+void test_undo_abort(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d);
+    struct obl_transaction *t;
+    struct obl_fixed_storage *storage;
+    struct obl_object *fixed, *three, *seven;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    storage = fixed->storage.fixed_storage;
+    three = obl_fixed_at(fixed, 3);
+    seven = obl_fixed_at(fixed, 7);
+
+    t = obl_begin_transaction(s);
+    obl_fixed_at_put(fixed, 3, seven);
+    obl_fixed_at_put(fixed, 7, three);
+    obl_fixed_at_put(fixed, 3, obl_create_integer(300));
+    obl_integer_set(seven, 70);
+    obl_integer_set(seven, 700);
+    CU_ASSERT(t->undo_count == 5);
+    obl_abort_transaction(t);
+
+    /* Everything is restored in place, without reading anything again. */
+    CU_ASSERT(s->current_transaction == NULL);
+    CU_ASSERT(fixed->storage.fixed_storage == storage);
+    CU_ASSERT(obl_fixed_at(fixed, 3) == three);
+    CU_ASSERT(obl_fixed_at(fixed, 7) == seven);
+    CU_ASSERT(obl_integer_value(seven) == 7);
+    CU_ASSERT(fixed->dirty_words == NULL);
+
+    /* Objects marked dirty as a whole are still read again. */
+    t = obl_begin_transaction(s);
+    fixed->storage.fixed_storage->contents[0] = seven;
+    obl_mark_dirty(fixed);
+    obl_abort_transaction(t);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 0)) == 0);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_savepoint(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *other;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *o;
+    size_t savepoint;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+
+    savepoint = obl_savepoint(t);
+    obl_integer_set(obl_fixed_at(fixed, 1), 100);
+    obl_integer_set(obl_fixed_at(fixed, 2), 20);
+    obl_fixed_at_put(fixed, 4, obl_fixed_at(fixed, 5));
+
+    CU_ASSERT(obl_rollback_to_savepoint(t, savepoint) == 0);
+    CU_ASSERT(s->current_transaction == t);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 1)) == 10);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 2)) == 2);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 4)) == 4);
+
+    /* Later savepoints are gone. */
+    CU_ASSERT(obl_rollback_to_savepoint(t, savepoint + 1) == 1);
+
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 10);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 2)) == 2);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 4)) == 4);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_write_conflict(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *other;
+    struct obl_transaction *t, *u;
+    struct obl_object *fixed, *o;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+
+    /* Both sessions change the same object: the second commit loses. */
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+    obl_integer_set(obl_fixed_at(fixed, 2), 20);
+    u = obl_begin_transaction(other);
+    obl_integer_set(obl_fixed_at(o, 1), 11);
+    CU_ASSERT(obl_commit_transaction(u) == 0);
+
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 1)) == 10);
+    CU_ASSERT(obl_commit_transaction(t) == OBL_COMMIT_CONFLICT);
+    CU_ASSERT(d->error_code == OBL_CONFLICT);
+    CU_ASSERT(s->current_transaction == NULL);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 1)) == 11);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 2)) == 2);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 2)) == 2);
+    obl_clear_error(d);
+
+    /* Changes to different objects don't conflict. */
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 3), 30);
+    u = obl_begin_transaction(other);
+    obl_integer_set(obl_fixed_at(o, 4), 40);
+    CU_ASSERT(obl_commit_transaction(u) == 0);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 4)) == 40);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 3)) == 30);
+
+    /* Neither do a session's own successive commits. */
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 3), 31);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    /* Objects marked as read are validated as well. */
+    t = obl_begin_transaction(s);
+    CU_ASSERT(obl_mark_read(obl_fixed_at(fixed, 5)) == 0);
+    obl_integer_set(obl_fixed_at(fixed, 6), 60);
+    u = obl_begin_transaction(other);
+    obl_integer_set(obl_fixed_at(o, 5), 50);
+    CU_ASSERT(obl_commit_transaction(u) == 0);
+
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 5)) == 50);
+    CU_ASSERT(obl_commit_transaction(t) == OBL_COMMIT_CONFLICT);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 6)) == 6);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 6)) == 6);
+    obl_clear_error(d);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_version_pruning(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *other;
+    struct obl_transaction *t, *u;
+    struct obl_object *fixed, *o;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    /* With nothing in flight, old entries are dropped as new ones arrive. */
+    for (i = 0; i < PRUNE_COMMITS; i++) {
+        t = obl_begin_transaction(s);
+        obl_fixed_at_put(fixed, 3, obl_create_integer((obl_int) i));
+        CU_ASSERT(obl_commit_transaction(t) == 0);
+    }
+    CU_ASSERT(d->versions.count < PRUNE_COMMITS / 4);
+
+    /* An entry a write set still depends on survives pruning. */
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+    u = obl_begin_transaction(other);
+    obl_integer_set(obl_fixed_at(o, 1), 11);
+
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    for (i = 0; i < PRUNE_COMMITS; i++) {
+        t = obl_begin_transaction(s);
+        obl_fixed_at_put(fixed, 3, obl_create_integer((obl_int) i));
+        CU_ASSERT(obl_commit_transaction(t) == 0);
+    }
+
+    CU_ASSERT(obl_commit_transaction(u) == OBL_COMMIT_CONFLICT);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 10);
+    obl_clear_error(d);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_batched_mutations(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *other;
+    struct obl_commit_statistics *stats = &d->commit_statistics;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *one, *o;
+    unsigned long commits;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(RUN_LENGTH);
+    for (i = 0; i < RUN_LENGTH; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    one = obl_fixed_at(fixed, 1);
+
+    /* Without batching, each mutation commits on its own. */
+    commits = stats->commits;
+    obl_integer_set(one, 10);
+    CU_ASSERT(stats->commits == commits + 1);
+    CU_ASSERT(s->current_transaction == NULL);
+
+    obl_session_batch(s, 10, 0);
+    commits = stats->commits;
+    for (i = 0; i < 25; i++) {
+        obl_integer_set(one, 100 + i);
+    }
+    CU_ASSERT(stats->commits == commits + 2);
+    CU_ASSERT(s->current_transaction != NULL);
+    CU_ASSERT(s->current_transaction->implicit);
+    CU_ASSERT(s->current_transaction->mutations == 5);
+
+    /* The last batch isn't visible until it's flushed. */
+    other = obl_create_session(d);
+    o = obl_at_address(other, one->logical_address);
+    CU_ASSERT(obl_integer_value(o) == 119);
+
+    CU_ASSERT(obl_session_flush(s) == 0);
+    CU_ASSERT(stats->commits == commits + 3);
+    CU_ASSERT(s->current_transaction == NULL);
+    CU_ASSERT(obl_integer_value(o) == 124);
+
+    /* Beginning an explicit transaction commits the batch first. */
+    obl_fixed_at_put(fixed, 2, one);
+    t = obl_begin_transaction(s);
+    CU_ASSERT(t != NULL);
+    CU_ASSERT(! t->implicit);
+    CU_ASSERT(stats->commits == commits + 4);
+    obl_fixed_at_put(fixed, 3, one);
+    CU_ASSERT(s->current_transaction == t);
+    CU_ASSERT(t->mutations == 0);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    /* Batches are also committed once they're old enough. */
+    obl_session_batch(s, 1000, 500);
+    commits = stats->commits;
+    obl_integer_set(one, 1);
+    obl_sleep_usec(2000);
+    obl_integer_set(one, 2);
+    CU_ASSERT(stats->commits == commits + 1);
+    CU_ASSERT(s->current_transaction == NULL);
+
+    /* Destroying the session commits what's left. */
+    obl_integer_set(one, 3);
+    obl_destroy_session(s);
+    CU_ASSERT(obl_integer_value(o) == 3);
+
+    obl_destroy_session(other);
+    obl_close_database(d);
+}
+
 void test_cross_session(void)
 {
     struct obl_database *d = obl_open_defdatabase(NULL);
@@ -350,9 +802,17 @@ CU_pSuite initialize_session_suite(void)
     ADD_TEST(test_mark_dirty);
     ADD_TEST(test_simple_commit);
     ADD_TEST(test_object_discovery);
+    ADD_TEST(test_deep_discovery);
+    ADD_TEST(test_coalesced_write_out);
+    ADD_TEST(test_partial_write);
     ADD_TEST(test_auto_mark_dirty);
     ADD_TEST(test_refresh_object);
     ADD_TEST(test_simple_abort);
+    ADD_TEST(test_undo_abort);
+    ADD_TEST(test_savepoint);
+    ADD_TEST(test_write_conflict);
+    ADD_TEST(test_version_pruning);
+    ADD_TEST(test_batched_mutations);
     ADD_TEST(test_cross_session);
 
     return pSuite;
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for multi-process coordination.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "shared.h"
+
+#include "storage/object.h"
+#include "database.h"
+#include "growth.h"
+#include "session.h"
+#include "transaction.h"
+#include "unitutilities.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const char *filename = "shared.obl";
+static const char *shared_filename = "shared.obl-shm";
+
+/* Open the test database with multi-process coordination. */
+static struct obl_database *_open_shared(void)
+{
+    struct obl_database_config config = { 0 };
+
+    config.filename = filename;
+    config.multi_process = 1;
+
+    return obl_open_database(&config);
+}
+
+/* Commit a single integer at a fixed physical address. */
+static int _commit_integer(struct obl_session *s, obl_physical_address at,
+        obl_int value)
+{
+    struct obl_transaction *t;
+    struct obl_object *o;
+    int result;
+
+    t = obl_begin_transaction(s);
+    o = obl_create_integer(value);
+    o->session = s;
+    o->logical_address = (obl_logical_address) (at + 1000);
+    o->physical_address = at;
+    obl_mark_dirty(o);
+
+    result = obl_commit_transaction(t);
+    obl_destroy_object(o);
+
+    return result;
+}
+
+/* Return the descriptor this process holds open on the sidecar, or -1. */
+static int _sidecar_fd(void)
+{
+    struct stat sidecar, info;
+    int fd;
+
+    if (stat(shared_filename, &sidecar) != 0) {
+        return -1;
+    }
+
+    for (fd = 0; fd < 1024; fd++) {
+        if (fstat(fd, &info) == 0 && info.st_dev == sidecar.st_dev &&
+                info.st_ino == sidecar.st_ino) {
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+/* Wait for a child process and return nonzero if it succeeded. */
+static int _succeeded(pid_t child)
+{
+    int status;
+
+    return waitpid(child, &status, 0) == child &&
+            WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void test_shared_catch_up(void)
+{
+    struct obl_session *s;
+    struct obl_object *allocator, *next_logical;
+    uint64_t sequence;
+    pid_t child;
+
+    remove(filename);
+    remove(shared_filename);
+    d = _open_shared();
+    CU_ASSERT_FATAL(d != NULL);
+    CU_ASSERT(d->shared != NULL);
+    s = obl_create_session(d);
+
+    allocator = obl_at_address(s, d->root.allocator_addr);
+    next_logical = obl_slotted_at(allocator, (obl_uint) 0);
+    CU_ASSERT(obl_integer_value(next_logical) != 4242);
+    sequence = obl_commit_sequence(d);
+
+    /* Another process changes an object that this one has already read. */
+    child = fork();
+    CU_ASSERT_FATAL(child >= 0);
+    if (child == 0) {
+        struct obl_database *other = _open_shared();
+        struct obl_session *os = obl_create_session(other);
+        struct obl_transaction *t = obl_begin_transaction(os);
+        struct obl_object *a = obl_at_address(os, other->root.allocator_addr);
+
+        obl_integer_set(obl_slotted_at(a, (obl_uint) 0), 4242);
+        _exit(obl_commit_transaction(t));
+    }
+    CU_ASSERT(_succeeded(child));
+    CU_ASSERT(obl_commit_sequence(d) == sequence + 1);
+
+    /* The next read notices the commit and refreshes the object in place. */
+    CU_ASSERT(obl_at_address(s, d->root.allocator_addr) == allocator);
+    CU_ASSERT(obl_integer_value(next_logical) == 4242);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_shared_growth(void)
+{
+    obl_uint size;
+    pid_t child;
+
+    d = _open_shared();
+    CU_ASSERT_FATAL(d != NULL);
+    size = d->content_size;
+
+    /* Another process grows the database and writes past our mapping. */
+    child = fork();
+    CU_ASSERT_FATAL(child >= 0);
+    if (child == 0) {
+        struct obl_database *other = _open_shared();
+
+        pthread_rwlock_wrlock(&other->content_lock);
+        _obl_shared_write_begin(other);
+        if (_obl_ensure_capacity(other, size * 4)) {
+            _exit(1);
+        }
+        other->content[size * 3] = writable_uint(77);
+        _obl_shared_write_end(other, 1);
+        _exit(0);
+    }
+    CU_ASSERT(_succeeded(child));
+
+    CU_ASSERT(_obl_shared_read_begin(d) == 0);
+    CU_ASSERT(d->content_size >= size * 4);
+    CU_ASSERT(readable_uint(d->content[size * 3]) == 77);
+    _obl_shared_read_end(d);
+
+    obl_close_database(d);
+}
+
+#define WRITERS 3
+#define COMMITS_EACH 20
+
+void test_shared_writers(void)
+{
+    pid_t children[WRITERS];
+    uint64_t sequence;
+    int i, j;
+
+    d = _open_shared();
+    CU_ASSERT_FATAL(d != NULL);
+    sequence = obl_commit_sequence(d);
+
+    for (i = 0; i < WRITERS; i++) {
+        children[i] = fork();
+        CU_ASSERT_FATAL(children[i] >= 0);
+        if (children[i] == 0) {
+            struct obl_database *other = _open_shared();
+            struct obl_session *os = obl_create_session(other);
+            int failed = 0;
+
+            for (j = 0; j < COMMITS_EACH; j++) {
+                failed |= _commit_integer(os,
+                        (obl_physical_address) (512 + 2 * (i * COMMITS_EACH + j)),
+                        (obl_int) (i * 1000 + j));
+            }
+            _exit(failed);
+        }
+    }
+    for (i = 0; i < WRITERS; i++) {
+        CU_ASSERT(_succeeded(children[i]));
+    }
+
+    /* Every commit was counted exactly once, and none were lost. */
+    CU_ASSERT(obl_commit_sequence(d) == sequence + WRITERS * COMMITS_EACH);
+    CU_ASSERT(_obl_shared_read_begin(d) == 0);
+    for (i = 0; i < WRITERS; i++) {
+        for (j = 0; j < COMMITS_EACH; j++) {
+            obl_physical_address at = 512 + 2 * (i * COMMITS_EACH + j);
+            CU_ASSERT(readable_int(d->content[at + 1]) == i * 1000 + j);
+        }
+    }
+    _obl_shared_read_end(d);
+
+    obl_close_database(d);
+    remove(shared_filename);
+}
+
+void test_shared_abort_unlocked(void)
+{
+    struct obl_session *s;
+    struct obl_transaction *t;
+    struct obl_object *o;
+    int fd, saved, unreadable;
+
+    remove(filename);
+    remove(shared_filename);
+    d = _open_shared();
+    CU_ASSERT_FATAL(d != NULL);
+    s = obl_create_session(d);
+
+    t = obl_begin_transaction(s);
+    o = obl_create_integer(7);
+    o->session = s;
+    obl_mark_dirty(o);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    /* Objects marked dirty as a whole are reread when the abort runs. */
+    t = obl_begin_transaction(s);
+    obl_mark_dirty(o);
+
+    /* Taking the shared lock fails on a descriptor that can't be read. */
+    fd = _sidecar_fd();
+    CU_ASSERT_FATAL(fd >= 0);
+    saved = dup(fd);
+    unreadable = open(shared_filename, O_WRONLY);
+    CU_ASSERT_FATAL(saved >= 0 && unreadable >= 0);
+    dup2(unreadable, fd);
+
+    obl_abort_transaction(t);
+
+    dup2(saved, fd);
+    close(saved);
+    close(unreadable);
+
+    /* The lock failure is reported, but the transaction is still over. */
+    CU_ASSERT(d->error_code == OBL_UNABLE_TO_READ_FILE);
+    CU_ASSERT(s->current_transaction == NULL);
+    CU_ASSERT(o->dirty_words == NULL);
+    obl_clear_error(d);
+
+    t = obl_begin_transaction(s);
+    CU_ASSERT(t != NULL);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+    remove(shared_filename);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_shared_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("shared", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_shared_catch_up);
+    ADD_TEST(test_shared_growth);
+    ADD_TEST(test_shared_writers);
+    ADD_TEST(test_shared_abort_unlocked);
+
+    return pSuite;
+}
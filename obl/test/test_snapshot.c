@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for snapshot reads.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "snapshot.h"
+
+#include "storage/fixed.h"
+#include "storage/integer.h"
+#include "storage/object.h"
+#include "database.h"
+#include "session.h"
+#include "transaction.h"
+#include "unitutilities.h"
+#include "view.h"
+
+/* Integers held by the fixed collection committed by each test. */
+#define SLOT_COUNT 8
+
+/* Commit a fixed collection of integers 0 through SLOT_COUNT - 1. */
+static struct obl_object *commit_integers(struct obl_session *s)
+{
+    struct obl_transaction *t;
+    struct obl_object *fixed;
+    int i;
+
+    t = obl_begin_transaction(s);
+    fixed = obl_create_fixed(SLOT_COUNT);
+    for (i = 0; i < SLOT_COUNT; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+    fixed->session = s;
+    obl_mark_dirty(fixed);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+
+    return fixed;
+}
+
+void test_snapshot_isolation(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *reader, *fresh;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *later, *o;
+
+    fixed = commit_integers(s);
+
+    reader = obl_create_session(d);
+    CU_ASSERT(obl_begin_snapshot(reader) == 0);
+    o = obl_at_address(reader, fixed->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 1);
+
+    /* Commits made meanwhile are invisible to the snapshot. */
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+    obl_integer_set(obl_fixed_at(fixed, 2), 20);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    later = commit_integers(s);
+
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 1);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 2)) == 2);
+    CU_ASSERT(obl_at_address(reader, later->logical_address) == obl_nil());
+
+    /* A session reading a snapshot can't change it. */
+    CU_ASSERT(obl_begin_transaction(reader) == NULL);
+    CU_ASSERT(d->error_code == OBL_ALREADY_IN_TRANSACTION);
+    obl_clear_error(d);
+
+    /* Ending the snapshot catches the session up. */
+    obl_end_snapshot(reader);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 10);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 2)) == 20);
+    o = obl_at_address(reader, later->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 3)) == 3);
+
+    /* Sessions that weren't reading the snapshot find the moved objects. */
+    fresh = obl_create_session(d);
+    o = obl_at_address(fresh, fixed->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 10);
+    obl_destroy_session(fresh);
+
+    obl_destroy_session(reader);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_snapshot_reclaim(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *reader;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *i, *j, *o;
+    obl_physical_address former;
+
+    fixed = commit_integers(s);
+    i = obl_fixed_at(fixed, 4);
+    former = i->physical_address;
+
+    reader = obl_create_session(d);
+    CU_ASSERT(obl_begin_snapshot(reader) == 0);
+
+    /* While the snapshot is pinned, the changed object moves. */
+    t = obl_begin_transaction(s);
+    obl_integer_set(i, 40);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    CU_ASSERT(i->physical_address != former);
+
+    o = obl_at_address(reader, i->logical_address);
+    CU_ASSERT(o->physical_address == former);
+    CU_ASSERT(obl_integer_value(o) == 4);
+
+    /* Once nothing can read its former space, the next commit reuses it. */
+    obl_end_snapshot(reader);
+    CU_ASSERT(obl_integer_value(o) == 40);
+
+    t = obl_begin_transaction(s);
+    j = obl_create_integer(50);
+    obl_fixed_at_put(fixed, 5, j);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    CU_ASSERT(j->physical_address == former);
+
+    obl_destroy_session(reader);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_snapshot_view(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d), *reader;
+    struct obl_transaction *t;
+    struct obl_object *fixed, *later;
+    struct obl_view view, child;
+
+    fixed = commit_integers(s);
+
+    reader = obl_create_session(d);
+    CU_ASSERT(obl_begin_snapshot(reader) == 0);
+
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    later = commit_integers(s);
+
+    /* Views within a snapshot see what its objects do. */
+    CU_ASSERT(obl_view_at(reader, fixed->logical_address, &view) == 0);
+    CU_ASSERT(obl_view_child(reader, &view, 1, &child) == 0);
+    CU_ASSERT(obl_view_integer(&child) == 1);
+    CU_ASSERT(obl_view_at(reader, later->logical_address, &view) == 1);
+
+    CU_ASSERT(obl_view_at(s, fixed->logical_address, &view) == 0);
+    CU_ASSERT(obl_view_child(s, &view, 1, &child) == 0);
+    CU_ASSERT(obl_view_integer(&child) == 10);
+
+    obl_end_snapshot(reader);
+    CU_ASSERT(obl_view_at(reader, fixed->logical_address, &view) == 0);
+    CU_ASSERT(obl_view_child(reader, &view, 1, &child) == 0);
+    CU_ASSERT(obl_view_integer(&child) == 10);
+
+    obl_destroy_session(reader);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_snapshot_exclusion(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d);
+    struct obl_transaction *t;
+
+    t = obl_begin_transaction(s);
+    CU_ASSERT(obl_begin_snapshot(s) == 1);
+    CU_ASSERT(d->error_code == OBL_ALREADY_IN_TRANSACTION);
+    obl_clear_error(d);
+    obl_abort_transaction(t);
+
+    CU_ASSERT(obl_begin_snapshot(s) == 0);
+    CU_ASSERT(obl_begin_snapshot(s) == 1);
+    obl_clear_error(d);
+    obl_end_snapshot(s);
+    obl_end_snapshot(s);
+
+    CU_ASSERT(! s->snapshot.pinned);
+    CU_ASSERT(d->snapshots.oldest == NULL);
+
+    /* Destroying a session releases its snapshot. */
+    CU_ASSERT(obl_begin_snapshot(s) == 0);
+    obl_destroy_session(s);
+    CU_ASSERT(d->snapshots.oldest == NULL);
+
+    obl_close_database(d);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_snapshot_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("snapshot", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_snapshot_isolation);
+    ADD_TEST(test_snapshot_reclaim);
+    ADD_TEST(test_snapshot_view);
+    ADD_TEST(test_snapshot_exclusion);
+
+    return pSuite;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for the open-addressing object table used by session read sets.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "table.h"
+
+#include "storage/object.h"
+#include "database.h"
+#include "unitutilities.h"
+
+static struct obl_object *addressed_integer(obl_logical_address address)
+{
+    struct obl_object *o;
+
+    o = obl_create_integer((obl_int) address);
+    o->logical_address = address;
+    return o;
+}
+
+void test_table_lookup(void)
+{
+    struct obl_table *table;
+    struct obl_object *o;
+    obl_logical_address address;
+    int found = 1;
+
+    table = obl_create_table();
+    CU_ASSERT_FATAL(table != NULL);
+    CU_ASSERT(obl_table_lookup(table, (obl_logical_address) 12) == NULL);
+
+    for (address = 1; address <= 1000; address++) {
+        obl_table_insert(table, addressed_integer(address));
+    }
+    CU_ASSERT(table->count == 1000);
+
+    for (address = 1; address <= 1000; address++) {
+        o = obl_table_lookup(table, address);
+        if (o == NULL || o->logical_address != address) {
+            found = 0;
+        }
+    }
+    CU_ASSERT(found);
+    CU_ASSERT(obl_table_lookup(table, (obl_logical_address) 1001) == NULL);
+
+    o = obl_table_lookup(table, (obl_logical_address) 500);
+    CU_ASSERT(obl_table_includes(table, o));
+
+    obl_destroy_table(table, &_obl_deallocate_object);
+}
+
+void test_table_replace(void)
+{
+    struct obl_table *table;
+    struct obl_object *first, *second;
+
+    table = obl_create_table();
+
+    first = addressed_integer((obl_logical_address) 7);
+    second = addressed_integer((obl_logical_address) 7);
+
+    obl_table_insert(table, first);
+    obl_table_insert(table, first);
+    CU_ASSERT(table->count == 1);
+    CU_ASSERT(obl_table_lookup(table, (obl_logical_address) 7) == first);
+
+    /* Replacing an object deallocates the original. */
+    obl_table_insert(table, second);
+    CU_ASSERT(table->count == 1);
+    CU_ASSERT(obl_table_lookup(table, (obl_logical_address) 7) == second);
+    CU_ASSERT(obl_table_includes(table, second));
+
+    obl_destroy_table(table, &_obl_deallocate_object);
+}
+
+void test_table_remove(void)
+{
+    struct obl_table *table;
+    struct obl_object *o;
+    obl_logical_address address;
+    size_t cursor = 0, visited = 0;
+    int correct = 1;
+
+    table = obl_create_table();
+
+    for (address = 1; address <= 5000; address++) {
+        obl_table_insert(table, addressed_integer(address));
+    }
+
+    for (address = 2; address <= 5000; address += 2) {
+        o = obl_table_lookup(table, address);
+        obl_table_remove(table, o);
+        _obl_deallocate_object(o);
+    }
+    CU_ASSERT(table->count == 2500);
+
+    for (address = 1; address <= 5000; address++) {
+        o = obl_table_lookup(table, address);
+        if ((address % 2 == 0) != (o == NULL)) {
+            correct = 0;
+        }
+    }
+    CU_ASSERT(correct);
+
+    /* Reinsertion reuses the slots that were freed. */
+    for (address = 2; address <= 5000; address += 2) {
+        obl_table_insert(table, addressed_integer(address));
+    }
+    CU_ASSERT(table->count == 5000);
+    CU_ASSERT(table->count + table->tombstones <= table->capacity);
+
+    while ( (o = obl_table_next(table, &cursor)) != NULL ) {
+        visited++;
+    }
+    CU_ASSERT(visited == 5000);
+
+    obl_destroy_table(table, &_obl_deallocate_object);
+}
+
+void test_table_churn(void)
+{
+    struct obl_table *table;
+    struct obl_object *o;
+    obl_logical_address address;
+    size_t capacity;
+
+    table = obl_create_table();
+
+    for (address = 1; address <= 100; address++) {
+        obl_table_insert(table, addressed_integer(address));
+    }
+    capacity = table->capacity;
+
+    /*
+     * A steady stream of insertions and removals leaves tombstones behind,
+     * which must be reclaimed without growing the table.
+     */
+    for (address = 101; address <= 20000; address++) {
+        obl_table_insert(table, addressed_integer(address));
+
+        o = obl_table_lookup(table, address - 100);
+        obl_table_remove(table, o);
+        _obl_deallocate_object(o);
+    }
+
+    CU_ASSERT(table->count == 100);
+    CU_ASSERT(table->capacity == capacity);
+    CU_ASSERT(obl_table_lookup(table, (obl_logical_address) 19900) == NULL);
+    CU_ASSERT(obl_table_lookup(table, (obl_logical_address) 19901) != NULL);
+
+    obl_destroy_table(table, &_obl_deallocate_object);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_table_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("table", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_table_lookup);
+    ADD_TEST(test_table_replace);
+    ADD_TEST(test_table_remove);
+    ADD_TEST(test_table_churn);
+
+    return pSuite;
+}
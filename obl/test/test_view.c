@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for read-only views of persisted objects.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "view.h"
+
+#include "storage/object.h"
+#include "database.h"
+#include "session.h"
+#include "table.h"
+#include "transaction.h"
+#include "unitutilities.h"
+
+/*
+ * Create a slotted object whose slots hold a string, an integer and a fixed
+ * collection of two integers.
+ */
+static struct obl_object *_create_viewed(void)
+{
+    struct obl_object *shape, *root, *fixed;
+    char *slots[] = { "name", "count", "items" };
+
+    shape = obl_create_cshape("ViewClass", 3, slots, OBL_SLOTTED);
+    root = obl_create_slotted(shape);
+    fixed = obl_create_fixed(2);
+
+    obl_fixed_at_put(fixed, 0, obl_create_integer(10));
+    obl_fixed_at_put(fixed, 1, obl_create_integer(20));
+    obl_slotted_atcnamed_put(root, "name", obl_create_cstring("viewed", 6));
+    obl_slotted_atcnamed_put(root, "count", obl_create_integer(42));
+    obl_slotted_atcnamed_put(root, "items", fixed);
+
+    return root;
+}
+
+void test_view_slotted(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_object *viewed;
+    struct obl_view root, child, element;
+    obl_logical_address address;
+    UChar buffer[10];
+
+    viewed = _create_viewed();
+    d = populate(&config, &viewed, 1, &address, NULL);
+    s = obl_create_session(d);
+
+    CU_ASSERT(obl_view_at(s, address, &root) == 0);
+    CU_ASSERT(root.storage == OBL_SLOTTED);
+    CU_ASSERT(root.size == 3);
+
+    CU_ASSERT(obl_view_child(s, &root, 0, &child) == 0);
+    CU_ASSERT(child.storage == OBL_STRING);
+    CU_ASSERT(child.size == 6);
+    CU_ASSERT(obl_view_string_ccmp(&child, "viewed") == 0);
+    CU_ASSERT(obl_view_string_ccmp(&child, "view") != 0);
+    CU_ASSERT(obl_view_string_ccmp(&child, "viewedx") != 0);
+    CU_ASSERT(obl_view_string_value(&child, buffer, 10) == 6);
+    CU_ASSERT(buffer[0] == 'v' && buffer[5] == 'd');
+
+    CU_ASSERT(obl_view_child(s, &root, 1, &child) == 0);
+    CU_ASSERT(child.storage == OBL_INTEGER);
+    CU_ASSERT(obl_view_integer(&child) == 42);
+
+    CU_ASSERT(obl_view_child(s, &root, 2, &child) == 0);
+    CU_ASSERT(child.storage == OBL_FIXED);
+    CU_ASSERT(child.size == 2);
+    CU_ASSERT(obl_view_child(s, &child, 1, &element) == 0);
+    CU_ASSERT(obl_view_integer(&element) == 20);
+
+    /* Viewing faults nothing into the session. */
+    CU_ASSERT(s->read_set->count == 0);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_view_fixed_space(void)
+{
+    struct obl_database *d = obl_open_defdatabase(NULL);
+    struct obl_session *s = obl_create_session(d);
+    struct obl_view view;
+
+    CU_ASSERT(obl_view_at(s, OBL_NIL_ADDR, &view) == 0);
+    CU_ASSERT(view.storage == OBL_NIL);
+    CU_ASSERT(view.physical_address == OBL_PHYSICAL_UNASSIGNED);
+
+    CU_ASSERT(obl_view_at(s, OBL_INTEGER_SHAPE_ADDR, &view) == 0);
+    CU_ASSERT(view.storage == OBL_SHAPE);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_view_errors(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_object *viewed;
+    struct obl_view root, child;
+    obl_logical_address address;
+
+    viewed = _create_viewed();
+    d = populate(&config, &viewed, 1, &address, &s);
+
+    /* Nothing has been committed at this address. */
+    CU_ASSERT(obl_view_at(s, (obl_logical_address) 4000, &root) == 1);
+
+    CU_ASSERT(obl_view_at(s, address, &root) == 0);
+    CU_ASSERT(obl_view_slot(&root, 3) == OBL_NIL_ADDR);
+    CU_ASSERT(obl_view_integer(&root) == 0);
+
+    CU_ASSERT(obl_view_child(s, &root, 1, &child) == 0);
+    CU_ASSERT(obl_view_slot(&child, 0) == OBL_NIL_ADDR);
+    CU_ASSERT(obl_view_string_ccmp(&child, "42") == -1);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_view_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("view", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_view_slotted);
+    ADD_TEST(test_view_fixed_space);
+    ADD_TEST(test_view_errors);
+
+    return pSuite;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for the write-ahead log.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "wal.h"
+
+#include "storage/integer.h"
+#include "storage/object.h"
+#include "database.h"
+#include "session.h"
+#include "transaction.h"
+#include "unitutilities.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const char *filename = "durable.obl";
+static const char *wal_filename = "durable.obl-wal";
+
+/* Open a fresh database with a write-ahead log. */
+static struct obl_database *_open_logged(int fresh)
+{
+    struct obl_database_config config = { 0 };
+
+    if (fresh) {
+        remove(filename);
+        remove(wal_filename);
+    }
+    config.filename = filename;
+    config.write_ahead_log = 1;
+
+    return obl_open_database(&config);
+}
+
+/* Commit a single integer at a fixed physical address. */
+static int _commit_integer(struct obl_session *s, obl_physical_address at,
+        obl_int value)
+{
+    struct obl_transaction *t;
+    struct obl_object *o;
+    int result;
+
+    t = obl_begin_transaction(s);
+    o = obl_create_integer(value);
+    o->session = s;
+    o->logical_address = (obl_logical_address) (at + 1000);
+    o->physical_address = at;
+    obl_mark_dirty(o);
+
+    result = obl_commit_transaction(t);
+    obl_destroy_object(o);
+
+    return result;
+}
+
+/* Read a single word from the database file itself. */
+static obl_uint _file_word(obl_physical_address at)
+{
+    obl_uint word = 0;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    pread(fd, &word, sizeof(obl_uint), (off_t) at * sizeof(obl_uint));
+    close(fd);
+
+    return readable_uint(word);
+}
+
+void test_wal_lazy_checkpoint(void)
+{
+    struct obl_database *d;
+    struct obl_session *s;
+    struct stat info;
+    unsigned long records, syncs;
+
+    d = _open_logged(1);
+    CU_ASSERT_FATAL(d != NULL);
+    CU_ASSERT_FATAL(d->wal != NULL);
+    s = obl_create_session(d);
+
+    records = d->wal->statistics.records;
+    syncs = d->wal->statistics.syncs;
+    CU_ASSERT(_commit_integer(s, 600, 1234) == 0);
+    CU_ASSERT(d->wal->statistics.records == records + 1);
+    CU_ASSERT(d->wal->statistics.syncs == syncs + 1);
+
+    /* Visible in memory and in the log, but not yet in the database file. */
+    CU_ASSERT(readable_int(d->content[601]) == 1234);
+    CU_ASSERT(stat(wal_filename, &info) == 0);
+    CU_ASSERT(info.st_size > 0);
+    CU_ASSERT(_file_word(601) == 0);
+
+    CU_ASSERT(obl_checkpoint_database(d) == 0);
+    CU_ASSERT(_file_word(600) == OBL_INTEGER_SHAPE_ADDR);
+    CU_ASSERT(_file_word(601) == 1234);
+    CU_ASSERT(stat(wal_filename, &info) == 0);
+    CU_ASSERT(info.st_size == 0);
+    CU_ASSERT(readable_int(d->content[601]) == 1234);
+
+    obl_destroy_session(s);
+    obl_close_database(d);
+
+    /* A clean close removes the log. */
+    CU_ASSERT(stat(wal_filename, &info) != 0);
+}
+
+void test_wal_recovery(void)
+{
+    struct obl_database *d;
+    struct obl_session *s;
+    pid_t child;
+    int status;
+
+    d = _open_logged(1);
+    CU_ASSERT_FATAL(d != NULL);
+    obl_close_database(d);
+
+    /* Commit from a process that dies without checkpointing. */
+    child = fork();
+    CU_ASSERT_FATAL(child >= 0);
+    if (child == 0) {
+        d = _open_logged(0);
+        s = obl_create_session(d);
+        _commit_integer(s, 600, 4321);
+        _commit_integer(s, 700, 8765);
+        _exit(0);
+    }
+    CU_ASSERT(waitpid(child, &status, 0) == child);
+    CU_ASSERT(_file_word(601) == 0);
+
+    /* Reopening replays both commits into the file. */
+    d = _open_logged(0);
+    CU_ASSERT_FATAL(d != NULL);
+    CU_ASSERT(_file_word(601) == 4321);
+    CU_ASSERT(readable_int(d->content[601]) == 4321);
+    CU_ASSERT(readable_int(d->content[701]) == 8765);
+    CU_ASSERT(readable_uint(d->content[0]) == 0x6F626C00);
+    obl_close_database(d);
+}
+
+#define COMMITTERS 4
+#define COMMITS_EACH 50
+
+static void *_committer(void *argument)
+{
+    struct obl_session *s;
+    long which = (long) argument;
+    int i;
+
+    s = obl_create_session(d);
+    for (i = 0; i < COMMITS_EACH; i++) {
+        _commit_integer(s, (obl_physical_address) (512 + 2 * (which *
+                COMMITS_EACH + i)), (obl_int) (which * 1000 + i));
+    }
+    obl_destroy_session(s);
+
+    return NULL;
+}
+
+void test_group_commit(void)
+{
+    pthread_t threads[COMMITTERS];
+    unsigned long records, syncs;
+    long i;
+    int j;
+
+    d = _open_logged(1);
+    CU_ASSERT_FATAL(d != NULL);
+    records = d->wal->statistics.records;
+    syncs = d->wal->statistics.syncs;
+
+    for (i = 0; i < COMMITTERS; i++) {
+        pthread_create(&threads[i], NULL, &_committer, (void *) i);
+    }
+    for (i = 0; i < COMMITTERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    records = d->wal->statistics.records - records;
+    syncs = d->wal->statistics.syncs - syncs;
+    CU_ASSERT(records == COMMITTERS * COMMITS_EACH);
+    CU_ASSERT(syncs <= records);
+    obl_close_database(d);
+
+    /* Every commit survives a round trip through the file. */
+    d = _open_logged(0);
+    CU_ASSERT_FATAL(d != NULL);
+    for (i = 0; i < COMMITTERS; i++) {
+        for (j = 0; j < COMMITS_EACH; j++) {
+            obl_physical_address at = 512 + 2 * (i * COMMITS_EACH + j);
+            CU_ASSERT(readable_int(d->content[at + 1]) == i * 1000 + j);
+        }
+    }
+    obl_close_database(d);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_wal_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("wal", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_wal_lazy_checkpoint);
+    ADD_TEST(test_wal_recovery);
+    ADD_TEST(test_group_commit);
+
+    return pSuite;
+}
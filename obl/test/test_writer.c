@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * Unit tests for asynchronous commits and the writer thread.
+ */
+
+#include "CUnit/Basic.h"
+
+#include "writer.h"
+
+#include "storage/object.h"
+#include "storage/stub.h"
+#include "addressmap.h"
+#include "cache.h"
+#include "database.h"
+#include "session.h"
+#include "transaction.h"
+#include "unitutilities.h"
+
+#define COMMIT_COUNT 100
+
+/* Records the order in which commits complete. */
+struct completions
+{
+    int order[COMMIT_COUNT];
+    int count;
+    int failures;
+};
+
+/* The data passed to record_completion() by each commit. */
+struct completion
+{
+    struct completions *completions;
+    int index;
+};
+
+static void record_completion(int result, void *data)
+{
+    struct completion *c = data;
+
+    c->completions->order[c->completions->count++] = c->index;
+    if (result != 0) {
+        c->completions->failures++;
+    }
+}
+
+/* Create a fixed collection of four integers, counting up from 0. */
+static struct obl_object *_create_fixed(void)
+{
+    struct obl_object *fixed;
+    int i;
+
+    fixed = obl_create_fixed(4);
+    for (i = 0; i < 4; i++) {
+        obl_fixed_at_put(fixed, i, obl_create_integer((obl_int) i));
+    }
+
+    return fixed;
+}
+
+void test_async_commit(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s, *other;
+    struct obl_transaction *t;
+    struct obl_commit *c;
+    struct obl_object *fixed, *added, *o;
+
+    fixed = _create_fixed();
+    d = populate(&config, &fixed, 1, NULL, &s);
+
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+    added = obl_create_integer(42);
+    obl_fixed_at_put(fixed, 2, added);
+
+    c = obl_commit_transaction_async(t, NULL, NULL);
+    CU_ASSERT(c != NULL);
+
+    /* The session may go on at once. */
+    CU_ASSERT(s->current_transaction == NULL);
+    CU_ASSERT(fixed->dirty_words == NULL);
+    t = obl_begin_transaction(s);
+    CU_ASSERT(t != NULL);
+
+    CU_ASSERT(obl_commit_wait(c) == 0);
+    CU_ASSERT(added->logical_address != OBL_LOGICAL_UNASSIGNED);
+    CU_ASSERT(added->physical_address != OBL_PHYSICAL_UNASSIGNED);
+
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == 10);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 2)) == 42);
+
+    /* The next transaction only writes what it changed itself. */
+    obl_integer_set(obl_fixed_at(fixed, 3), 30);
+    CU_ASSERT(obl_commit_transaction(t) == 0);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 3)) == 30);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_async_order(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s, *other;
+    struct obl_object *fixed, *one, *o;
+    struct completions completions;
+    struct completion each[COMMIT_COUNT];
+    unsigned long commits;
+    int i, ordered = 1;
+
+    /* A short queue, so that most commits wait for room. */
+    config.commit_queue_length = 2;
+    fixed = _create_fixed();
+    d = populate(&config, &fixed, 1, NULL, &s);
+    one = obl_fixed_at(fixed, 1);
+    commits = d->commit_statistics.commits;
+
+    completions.count = completions.failures = 0;
+    for (i = 0; i < COMMIT_COUNT; i++) {
+        struct obl_transaction *t = obl_begin_transaction(s);
+
+        obl_integer_set(one, (obl_int) i);
+        each[i].completions = &completions;
+        each[i].index = i;
+        obl_commit_release(
+                obl_commit_transaction_async(t, &record_completion, &each[i]));
+    }
+
+    /* A synchronous commit waits for the asynchronous ones. */
+    obl_integer_set(obl_fixed_at(fixed, 2), 20);
+
+    CU_ASSERT(d->commit_statistics.commits == commits + COMMIT_COUNT + 1);
+    CU_ASSERT(completions.count == COMMIT_COUNT);
+    CU_ASSERT(completions.failures == 0);
+    for (i = 0; i < completions.count; i++) {
+        if (completions.order[i] != i) {
+            ordered = 0;
+        }
+    }
+    CU_ASSERT(ordered);
+
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 1)) == COMMIT_COUNT - 1);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(o, 2)) == 20);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_async_conflict(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s, *other;
+    struct obl_transaction *t, *u;
+    struct obl_commit *c;
+    struct obl_object *fixed, *o;
+
+    fixed = _create_fixed();
+    d = populate(&config, &fixed, 1, NULL, &s);
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+
+    t = obl_begin_transaction(s);
+    obl_integer_set(obl_fixed_at(fixed, 1), 10);
+    u = obl_begin_transaction(other);
+    obl_integer_set(obl_fixed_at(o, 1), 11);
+    CU_ASSERT(obl_commit_transaction(u) == 0);
+
+    /* The losing commit is abandoned, and its object read again. */
+    c = obl_commit_transaction_async(t, NULL, NULL);
+    CU_ASSERT(obl_commit_wait(c) == OBL_COMMIT_CONFLICT);
+    CU_ASSERT(s->current_transaction == NULL);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 1)) == 11);
+    obl_clear_error(d);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_async_eviction(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s, *other;
+    struct obl_transaction *t;
+    struct obl_commit *c;
+    struct obl_object *fixed, *o, *one;
+    obl_physical_address former;
+
+    fixed = _create_fixed();
+    d = populate(&config, &fixed, 1, NULL, &s);
+    other = obl_create_session(d);
+    o = obl_at_address(other, fixed->logical_address);
+    one = obl_fixed_at(o, 1);
+    CU_ASSERT(obl_integer_value(one) == 1);
+    former = one->physical_address;
+
+    t = obl_begin_transaction(other);
+    obl_integer_set(one, 10);
+
+    /* Hold the writer off while the session trims its cache to nothing. */
+    pthread_rwlock_rdlock(&d->content_lock);
+    c = obl_commit_transaction_async(t, NULL, NULL);
+    other->cache.budget = 1;
+    _obl_cache_trim(other, NULL);
+    CU_ASSERT(other->cache.evictions > 0);
+    CU_ASSERT(! _obl_is_stub(one));
+    pthread_rwlock_unlock(&d->content_lock);
+
+    /* The object is written where it was, not placed anew. */
+    CU_ASSERT(obl_commit_wait(c) == 0);
+    CU_ASSERT(one->physical_address == former);
+    CU_ASSERT(obl_address_lookup(d, one->logical_address) == former);
+    CU_ASSERT(obl_integer_value(obl_fixed_at(fixed, 1)) == 10);
+
+    obl_destroy_session(other);
+    obl_destroy_session(s);
+    obl_close_database(d);
+}
+
+void test_async_close(void)
+{
+    struct obl_database_config config = { 0 };
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_object *fixed;
+    struct completions completions;
+    struct completion each[COMMIT_COUNT];
+    int i;
+
+    config.commit_queue_length = 4;
+    fixed = _create_fixed();
+    d = populate(&config, &fixed, 1, NULL, &s);
+
+    completions.count = completions.failures = 0;
+    for (i = 0; i < COMMIT_COUNT; i++) {
+        struct obl_transaction *t = obl_begin_transaction(s);
+
+        obl_integer_set(obl_fixed_at(fixed, i % 4), (obl_int) i);
+        each[i].completions = &completions;
+        each[i].index = i;
+        obl_commit_release(
+                obl_commit_transaction_async(t, &record_completion, &each[i]));
+    }
+
+    /* Closing the database applies everything still queued. */
+    obl_close_database(d);
+    CU_ASSERT(completions.count == COMMIT_COUNT);
+    CU_ASSERT(completions.failures == 0);
+}
+
+/*
+ * Collect the unit tests defined here into a CUnit test suite.  Return the
+ * initialized suite on success, or NULL on failure.  Invoked by unittests.c.
+ */
+CU_pSuite initialize_writer_suite(void)
+{
+    CU_pSuite pSuite = NULL;
+
+    pSuite = CU_add_suite("writer", NULL, NULL);
+    if (pSuite == NULL) {
+        return NULL;
+    }
+
+    ADD_TEST(test_async_commit);
+    ADD_TEST(test_async_order);
+    ADD_TEST(test_async_conflict);
+    ADD_TEST(test_async_eviction);
+    ADD_TEST(test_async_close);
+
+    return pSuite;
+}
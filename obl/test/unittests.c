@@ -20,6 +20,14 @@ CU_pSuite initialize_object_suite(void);
 CU_pSuite initialize_addressmap_suite(void);
 CU_pSuite initialize_allocator_suite(void);
 CU_pSuite initialize_session_suite(void);
+CU_pSuite initialize_wal_suite(void);
+CU_pSuite initialize_shared_suite(void);
+CU_pSuite initialize_table_suite(void);
+CU_pSuite initialize_cache_suite(void);
+CU_pSuite initialize_payload_suite(void);
+CU_pSuite initialize_view_suite(void);
+CU_pSuite initialize_writer_suite(void);
+CU_pSuite initialize_snapshot_suite(void);
 
 /*
  * Prototypes for non-CUnit test cases.  Manually call these from main() to
@@ -47,7 +55,15 @@ int main()
             (initialize_object_suite() == NULL) ||
             (initialize_addressmap_suite() == NULL) ||
             (initialize_allocator_suite() == NULL) ||
-            (initialize_session_suite() == NULL)
+            (initialize_session_suite() == NULL) ||
+            (initialize_wal_suite() == NULL) ||
+            (initialize_shared_suite() == NULL) ||
+            (initialize_table_suite() == NULL) ||
+            (initialize_cache_suite() == NULL) ||
+            (initialize_payload_suite() == NULL) ||
+            (initialize_view_suite() == NULL) ||
+            (initialize_writer_suite() == NULL) ||
+            (initialize_snapshot_suite() == NULL)
     ) {
         CU_cleanup_registry();
         return CU_get_error();
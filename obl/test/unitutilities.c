@@ -8,7 +8,10 @@
 
 #include "unitutilities.h"
 
+#include "storage/object.h"
 #include "database.h"
+#include "session.h"
+#include "transaction.h"
 
 #include <stdio.h>
 
@@ -17,6 +20,37 @@ void wipe(struct obl_database *d)
     memset(d->content, 0, sizeof(obl_uint) * d->content_size);
 }
 
+struct obl_database *populate(struct obl_database_config *config,
+        struct obl_object **objects, int count,
+        obl_logical_address *addresses, struct obl_session **session)
+{
+    struct obl_database *d;
+    struct obl_session *s;
+    struct obl_transaction *t;
+    int i;
+
+    d = obl_open_database(config);
+    s = obl_create_session(d);
+
+    for (i = 0; i < count; i++) {
+        t = obl_begin_transaction(s);
+        objects[i]->session = s;
+        obl_mark_dirty(objects[i]);
+        obl_commit_transaction(t);
+
+        if (addresses != NULL) {
+            addresses[i] = objects[i]->logical_address;
+        }
+    }
+
+    if (session != NULL) {
+        *session = s;
+    } else {
+        obl_destroy_session(s);
+    }
+    return d;
+}
+
 void dump_memory(char *memory, int size, const char *filename)
 {
     int i;
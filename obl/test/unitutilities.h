@@ -10,8 +10,17 @@
 #ifndef UNITUTILITIES_H
 #define UNITUTILITIES_H
 
+#include "platform.h"
+
 /* defined in database.h */
 struct obl_database *d;
+struct obl_database_config;
+
+/* defined in session.h */
+struct obl_session;
+
+/* defined in storage/object.h */
+struct obl_object;
 
 /**
  * Register the test function +name+ with CUnit.  Use within an
@@ -47,6 +56,25 @@ struct obl_database *d;
  */
 void wipe(struct obl_database *d);
 
+/**
+ * Open a database as described by +config+, and persist each of +count+
+ * +objects+ within it, in a transaction of its own.  Objects that they refer
+ * to are persisted along with them.
+ *
+ * @param config
+ * @param objects Objects that haven't been assigned to a session yet.
+ * @param count
+ * @param addresses [out] If non-NULL, receives the logical address assigned
+ *      to each object.
+ * @param session [out] If non-NULL, receives the session that committed the
+ *      objects, which the caller must destroy.  Otherwise, the session is
+ *      destroyed, and the objects with it.
+ * @return The open database.
+ */
+struct obl_database *populate(struct obl_database_config *config,
+        struct obl_object **objects, int count,
+        obl_logical_address *addresses, struct obl_session **session);
+
 /**
  * Print the contents of +memory+ in hexadecimal, char by char.  Useful to pop
  * in when a memcmp() is failing.
@@ -10,11 +10,127 @@
 
 #include "addressmap.h"
 #include "allocator.h"
+#include "cache.h"
+#include "constants.h"
 #include "database.h"
+#include "payload.h"
+#include "dirty.h"
 #include "session.h"
 #include "set.h"
+#include "shared.h"
+#include "table.h"
+#include "wal.h"
+#include "writer.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+/** Test the bit for word +index+ within a dirty_words bitmap. */
+#define IS_DIRTY_WORD(bits, index) \
+    (((bits)[(index) / 64] >> ((index) % 64)) & 1)
+
+/**
+ * An object serialized by _prepare(), waiting to be copied into place.
+ */
+struct prepared
+{
+    struct obl_object *object;
+
+    /** Where the object was serialized, in words from the plan's buffer. */
+    size_t offset;
+
+    /** The size of the object, in words. */
+    obl_uint size;
+
+    /** Set if _place() assigned the object's physical address. */
+    int placed;
+
+    /**
+     * The physical address that _place() moved the object away from, so that
+     * a pinned snapshot could keep reading it, or OBL_PHYSICAL_UNASSIGNED.
+     */
+    obl_physical_address former;
+
+    /**
+     * The object's dirty_words, if only some of its words need to be written,
+     * or NULL to write all of them.
+     */
+    uint64_t *dirty;
+
+    /** The object's read_version when it was serialized. */
+    uint64_t version;
+};
+
+/**
+ * Everything that a commit will write, serialized ahead of time.
+ */
+struct plan
+{
+    /** The objects to write, in the order they were serialized. */
+    struct prepared *objects;
+
+    /** The number of entries in use and allocated within objects. */
+    size_t count, capacity;
+
+    /** The objects' serialized contents, back to back. */
+    obl_uint *buffer;
+
+    /** The size of buffer, in words. */
+    size_t words;
+
+    /**
+     * Set by _detach() once the commit no longer belongs to its session's
+     * current transaction.  The plan then owns the adopted objects' array
+     * and the dirty_words of its objects.
+     */
+    int detached;
+
+    /** The objects adopted by a detached commit. */
+    struct obl_object **adopted;
+
+    /** The number of entries within adopted. */
+    size_t adopted_count;
+};
+
+/**
+ * A commit made with obl_commit_transaction_async(), waiting to be published
+ * by the database's writer thread.
+ */
+struct obl_commit
+{
+    /** Queued with the writer thread.  Must come first. */
+    struct obl_writer_job job;
+
+    /** The detached transaction being committed. */
+    struct obl_transaction *transaction;
+
+    /** Its objects, already serialized. */
+    struct plan plan;
+
+    /** Called once the commit is complete, or NULL. */
+    obl_commit_callback callback;
+
+    /** Passed to callback. */
+    void *data;
+
+    /** Set once the commit is complete, successfully or not. */
+    int done;
+
+    /** The commit's outcome, as obl_commit_transaction() would return it. */
+    int result;
+
+    /**
+     * Held by the writer thread until the commit is complete, and by the
+     * caller until it calls obl_commit_wait() or obl_commit_release().
+     */
+    int references;
+
+    /** Guards done and references. */
+    pthread_mutex_t lock;
+
+    /** Signalled when done is set. */
+    pthread_cond_t finished;
+};
 
 /* Internal function prototypes. */
 
@@ -24,18 +140,203 @@ static struct obl_transaction *_allocate_transaction(
 static void _deallocate_transaction(struct obl_transaction *t);
 
 /**
- * Recursively visit the transitive closure of a root object, assigning
- * any missing logical or physical addresses or session references.  The
- * traversal is stubbed where addresses or session references already exist
- * (and hence the traversal will not be an infinite loop).
+ * Undo the adoption of objects by a commit that failed before placing them, so
+ * that a later commit will discover them again.  Logical addresses given out
+ * by _prepare() are abandoned.
+ */
+static void _unadopt(struct obl_transaction *t, struct plan *plan);
+
+/**
+ * Release the array of objects adopted by a commit: its own, if the commit is
+ * detached, or else the session's.
+ */
+static void _release_adopted(struct obl_session *s, struct plan *plan);
+
+/**
+ * Empty a session's array of adopted objects, freeing it if a large commit
+ * has left it bigger than ADOPTED_RETAINED.
+ */
+static void _reset_adopted(struct obl_session *s);
+
+/**
+ * Visit the transitive closure of a root object, assigning any missing
+ * session references.  The traversal is stubbed where session references
+ * already exist (and hence the traversal will not be an infinite loop).
+ * Logical addresses are assigned later by _prepare(), and physical ones by
+ * _place() once the commit has write access to the database.
+ *
+ * The traversal is breadth-first and uses no stack: each object that needs
+ * a session reference or an address is appended to s->adopted, which also
+ * serves as the queue of objects whose children remain to be visited.  An
+ * object's session reference is assigned as it is appended, so it's never
+ * appended twice.
  *
  * @param s The session to adopt objects on behalf of.
- * @param o The current root of traversal.
- * @param adopted [out] A list of all objects that needed session references
- *      and/or addresses.
+ * @param root The root of traversal.
+ * @return 0 on success, or 1 if memory is exhausted.
+ */
+static int _visit_transitive_closure(struct obl_session *s,
+        struct obl_object *root);
+
+/** An obl_child_callback that adopts a child without a session. */
+static int _visit_child(struct obl_object *child, void *data);
+
+/**
+ * Append an object to s->adopted and assign it to s.  Returns 1 if memory is
+ * exhausted.
+ */
+static int _adopt(struct obl_session *s, struct obl_object *o);
+
+/**
+ * The first phase of a commit.  Discover the objects that need to be adopted,
+ * give them logical addresses, and serialize them and every other object in
+ * the write set into a private buffer.  Runs with only the session lock held,
+ * although it releases it to renew the session's logical address lease.
+ *
+ * @param t The transaction being committed.
+ * @param plan [out] Receives the serialized objects.  Must be released with
+ *      _discard_plan() whether this call succeeds or not.
+ * @return 0 on success, or 1 if the objects could not be serialized.
+ */
+static int _prepare(struct obl_transaction *t, struct plan *plan);
+
+/** Add an object to a plan, leaving room for its contents. */
+static int _plan_object(struct obl_session *s, struct plan *plan,
+        struct obl_object *o);
+
+/**
+ * Give each planned object that has no physical address one, growing the
+ * database as needed, and record the new mappings within the address map.
+ * While a snapshot is pinned, objects that are already persisted are moved to
+ * fresh space as well, and their former space is retired.  Makes room to
+ * record the objects' versions as well.  Requires exclusive access to the
+ * database.  If the database can't grow, the assignments are undone and 1 is
+ * returned.
+ */
+static int _place(struct obl_session *s, struct plan *plan);
+
+/**
+ * Return the objects that _place() gave physical addresses to the addresses
+ * they had before.
+ */
+static void _unplace(struct plan *plan);
+
+/**
+ * Copy a placed plan's objects into the database in order of physical
+ * address, coalescing physically adjacent objects into a single write.
+ * Requires exclusive access to the database.
+ */
+static void _write_out(struct obl_database *d, struct plan *plan);
+
+/**
+ * Copy just the changed words of a partly dirty object into place, one noted
+ * write per run of consecutive changed words.
+ */
+static void _write_words(struct obl_database *d, struct plan *plan,
+        struct prepared *p);
+
+/** Discard the dirty_words of each object within a write set. */
+static void _clear_dirty_words(struct obl_set *write_set);
+
+/**
+ * Append an entry for word +index+ of +o+ to the current transaction's undo
+ * log, growing it as needed.  Returns NULL if o's session has no transaction,
+ * or if memory is exhausted, in which case o has been marked dirty as a whole.
+ */
+static struct obl_undo_entry *_log(struct obl_object *o, obl_uint index);
+
+/**
+ * Restore the entries of a transaction's undo log after the first +mark+,
+ * newest first, and truncate it.  The caller must hold the session lock.
+ */
+static void _undo_to(struct obl_transaction *t, size_t mark);
+
+/**
+ * Find an object that the commit writes or depends upon, and that another
+ * session has committed a change to since it was read.  Requires exclusive
+ * access to the database.
+ *
+ * @return The object's logical address, or OBL_LOGICAL_UNASSIGNED if the
+ *      commit doesn't conflict.
+ */
+static obl_logical_address _validate(struct obl_transaction *t,
+        struct plan *plan);
+
+/** Return true if another session has committed +address+ since +version+. */
+static int _is_stale(struct obl_session *s, obl_logical_address address,
+        uint64_t version);
+
+/**
+ * Deal with the stale objects of a commit that conflicted.  The undo log of a
+ * transaction that remains active would restore their stale contents, so
+ * they're marked dirty as a whole, and will be read again when it's aborted.
+ * Those of a detached commit are read again at once, unless the session's
+ * current transaction has changed them since.  Requires exclusive access to
+ * the database and the session lock.
+ */
+static void _discard_stale(struct obl_transaction *t, struct plan *plan);
+
+/**
+ * Number a commit that has been written, and record it as the version of
+ * each object that it wrote.  Until _obl_versions_propagated() is called, its
+ * changes count as undelivered.  Requires exclusive access to the database.
+ * Returns the commit's version.
+ */
+static uint64_t _stamp(struct obl_session *s, struct plan *plan);
+
+/**
+ * Return the oldest version that any copy that may yet be validated was read
+ * at, or 0 if some session is too busy to tell.  Requires exclusive access to
+ * the database and the committing session's lock.
+ */
+static uint64_t _oldest_read(struct obl_session *s);
+
+/**
+ * Return the oldest version that an object within a session's current
+ * transaction or detached commits was read at.  The caller must hold the
+ * session's lock.
+ */
+static uint64_t _session_oldest_read(struct obl_session *s);
+
+/** qsort() comparison function that orders prepared objects by location. */
+static int _compare_prepared(const void *left, const void *right);
+
+/** Free a plan's storage. */
+static void _discard_plan(struct plan *plan);
+
+/**
+ * The second phase of a commit.  Take exclusive access to the database, give
+ * the planned objects physical addresses and copy them into place, then
+ * notify the other sessions.  Destroys the transaction unless the commit
+ * fails before anything is written.
+ *
+ * @param t The transaction being committed.
+ * @param plan As filled in by _prepare().
+ * @return As obl_commit_transaction().
+ */
+static int _publish(struct obl_transaction *t, struct plan *plan);
+
+/**
+ * Separate a prepared commit from its session, so that the session can begin
+ * another transaction while the commit is published.  The plan takes the
+ * session's adopted objects and the dirty_words of the objects it will write,
+ * which are kept from eviction until the commit is published.  The caller
+ * must hold the session lock.
+ */
+static void _detach(struct obl_transaction *t, struct plan *plan);
+
+/**
+ * Destroy a detached transaction whose commit failed before anything was
+ * written.  Its changes remain in memory, but nothing in its session refers
+ * to it any longer.  The caller must hold the session lock.
  */
-static void _visit_transitive_closure(struct obl_session *s,
-        struct obl_object *o, struct obl_object_list **adopted);
+static void _abandon(struct obl_transaction *t);
+
+/** Publish a commit made with obl_commit_transaction_async(). */
+static void _run_commit(struct obl_writer_job *job);
+
+/** Release one reference to a commit, freeing it after the last. */
+static void _release_commit(struct obl_commit *c);
 
 /* External function definitions. */
 
@@ -43,9 +344,16 @@ struct obl_transaction *obl_begin_transaction(struct obl_session *s)
 {
     struct obl_transaction *t;
 
-    sem_wait(&s->session_mutex);
+    if (s->database->configuration.read_only) {
+        obl_report_error(s->database, OBL_READ_ONLY, NULL);
+        return NULL;
+    }
+
+    obl_session_flush(s);
+
+    pthread_mutex_lock(&s->session_mutex);
     t = _allocate_transaction(s);
-    sem_post(&s->session_mutex);
+    pthread_mutex_unlock(&s->session_mutex);
 
     return t;
 }
@@ -58,7 +366,15 @@ struct obl_transaction *obl_ensure_transaction(struct obl_session *s,
     if (s == NULL)
         return NULL;
 
-    sem_wait(&s->session_mutex);
+    if (s->database->configuration.read_only) {
+        *created = 0;
+        obl_report_error(s->database, OBL_READ_ONLY, NULL);
+        return NULL;
+    }
+
+    obl_session_flush(s);
+
+    pthread_mutex_lock(&s->session_mutex);
     if (s->current_transaction != NULL) {
         *created = 0;
         t = s->current_transaction;
@@ -66,205 +382,1295 @@ struct obl_transaction *obl_ensure_transaction(struct obl_session *s,
         *created = 1;
         t = _allocate_transaction(s);
     }
-    sem_post(&s->session_mutex);
+    pthread_mutex_unlock(&s->session_mutex);
+
+    return t;
+}
+
+struct obl_transaction *_obl_begin_mutation(struct obl_session *s,
+        int *implicit)
+{
+    struct obl_transaction *t;
+
+    *implicit = 0;
+    if (s == NULL)
+        return NULL;
+
+    if (s->database->configuration.read_only) {
+        obl_report_error(s->database, OBL_READ_ONLY, NULL);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&s->session_mutex);
+    t = s->current_transaction;
+    if (t != NULL) {
+        *implicit = t->implicit;
+    } else {
+        t = _allocate_transaction(s);
+        if (t != NULL) {
+            *implicit = 1;
+            if (s->batch_mutations > 0) {
+                t->implicit = 1;
+                t->started = obl_monotonic_usec();
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->session_mutex);
 
     return t;
 }
 
+void _obl_end_mutation(struct obl_transaction *t, int implicit)
+{
+    struct obl_session *s;
+
+    if (t == NULL || ! implicit) return ;
+
+    if (! t->implicit) {
+        obl_commit_transaction(t);
+        return ;
+    }
+
+    s = t->session;
+    t->mutations++;
+    if (t->mutations >= s->batch_mutations || (s->batch_usec > 0 &&
+            obl_monotonic_usec() - t->started >= s->batch_usec)) {
+        obl_commit_transaction(t);
+    }
+}
+
 void obl_mark_dirty(struct obl_object *o)
 {
     struct obl_session *s = o->session;
     struct obl_transaction *t;
 
-    if (s == NULL) return ;
+    /* Read-only sessions never have a transaction. */
+    if (s == NULL || s->database->configuration.read_only) return ;
 
-    sem_wait(&s->session_mutex);
+    pthread_mutex_lock(&s->session_mutex);
     if (s->current_transaction == NULL) {
-        sem_post(&s->session_mutex);
+        pthread_mutex_unlock(&s->session_mutex);
         return ;
     }
 
     t = s->current_transaction;
     obl_set_insert(t->write_set, o);
 
-    sem_post(&s->session_mutex);
+    /* The whole object will be written. */
+    free(o->dirty_words);
+    o->dirty_words = NULL;
+
+    pthread_mutex_unlock(&s->session_mutex);
 }
 
-int obl_commit_transaction(struct obl_transaction *t)
+int obl_mark_read(struct obl_object *o)
 {
-    struct obl_set_iterator *scan_it, *write_it;
-    struct obl_object *current;
-    struct obl_object_list *adopted = NULL;
-    struct obl_session *s = t->session;
-    struct obl_database *d = s->database;
-    struct obl_session_list *session_list;
-    struct obl_set *change_set;
-    unsigned long count = 0, adopt_count = 0;
+    struct obl_session *s = o->session;
+    struct obl_transaction *t;
+    struct obl_read_entry *e;
 
-    OBL_DEBUG(d, "Beginning commit.");
+    if (s == NULL || s->database->configuration.read_only ||
+            o->physical_address == OBL_PHYSICAL_UNASSIGNED) return 0;
 
-    sem_wait(&d->content_mutex);
-    sem_wait(&s->session_mutex);
+    pthread_mutex_lock(&s->session_mutex);
+    t = s->current_transaction;
+    if (t == NULL) {
+        pthread_mutex_unlock(&s->session_mutex);
+        return 0;
+    }
 
-    /*
-     * Scan all objects in the write set for references to any nonpersisted
-     * obl_objects.  Assign them to this transaction's session and accumulate
-     * them into the obl_object_list adopted.
-     */
-    scan_it = obl_set_inorder_iter(t->write_set);
-    while ( (current = obl_set_iternext(scan_it)) != NULL ) {
-        _visit_transitive_closure(s, current, &adopted);
+    if (t->read_count == t->read_capacity) {
+        size_t capacity = t->read_capacity == 0 ? 16 : 2 * t->read_capacity;
+        struct obl_read_entry *grown;
+
+        grown = realloc(t->reads, capacity * sizeof(struct obl_read_entry));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&s->session_mutex);
+            obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+            return 1;
+        }
+        t->reads = grown;
+        t->read_capacity = capacity;
     }
-    obl_set_destroyiter(scan_it);
 
-    /*
-     * Now that they have addresses and so on, add all adopted objects to the
-     * transaction write set and the session's read set.
-     */
-    while (adopted != NULL) {
-        struct obl_object_list *former;
+    e = &t->reads[t->read_count++];
+    e->address = o->logical_address;
+    e->version = o->read_version;
 
-        current = adopted->entry;
-        obl_set_insert(t->write_set, current);
-        obl_set_insert(s->read_set, current);
-        adopt_count++;
+    pthread_mutex_unlock(&s->session_mutex);
+
+    return 0;
+}
+
+void _obl_mark_dirty_word(struct obl_object *o, obl_uint index)
+{
+    struct obl_session *s = o->session;
+    struct obl_transaction *t;
+
+    if (s == NULL || s->database->configuration.read_only) return ;
 
-        former = adopted;
-        adopted = adopted->next;
-        free(former);
+    if (o->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+        obl_mark_dirty(o);
+        return ;
     }
 
-    /*
-     * Write each dirty object to the database.
-     */
-    write_it = obl_set_inorder_iter(t->write_set);
-    while ( (current = obl_set_iternext(write_it)) != NULL ) {
-        count++;
-        _obl_write(current);
+    pthread_mutex_lock(&s->session_mutex);
+    if (s->current_transaction == NULL) {
+        pthread_mutex_unlock(&s->session_mutex);
+        return ;
     }
-    obl_set_destroyiter(write_it);
 
-    /*
-     * Destroy this transaction and remove it from the session.  Its work
-     * is now complete.
-     */
-    change_set = t->write_set;
-    _deallocate_transaction(t);
+    t = s->current_transaction;
+    if (! obl_set_includes(t->write_set, o)) {
+        obl_uint words = obl_object_wordsize(o);
 
-    sem_post(&s->session_mutex);
-    sem_post(&d->content_mutex);
+        /* Without room for a bitmap, the whole object will be written. */
+        o->dirty_words = calloc((words + 63) / 64, sizeof(uint64_t));
+        obl_set_insert(t->write_set, o);
+    }
 
-    /*
-     * Notify each other session to update their views of any objects we've
-     * just changed.
-     */
-    sem_wait(&d->session_list_mutex);
-    session_list = d->session_list;
-    while (session_list != NULL) {
-        struct obl_session *other = session_list->entry;
-        if (other != s) {
-            _obl_update_objects(other, change_set);
-        }
+    if (o->dirty_words != NULL) {
+        o->dirty_words[index / 64] |= (uint64_t) 1 << (index % 64);
+    }
 
-        session_list = session_list->next;
+    pthread_mutex_unlock(&s->session_mutex);
+}
+
+void _obl_log_reference(struct obl_object *o, obl_uint index,
+        struct obl_object *before)
+{
+    struct obl_undo_entry *e = _log(o, index);
+
+    if (e != NULL) {
+        e->before.reference = before;
     }
-    sem_post(&d->session_list_mutex);
+}
 
-    obl_destroy_set(change_set, NULL);
+void _obl_log_integer(struct obl_object *o, obl_int before)
+{
+    struct obl_undo_entry *e = _log(o, 1);
 
-    OBL_DEBUGF(d,
-            "Successful commit of %lu objects, "
-            "%lu previously unpersisted.", count, adopt_count);
+    if (e != NULL) {
+        e->before.integer = before;
+    }
+}
 
-    return 0;
+size_t obl_savepoint(struct obl_transaction *t)
+{
+    return t->undo_count;
 }
 
-void obl_abort_transaction(struct obl_transaction *t)
+int obl_rollback_to_savepoint(struct obl_transaction *t, size_t savepoint)
 {
     struct obl_session *s = t->session;
-    struct obl_set_iterator *iter;
-    struct obl_object *current;
 
-    sem_wait(&s->session_mutex);
-
-    iter = obl_set_destroying_iter(t->write_set);
-    while ( (current = obl_set_iternext(iter)) != NULL ) {
-        obl_refresh_object(current);
+    if (savepoint > t->undo_count) {
+        obl_report_errorf(s->database, OBL_INVALID_INDEX,
+                "obl_rollback_to_savepoint called with an invalid savepoint "
+                "(%lu, valid 0..%lu)",
+                (unsigned long) savepoint, (unsigned long) t->undo_count);
+        return 1;
     }
-    obl_set_destroyiter(iter);
 
-    _deallocate_transaction(t);
+    pthread_mutex_lock(&s->session_mutex);
+    _undo_to(t, savepoint);
+    pthread_mutex_unlock(&s->session_mutex);
 
-    sem_post(&s->session_mutex);
+    return 0;
 }
 
-static void _deallocate_transaction(struct obl_transaction *t)
+int obl_commit_transaction(struct obl_transaction *t)
 {
-    t->session->current_transaction = NULL;
-    free(t);
+    struct obl_session *s = t->session;
+    struct obl_database *d = s->database;
+    struct plan plan;
+    int result;
+
+    OBL_DEBUG(d, "Beginning commit.");
+
+    /*
+     * Discover the objects that this commit will persist and serialize them.
+     * This touches nothing but the session's own objects, so other sessions
+     * may keep reading and committing meanwhile.
+     */
+    pthread_mutex_lock(&s->session_mutex);
+    if (_prepare(t, &plan)) {
+        _unadopt(t, &plan);
+        _discard_plan(&plan);
+        pthread_mutex_unlock(&s->session_mutex);
+        return 1;
+    }
+    pthread_mutex_unlock(&s->session_mutex);
+
+    /* Earlier asynchronous commits from this session must be applied first. */
+    _obl_await_commits(s);
+
+    result = _publish(t, &plan);
+    _discard_plan(&plan);
+
+    if (result == OBL_COMMIT_CONFLICT) {
+        obl_abort_transaction(t);
+    }
+    return result;
 }
 
-static struct obl_transaction *_allocate_transaction(
-        struct obl_session *s)
+struct obl_commit *obl_commit_transaction_async(struct obl_transaction *t,
+        obl_commit_callback callback, void *data)
 {
-    struct obl_transaction *t;
+    struct obl_session *s = t->session;
+    struct obl_database *d = s->database;
+    struct obl_commit *c;
 
-    if (s->current_transaction != NULL) {
-        obl_report_error(s->database, OBL_ALREADY_IN_TRANSACTION, NULL);
+    c = malloc(sizeof(struct obl_commit));
+    if (c == NULL) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
         return NULL;
     }
 
-    t = malloc(sizeof(struct obl_transaction));
-    if (t == NULL) {
-        obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+    OBL_DEBUG(d, "Beginning asynchronous commit.");
+
+    pthread_mutex_lock(&s->session_mutex);
+    if (_prepare(t, &c->plan)) {
+        _unadopt(t, &c->plan);
+        _discard_plan(&c->plan);
+        pthread_mutex_unlock(&s->session_mutex);
+        free(c);
         return NULL;
     }
+    _detach(t, &c->plan);
+    s->commits_pending++;
+    pthread_mutex_unlock(&s->session_mutex);
 
-    t->write_set = obl_create_set(&logical_address_keyfunction);
-    t->session = s;
+    c->job.run = &_run_commit;
+    c->transaction = t;
+    c->callback = callback;
+    c->data = data;
+    c->done = 0;
+    c->result = 0;
+    c->references = 2;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->finished, NULL);
 
-    s->current_transaction = t;
+    if (_obl_writer_submit(&d->writer, &c->job)) {
+        OBL_WARN(d, "Unable to start the writer thread; committing in place.");
+        _run_commit(&c->job);
+    }
 
-    return t;
+    return c;
 }
 
-static void _visit_transitive_closure(struct obl_session *s,
-        struct obl_object *o, struct obl_object_list **adopted)
+int obl_commit_wait(struct obl_commit *c)
 {
-    struct obl_object_list *children = NULL;
-    int was_adopted = 0;
+    int result;
 
-    if (o->session == NULL) {
-        o->session = s;
-        was_adopted = 1;
+    pthread_mutex_lock(&c->lock);
+    while (! c->done) {
+        pthread_cond_wait(&c->finished, &c->lock);
     }
+    result = c->result;
+    pthread_mutex_unlock(&c->lock);
 
-    if (_obl_assign_addresses(o)) {
-        /* o did not have a logical address. */
-        was_adopted = 1;
-    }
+    _release_commit(c);
+    return result;
+}
 
-    if (was_adopted == 1) {
-        obl_object_list_append(adopted, o);
-    }
+void obl_commit_release(struct obl_commit *c)
+{
+    _release_commit(c);
+}
+
+void _obl_await_commits(struct obl_session *s)
+{
+    pthread_mutex_lock(&s->session_mutex);
+    while (s->commits_pending > 0) {
+        pthread_cond_wait(&s->commits_applied, &s->session_mutex);
+    }
+    pthread_mutex_unlock(&s->session_mutex);
+}
+
+void obl_abort_transaction(struct obl_transaction *t)
+{
+    struct obl_session *s = t->session;
+    struct obl_database *d = s->database;
+    struct obl_set_iterator *iter;
+    struct obl_object *current;
+    int stale = 0;
+
+    pthread_mutex_lock(&s->session_mutex);
+
+    _undo_to(t, 0);
+
+    /*
+     * Objects without a dirty_words bitmap were marked dirty as a whole, so
+     * the undo log may not cover them.
+     */
+    iter = obl_set_inorder_iter(t->write_set);
+    while ( (current = obl_set_iternext(iter)) != NULL ) {
+        if (current->dirty_words == NULL &&
+                current->physical_address != OBL_PHYSICAL_UNASSIGNED) {
+            stale = 1;
+        }
+    }
+    obl_set_destroyiter(iter);
+
+    pthread_mutex_unlock(&s->session_mutex);
+
+    /*
+     * If the shared lock can't be taken, the error has been reported and the
+     * stale objects keep their aborted contents, but the transaction still
+     * ends.
+     */
+    if (stale) {
+        pthread_rwlock_rdlock(&d->content_lock);
+        if (! _obl_shared_read_begin(d)) {
+            pthread_mutex_lock(&s->session_mutex);
+
+            iter = obl_set_inorder_iter(t->write_set);
+            while ( (current = obl_set_iternext(iter)) != NULL ) {
+                if (current->dirty_words == NULL) {
+                    _obl_reread_object(s, current);
+                }
+            }
+            obl_set_destroyiter(iter);
+
+            pthread_mutex_unlock(&s->session_mutex);
+            _obl_shared_read_end(d);
+        }
+        pthread_rwlock_unlock(&d->content_lock);
+    }
+
+    pthread_mutex_lock(&s->session_mutex);
+
+    iter = obl_set_destroying_iter(t->write_set);
+    while ( (current = obl_set_iternext(iter)) != NULL ) {
+        free(current->dirty_words);
+        current->dirty_words = NULL;
+    }
+    obl_set_destroyiter(iter);
+
+    _deallocate_transaction(t);
+
+    pthread_mutex_unlock(&s->session_mutex);
+}
+
+static int _publish(struct obl_transaction *t, struct plan *plan)
+{
+    struct obl_object *current;
+    struct obl_session *s = t->session;
+    struct obl_database *d = s->database;
+    struct obl_session_list *session_list;
+    struct obl_set *change_set;
+    struct obl_object **adopted;
+    size_t adopted_count;
+    unsigned long adopt_count = 0;
+    obl_logical_address conflict;
+    uint64_t lsn = 0, version;
+    size_t i;
+    int result = 0;
+
+    /*
+     * Everything from here to the write-out is exclusive: placing objects
+     * changes the address map and may grow the database.
+     */
+    _obl_wal_enter(d);
+    _obl_content_write_begin(d);
+
+    /* Exclude other processes, and catch up with their commits. */
+    if (_obl_shared_write_begin(d)) {
+        _obl_content_write_end(d);
+        _obl_wal_leave(d, lsn);
+        pthread_mutex_lock(&s->session_mutex);
+        _unadopt(t, plan);
+        if (plan->detached) _abandon(t);
+        pthread_mutex_unlock(&s->session_mutex);
+        return 1;
+    }
+
+    pthread_mutex_lock(&s->session_mutex);
+    _obl_session_catch_up(s);
+
+    conflict = _validate(t, plan);
+    if (conflict != OBL_LOGICAL_UNASSIGNED) {
+        obl_report_errorf(d, OBL_CONFLICT,
+                "Object %lu was changed by a concurrent commit.",
+                (unsigned long) conflict);
+        _discard_stale(t, plan);
+        _unadopt(t, plan);
+        if (plan->detached) _abandon(t);
+        pthread_mutex_unlock(&s->session_mutex);
+        _obl_shared_write_end(d, 0);
+        _obl_content_write_end(d);
+        _obl_wal_leave(d, lsn);
+        return OBL_COMMIT_CONFLICT;
+    }
+
+    if (_place(s, plan)) {
+        _unadopt(t, plan);
+        if (plan->detached) _abandon(t);
+        pthread_mutex_unlock(&s->session_mutex);
+        _obl_shared_write_end(d, 1);
+        _obl_content_write_end(d);
+        _obl_wal_leave(d, lsn);
+        return 1;
+    }
+
+    _write_out(d, plan);
+    version = _stamp(s, plan);
+    if (! plan->detached) {
+        _clear_dirty_words(t->write_set);
+    }
+
+    /*
+     * Now that they have addresses and so on, add all adopted objects to the
+     * transaction write set and the session's read set.
+     */
+    adopted = plan->detached ? plan->adopted : s->adopted;
+    adopted_count = plan->detached ? plan->adopted_count : s->adopted_count;
+    for (i = 0; i < adopted_count; i++) {
+        current = adopted[i];
+        obl_set_insert(t->write_set, current);
+        obl_table_insert(s->read_set, current);
+        _obl_cache_admit(s, current);
+        adopt_count++;
+    }
+    _release_adopted(s, plan);
+
+    if (d->root.dirty) {
+        _obl_write_root(d);
+    }
+
+    /*
+     * Log everything that was just written or, without a log, flush the
+     * pages that it touched if we've been asked to.
+     */
+    if (d->wal != NULL) {
+        result = _obl_wal_append(d, &lsn);
+    } else {
+        result = _obl_flush_pages(d);
+    }
+    d->commit_statistics.commits++;
+    _obl_shared_write_end(d, 1);
+
+    /*
+     * Destroy this transaction and remove it from the session.  Its work
+     * is now complete.
+     */
+    change_set = t->write_set;
+    _deallocate_transaction(t);
+
+    pthread_mutex_unlock(&s->session_mutex);
+    _obl_content_write_end(d);
+
+    /* Wait for the log record to reach the disk, sharing an fsync() if we can. */
+    if (_obl_wal_leave(d, lsn)) {
+        result = 1;
+    }
+
+    /*
+     * Notify each other session to update their views of any objects we've
+     * just changed.
+     */
+    pthread_rwlock_rdlock(&d->session_list_lock);
+    session_list = d->session_list;
+    while (session_list != NULL) {
+        struct obl_session *other = session_list->entry;
+        if (other != s) {
+            _obl_update_objects(other, change_set, version);
+        }
+
+        session_list = session_list->next;
+    }
+    pthread_rwlock_unlock(&d->session_list_lock);
+    _obl_versions_propagated(&d->versions);
+
+    obl_destroy_set(change_set, NULL);
+
+    if (result) {
+        OBL_ERROR(d, "Unable to make a commit durable.");
+        return result;
+    }
+
+    OBL_DEBUGF(d,
+            "Successful commit of %lu objects, "
+            "%lu previously unpersisted.", (unsigned long) plan->count,
+            adopt_count);
+
+    return 0;
+}
+
+
+static int _prepare(struct obl_transaction *t, struct plan *plan)
+{
+    struct obl_session *s = t->session;
+    struct obl_set_iterator *it;
+    struct obl_object *current;
+    size_t i;
+    int result = 0;
+
+    plan->objects = NULL;
+    plan->count = plan->capacity = 0;
+    plan->buffer = NULL;
+    plan->words = 0;
+    plan->detached = 0;
+    plan->adopted = NULL;
+    plan->adopted_count = 0;
+
+    /*
+     * Scan all objects in the write set for references to any nonpersisted
+     * obl_objects.  Assign them to this transaction's session and accumulate
+     * them into s->adopted.  Objects that already have logical addresses
+     * will simply be rewritten.
+     */
+    it = obl_set_inorder_iter(t->write_set);
+    while (result == 0 && (current = obl_set_iternext(it)) != NULL) {
+        result = _visit_transitive_closure(s, current);
+        if (result == 0 && current->logical_address != OBL_LOGICAL_UNASSIGNED) {
+            result = _plan_object(s, plan, current);
+        }
+    }
+    obl_set_destroyiter(it);
+    if (result) {
+        return 1;
+    }
+
+    /*
+     * Give each adopted object a logical address, so that its referrers can
+     * be serialized.  Renewing the lease is the only step that needs the
+     * database's content lock.
+     */
+    for (i = 0; i < s->adopted_count; i++) {
+        current = s->adopted[i];
+
+        if (current->logical_address == OBL_LOGICAL_UNASSIGNED) {
+            struct obl_allocation_lease *lease = &s->logical_lease;
+
+            if (lease->next >= lease->limit) {
+                pthread_mutex_unlock(&s->session_mutex);
+                result = _obl_lease_logical(s,
+                        (obl_uint) (s->adopted_count - i));
+                pthread_mutex_lock(&s->session_mutex);
+                if (result) {
+                    return 1;
+                }
+            }
+            current->logical_address = obl_allocate_logical(s);
+        }
+
+        if (_plan_object(s, plan, current)) {
+            return 1;
+        }
+    }
+
+    plan->buffer = malloc(plan->words * sizeof(obl_uint));
+    if (plan->buffer == NULL && plan->words > 0) {
+        obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+        return 1;
+    }
+
+    for (i = 0; i < plan->count; i++) {
+        obl_write_object_at(plan->objects[i].object, plan->buffer,
+                (obl_physical_address) plan->objects[i].offset);
+    }
+
+    return 0;
+}
+
+static int _plan_object(struct obl_session *s, struct plan *plan,
+        struct obl_object *o)
+{
+    struct prepared *p;
+
+    if (plan->count == plan->capacity) {
+        size_t capacity = plan->capacity == 0 ? 64 : 2 * plan->capacity;
+        struct prepared *grown;
+
+        grown = realloc(plan->objects, capacity * sizeof(struct prepared));
+        if (grown == NULL) {
+            obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+            return 1;
+        }
+        plan->objects = grown;
+        plan->capacity = capacity;
+    }
+
+    p = &plan->objects[plan->count++];
+    p->object = o;
+    p->offset = plan->words;
+    p->size = obl_object_wordsize(o);
+    p->placed = 0;
+    p->dirty = o->physical_address == OBL_PHYSICAL_UNASSIGNED ?
+            NULL : o->dirty_words;
+    p->version = o->read_version;
+    plan->words += p->size;
+
+    return 0;
+}
+
+static int _place(struct obl_session *s, struct plan *plan)
+{
+    struct obl_database *d = s->database;
+    obl_physical_address root;
+    obl_uint extent = 0;
+    size_t i, mark;
+    int failed = 0, relocate, root_dirty;
+
+    if (_obl_versions_crowded(&d->versions, plan->count)) {
+        _obl_versions_prune(&d->versions, _oldest_read(s));
+    }
+    if (_obl_versions_reserve(&d->versions, plan->count)) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+        return 1;
+    }
+
+    _obl_reclaim(d);
+    relocate = _obl_snapshots_pinned(d);
+
+    for (i = 0; i < plan->count && ! failed; i++) {
+        struct prepared *p = &plan->objects[i];
+        struct obl_object *o = p->object;
+
+        p->former = OBL_PHYSICAL_UNASSIGNED;
+        if (relocate && o->physical_address != OBL_PHYSICAL_UNASSIGNED) {
+            p->former = o->physical_address;
+            o->physical_address = OBL_PHYSICAL_UNASSIGNED;
+        }
+
+        if (o->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+            o->physical_address = obl_allocate_physical(s, p->size);
+            p->placed = 1;
+            if (o->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+                failed = 1;
+                break;
+            }
+        }
+        if ((obl_uint) o->physical_address + p->size > extent) {
+            extent = (obl_uint) o->physical_address + p->size;
+        }
+    }
+
+    if (failed || _obl_ensure_capacity(d, extent)) {
+        _unplace(plan);
+        return 1;
+    }
+
+    root = d->root.address_map_addr;
+    root_dirty = d->root.dirty;
+    mark = _obl_retire_mark(d);
+
+    for (i = 0; i < plan->count && ! failed; i++) {
+        struct prepared *p = &plan->objects[i];
+
+        if (p->placed) {
+            struct obl_object *o = p->object;
+
+            if (obl_address_assign(s, o->logical_address,
+                    o->physical_address)) {
+                failed = 1;
+            } else if (p->former != OBL_PHYSICAL_UNASSIGNED) {
+                _obl_retire(d, p->former, p->size);
+            }
+        }
+    }
+    _obl_forget_copies(d);
+
+    /*
+     * While copying on write, the former root still maps every object where
+     * it was.  Otherwise, the new mappings are to space that nothing will
+     * reach.
+     */
+    if (failed) {
+        _obl_unretire(d, mark);
+        if (d->root.address_map_addr != root) {
+            _obl_address_cache_clear(d);
+            d->root.address_map_addr = root;
+            d->root.dirty = root_dirty;
+        }
+        _unplace(plan);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void _unplace(struct plan *plan)
+{
+    size_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        struct prepared *p = &plan->objects[i];
+
+        if (p->placed) {
+            p->object->physical_address = p->former;
+            p->placed = 0;
+        }
+    }
+}
+
+static void _write_out(struct obl_database *d, struct plan *plan)
+{
+    struct obl_commit_statistics *stats = &d->commit_statistics;
+    size_t first = 0, i;
+
+    qsort(plan->objects, plan->count, sizeof(struct prepared),
+            &_compare_prepared);
+
+    for (i = 0; i < plan->count; i++) {
+        _obl_payload_invalidate(d, plan->objects[i].object->physical_address);
+    }
+
+    /*
+     * A run continues while each object begins where the last one ended.  New
+     * objects are placed in the order that they were serialized, so their
+     * bytes are usually adjacent within the buffer as well, and the whole run
+     * is copied at once.
+     */
+    while (first < plan->count) {
+        struct prepared *start = &plan->objects[first];
+        obl_physical_address base = start->object->physical_address;
+        size_t end = first + 1, words = start->size, copied = 0;
+
+        /* A relocated object has nothing at its new address to patch. */
+        if (start->dirty != NULL && ! start->placed) {
+            _write_words(d, plan, start);
+            stats->objects_written++;
+            first++;
+            continue;
+        }
+
+        while (end < plan->count && (plan->objects[end].dirty == NULL ||
+                plan->objects[end].placed) &&
+                plan->objects[end].object->physical_address == base + words) {
+            words += plan->objects[end].size;
+            end++;
+        }
+
+        for (i = first; i < end; i++) {
+            struct prepared *segment = &plan->objects[i];
+            size_t length = segment->size;
+
+            while (i + 1 < end && plan->objects[i + 1].offset ==
+                    segment->offset + length) {
+                length += plan->objects[++i].size;
+            }
+
+            memcpy(d->content + base + copied, plan->buffer + segment->offset,
+                    length * sizeof(obl_uint));
+            copied += length;
+        }
+        _obl_note_write(d, base, (obl_uint) words);
+
+        stats->objects_written += (unsigned long) (end - first);
+        stats->write_runs++;
+        stats->words_written += words;
+        first = end;
+    }
+}
+
+static void _write_words(struct obl_database *d, struct plan *plan,
+        struct prepared *p)
+{
+    struct obl_commit_statistics *stats = &d->commit_statistics;
+    obl_physical_address base = p->object->physical_address;
+    obl_uint i = 0, run;
+
+    while (i < p->size) {
+        if (! IS_DIRTY_WORD(p->dirty, i)) {
+            i++;
+            continue;
+        }
+
+        run = 1;
+        while (i + run < p->size && IS_DIRTY_WORD(p->dirty, i + run)) {
+            run++;
+        }
+
+        memcpy(d->content + base + i, plan->buffer + p->offset + i,
+                run * sizeof(obl_uint));
+        _obl_note_write(d, base + i, run);
+
+        stats->write_runs++;
+        stats->words_written += run;
+        i += run;
+    }
+}
+
+static void _clear_dirty_words(struct obl_set *write_set)
+{
+    struct obl_set_iterator *it;
+    struct obl_object *current;
+
+    it = obl_set_inorder_iter(write_set);
+    while ( (current = obl_set_iternext(it)) != NULL ) {
+        free(current->dirty_words);
+        current->dirty_words = NULL;
+    }
+    obl_set_destroyiter(it);
+}
+
+static obl_logical_address _validate(struct obl_transaction *t,
+        struct plan *plan)
+{
+    struct obl_session *s = t->session;
+    size_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        struct prepared *p = &plan->objects[i];
+
+        if (p->object->physical_address != OBL_PHYSICAL_UNASSIGNED &&
+                _is_stale(s, p->object->logical_address, p->version)) {
+            return p->object->logical_address;
+        }
+    }
+
+    for (i = 0; i < t->read_count; i++) {
+        if (_is_stale(s, t->reads[i].address, t->reads[i].version)) {
+            return t->reads[i].address;
+        }
+    }
+
+    return OBL_LOGICAL_UNASSIGNED;
+}
+
+static int _is_stale(struct obl_session *s, obl_logical_address address,
+        uint64_t version)
+{
+    struct obl_version_entry *e;
+
+    e = _obl_version_of(&s->database->versions, address);
+
+    /* A session's own commits are already reflected in its objects. */
+    return e != NULL && e->version > version && e->session != s;
+}
+
+static void _discard_stale(struct obl_transaction *t, struct plan *plan)
+{
+    struct obl_session *s = t->session;
+    struct obl_transaction *current = s->current_transaction;
+    size_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        struct obl_object *o = plan->objects[i].object;
+
+        if (o->physical_address == OBL_PHYSICAL_UNASSIGNED ||
+                ! _is_stale(s, o->logical_address, plan->objects[i].version)) {
+            continue;
+        }
+
+        if (! plan->detached) {
+            free(o->dirty_words);
+            o->dirty_words = NULL;
+        } else if (current == NULL || obl_set_lookup(current->write_set,
+                (obl_set_key) o->logical_address) == NULL) {
+            _obl_reread_object(s, o);
+        }
+    }
+}
+
+static uint64_t _stamp(struct obl_session *s, struct plan *plan)
+{
+    struct obl_database *d = s->database;
+    uint64_t version = ++d->commit_version;
+    size_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        struct obl_object *o = plan->objects[i].object;
+
+        _obl_version_record(&d->versions, o->logical_address, version, s);
+        o->read_version = version;
+    }
+    _obl_versions_propagating(&d->versions, version);
+
+    return version;
+}
+
+static uint64_t _oldest_read(struct obl_session *s)
+{
+    struct obl_database *d = s->database;
+    struct obl_session_list *node;
+    uint64_t oldest, each;
+
+    oldest = _obl_versions_undelivered(&d->versions);
 
     /*
-     * Recursively call with the children of this object that have no session
-     * set or addresses.
+     * Other sessions may be waiting for the content lock with their own locks
+     * held, so don't wait for them.
      */
-    children = _obl_children(o);
+    if (pthread_rwlock_tryrdlock(&d->session_list_lock)) {
+        return 0;
+    }
+    for (node = d->session_list; node != NULL; node = node->next) {
+        struct obl_session *other = node->entry;
+
+        if (other == s) {
+            each = _session_oldest_read(other);
+        } else if (pthread_mutex_trylock(&other->session_mutex) == 0) {
+            each = _session_oldest_read(other);
+            pthread_mutex_unlock(&other->session_mutex);
+        } else {
+            each = 0;
+        }
+
+        if (each < oldest) {
+            oldest = each;
+        }
+    }
+    pthread_rwlock_unlock(&d->session_list_lock);
+
+    return oldest;
+}
+
+static uint64_t _session_oldest_read(struct obl_session *s)
+{
+    struct obl_transaction *t = s->current_transaction;
+    struct obl_set_iterator *it;
+    struct obl_object *o;
+    uint64_t oldest = s->detached_oldest;
+    size_t i;
+
+    if (t == NULL) {
+        return oldest;
+    }
+
+    it = obl_set_inorder_iter(t->write_set);
+    while ( (o = obl_set_iternext(it)) != NULL ) {
+        if (o->physical_address != OBL_PHYSICAL_UNASSIGNED &&
+                o->read_version < oldest) {
+            oldest = o->read_version;
+        }
+    }
+    obl_set_destroyiter(it);
+
+    for (i = 0; i < t->read_count; i++) {
+        if (t->reads[i].version < oldest) {
+            oldest = t->reads[i].version;
+        }
+    }
+
+    return oldest;
+}
+
+static int _compare_prepared(const void *left, const void *right)
+{
+    const struct prepared *a = left, *b = right;
+    obl_physical_address x = a->object->physical_address;
+    obl_physical_address y = b->object->physical_address;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void _discard_plan(struct plan *plan)
+{
+    size_t i;
+
+    if (plan->detached) {
+        for (i = 0; i < plan->count; i++) {
+            free(plan->objects[i].dirty);
+        }
+        free(plan->adopted);
+    }
+
+    free(plan->objects);
+    free(plan->buffer);
+}
+
+static void _detach(struct obl_transaction *t, struct plan *plan)
+{
+    struct obl_session *s = t->session;
+    size_t i;
+
+    plan->detached = 1;
+    plan->adopted = s->adopted;
+    plan->adopted_count = s->adopted_count;
+    s->adopted = NULL;
+    s->adopted_count = s->adopted_capacity = 0;
+
+    /* The session's next transaction will mark its own words dirty. */
+    for (i = 0; i < plan->count; i++) {
+        struct obl_object *o = plan->objects[i].object;
+
+        if (plan->objects[i].dirty == NULL) {
+            free(o->dirty_words);
+        }
+        o->dirty_words = NULL;
+
+        /* An evicted object would be placed again as though it were new. */
+        o->cache.committing++;
+
+        if (o->physical_address != OBL_PHYSICAL_UNASSIGNED &&
+                plan->objects[i].version < s->detached_oldest) {
+            s->detached_oldest = plan->objects[i].version;
+        }
+    }
+
+    s->current_transaction = NULL;
+}
+
+static void _abandon(struct obl_transaction *t)
+{
+    obl_destroy_set(t->write_set, NULL);
+    _deallocate_transaction(t);
+}
+
+static void _run_commit(struct obl_writer_job *job)
+{
+    struct obl_commit *c = (struct obl_commit *) job;
+    struct obl_session *s = c->transaction->session;
+    size_t i;
+
+    c->result = _publish(c->transaction, &c->plan);
+
+    pthread_mutex_lock(&s->session_mutex);
+    for (i = 0; i < c->plan.count; i++) {
+        c->plan.objects[i].object->cache.committing--;
+    }
+    pthread_mutex_unlock(&s->session_mutex);
+    _discard_plan(&c->plan);
+
+    if (c->callback != NULL) {
+        (*c->callback)(c->result, c->data);
+    }
+
+    pthread_mutex_lock(&s->session_mutex);
+    if (--s->commits_pending == 0) {
+        s->detached_oldest = UINT64_MAX;
+    }
+    pthread_cond_broadcast(&s->commits_applied);
+    pthread_mutex_unlock(&s->session_mutex);
+
+    pthread_mutex_lock(&c->lock);
+    c->done = 1;
+    pthread_cond_broadcast(&c->finished);
+    pthread_mutex_unlock(&c->lock);
 
-    while (children != NULL) {
-        struct obl_object *current = children->entry;
-        struct obl_object_list *former;
+    _release_commit(c);
+}
+
+static void _release_commit(struct obl_commit *c)
+{
+    int last;
+
+    pthread_mutex_lock(&c->lock);
+    last = --c->references == 0;
+    pthread_mutex_unlock(&c->lock);
+
+    if (last) {
+        pthread_cond_destroy(&c->finished);
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+    }
+}
+
+static struct obl_undo_entry *_log(struct obl_object *o, obl_uint index)
+{
+    struct obl_session *s = o->session;
+    struct obl_transaction *t;
+    struct obl_undo_entry *e;
+
+    if (s == NULL || s->database->configuration.read_only) return NULL;
+
+    pthread_mutex_lock(&s->session_mutex);
+    t = s->current_transaction;
+    if (t == NULL) {
+        pthread_mutex_unlock(&s->session_mutex);
+        return NULL;
+    }
+
+    if (t->undo_count == t->undo_capacity) {
+        size_t capacity = t->undo_capacity == 0 ? 64 : 2 * t->undo_capacity;
+        struct obl_undo_entry *grown;
+
+        grown = realloc(t->undo, capacity * sizeof(struct obl_undo_entry));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&s->session_mutex);
+
+            /* Without room to log the change, an abort will read o again. */
+            obl_mark_dirty(o);
+            return NULL;
+        }
+        t->undo = grown;
+        t->undo_capacity = capacity;
+    }
+
+    e = &t->undo[t->undo_count++];
+    e->object = o;
+    e->index = index;
+
+    pthread_mutex_unlock(&s->session_mutex);
+
+    return e;
+}
+
+static void _undo_to(struct obl_transaction *t, size_t mark)
+{
+    while (t->undo_count > mark) {
+        struct obl_undo_entry *e = &t->undo[--t->undo_count];
+        struct obl_object *o = e->object;
+
+        /* Go through storage: a re-read may have replaced it since. */
+        switch (obl_storage_of(o)) {
+        case OBL_SLOTTED:
+            o->storage.slotted_storage->slots[e->index - 1] =
+                    e->before.reference;
+            break;
+        case OBL_FIXED:
+            o->storage.fixed_storage->contents[e->index - 2] =
+                    e->before.reference;
+            break;
+        case OBL_INTEGER:
+            o->storage.integer_storage->value = e->before.integer;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void _deallocate_transaction(struct obl_transaction *t)
+{
+    if (t->session->current_transaction == t) {
+        t->session->current_transaction = NULL;
+    }
+    free(t->undo);
+    free(t->reads);
+    free(t);
+}
+
+static void _unadopt(struct obl_transaction *t, struct plan *plan)
+{
+    struct obl_session *s = t->session;
+    struct obl_object **adopted;
+    size_t count, i;
+
+    adopted = plan->detached ? plan->adopted : s->adopted;
+    count = plan->detached ? plan->adopted_count : s->adopted_count;
+    for (i = 0; i < count; i++) {
+        struct obl_object *o = adopted[i];
+
+        if (! obl_set_includes(t->write_set, o)) {
+            o->session = NULL;
+        }
+        if (o->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+            o->logical_address = OBL_LOGICAL_UNASSIGNED;
+        }
+    }
+
+    _release_adopted(s, plan);
+}
+
+static void _release_adopted(struct obl_session *s, struct plan *plan)
+{
+    if (plan->detached) {
+        free(plan->adopted);
+        plan->adopted = NULL;
+        plan->adopted_count = 0;
+    } else {
+        _reset_adopted(s);
+    }
+}
 
-        if (! IS_FIXED_ADDR(current->logical_address) &&
-                current->session == NULL) {
-            _visit_transitive_closure(s, current, adopted);
+static void _reset_adopted(struct obl_session *s)
+{
+    s->adopted_count = 0;
+
+    if (s->adopted_capacity > ADOPTED_RETAINED) {
+        free(s->adopted);
+        s->adopted = NULL;
+        s->adopted_capacity = 0;
+    }
+}
+
+static struct obl_transaction *_allocate_transaction(
+        struct obl_session *s)
+{
+    struct obl_transaction *t;
+
+    if (s->current_transaction != NULL) {
+        obl_report_error(s->database, OBL_ALREADY_IN_TRANSACTION, NULL);
+        return NULL;
+    }
+
+    /* A snapshot's objects are out of date: changes made to them would be. */
+    if (s->snapshot.pinned) {
+        obl_report_error(s->database, OBL_ALREADY_IN_TRANSACTION,
+                "Unable to begin a transaction within a snapshot.");
+        return NULL;
+    }
+
+    t = malloc(sizeof(struct obl_transaction));
+    if (t == NULL) {
+        obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+        return NULL;
+    }
+
+    t->write_set = obl_create_set(&logical_address_keyfunction);
+    t->session = s;
+    t->undo = NULL;
+    t->undo_count = t->undo_capacity = 0;
+    t->reads = NULL;
+    t->read_count = t->read_capacity = 0;
+    t->implicit = 0;
+    t->mutations = 0;
+    t->started = 0;
+
+    s->current_transaction = t;
+
+    return t;
+}
+
+static int _visit_transitive_closure(struct obl_session *s,
+        struct obl_object *root)
+{
+    size_t next = s->adopted_count;
+
+    if (root->session == NULL ||
+            root->logical_address == OBL_LOGICAL_UNASSIGNED) {
+        if (_adopt(s, root)) {
+            return 1;
         }
+    } else if (_obl_each_child(root, &_visit_child, s)) {
+        return 1;
+    }
+
+    /* Visit the children of everything adopted since, including the root. */
+    while (next < s->adopted_count) {
+        if (_obl_each_child(s->adopted[next], &_visit_child, s)) {
+            return 1;
+        }
+        next++;
+    }
+
+    return 0;
+}
+
+static int _visit_child(struct obl_object *child, void *data)
+{
+    struct obl_session *s = data;
 
-        former = children;
-        children = children->next;
-        free(former);
+    if (IS_FIXED_ADDR(child->logical_address) || child->session != NULL) {
+        return 0;
     }
+
+    return _adopt(s, child);
+}
+
+static int _adopt(struct obl_session *s, struct obl_object *o)
+{
+    if (s->adopted_count == s->adopted_capacity) {
+        size_t capacity = s->adopted_capacity == 0 ?
+                64 : 2 * s->adopted_capacity;
+        struct obl_object **grown;
+
+        grown = realloc(s->adopted, capacity * sizeof(struct obl_object *));
+        if (grown == NULL) {
+            obl_report_error(s->database, OBL_OUT_OF_MEMORY, NULL);
+            return 1;
+        }
+        s->adopted = grown;
+        s->adopted_capacity = capacity;
+    }
+
+    o->session = s;
+    s->adopted[s->adopted_count++] = o;
+
+    return 0;
 }
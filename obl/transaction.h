@@ -12,6 +12,8 @@
 #ifndef TRANSACTION_H
 #define TRANSACTION_H
 
+#include <stddef.h>
+
 #include "platform.h"
 
 /* defined in set.h */
@@ -23,6 +25,93 @@ struct obl_session;
 /* defined in storage/object.h */
 struct obl_object;
 
+/* defined in transaction.c */
+struct obl_commit;
+
+/**
+ * Returned by obl_commit_transaction() when another commit has changed an
+ * object that the transaction wrote or marked as read since it was read.
+ */
+#define OBL_COMMIT_CONFLICT 2
+
+/**
+ * Called once a commit made with obl_commit_transaction_async() is complete.
+ *
+ * @param result As obl_commit_transaction() would return it.
+ * @param data As passed to obl_commit_transaction_async().
+ */
+typedef void (*obl_commit_callback)(int result, void *data);
+
+/**
+ * Running totals that describe the commits performed on a database since it
+ * was opened.
+ */
+struct obl_commit_statistics
+{
+    /** The number of transactions committed. */
+    unsigned long commits;
+
+    /** The number of objects copied into the database by commits. */
+    unsigned long objects_written;
+
+    /**
+     * The number of runs of physically adjacent words that those objects were
+     * copied in: one noted write apiece.
+     */
+    unsigned long write_runs;
+
+    /**
+     * The number of words copied.  Objects that were only partly changed
+     * contribute just the words that changed.
+     */
+    uint64_t words_written;
+
+    /**
+     * The number of pages written back to the database file by commits made
+     * with the sync_commits setting.  See dirty.h.
+     */
+    unsigned long pages_flushed;
+
+    /** The number of msync() calls, one per run of consecutive pages. */
+    unsigned long flush_runs;
+
+    /** Wall-clock time spent flushing pages, in microseconds. */
+    uint64_t flush_usec;
+};
+
+/**
+ * The value that one word of an object held before a storage mutator changed
+ * it.  Aborting a transaction puts these back instead of reading each changed
+ * object from the database again.
+ */
+struct obl_undo_entry
+{
+    /** The object that was changed. */
+    struct obl_object *object;
+
+    /** The word that was changed, numbered as for _obl_mark_dirty_word(). */
+    obl_uint index;
+
+    /** Its former contents. */
+    union
+    {
+        struct obl_object *reference;
+        obl_int integer;
+    } before;
+};
+
+/**
+ * An object that a transaction depends upon without changing it, as recorded
+ * by obl_mark_read().
+ */
+struct obl_read_entry
+{
+    obl_logical_address address;
+
+    /** The commit version that the object had been read at. */
+    uint64_t version;
+};
+
 /**
  * A transaction contains state that will be applied if it is committed or
  * discarded if it is aborted.
@@ -36,28 +125,84 @@ struct obl_transaction
      * Objects that have been changed while this transaction has been active.
      */
     struct obl_set *write_set;
+
+    /** Before-images logged by the storage mutators, oldest first. */
+    struct obl_undo_entry *undo;
+
+    /** The number of entries in use and allocated within undo. */
+    size_t undo_count, undo_capacity;
+
+    /** The objects marked with obl_mark_read(), to validate at commit. */
+    struct obl_read_entry *reads;
+
+    /** The number of entries in use and allocated within reads. */
+    size_t read_count, read_capacity;
+
+    /**
+     * Set if this transaction was begun by a storage mutator to batch the
+     * mutations made outside of any explicit transaction.  See
+     * obl_session_batch().
+     */
+    int implicit;
+
+    /** The number of mutations batched into an implicit transaction. */
+    unsigned long mutations;
+
+    /** When an implicit transaction was begun, from obl_monotonic_usec(). */
+    uint64_t started;
 };
 
 /**
  * Allocate a new transaction and mark it as the current one within a session.
+ * Mutations that were batched into an implicit transaction are committed
+ * first.
  *
  * @param session
- * @return A newly allocated obl_transaction.
+ * @return A newly allocated obl_transaction.  Reports an error and returns
+ *      NULL if the database is read-only.
  */
 struct obl_transaction *obl_begin_transaction(struct obl_session *session);
 
 /**
  * If the session have an active transaction already, return it.  Otherwise,
- * begin a new transaction, and set created to true.
+ * begin a new transaction, and set created to true.  As with
+ * obl_begin_transaction(), batched mutations are committed first.
  *
  * @param session
  * @param created [out] Will be set to 0 if a transaction already exists or 1
  *      if one needed to be created.
- * @return An active, valid transaction.
+ * @return An active, valid transaction.  Reports an error and returns NULL
+ *      if the database is read-only.
  */
 struct obl_transaction *obl_ensure_transaction(struct obl_session *session,
         int *created);
 
+/**
+ * Find or begin the transaction that a storage mutator should make its change
+ * within.  When the session has no transaction, one is begun: an implicit
+ * transaction if the session batches its mutations, or a transaction for this
+ * mutation alone if it doesn't.  For internal use by the storage mutators.
+ *
+ * @param session The session that owns the object being changed, or NULL.
+ * @param implicit [out] Set to 1 if the mutation isn't part of an explicit
+ *      transaction, and must be finished with _obl_end_mutation().
+ * @return The transaction, or NULL if the object has no session or the
+ *      database is read-only.
+ */
+struct obl_transaction *_obl_begin_mutation(struct obl_session *session,
+        int *implicit);
+
+/**
+ * Finish a mutation begun by _obl_begin_mutation().  A mutation that isn't
+ * batched is committed immediately.  A batched one is counted, and the batch
+ * is committed once it holds as many mutations, or has been open for as long,
+ * as its session allows.
+ *
+ * @param transaction
+ * @param implicit As set by _obl_begin_mutation().
+ */
+void _obl_end_mutation(struct obl_transaction *transaction, int implicit);
+
 /**
  * If o is a persisted object, and its session has an active transaction, add
  * o to its write set.
@@ -66,6 +211,75 @@ struct obl_transaction *obl_ensure_transaction(struct obl_session *session,
  */
 void obl_mark_dirty(struct obl_object *o);
 
+/**
+ * Make the current transaction of o's session depend upon o, which it has
+ * read but needn't change: if another session commits a change to o before
+ * this transaction commits, the commit conflicts.  Objects that the
+ * transaction writes are validated without being marked.  Does nothing for
+ * objects that haven't been persisted, or outside of a transaction.
+ *
+ * @param o
+ * @return 0 on success, or 1 if memory is exhausted.
+ */
+int obl_mark_read(struct obl_object *o);
+
+/**
+ * Record that one word of a persisted object is about to change, so that
+ * committing it needs to write only the words that changed.  Otherwise, this
+ * is just like obl_mark_dirty(), which it defers to for objects that have no
+ * physical address yet.  Marking the whole object dirty supersedes this.  For
+ * internal use by the storage mutators.
+ *
+ * @param o
+ * @param index The index of the word within o, where its shape is word 0.
+ */
+void _obl_mark_dirty_word(struct obl_object *o, obl_uint index);
+
+/**
+ * Log the former value of a word that holds a reference, so that aborting the
+ * current transaction can restore it.  If the entry can't be logged, o is
+ * marked dirty as a whole instead, and will be read again by an abort.  For
+ * internal use by the storage mutators, after _obl_mark_dirty_word().
+ *
+ * @param o
+ * @param index The index of the word within o, where its shape is word 0.
+ * @param before The object that the word referenced.
+ */
+void _obl_log_reference(struct obl_object *o, obl_uint index,
+        struct obl_object *before);
+
+/**
+ * Log the former value of an integer, just as _obl_log_reference() does for
+ * a reference.  For internal use by obl_integer_set().
+ *
+ * @param o
+ * @param before
+ */
+void _obl_log_integer(struct obl_object *o, obl_int before);
+
+/**
+ * Mark the current position within a transaction's undo log, so that the
+ * changes made after it can later be rolled back without aborting.
+ *
+ * @param transaction
+ * @return A savepoint to pass to obl_rollback_to_savepoint().
+ */
+size_t obl_savepoint(struct obl_transaction *transaction);
+
+/**
+ * Undo every change that the storage mutators have made since a savepoint
+ * was taken, newest first.  The transaction remains active, and the objects
+ * remain within its write set.  Savepoints taken after this one are no longer
+ * valid.  Objects that were changed by other means and marked dirty with
+ * obl_mark_dirty() are not restored.
+ *
+ * @param transaction
+ * @param savepoint As returned by obl_savepoint().
+ * @return 0 on success, or 1 if the savepoint is no longer valid.
+ */
+int obl_rollback_to_savepoint(struct obl_transaction *transaction,
+        size_t savepoint);
+
 /**
  * Apply any and all object changes recorded within a transaction.  Discover
  * and persist any unpersisted objects that are now referenced by persisted
@@ -73,14 +287,91 @@ void obl_mark_dirty(struct obl_object *o);
  * other sessions within the same database that reference any changed
  * objects to acquire the latest object data.  Destroy the transaction object.
  *
- * @param transaction This memory will be freed before the call returns.
+ * If the database uses a write-ahead log, the commit is durable once this
+ * call returns successfully.
+ *
+ * The objects to be written are serialized before the commit takes exclusive
+ * access to the database, so that other sessions are only excluded while
+ * they're copied into place.
+ *
+ * Sessions don't lock the objects they change.  Instead, the commit validates
+ * that no other session has committed a change to any object that this one
+ * writes, or marked with obl_mark_read(), since it was read.  If one has,
+ * nothing is written, an OBL_CONFLICT error is reported, and the transaction
+ * is aborted so that its objects hold the winning commit's contents.  Only
+ * commits made within this process are detected.
+ *
+ * @param transaction This memory will be freed before the call returns,
+ *      unless the commit fails for another reason before anything is written.
+ * @return 0 on success, or OBL_COMMIT_CONFLICT if the commit conflicted.
+ *      Returns 1 if the commit could not be written or logged.  If nothing
+ *      was written, the transaction remains active.
  */
 int obl_commit_transaction(struct obl_transaction *transaction);
 
+/**
+ * Commit a transaction without waiting for it to be applied.  The transaction's
+ * objects are discovered and serialized on the calling thread, just as
+ * obl_commit_transaction() does, and the transaction is then handed to the
+ * database's writer thread to be copied into place, logged and announced to
+ * other sessions.  The session may begin its next transaction at once.
+ *
+ * Asynchronous commits are applied in the order that they're made.  If the
+ * writer thread has commit_queue_length of them waiting already, this call
+ * blocks until it catches up.  A synchronous commit from the same session
+ * waits for that session's asynchronous commits to be applied first.
+ *
+ * If an asynchronous commit fails, its changes remain in memory but aren't
+ * written, and it is abandoned rather than left active.  If it conflicts, the
+ * objects that another session changed are read again instead, unless the
+ * session's current transaction has changed them since.
+ *
+ * @param transaction This memory will be freed once the commit is applied.
+ * @param callback If non-NULL, called on the writer thread once the commit
+ *      is complete.  It must neither commit nor wait for a commit.
+ * @param data Passed to callback.
+ * @return A handle to pass to obl_commit_wait() or obl_commit_release().
+ *      Returns NULL, leaving the transaction active, if its objects could
+ *      not be serialized.
+ */
+struct obl_commit *obl_commit_transaction_async(
+        struct obl_transaction *transaction, obl_commit_callback callback,
+        void *data);
+
+/**
+ * Wait for an asynchronous commit to be applied, and release its handle.
+ *
+ * @param commit As returned by obl_commit_transaction_async().  This memory
+ *      may be freed before the call returns.
+ * @return As obl_commit_transaction() would have returned.
+ */
+int obl_commit_wait(struct obl_commit *commit);
+
+/**
+ * Release the handle to an asynchronous commit without waiting for it.  The
+ * commit will still be applied.
+ *
+ * @param commit As returned by obl_commit_transaction_async().
+ */
+void obl_commit_release(struct obl_commit *commit);
+
+/**
+ * Wait until the writer thread has applied every asynchronous commit that
+ * +session+ has handed it.  For internal use only.
+ *
+ * @param session
+ */
+void _obl_await_commits(struct obl_session *session);
+
 /**
  * Revert any object changes recorded within a transaction.  Destroy the
  * transaction object.
  *
+ * Words changed by the storage mutators are restored from the transaction's
+ * undo log without touching the database.  Only objects that were marked
+ * dirty with obl_mark_dirty(), or were overwritten by another session's
+ * commit, are read from the database again.
+ *
  * @param transaction This memory will be freed before the call returns.
  */
 void obl_abort_transaction(struct obl_transaction *transaction);
@@ -0,0 +1,216 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file versions.c
+ */
+
+#include "versions.h"
+
+#include <stdlib.h>
+
+/* Never let more than 3/4ths of the slots be occupied. */
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 4)
+
+/* The smallest table worth pruning. */
+#define MIN_PRUNE 64
+
+/* Internal function prototypes. */
+
+/** Spread the bits of a logical address across a 64-bit hash. */
+static uint64_t _hash(obl_logical_address key);
+
+/**
+ * Return the slot holding +key+ or, if it isn't present, the empty slot where
+ * it belongs.  The table must have at least one empty slot.
+ */
+static size_t _find(struct obl_version_entry *entries, size_t capacity,
+        obl_logical_address key);
+
+/**
+ * Move the entries of a table last written after version +oldest+ into a new
+ * array of +capacity+ slots.  Returns 1 if memory is exhausted.
+ */
+static int _rehash(struct obl_versions *versions, size_t capacity,
+        uint64_t oldest);
+
+/* External function definitions. */
+
+void _obl_versions_init(struct obl_versions *versions)
+{
+    versions->entries = NULL;
+    versions->capacity = 0;
+    versions->count = 0;
+    versions->prune_at = MIN_PRUNE;
+    versions->propagating = 0;
+    versions->propagating_from = 0;
+    pthread_mutex_init(&versions->lock, NULL);
+}
+
+void _obl_versions_destroy(struct obl_versions *versions)
+{
+    free(versions->entries);
+    versions->entries = NULL;
+    versions->capacity = versions->count = 0;
+    pthread_mutex_destroy(&versions->lock);
+}
+
+struct obl_version_entry *_obl_version_of(struct obl_versions *versions,
+        obl_logical_address address)
+{
+    struct obl_version_entry *e;
+
+    if (versions->count == 0) {
+        return NULL;
+    }
+
+    e = &versions->entries[_find(versions->entries, versions->capacity,
+            address)];
+    return e->key == address ? e : NULL;
+}
+
+int _obl_versions_reserve(struct obl_versions *versions, size_t extra)
+{
+    size_t capacity;
+
+    if (versions->count + extra <= MAX_LOAD(versions->capacity)) {
+        return 0;
+    }
+
+    capacity = versions->capacity == 0 ? 64 : versions->capacity;
+    while (versions->count + extra > MAX_LOAD(capacity)) {
+        capacity *= 2;
+    }
+
+    return _rehash(versions, capacity, 0);
+}
+
+int _obl_versions_crowded(struct obl_versions *versions, size_t extra)
+{
+    return versions->count + extra > versions->prune_at;
+}
+
+void _obl_versions_prune(struct obl_versions *versions, uint64_t oldest)
+{
+    size_t kept = 0, capacity = 64, i;
+
+    for (i = 0; i < versions->capacity; i++) {
+        struct obl_version_entry *e = &versions->entries[i];
+
+        if (e->key != OBL_LOGICAL_UNASSIGNED && e->version > oldest) {
+            kept++;
+        }
+    }
+
+    /* Leave room to double again before the next attempt. */
+    while (2 * kept > MAX_LOAD(capacity)) {
+        capacity *= 2;
+    }
+
+    if (_rehash(versions, capacity, oldest) == 0) {
+        versions->prune_at = 2 * versions->count > MIN_PRUNE ?
+                2 * versions->count : MIN_PRUNE;
+    }
+}
+
+void _obl_versions_propagating(struct obl_versions *versions,
+        uint64_t version)
+{
+    pthread_mutex_lock(&versions->lock);
+    if (versions->propagating++ == 0) {
+        versions->propagating_from = version;
+    }
+    pthread_mutex_unlock(&versions->lock);
+}
+
+void _obl_versions_propagated(struct obl_versions *versions)
+{
+    pthread_mutex_lock(&versions->lock);
+    versions->propagating--;
+    pthread_mutex_unlock(&versions->lock);
+}
+
+uint64_t _obl_versions_undelivered(struct obl_versions *versions)
+{
+    uint64_t result = UINT64_MAX;
+
+    /*
+     * Commits that overlap keep the oldest one's version until they've all
+     * finished, which is conservative.
+     */
+    pthread_mutex_lock(&versions->lock);
+    if (versions->propagating > 0) {
+        result = versions->propagating_from - 1;
+    }
+    pthread_mutex_unlock(&versions->lock);
+
+    return result;
+}
+
+void _obl_version_record(struct obl_versions *versions,
+        obl_logical_address address, uint64_t version,
+        struct obl_session *session)
+{
+    struct obl_version_entry *e;
+
+    e = &versions->entries[_find(versions->entries, versions->capacity,
+            address)];
+    if (e->key == OBL_LOGICAL_UNASSIGNED) {
+        e->key = address;
+        versions->count++;
+    }
+    e->version = version;
+    e->session = session;
+}
+
+/* Internal function definitions. */
+
+static uint64_t _hash(obl_logical_address key)
+{
+    uint64_t h = (uint64_t) key * UINT64_C(0x9E3779B97F4A7C15);
+
+    return h ^ (h >> 29);
+}
+
+static size_t _find(struct obl_version_entry *entries, size_t capacity,
+        obl_logical_address key)
+{
+    size_t mask = capacity - 1;
+    size_t slot = (size_t) _hash(key) & mask;
+
+    while (entries[slot].key != key &&
+            entries[slot].key != OBL_LOGICAL_UNASSIGNED) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static int _rehash(struct obl_versions *versions, size_t capacity,
+        uint64_t oldest)
+{
+    struct obl_version_entry *entries;
+    size_t count = 0, i;
+
+    entries = calloc(capacity, sizeof(struct obl_version_entry));
+    if (entries == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < versions->capacity; i++) {
+        struct obl_version_entry *e = &versions->entries[i];
+
+        if (e->key != OBL_LOGICAL_UNASSIGNED && e->version > oldest) {
+            entries[_find(entries, capacity, e->key)] = *e;
+            count++;
+        }
+    }
+
+    free(versions->entries);
+    versions->entries = entries;
+    versions->capacity = capacity;
+    versions->count = count;
+
+    return 0;
+}
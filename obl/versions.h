@@ -0,0 +1,175 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file versions.h
+ *
+ * The commit versions that optimistic concurrency control validates against.
+ * Each commit is numbered, and the table remembers the number of the last
+ * commit to write each object, and the session that made it.  An object that
+ * a session read at an earlier version than the one recorded here has since
+ * been changed, and unless the session made that change itself, its copy is
+ * stale.
+ *
+ * The table is an open-addressing hash keyed by logical address, with linear
+ * probing.  Objects that no commit has written since the database was opened
+ * have no entry.  An entry is only needed while some copy of its object may
+ * have been read at an earlier version and may yet be validated: one within
+ * a write set, or one that the commit's changes have yet to reach.  Once the
+ * table has doubled since it was last pruned, entries that no such copy can
+ * be older than are dropped, so that it grows with the number of objects in
+ * flight rather than with every object ever committed.
+ */
+
+#ifndef VERSIONS_H
+#define VERSIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform.h"
+
+/* Defined in session.h */
+struct obl_session;
+
+/**
+ * One slot of an obl_versions table.  Empty slots have a key of
+ * OBL_LOGICAL_UNASSIGNED.
+ */
+struct obl_version_entry
+{
+    obl_logical_address key;
+
+    uint64_t version;
+
+    /** The session that committed version. */
+    struct obl_session *session;
+};
+
+/**
+ * The last commit version to write each object.  Guarded by the database's
+ * content lock: read while holding it for either reading or writing, and
+ * changed only while holding it for writing.
+ */
+struct obl_versions
+{
+    /** The slots, or NULL until the first reservation. */
+    struct obl_version_entry *entries;
+
+    /** The number of slots: zero, or a power of two. */
+    size_t capacity;
+
+    /** The number of slots in use. */
+    size_t count;
+
+    /** Once count would pass this, the table is pruned. */
+    size_t prune_at;
+
+    /**
+     * The number of commits whose changes are still being delivered to other
+     * sessions, and the version of the oldest of them.  Guarded by lock.
+     */
+    unsigned long propagating;
+    uint64_t propagating_from;
+
+    pthread_mutex_t lock;
+};
+
+/**
+ * Prepare an empty table.  For internal use only.
+ *
+ * @param versions
+ */
+void _obl_versions_init(struct obl_versions *versions);
+
+/**
+ * Release a table's slots.  For internal use only.
+ *
+ * @param versions
+ */
+void _obl_versions_destroy(struct obl_versions *versions);
+
+/**
+ * Find the last commit to write an object.  For internal use only.
+ *
+ * @param versions
+ * @param address The object's logical address.
+ * @return The object's entry, or NULL if no commit has written it since the
+ *      database was opened.
+ */
+struct obl_version_entry *_obl_version_of(struct obl_versions *versions,
+        obl_logical_address address);
+
+/**
+ * Make room to record the versions of +extra+ more objects, so that the
+ * following calls to _obl_version_record() can't fail.  For internal use
+ * only.
+ *
+ * @param versions
+ * @param extra
+ * @return 0 on success, or 1 if memory is exhausted.
+ */
+int _obl_versions_reserve(struct obl_versions *versions, size_t extra);
+
+/**
+ * Return nonzero if the table has grown enough since it was last pruned that
+ * it should be pruned before making room for +extra+ more objects.  For
+ * internal use only.
+ *
+ * @param versions
+ * @param extra
+ */
+int _obl_versions_crowded(struct obl_versions *versions, size_t extra);
+
+/**
+ * Drop the entries of every object last written at or before version
+ * +oldest+, because no copy that may yet be validated was read before it.
+ * If memory is exhausted, the table is left as it is.  For internal use only.
+ *
+ * @param versions
+ * @param oldest
+ */
+void _obl_versions_prune(struct obl_versions *versions, uint64_t oldest);
+
+/**
+ * Note that commit +version+ is about to deliver its changes to other
+ * sessions.  For internal use only.
+ *
+ * @param versions
+ * @param version
+ */
+void _obl_versions_propagating(struct obl_versions *versions,
+        uint64_t version);
+
+/**
+ * Note that a commit has delivered its changes to other sessions.  For
+ * internal use only.
+ *
+ * @param versions
+ */
+void _obl_versions_propagated(struct obl_versions *versions);
+
+/**
+ * Return the newest version that copies yet to receive some commit's changes
+ * may have been read at, or UINT64_MAX if every commit's changes have been
+ * delivered.  For internal use only.
+ *
+ * @param versions
+ */
+uint64_t _obl_versions_undelivered(struct obl_versions *versions);
+
+/**
+ * Record that commit +version+, made by +session+, wrote an object.  Room must
+ * have been made with _obl_versions_reserve().  For internal use only.
+ *
+ * @param versions
+ * @param address The object's logical address.
+ * @param version
+ * @param session
+ */
+void _obl_version_record(struct obl_versions *versions,
+        obl_logical_address address, uint64_t version,
+        struct obl_session *session);
+
+#endif /* VERSIONS_H */
@@ -0,0 +1,307 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file view.c
+ */
+
+#include "view.h"
+
+#include "storage/object.h"
+#include "addressmap.h"
+#include "database.h"
+#include "session.h"
+#include "shared.h"
+
+/* Outcomes of _fill(). */
+#define FILLED 0
+#define MISSING 1
+#define CORRUPT 2
+
+/* Internal function prototypes. */
+
+/**
+ * Fill in +view+ from the committed object at logical address +address+,
+ * beneath address map root +root+, reporting nothing.  If +optimistic+ is
+ * set, no lock is held, so every read is bounds-checked and the current
+ * address map is read with _obl_address_peek() instead.  Returns FILLED,
+ * MISSING or CORRUPT.
+ */
+static int _fill(struct obl_database *d, obl_physical_address root,
+        obl_logical_address address, struct obl_view *view, int optimistic);
+
+/**
+ * Translate +address+ for _fill().  Sets +corrupt+ if an optimistic read
+ * found the address map inconsistent.
+ */
+static obl_physical_address _translate(struct obl_database *d,
+        obl_physical_address root, obl_logical_address address,
+        int optimistic, int *corrupt);
+
+/** Return 1 if the +count+ words at +base+ lie within the database. */
+static int _within(struct obl_database *d, obl_physical_address base,
+        uint64_t count);
+
+/** Return 1 if +view+ has +storage+, reporting an error from +caller+ if not. */
+static int _require(const struct obl_view *view,
+        enum obl_storage_type storage, const char *caller);
+
+/* External function definitions. */
+
+int obl_view_at(struct obl_session *s, obl_logical_address address,
+        struct obl_view *view)
+{
+    struct obl_database *d = s->database;
+    int locking = ! d->configuration.read_only;
+    unsigned long sequence;
+    int result;
+
+    view->database = d;
+    view->logical_address = address;
+
+    if (IS_FIXED_ADDR(address)) {
+        struct obl_object *o = _obl_at_fixed_address(address);
+
+        view->physical_address = OBL_PHYSICAL_UNASSIGNED;
+        view->shape_address = obl_object_shape(o)->logical_address;
+        view->storage = obl_storage_of(o);
+        view->size = 0;
+        return 0;
+    }
+
+    /* A snapshot's address map is read under the lock, like any other. */
+    if (_obl_content_optimistic(d) && ! s->snapshot.pinned) {
+        /* Read without locking, and start over if a commit intervened. */
+        do {
+            sequence = _obl_content_read_begin(d);
+            result = _fill(d, OBL_PHYSICAL_UNASSIGNED, address, view, 1);
+        } while (_obl_content_read_retry(d, sequence));
+    } else {
+        if (locking) pthread_rwlock_rdlock(&d->content_lock);
+        if (_obl_shared_read_begin(d)) {
+            if (locking) pthread_rwlock_unlock(&d->content_lock);
+            return 1;
+        }
+
+        result = _fill(d, _obl_session_address_map(s), address, view, 0);
+
+        _obl_shared_read_end(d);
+        if (locking) pthread_rwlock_unlock(&d->content_lock);
+    }
+
+    if (result == CORRUPT) {
+        obl_report_errorf(d, OBL_WRONG_STORAGE,
+                "Corrupt object header at physical address %lu.",
+                (unsigned long) view->physical_address);
+    }
+
+    return result != FILLED;
+}
+
+obl_logical_address obl_view_slot(const struct obl_view *view,
+        obl_uint index)
+{
+    obl_uint *content = view->database->content;
+    obl_uint offset;
+
+    switch (view->storage) {
+    case OBL_SLOTTED:
+        offset = 1;
+        break;
+    case OBL_FIXED:
+        offset = 2;
+        break;
+    default:
+        obl_report_error(view->database, OBL_WRONG_STORAGE,
+                "obl_view_slot requires a SLOTTED or FIXED object.");
+        return OBL_NIL_ADDR;
+    }
+
+    if (index >= view->size) {
+        obl_report_errorf(view->database, OBL_INVALID_INDEX,
+                "obl_view_slot called with an invalid index (%lu).",
+                (unsigned long) index);
+        return OBL_NIL_ADDR;
+    }
+
+    return readable_logical(content[view->physical_address + offset + index]);
+}
+
+int obl_view_child(struct obl_session *s, const struct obl_view *view,
+        obl_uint index, struct obl_view *child)
+{
+    return obl_view_at(s, obl_view_slot(view, index), child);
+}
+
+obl_int obl_view_integer(const struct obl_view *view)
+{
+    if (! _require(view, OBL_INTEGER, "obl_view_integer")) {
+        return 0;
+    }
+
+    return readable_int(view->database->content[view->physical_address + 1]);
+}
+
+size_t obl_view_string_value(const struct obl_view *view,
+        UChar *buffer, size_t buffer_size)
+{
+    const UChar *source;
+    size_t count, i;
+
+    if (! _require(view, OBL_STRING, "obl_view_string_value")) {
+        return 0;
+    }
+
+    source = (const UChar *) &view->database->content[
+            view->physical_address + 2];
+    count = view->size < buffer_size ? view->size : buffer_size;
+    for (i = 0; i < count; i++) {
+        buffer[i] = readable_UChar(source[i]);
+    }
+
+    return count;
+}
+
+int obl_view_string_ccmp(const struct obl_view *view, const char *match)
+{
+    const UChar *source;
+    obl_uint i;
+
+    if (! _require(view, OBL_STRING, "obl_view_string_ccmp")) {
+        return -1;
+    }
+
+    source = (const UChar *) &view->database->content[
+            view->physical_address + 2];
+    for (i = 0; i < view->size; i++) {
+        UChar expected = (UChar) (unsigned char) match[i];
+
+        if (match[i] == '\0' || readable_UChar(source[i]) != expected) {
+            return 1;
+        }
+    }
+
+    return match[i] == '\0' ? 0 : 1;
+}
+
+/* Internal function definitions. */
+
+static int _fill(struct obl_database *d, obl_physical_address root,
+        obl_logical_address address, struct obl_view *view, int optimistic)
+{
+    obl_physical_address physical, shape_physical, names_physical;
+    int corrupt = 0;
+
+    view->size = 0;
+    view->physical_address = physical =
+            _translate(d, root, address, optimistic, &corrupt);
+    if (corrupt) {
+        return CORRUPT;
+    }
+    if (physical == OBL_PHYSICAL_UNASSIGNED) {
+        return MISSING;
+    }
+    if (! _within(d, physical, 2)) {
+        return CORRUPT;
+    }
+
+    view->shape_address = readable_logical(d->content[physical]);
+    shape_physical = OBL_PHYSICAL_UNASSIGNED;
+
+    if (view->shape_address == OBL_NIL_ADDR) {
+        view->storage = OBL_SHAPE;
+    } else if (IS_FIXED_ADDR(view->shape_address)) {
+        struct obl_object *shape = _obl_at_fixed_address(view->shape_address);
+
+        if (obl_storage_of(shape) != OBL_SHAPE) {
+            return CORRUPT;
+        }
+        view->storage = obl_shape_storagetype(shape);
+    } else {
+        obl_uint format;
+
+        /* Shapes are themselves stored with the nil shape. */
+        shape_physical = _translate(d, root, view->shape_address, optimistic,
+                &corrupt);
+        if (corrupt || ! _within(d, shape_physical, 5) ||
+                readable_logical(d->content[shape_physical]) != OBL_NIL_ADDR) {
+            return CORRUPT;
+        }
+
+        format = readable_uint(d->content[shape_physical + 4]);
+        if (format > OBL_STORAGE_TYPE_MAX) {
+            return CORRUPT;
+        }
+        view->storage = (enum obl_storage_type) format;
+    }
+
+    switch (view->storage) {
+    case OBL_SLOTTED:
+        /* One slot for each of the shape's slot names. */
+        if (shape_physical == OBL_PHYSICAL_UNASSIGNED) {
+            return CORRUPT;
+        }
+        names_physical = _translate(d, root,
+                readable_logical(d->content[shape_physical + 2]),
+                optimistic, &corrupt);
+        if (corrupt || ! _within(d, names_physical, 2)) {
+            return CORRUPT;
+        }
+        view->size = readable_uint(d->content[names_physical + 1]);
+        if (! _within(d, physical, 1 + (uint64_t) view->size)) {
+            return CORRUPT;
+        }
+        break;
+    case OBL_FIXED:
+        view->size = readable_uint(d->content[physical + 1]);
+        if (! _within(d, physical, 2 + (uint64_t) view->size)) {
+            return CORRUPT;
+        }
+        break;
+    case OBL_STRING:
+        view->size = readable_uint(d->content[physical + 1]);
+        if (! _within(d, physical, 2 + ((uint64_t) view->size *
+                sizeof(UChar) + sizeof(obl_uint) - 1) / sizeof(obl_uint))) {
+            return CORRUPT;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return FILLED;
+}
+
+static obl_physical_address _translate(struct obl_database *d,
+        obl_physical_address root, obl_logical_address address,
+        int optimistic, int *corrupt)
+{
+    obl_physical_address leaf;
+
+    if (optimistic) {
+        return _obl_address_peek(d, address, &leaf, corrupt);
+    }
+
+    return _obl_address_lookup_at(d, root, address);
+}
+
+static int _within(struct obl_database *d, obl_physical_address base,
+        uint64_t count)
+{
+    return base != OBL_PHYSICAL_UNASSIGNED &&
+            (uint64_t) base + count <= (uint64_t) d->content_size;
+}
+
+static int _require(const struct obl_view *view,
+        enum obl_storage_type storage, const char *caller)
+{
+    if (view->storage != storage ||
+            view->physical_address == OBL_PHYSICAL_UNASSIGNED) {
+        obl_report_errorf(view->database, OBL_WRONG_STORAGE,
+                "%s called with a view of the wrong storage.", caller);
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file view.h
+ *
+ * Read-only views of persisted objects.  Faulting an object with
+ * obl_at_address() allocates an obl_object and its storage and decodes every
+ * word of it; a view instead reads the shape, slots, integer value or string
+ * contents of an object straight from the mapped database file, only when
+ * they're asked for.  Views are small enough to live on the stack, and
+ * creating or reading one never allocates memory, which makes them suitable
+ * for lookups and scans that only need to inspect a few words of each
+ * object.
+ *
+ * A view sees the contents of the database as of its most recent commit, not
+ * changes made within an open transaction, or as of its session's snapshot,
+ * if it's reading one.  It remains valid until the object that it views is
+ * next committed or, within a snapshot, until the snapshot ends.  Where the
+ * database's mapping can't move and no snapshot is pinned, obl_view_at()
+ * takes no lock at all: it reads optimistically, and starts over if a commit
+ * intervened.
+ */
+
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <stddef.h>
+
+#include "platform.h"
+#include "storage/storagetypes.h"
+
+/* Defined in database.h */
+struct obl_database;
+
+/* Defined in session.h */
+struct obl_session;
+
+/**
+ * Fill one in with obl_view_at().
+ */
+struct obl_view
+{
+    /** The database that contains the object. */
+    struct obl_database *database;
+
+    /** The viewed object's logical address. */
+    obl_logical_address logical_address;
+
+    /**
+     * The viewed object's physical address, or OBL_PHYSICAL_UNASSIGNED for
+     * objects within the fixed address space.
+     */
+    obl_physical_address physical_address;
+
+    /** The logical address of the object's shape. */
+    obl_logical_address shape_address;
+
+    /** The storage type of the object's shape. */
+    enum obl_storage_type storage;
+
+    /**
+     * The number of slots in a SLOTTED object, elements in a FIXED
+     * collection, or code points in a STRING.  Zero for anything else.
+     */
+    obl_uint size;
+};
+
+/**
+ * View the persisted object at a logical address.
+ *
+ * @param s The session on whose behalf the object is read.
+ * @param address The logical address to view.
+ * @param view [out] Filled in with the object's shape and size.
+ * @return 0 on success, or 1 if no object has been committed at that
+ *      address.  Reports an error and returns 1 if the object's shape is
+ *      corrupt.
+ */
+int obl_view_at(struct obl_session *s, obl_logical_address address,
+        struct obl_view *view);
+
+/**
+ * Return the logical address stored in one slot of a SLOTTED object, or one
+ * element of a FIXED collection, without resolving it.
+ *
+ * @param view
+ * @param index Must be less than view->size.
+ * @return The logical address of the referenced object.  Reports an error
+ *      and returns OBL_NIL_ADDR if the view has some other storage, or if
+ *      the index is out of range.
+ */
+obl_logical_address obl_view_slot(const struct obl_view *view,
+        obl_uint index);
+
+/**
+ * View the object referenced by a slot or element.  Equivalent to calling
+ * obl_view_at() with the result of obl_view_slot().
+ *
+ * @param s
+ * @param view
+ * @param index
+ * @param child [out]
+ * @return As obl_view_at().
+ */
+int obl_view_child(struct obl_session *s, const struct obl_view *view,
+        obl_uint index, struct obl_view *child);
+
+/**
+ * Return the value of an INTEGER object.
+ *
+ * @param view
+ * @return The integer's value.  Reports an error and returns 0 if the view
+ *      is not of an INTEGER.
+ */
+obl_int obl_view_integer(const struct obl_view *view);
+
+/**
+ * Copy the code points of a STRING object into a buffer.
+ *
+ * @param view
+ * @param buffer [out] Receives at most buffer_size code points.
+ * @param buffer_size
+ * @return The number of code points copied.  Reports an error and returns 0
+ *      if the view is not of a STRING.
+ */
+size_t obl_view_string_value(const struct obl_view *view,
+        UChar *buffer, size_t buffer_size);
+
+/**
+ * Compare the contents of a STRING object with a NULL-terminated US-ASCII C
+ * string, as obl_string_ccmp() does.
+ *
+ * @param view
+ * @param match
+ * @return Zero if they match exactly, nonzero otherwise.  Reports an error
+ *      and returns -1 if the view is not of a STRING.
+ */
+int obl_view_string_ccmp(const struct obl_view *view, const char *match);
+
+#endif /* VIEW_H */
@@ -0,0 +1,767 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file wal.c
+ *
+ * Write-ahead log implementation.  The log is a sequence of records, each
+ * stored in network byte order as:
+ *
+ *   magic | payload length | payload ... | checksum
+ *
+ * where the payload is a series of (base, count, count words) ranges, and the
+ * checksum covers everything that precedes it.  Replay stops at the first
+ * record that is truncated or fails its checksum: that record was being
+ * appended when the process died, so its commit never completed.
+ */
+
+#include "wal.h"
+
+#include "database.h"
+#include "log.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Internal function prototypes. */
+
+/** Add a range to a growable extent list. */
+static int _add_extent(struct obl_wal_extent **list, size_t *count,
+        size_t *capacity, obl_physical_address base, obl_uint words);
+
+/**
+ * Sort an extent list and merge any ranges that overlap or touch.
+ * Returns the new length of the list.
+ */
+static size_t _coalesce(struct obl_wal_extent *list, size_t count);
+
+/** qsort() comparison function for extents. */
+static int _compare_extents(const void *left, const void *right);
+
+/** Checksum a run of words. */
+static obl_uint _checksum(const obl_uint *words, size_t count);
+
+/** Write an entire buffer to a file at an offset, or append it if offset < 0. */
+static int _write_fully(int fd, const void *buffer, size_t bytes,
+        off_t offset);
+
+/** Flush the data (and size) of a file to disk. */
+static int _sync_file(int fd);
+
+/** Apply every intact record within the log open at +fd+ to d->fd. */
+static int _replay(struct obl_database *d, int fd, const char *filename);
+
+/** Block until the log is durable through +lsn+. */
+static int _wait_durable(struct obl_database *d, uint64_t lsn);
+
+/**
+ * Copy all logged ranges into the database file and empty the log.  The
+ * caller must hold the content lock.
+ */
+static int _checkpoint(struct obl_database *d);
+
+/**
+ * Discard the private copies of a run of checkpointed pages, so that they're
+ * faulted back in from the database file.
+ */
+static void _release_pages(struct obl_database *d, size_t offset,
+        size_t bytes);
+
+/** Marks the start of each record.  The string "oblW" in hex. */
+#define WAL_MAGIC 0x6F626C57
+
+/** The number of words in a record that are not payload. */
+#define WAL_OVERHEAD 3
+
+/** The suffix appended to a database filename to name its log. */
+#define WAL_SUFFIX "-wal"
+
+/* External function definitions. */
+
+int obl_checkpoint_database(struct obl_database *d)
+{
+    int result;
+
+    if (d->wal == NULL) {
+        return 0;
+    }
+
+    _obl_content_write_begin(d);
+    result = _checkpoint(d);
+    _obl_content_write_end(d);
+
+    return result;
+}
+
+int _obl_wal_open(struct obl_database *d)
+{
+    struct obl_wal *wal;
+    char *filename;
+    int fd, flags;
+
+    if (d->configuration.filename == NULL) {
+        return 0;
+    }
+
+    filename = malloc(strlen(d->configuration.filename) +
+            sizeof(WAL_SUFFIX));
+    if (filename == NULL) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+        return 1;
+    }
+    strcpy(filename, d->configuration.filename);
+    strcat(filename, WAL_SUFFIX);
+
+    if (d->configuration.read_only) {
+        struct stat info;
+
+        /* Recovery writes to the file, so it must be left to a writer. */
+        if (stat(filename, &info) == 0 && info.st_size > 0) {
+            obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
+                    "Unable to open <%s> read-only: its write-ahead log <%s> "
+                    "must be replayed first.",
+                    d->configuration.filename, filename);
+            free(filename);
+            return 1;
+        }
+
+        free(filename);
+        return 0;
+    }
+
+    flags = O_RDWR | O_APPEND;
+    if (d->configuration.write_ahead_log) {
+        flags |= O_CREAT;
+    }
+
+    fd = open(filename, flags, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        if (errno == ENOENT && ! d->configuration.write_ahead_log) {
+            /* No log to replay and none wanted. */
+            free(filename);
+            return 0;
+        }
+
+        obl_report_errorf(d, OBL_UNABLE_TO_OPEN_FILE,
+                "Unable to open write-ahead log <%s>: %s",
+                filename, strerror(errno));
+        free(filename);
+        return 1;
+    }
+
+    if (_replay(d, fd, filename)) {
+        close(fd);
+        free(filename);
+        return 1;
+    }
+
+    if (! d->configuration.write_ahead_log) {
+        /* Everything has been recovered, so the log is no longer needed. */
+        close(fd);
+        unlink(filename);
+        free(filename);
+        return 0;
+    }
+
+    wal = malloc(sizeof(struct obl_wal));
+    if (wal == NULL) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+        close(fd);
+        free(filename);
+        return 1;
+    }
+
+    wal->fd = fd;
+    wal->filename = filename;
+    wal->size = 0;
+    wal->pending = NULL;
+    wal->pending_count = wal->pending_capacity = 0;
+    obl_page_set_init(&wal->dirty);
+    wal->lost = 0;
+    wal->buffer = NULL;
+    wal->buffer_capacity = 0;
+    wal->appended_lsn = wal->durable_lsn = 0;
+    wal->syncing = 0;
+    wal->committers = 0;
+    pthread_mutex_init(&wal->mutex, NULL);
+    pthread_cond_init(&wal->synced, NULL);
+    memset(&wal->statistics, 0, sizeof(struct obl_wal_statistics));
+
+    d->wal = wal;
+
+    return 0;
+}
+
+void _obl_wal_close(struct obl_database *d)
+{
+    struct obl_wal *wal = d->wal;
+    int failed;
+
+    if (wal == NULL) {
+        return ;
+    }
+
+    failed = _checkpoint(d);
+
+    close(wal->fd);
+    if (! failed) {
+        unlink(wal->filename);
+    } else {
+        OBL_WARN(d, "Unable to checkpoint the database while closing it. "
+                "Its write-ahead log will be replayed when it is reopened.");
+    }
+
+    pthread_mutex_destroy(&wal->mutex);
+    pthread_cond_destroy(&wal->synced);
+    free(wal->filename);
+    free(wal->pending);
+    obl_page_set_destroy(&wal->dirty);
+    free(wal->buffer);
+    free(wal);
+
+    d->wal = NULL;
+}
+
+void _obl_wal_note(struct obl_database *d, obl_physical_address base,
+        obl_uint count)
+{
+    struct obl_wal *wal = d->wal;
+    struct obl_wal_extent *last;
+
+    if (wal == NULL || count == 0) {
+        return ;
+    }
+
+    /* Consecutive writes are usually adjacent: extend the previous range. */
+    if (wal->pending_count > 0) {
+        last = &wal->pending[wal->pending_count - 1];
+        if (base >= last->base && base <= last->base + last->count) {
+            if (base + count > last->base + last->count) {
+                last->count = base + count - last->base;
+            }
+            return ;
+        }
+    }
+
+    if (_add_extent(&wal->pending, &wal->pending_count,
+            &wal->pending_capacity, base, count)) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY,
+                "Unable to record a change in the write-ahead log.");
+        wal->lost = 1;
+    }
+}
+
+void _obl_wal_enter(struct obl_database *d)
+{
+    struct obl_wal *wal = d->wal;
+
+    if (wal == NULL) {
+        return ;
+    }
+
+    pthread_mutex_lock(&wal->mutex);
+    wal->committers++;
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+int _obl_wal_append(struct obl_database *d, uint64_t *lsn)
+{
+    struct obl_wal *wal = d->wal;
+    size_t i, words, at;
+    obl_uint *record;
+    int error;
+
+    *lsn = 0;
+    if (wal == NULL) {
+        return 0;
+    }
+
+    if (wal->lost) {
+        wal->lost = 0;
+        wal->pending_count = 0;
+        obl_report_error(d, OBL_OUT_OF_MEMORY,
+                "Changes were lost before they could be logged.");
+        return 1;
+    }
+
+    if (wal->pending_count == 0) {
+        return 0;
+    }
+
+    wal->pending_count = _coalesce(wal->pending, wal->pending_count);
+
+    words = WAL_OVERHEAD;
+    for (i = 0; i < wal->pending_count; i++) {
+        words += 2 + wal->pending[i].count;
+    }
+
+    if (words > wal->buffer_capacity) {
+        record = realloc(wal->buffer, words * sizeof(obl_uint));
+        if (record == NULL) {
+            obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+            return 1;
+        }
+        wal->buffer = record;
+        wal->buffer_capacity = words;
+    }
+    record = wal->buffer;
+
+    /* Contents are copied as they appear in the file: already network order. */
+    record[0] = writable_uint(WAL_MAGIC);
+    record[1] = writable_uint((obl_uint) (words - WAL_OVERHEAD));
+    at = 2;
+    for (i = 0; i < wal->pending_count; i++) {
+        const struct obl_wal_extent *extent = &wal->pending[i];
+
+        record[at++] = writable_uint(extent->base);
+        record[at++] = writable_uint(extent->count);
+        memcpy(record + at, d->content + extent->base,
+                extent->count * sizeof(obl_uint));
+        at += extent->count;
+    }
+    record[at] = writable_uint(_checksum(record, at));
+
+    error = _write_fully(wal->fd, record, words * sizeof(obl_uint), -1);
+    if (error) {
+        obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                "Unable to append to write-ahead log <%s>: %s",
+                wal->filename, strerror(error));
+        return 1;
+    }
+
+    /* These pages must now be copied into the database at the checkpoint. */
+    for (i = 0; i < wal->pending_count; i++) {
+        if (obl_page_set_add(&wal->dirty,
+                wal->pending[i].base, wal->pending[i].count)) {
+            obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+            return 1;
+        }
+    }
+    wal->pending_count = 0;
+
+    wal->statistics.records++;
+    wal->statistics.bytes_logged += words * sizeof(obl_uint);
+
+    pthread_mutex_lock(&wal->mutex);
+    wal->size += (off_t) (words * sizeof(obl_uint));
+    wal->appended_lsn += words * sizeof(obl_uint);
+    *lsn = wal->appended_lsn;
+    pthread_mutex_unlock(&wal->mutex);
+
+    return 0;
+}
+
+int _obl_wal_leave(struct obl_database *d, uint64_t lsn)
+{
+    struct obl_wal *wal = d->wal;
+    int result = 0, due;
+
+    if (wal == NULL) {
+        return 0;
+    }
+
+    if (lsn != 0) {
+        result = _wait_durable(d, lsn);
+    }
+
+    pthread_mutex_lock(&wal->mutex);
+    wal->committers--;
+    due = wal->size >= (off_t) d->configuration.checkpoint_size;
+    pthread_mutex_unlock(&wal->mutex);
+
+    if (result == 0 && due) {
+        _obl_content_write_begin(d);
+
+        /* Another committer may have checkpointed in the meantime. */
+        pthread_mutex_lock(&wal->mutex);
+        due = wal->size >= (off_t) d->configuration.checkpoint_size;
+        pthread_mutex_unlock(&wal->mutex);
+
+        if (due) {
+            result = _checkpoint(d);
+        }
+
+        _obl_content_write_end(d);
+    }
+
+    return result;
+}
+
+/* Internal function definitions. */
+
+static int _add_extent(struct obl_wal_extent **list, size_t *count,
+        size_t *capacity, obl_physical_address base, obl_uint words)
+{
+    if (*count == *capacity) {
+        size_t grown = *capacity == 0 ? 64 : *capacity * 2;
+        struct obl_wal_extent *larger;
+
+        larger = realloc(*list, grown * sizeof(struct obl_wal_extent));
+        if (larger == NULL) {
+            return 1;
+        }
+        *list = larger;
+        *capacity = grown;
+    }
+
+    (*list)[*count].base = base;
+    (*list)[*count].count = words;
+    (*count)++;
+
+    return 0;
+}
+
+static size_t _coalesce(struct obl_wal_extent *list, size_t count)
+{
+    size_t read, written;
+
+    if (count < 2) {
+        return count;
+    }
+
+    qsort(list, count, sizeof(struct obl_wal_extent), &_compare_extents);
+
+    written = 0;
+    for (read = 1; read < count; read++) {
+        struct obl_wal_extent *last = &list[written];
+        uint64_t end = (uint64_t) last->base + last->count;
+
+        if ((uint64_t) list[read].base <= end) {
+            uint64_t next_end = (uint64_t) list[read].base + list[read].count;
+            if (next_end > end) {
+                last->count = (obl_uint) (next_end - last->base);
+            }
+        } else {
+            list[++written] = list[read];
+        }
+    }
+
+    return written + 1;
+}
+
+static int _compare_extents(const void *left, const void *right)
+{
+    const struct obl_wal_extent *l = left, *r = right;
+
+    if (l->base < r->base) {
+        return -1;
+    } else if (l->base > r->base) {
+        return 1;
+    }
+    return 0;
+}
+
+static obl_uint _checksum(const obl_uint *words, size_t count)
+{
+    obl_uint hash = 2166136261u;
+    size_t i;
+
+    /* FNV-1a, a word at a time. */
+    for (i = 0; i < count; i++) {
+        hash ^= words[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int _write_fully(int fd, const void *buffer, size_t bytes,
+        off_t offset)
+{
+    const char *at = buffer;
+    ssize_t written;
+
+    while (bytes > 0) {
+        if (offset < 0) {
+            written = write(fd, at, bytes);
+        } else {
+            written = pwrite(fd, at, bytes, offset);
+        }
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        at += written;
+        bytes -= (size_t) written;
+        if (offset >= 0) {
+            offset += written;
+        }
+    }
+
+    return 0;
+}
+
+static int _sync_file(int fd)
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    if (fdatasync(fd) != 0) {
+        return errno;
+    }
+#else
+    if (fsync(fd) != 0) {
+        return errno;
+    }
+#endif
+    return 0;
+}
+
+static int _replay(struct obl_database *d, int fd, const char *filename)
+{
+    struct stat info;
+    obl_uint *log;
+    size_t length, at, payload, end, cursor;
+    unsigned long replayed = 0;
+    ssize_t got;
+    int error = 0;
+
+    if (fstat(fd, &info) != 0) {
+        obl_report_errorf(d, OBL_UNABLE_TO_READ_FILE,
+                "Unable to stat write-ahead log <%s>: %s",
+                filename, strerror(errno));
+        return 1;
+    }
+
+    length = (size_t) info.st_size / sizeof(obl_uint);
+    if (length == 0) {
+        return 0;
+    }
+
+    log = malloc(length * sizeof(obl_uint));
+    if (log == NULL) {
+        obl_report_error(d, OBL_OUT_OF_MEMORY, NULL);
+        return 1;
+    }
+
+    for (at = 0; at < length * sizeof(obl_uint); at += (size_t) got) {
+        got = pread(fd, (char *) log + at, length * sizeof(obl_uint) - at,
+                (off_t) at);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                got = 0;
+                continue;
+            }
+            obl_report_errorf(d, OBL_UNABLE_TO_READ_FILE,
+                    "Unable to read write-ahead log <%s>.", filename);
+            free(log);
+            return 1;
+        }
+    }
+
+    at = 0;
+    while (at + WAL_OVERHEAD <= length) {
+        if (readable_uint(log[at]) != WAL_MAGIC) {
+            break;
+        }
+        payload = readable_uint(log[at + 1]);
+        end = at + 2 + payload;
+        if (payload > length || end >= length) {
+            break;
+        }
+        if (readable_uint(log[end]) != _checksum(log + at, end - at)) {
+            break;
+        }
+
+        for (cursor = at + 2; cursor < end && ! error; ) {
+            obl_uint base = readable_uint(log[cursor]);
+            obl_uint count = readable_uint(log[cursor + 1]);
+
+            error = _write_fully(d->fd, log + cursor + 2,
+                    (size_t) count * sizeof(obl_uint),
+                    (off_t) base * sizeof(obl_uint));
+            cursor += 2 + count;
+        }
+        if (error) {
+            break;
+        }
+
+        replayed++;
+        at = end + 1;
+    }
+    free(log);
+
+    if (! error && replayed > 0) {
+        error = _sync_file(d->fd);
+    }
+    if (error) {
+        obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                "Unable to replay write-ahead log <%s>: %s",
+                filename, strerror(error));
+        return 1;
+    }
+
+    if (replayed > 0) {
+        OBL_INFOF(d, "Replayed %lu records from the write-ahead log.",
+                replayed);
+    }
+
+    /* The log has been applied in full; start it over. */
+    if (ftruncate(fd, 0) != 0) {
+        obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                "Unable to truncate write-ahead log <%s>: %s",
+                filename, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int _wait_durable(struct obl_database *d, uint64_t lsn)
+{
+    struct obl_wal *wal = d->wal;
+    uint64_t target;
+    int error;
+
+    pthread_mutex_lock(&wal->mutex);
+    while (wal->durable_lsn < lsn) {
+        if (wal->syncing) {
+            /* Another committer's fsync() may cover this record, too. */
+            pthread_cond_wait(&wal->synced, &wal->mutex);
+            continue;
+        }
+
+        /*
+         * Lead a group commit.  If other commits are underway, give them a
+         * moment to append their records so that one fsync() covers them all.
+         */
+        wal->syncing = 1;
+        if (wal->committers > 1 && d->configuration.group_commit_delay > 0) {
+            pthread_mutex_unlock(&wal->mutex);
+            obl_sleep_usec((uint64_t) d->configuration.group_commit_delay);
+            pthread_mutex_lock(&wal->mutex);
+        }
+        target = wal->appended_lsn;
+        pthread_mutex_unlock(&wal->mutex);
+
+        error = _sync_file(wal->fd);
+
+        pthread_mutex_lock(&wal->mutex);
+        wal->syncing = 0;
+        if (error) {
+            pthread_cond_broadcast(&wal->synced);
+            pthread_mutex_unlock(&wal->mutex);
+            obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                    "Unable to synchronize write-ahead log <%s>: %s",
+                    wal->filename, strerror(error));
+            return 1;
+        }
+        if (target > wal->durable_lsn) {
+            wal->durable_lsn = target;
+        }
+        wal->statistics.syncs++;
+        pthread_cond_broadcast(&wal->synced);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+
+    return 0;
+}
+
+static int _checkpoint(struct obl_database *d)
+{
+    struct obl_wal *wal = d->wal;
+    struct obl_page_set *dirty = &wal->dirty;
+    size_t cursor, first, length, limit, offset, bytes;
+    uint64_t lsn;
+    int error = 0;
+
+    /* Log anything written since the last commit, then make it all durable. */
+    if (_obl_wal_append(d, &lsn)) {
+        return 1;
+    }
+    pthread_mutex_lock(&wal->mutex);
+    lsn = wal->appended_lsn;
+    pthread_mutex_unlock(&wal->mutex);
+    if (_wait_durable(d, lsn)) {
+        return 1;
+    }
+
+    if (dirty->count == 0) {
+        return 0;
+    }
+
+    /* Copy each run of logged pages into the file with a single write. */
+    limit = (size_t) d->content_size * sizeof(obl_uint);
+    cursor = 0;
+    while (! error && obl_page_set_next_run(dirty, &cursor, &first, &length)) {
+        offset = first * dirty->page_words * sizeof(obl_uint);
+        bytes = length * dirty->page_words * sizeof(obl_uint);
+        if (offset >= limit) {
+            break;
+        }
+        if (offset + bytes > limit) {
+            bytes = limit - offset;
+        }
+
+        error = _write_fully(d->fd, (char *) d->content + offset, bytes,
+                (off_t) offset);
+        wal->statistics.pages_checkpointed += length;
+    }
+    if (! error) {
+        error = _sync_file(d->fd);
+    }
+    if (error) {
+        obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                "Unable to checkpoint file <%s>: %s",
+                d->configuration.filename, strerror(error));
+        return 1;
+    }
+
+    cursor = 0;
+    while (obl_page_set_next_run(dirty, &cursor, &first, &length)) {
+        offset = first * dirty->page_words * sizeof(obl_uint);
+        bytes = length * dirty->page_words * sizeof(obl_uint);
+        _release_pages(d, offset, bytes);
+    }
+
+    /*
+     * Every logged change is now in the database file, so the log can be
+     * emptied.  If this truncation is lost to a crash, replaying the old
+     * records again is harmless.
+     */
+    if (ftruncate(wal->fd, 0) != 0) {
+        obl_report_errorf(d, OBL_UNABLE_TO_WRITE_FILE,
+                "Unable to truncate write-ahead log <%s>: %s",
+                wal->filename, strerror(errno));
+        return 1;
+    }
+
+    pthread_mutex_lock(&wal->mutex);
+    wal->size = 0;
+    pthread_mutex_unlock(&wal->mutex);
+
+    obl_page_set_clear(dirty);
+    wal->statistics.checkpoints++;
+
+    OBL_DEBUG(d, "Checkpointed the write-ahead log.");
+
+    return 0;
+}
+
+static void _release_pages(struct obl_database *d, size_t offset,
+        size_t bytes)
+{
+#ifdef MADV_DONTNEED
+    size_t limit;
+
+    /*
+     * Every change to these pages is now in the file, so they can be
+     * refaulted from it.  Only whole pages within the mapping are released.
+     */
+    limit = (size_t) d->content_size * sizeof(obl_uint);
+    limit &= ~((size_t) d->wal->dirty.page_words * sizeof(obl_uint) - 1);
+    if (offset + bytes > limit) {
+        bytes = offset < limit ? limit - offset : 0;
+    }
+    if (bytes > 0) {
+        madvise((char *) d->content + offset, bytes, MADV_DONTNEED);
+    }
+#endif
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file wal.h
+ *
+ * A redo-only write-ahead log that makes committed transactions durable.
+ *
+ * When the write_ahead_log setting is enabled, a file-backed database is
+ * mapped copy-on-write: commits still serialize objects into d->content, but
+ * nothing reaches the database file until it has been logged.  Each commit
+ * appends one record containing the final contents of every word range that
+ * it touched to a sidecar file named after the database with a "-wal" suffix.
+ * Committing sessions that arrive while the log is being synchronized share
+ * the next fsync() (group commit).  Logged ranges are copied back into the
+ * database file lazily, by a checkpoint, once the log grows past
+ * checkpoint_size bytes or when the database is closed.
+ *
+ * Opening a database replays any intact records left in its log by a crash.
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#include "dirty.h"
+#include "platform.h"
+
+#include <sys/types.h>
+
+/* Defined in database.h */
+struct obl_database;
+
+/**
+ * A contiguous range of database words, recorded each time the database
+ * contents are modified.
+ */
+struct obl_wal_extent
+{
+    /** The first word within the range. */
+    obl_physical_address base;
+
+    /** The number of words within the range. */
+    obl_uint count;
+};
+
+/**
+ * Running totals that describe the activity of a write-ahead log since its
+ * database was opened.
+ */
+struct obl_wal_statistics
+{
+    /** The number of commit records appended to the log. */
+    unsigned long records;
+
+    /**
+     * The number of times the log was synchronized to disk.  When commits
+     * are grouped, this will be less than records.
+     */
+    unsigned long syncs;
+
+    /** The number of checkpoints performed. */
+    unsigned long checkpoints;
+
+    /** The number of pages copied into the database file by checkpoints. */
+    unsigned long pages_checkpointed;
+
+    /** The total number of bytes appended to the log. */
+    uint64_t bytes_logged;
+};
+
+/**
+ * The state of the write-ahead log for an open database.
+ *
+ * The pending extents and dirty pages are guarded by the database's content
+ * lock; the sequence numbers and committer count are guarded by mutex.
+ */
+struct obl_wal
+{
+    /** The descriptor of the open log file. */
+    int fd;
+
+    /** The log filename, heap-allocated. */
+    char *filename;
+
+    /** The current length of the log file, in bytes. */
+    off_t size;
+
+    /** Ranges modified since the last record was appended. */
+    struct obl_wal_extent *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+
+    /** Pages logged since the last checkpoint. */
+    struct obl_page_set dirty;
+
+    /** Set if a range couldn't be recorded, which fails the next append. */
+    int lost;
+
+    /** Scratch space used to assemble records, in words. */
+    obl_uint *buffer;
+    size_t buffer_capacity;
+
+    /**
+     * Log sequence numbers: the total number of bytes ever appended to the
+     * log, and the prefix of those that is known to be on disk.
+     */
+    uint64_t appended_lsn;
+    uint64_t durable_lsn;
+
+    /** Nonzero while one committer synchronizes the log on behalf of all. */
+    int syncing;
+
+    /** The number of commits currently in progress. */
+    int committers;
+
+    /** Guards the sequence numbers, syncing, and committers. */
+    pthread_mutex_t mutex;
+
+    /** Broadcast each time durable_lsn advances. */
+    pthread_cond_t synced;
+
+    /** Activity counters. */
+    struct obl_wal_statistics statistics;
+};
+
+/**
+ * Copy all logged changes into the database file, synchronize it, and empty
+ * the write-ahead log.  Checkpoints happen automatically, so calling this is
+ * only necessary to bound recovery time at a known point.
+ *
+ * @param d An open database.  Has no effect unless write_ahead_log is set.
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int obl_checkpoint_database(struct obl_database *d);
+
+/**
+ * Replay any intact records left in the write-ahead log of a file-backed
+ * database into its (unmapped) database file, then, if write_ahead_log is
+ * enabled, open the log and attach it to the database as d->wal.  Must be
+ * called after d->fd has been opened and before the file is mapped.  A
+ * read-only database can't be recovered, so this fails instead if there are
+ * records to replay.  For internal use only.
+ *
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_wal_open(struct obl_database *d);
+
+/**
+ * Checkpoint and detach the write-ahead log of a database, removing the log
+ * file.  Must be called while d->content is still mapped.  For internal use
+ * only.
+ */
+void _obl_wal_close(struct obl_database *d);
+
+/**
+ * Record that +count+ words starting at physical address +base+ have been
+ * modified and must be included in the next log record.  Does nothing if the
+ * database has no write-ahead log.  The caller must hold the content lock.
+ * For internal use only.
+ */
+void _obl_wal_note(struct obl_database *d, obl_physical_address base,
+        obl_uint count);
+
+/**
+ * Announce that a commit is beginning.  Committers that synchronize the log
+ * while others are in progress will wait up to group_commit_delay
+ * microseconds for them to append their records, too.  For internal use
+ * only.
+ */
+void _obl_wal_enter(struct obl_database *d);
+
+/**
+ * Append one record containing every range noted since the last record.
+ * The caller must hold the content lock.  For internal use only.
+ *
+ * @param d The database whose changes should be logged.
+ * @param lsn [out] The log sequence number that must become durable for the
+ *      record to survive a crash, or 0 if there was nothing to append.
+ * @return 0 on success.  Reports an error and returns 1 if the record
+ *      couldn't be written.
+ */
+int _obl_wal_append(struct obl_database *d, uint64_t *lsn);
+
+/**
+ * Wait until the log is durable through +lsn+, synchronizing it on behalf of
+ * any other waiting committers if necessary, then checkpoint if the log has
+ * grown too large.  Balances a call to _obl_wal_enter().  The caller must not
+ * hold the content lock.  For internal use only.
+ *
+ * @return 0 on success.  Reports an error and returns 1 on failure.
+ */
+int _obl_wal_leave(struct obl_database *d, uint64_t lsn);
+
+#endif /* WAL_H */
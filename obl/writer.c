@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file writer.c
+ */
+
+#include "writer.h"
+
+/* Internal function prototypes. */
+
+/** The writer thread's start routine.  Runs jobs until told to stop. */
+static void *_run(void *argument);
+
+/* External function definitions. */
+
+void _obl_writer_init(struct obl_writer *writer, size_t capacity)
+{
+    writer->head = writer->tail = NULL;
+    writer->queued = 0;
+    writer->capacity = capacity > 0 ? capacity : 1;
+    writer->started = 0;
+    writer->stopping = 0;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->nonempty, NULL);
+    pthread_cond_init(&writer->nonfull, NULL);
+}
+
+int _obl_writer_submit(struct obl_writer *writer, struct obl_writer_job *job)
+{
+    pthread_mutex_lock(&writer->lock);
+
+    if (! writer->started) {
+        if (pthread_create(&writer->thread, NULL, &_run, writer) != 0) {
+            pthread_mutex_unlock(&writer->lock);
+            return 1;
+        }
+        writer->started = 1;
+    }
+
+    while (writer->queued >= writer->capacity) {
+        pthread_cond_wait(&writer->nonfull, &writer->lock);
+    }
+
+    job->next = NULL;
+    if (writer->tail != NULL) {
+        writer->tail->next = job;
+    } else {
+        writer->head = job;
+    }
+    writer->tail = job;
+    writer->queued++;
+
+    pthread_cond_broadcast(&writer->nonempty);
+    pthread_mutex_unlock(&writer->lock);
+
+    return 0;
+}
+
+void _obl_writer_destroy(struct obl_writer *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = 1;
+    pthread_cond_broadcast(&writer->nonempty);
+    pthread_mutex_unlock(&writer->lock);
+
+    if (writer->started) {
+        pthread_join(writer->thread, NULL);
+        writer->started = 0;
+    }
+
+    pthread_cond_destroy(&writer->nonfull);
+    pthread_cond_destroy(&writer->nonempty);
+    pthread_mutex_destroy(&writer->lock);
+}
+
+/* Internal function definitions. */
+
+static void *_run(void *argument)
+{
+    struct obl_writer *writer = argument;
+    struct obl_writer_job *job;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->head == NULL && ! writer->stopping) {
+            pthread_cond_wait(&writer->nonempty, &writer->lock);
+        }
+        if (writer->head == NULL) {
+            break;
+        }
+
+        job = writer->head;
+        writer->head = job->next;
+        if (writer->head == NULL) {
+            writer->tail = NULL;
+        }
+        writer->queued--;
+        pthread_cond_broadcast(&writer->nonfull);
+
+        /* Let more work be queued while this job runs. */
+        pthread_mutex_unlock(&writer->lock);
+        (*job->run)(job);
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
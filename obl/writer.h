@@ -0,0 +1,97 @@
+/**
+ * Copyright (C) 2009 Ashley J. Wilson, Roger E. Ostrander
+ * This software is licensed as described in the file COPYING in the root
+ * directory of this distribution.
+ *
+ * @file writer.h
+ *
+ * A per-database writer thread that runs work handed to it in submission
+ * order.  obl_commit_transaction_async() uses it to publish commits off of the
+ * calling thread.
+ *
+ * The queue is bounded by the commit_queue_length setting: submitting work
+ * while it's full blocks until the writer catches up, so that callers can't
+ * outrun the database indefinitely.  The thread is started by the first
+ * submission and stopped, once it has run everything queued, when the
+ * database is closed.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+
+#include "platform.h"
+
+/**
+ * One piece of work for the writer thread.  Embed it within a larger
+ * structure that describes the work.
+ */
+struct obl_writer_job
+{
+    /** Called on the writer thread to do the work. */
+    void (*run)(struct obl_writer_job *job);
+
+    /** The next job in submission order. */
+    struct obl_writer_job *next;
+};
+
+/**
+ * A database's writer thread and its queue.
+ */
+struct obl_writer
+{
+    /** Jobs waiting to run, oldest first. */
+    struct obl_writer_job *head, *tail;
+
+    /** The number of jobs queued, and the most that may be. */
+    size_t queued, capacity;
+
+    /** Set once the thread has been started. */
+    int started;
+
+    /** Set when the thread should exit once the queue is empty. */
+    int stopping;
+
+    pthread_t thread;
+
+    /** Guards every field above. */
+    pthread_mutex_t lock;
+
+    /** Signalled when a job is queued, or the thread should stop. */
+    pthread_cond_t nonempty;
+
+    /** Signalled when a job is taken from a full queue. */
+    pthread_cond_t nonfull;
+};
+
+/**
+ * Prepare a writer with an empty queue.  The thread isn't started until work
+ * is submitted.  For internal use only.
+ *
+ * @param writer
+ * @param capacity The most jobs to queue at once.
+ */
+void _obl_writer_init(struct obl_writer *writer, size_t capacity);
+
+/**
+ * Queue a job for the writer thread, starting the thread if need be.  Blocks
+ * while the queue is full.  Must not be called by a job.  For internal use
+ * only.
+ *
+ * @param writer
+ * @param job
+ * @return 0 on success, or 1 if the thread could not be started, in which
+ *      case the job was not queued.
+ */
+int _obl_writer_submit(struct obl_writer *writer, struct obl_writer_job *job);
+
+/**
+ * Wait for the writer thread to run every queued job, stop it and release its
+ * resources.  For internal use only.
+ *
+ * @param writer
+ */
+void _obl_writer_destroy(struct obl_writer *writer);
+
+#endif /* WRITER_H */